@@ -0,0 +1,521 @@
+#include "AlignmentPipeline.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+  AlignmentPipeline::AlignmentPipeline(IAlignmentReader::SharedPtr alignmentReaderPtr, const std::vector< GSSWGraph::SharedPtr >& graphPtrs, size_t batchSize, size_t readQueueCapacity, size_t batchQueueCapacity) :
+    m_alignment_reader_ptr(alignmentReaderPtr),
+    m_graph_ptrs(graphPtrs),
+    m_batch_size(std::max< size_t >(batchSize, 1)),
+    m_alignment_link(readQueueCapacity, s_alignment_wake_count),
+    m_routed_batch_link(batchQueueCapacity, 1),
+    m_aligned_batch_link(batchQueueCapacity, 1),
+    m_reader_exhausted(false),
+    m_aligning_count(0),
+    m_pending_batches(graphPtrs.size()),
+    m_has_routed(false),
+    m_last_contig_graphs_ptr(nullptr),
+    m_last_alignment_position(0),
+    m_ready_batch_count(0),
+    m_open_graph_count(graphPtrs.size()),
+    m_graph_outstanding_counts(new std::atomic< uint32_t >[graphPtrs.size()]),
+    m_report_regions_early(false),
+    m_decoded_count(0),
+    m_unrouted_count(0),
+    m_aligned_count(0),
+    m_failed(false),
+    m_outstanding_pump_count(0)
+  {
+    std::sort(this->m_graph_ptrs.begin(), this->m_graph_ptrs.end(), [](const GSSWGraph::SharedPtr& a, const GSSWGraph::SharedPtr& b)
+	      {
+		int referenceCompare = a->getReferenceID().compare(b->getReferenceID());
+		return referenceCompare < 0 || (referenceCompare == 0 && a->getStartPosition() < b->getStartPosition());
+	      });
+    for (size_t i = 0; i < this->m_graph_ptrs.size(); ++i)
+      {
+	auto contigIter = this->m_contig_graphs.emplace(this->m_graph_ptrs[i]->getReferenceID(), ContigGraphs{ i, i, i }).first;
+	contigIter->second.end_idx = i + 1;
+      }
+    for (uint32_t i = 0; i < STAGE_COUNT; ++i)
+      {
+	this->m_stages[i].active_count.store(0);
+	this->m_stages[i].max_active_count = 1;
+	this->m_stages[i].input_closed.store(i == DECODE);
+	this->m_stages[i].finished.store(false);
+      }
+    this->m_stages[ALIGN].max_active_count = std::max< uint32_t >(ThreadPool::Instance()->getThreadCount(), 1);
+    for (size_t i = 0; i < this->m_graph_ptrs.size(); ++i)
+      {
+	this->m_graph_outstanding_counts[i].store(1);
+      }
+  }
+
+  AlignmentPipeline::~AlignmentPipeline()
+  {
+  }
+
+  void AlignmentPipeline::run()
+  {
+    if (ThreadPool::getCurrentWorkerIndex() >= 0)
+      {
+	throw std::logic_error("AlignmentPipeline::run called from inside a ThreadPool task");
+      }
+    if (this->m_count_accumulator_ptr != nullptr)
+      {
+	this->m_stages[AGGREGATE].max_active_count = this->m_stages[ALIGN].max_active_count;
+      }
+    this->m_report_regions_early = static_cast< bool >(this->m_region_complete_callback);
+    schedule(DECODE);
+    std::exception_ptr exception;
+    {
+      // pumps drop the count with the mutex held as the last thing they do,
+      // once it is zero nothing touches the pipeline anymore
+      std::unique_lock< std::mutex > lock(this->m_mutex);
+      this->m_condition.wait(lock, [this]
+			     {
+			       return this->m_outstanding_pump_count == 0 && (this->m_stages[AGGREGATE].finished.load() || this->m_exception);
+			     });
+      exception = this->m_exception;
+    }
+    if (exception)
+      {
+	std::rethrow_exception(exception);
+      }
+    if (this->m_count_accumulator_ptr != nullptr)
+      {
+	// every graph merged its own counts as it completed, this only picks up
+	// counts made into the accumulator outside the pipeline
+	this->m_count_accumulator_ptr->merge();
+      }
+  }
+
+  void AlignmentPipeline::setCountAccumulator(AlleleCountAccumulator::SharedPtr countAccumulatorPtr)
+  {
+    this->m_count_accumulator_ptr = countAccumulatorPtr;
+  }
+
+  void AlignmentPipeline::setRegionCompleteCallback(RegionCompleteCallback regionCompleteCallback)
+  {
+    this->m_region_complete_callback = regionCompleteCallback;
+  }
+
+  void AlignmentPipeline::schedule(StageType stageType)
+  {
+    Stage& stage = this->m_stages[stageType];
+    uint32_t activeCount = stage.active_count.load();
+    while (activeCount < stage.max_active_count)
+      {
+	if (stage.active_count.compare_exchange_weak(activeCount, activeCount + 1))
+	  {
+	    {
+	      std::lock_guard< std::mutex > lock(this->m_mutex);
+	      ++this->m_outstanding_pump_count;
+	    }
+	    try
+	      {
+		ThreadPool::Instance()->enqueue([this, stageType]() { runPump(stageType); });
+	      }
+	    catch (...)
+	      {
+		stage.active_count.fetch_sub(1);
+		std::lock_guard< std::mutex > lock(this->m_mutex);
+		--this->m_outstanding_pump_count;
+		throw;
+	      }
+	    return;
+	  }
+      }
+  }
+
+  void AlignmentPipeline::runPump(StageType stageType)
+  {
+    Stage& stage = this->m_stages[stageType];
+    try
+      {
+	while (!this->m_failed.load() && runStage(stageType)) {}
+      }
+    catch (...)
+      {
+	recordException();
+      }
+    stage.active_count.fetch_sub(1);
+    // something may have arrived between the last look and the decrement above,
+    // whoever added it saw this pump still active and didn't schedule another
+    if (!this->m_failed.load())
+      {
+	if (hasWork(stageType))
+	  {
+	    if (canResume(stageType))
+	      {
+		schedule(stageType);
+	      }
+	  }
+	else if (isDrained(stageType))
+	  {
+	    finish(stageType);
+	  }
+      }
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    if (--this->m_outstanding_pump_count == 0)
+      {
+	this->m_condition.notify_all();
+      }
+  }
+
+  // called from a catch block
+  void AlignmentPipeline::recordException()
+  {
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    if (!this->m_exception)
+      {
+	this->m_exception = std::current_exception();
+      }
+    this->m_failed.store(true);
+  }
+
+  // nothing more can come in and nothing is running, align's batches on their graphs' workers included.
+  // a pump or batch that is done checks after its own count drop, so the last of them sees zero
+  bool AlignmentPipeline::isDrained(StageType stageType)
+  {
+    Stage& stage = this->m_stages[stageType];
+    return stage.input_closed.load() && stage.active_count.load() == 0 &&
+      (stageType != ALIGN || this->m_aligning_count.load() == 0);
+  }
+
+  bool AlignmentPipeline::runStage(StageType stageType)
+  {
+    switch (stageType)
+      {
+      case DECODE:
+	return decode();
+      case ROUTE:
+	return route();
+      case ALIGN:
+	return align();
+      case AGGREGATE:
+	return aggregate();
+      default:
+	return false;
+      }
+  }
+
+  bool AlignmentPipeline::decode()
+  {
+    if (this->m_reader_exhausted.load() || !this->m_alignment_link.reserve())
+      {
+	return false;
+      }
+    IAlignment::SharedPtr alignmentPtr;
+    if (!this->m_alignment_reader_ptr->getNextAlignment(alignmentPtr))
+      {
+	this->m_alignment_link.unreserve();
+	this->m_reader_exhausted.store(true);
+	return false;
+      }
+    this->m_decoded_count.fetch_add(1);
+    this->m_alignment_link.push(std::move(alignmentPtr));
+    if (this->m_alignment_link.shouldWakeConsumer())
+      {
+	schedule(ROUTE);
+      }
+    return true;
+  }
+
+  bool AlignmentPipeline::route()
+  {
+    if (!this->m_ready_batches.empty())
+      {
+	if (!this->m_routed_batch_link.reserve())
+	  {
+	    return false;
+	  }
+	this->m_routed_batch_link.push(std::move(this->m_ready_batches.front()));
+	this->m_ready_batches.pop_front();
+	this->m_ready_batch_count.fetch_sub(1);
+	schedule(ALIGN);
+	return true;
+      }
+
+    bool inputClosed = this->m_stages[ROUTE].input_closed.load();
+    IAlignment::SharedPtr alignmentPtr;
+    if (this->m_alignment_link.pop(alignmentPtr))
+      {
+	if (!this->m_reader_exhausted.load() && this->m_alignment_link.shouldResumeProducer())
+	  {
+	    schedule(DECODE);
+	  }
+	routeAlignment(alignmentPtr);
+	return true;
+      }
+    if (!inputClosed || this->m_open_graph_count.load() == 0)
+      {
+	return false;
+      }
+    // the reader is done, send the partly filled batches
+    for (auto& contigGraphs : this->m_contig_graphs)
+      {
+	closeGraphsBefore(&contigGraphs.second, MAX_POSITION);
+      }
+    return true;
+  }
+
+  AlignmentPipeline::ContigGraphs* AlignmentPipeline::getContigGraphs(const std::string& referenceID)
+  {
+    auto contigIter = this->m_contig_graphs.find(referenceID);
+    return (contigIter != this->m_contig_graphs.end()) ? &contigIter->second : nullptr;
+  }
+
+  void AlignmentPipeline::closeGraphsBefore(ContigGraphs* contigGraphsPtr, position startPosition)
+  {
+    if (contigGraphsPtr == nullptr)
+      {
+	return;
+      }
+    size_t graphIdx = contigGraphsPtr->next_open_idx;
+    for (; graphIdx < contigGraphsPtr->end_idx && (startPosition == MAX_POSITION || this->m_graph_ptrs[graphIdx]->getEndPosition() < startPosition); ++graphIdx)
+      {
+	auto& batchPtr = this->m_pending_batches[graphIdx];
+	if (batchPtr != nullptr)
+	  {
+	    this->m_ready_batches.emplace_back(std::move(batchPtr));
+	    this->m_ready_batch_count.fetch_add(1);
+	  }
+	releaseGraph(graphIdx);
+      }
+    this->m_open_graph_count.fetch_sub(graphIdx - contigGraphsPtr->next_open_idx);
+    contigGraphsPtr->next_open_idx = graphIdx;
+  }
+
+  void AlignmentPipeline::releaseGraph(size_t graphIdx)
+  {
+    if (this->m_graph_outstanding_counts[graphIdx].fetch_sub(1) != 1)
+      {
+	return;
+      }
+    // every batch of the graph has been counted, the fetch_sub chain makes their counts visible here
+    if (this->m_count_accumulator_ptr != nullptr)
+      {
+	this->m_count_accumulator_ptr->merge(graphIdx);
+      }
+    if (this->m_report_regions_early)
+      {
+	std::lock_guard< std::mutex > lock(this->m_region_complete_mutex);
+	this->m_region_complete_callback(this->m_graph_ptrs[graphIdx]);
+      }
+  }
+
+  void AlignmentPipeline::routeAlignment(IAlignment::SharedPtr alignmentPtr)
+  {
+    position startPosition = alignmentPtr->getPosition();
+    position endPosition = startPosition + std::max< size_t >(alignmentPtr->getLength(), 1) - 1;
+    std::string referenceID = alignmentPtr->getReferenceID();
+    if (!this->m_has_routed || referenceID != this->m_last_reference_id)
+      {
+	if (this->m_report_regions_early)
+	  {
+	    if (this->m_has_routed)
+	      {
+		// nothing is coming for the contig the alignments have left
+		this->m_passed_reference_ids.insert(this->m_last_reference_id);
+		closeGraphsBefore(this->m_last_contig_graphs_ptr, MAX_POSITION);
+	      }
+	    if (this->m_passed_reference_ids.count(referenceID) > 0)
+	      {
+		throw std::runtime_error("AlignmentPipeline needs each contig's alignments together to report regions as they complete");
+	      }
+	    this->m_last_alignment_position = 0;
+	  }
+	this->m_has_routed = true;
+	this->m_last_reference_id = referenceID;
+	this->m_last_contig_graphs_ptr = getContigGraphs(referenceID);
+      }
+    ContigGraphs* contigGraphsPtr = this->m_last_contig_graphs_ptr;
+    if (this->m_report_regions_early)
+      {
+	if (startPosition < this->m_last_alignment_position)
+	  {
+	    throw std::runtime_error("AlignmentPipeline needs alignments sorted by position to report regions as they complete");
+	  }
+	this->m_last_alignment_position = startPosition;
+	// nothing coming after this alignment can reach the graphs ending before it
+	closeGraphsBefore(contigGraphsPtr, startPosition);
+      }
+    if (contigGraphsPtr == nullptr)
+      {
+	this->m_unrouted_count.fetch_add(1);
+	return;
+      }
+    // the contig's graphs don't overlap, so walking back from the last graph starting
+    // at or before the alignment's end visits exactly the graphs it overlaps
+    auto graphBegin = this->m_graph_ptrs.begin() + contigGraphsPtr->begin_idx;
+    auto graphIter = std::upper_bound(graphBegin, this->m_graph_ptrs.begin() + contigGraphsPtr->end_idx, endPosition, [](position pos, const GSSWGraph::SharedPtr& graphPtr)
+				      {
+					return pos < graphPtr->getStartPosition();
+				      });
+    bool routed = false;
+    while (graphIter != graphBegin)
+      {
+	--graphIter;
+	if ((*graphIter)->getEndPosition() < startPosition)
+	  {
+	    break;
+	  }
+	size_t graphIdx = graphIter - this->m_graph_ptrs.begin();
+	auto& batchPtr = this->m_pending_batches[graphIdx];
+	if (batchPtr == nullptr)
+	  {
+	    batchPtr.reset(new AlignmentBatch());
+	    batchPtr->graph_ptr = *graphIter;
+	    batchPtr->graph_idx = graphIdx;
+	    this->m_graph_outstanding_counts[graphIdx].fetch_add(1);
+	    batchPtr->alignment_ptrs.reserve(this->m_batch_size);
+	  }
+	batchPtr->alignment_ptrs.emplace_back(alignmentPtr);
+	if (batchPtr->alignment_ptrs.size() >= this->m_batch_size)
+	  {
+	    this->m_ready_batches.emplace_back(std::move(batchPtr));
+	    this->m_ready_batch_count.fetch_add(1);
+	  }
+	routed = true;
+      }
+    if (!routed)
+      {
+	this->m_unrouted_count.fetch_add(1);
+      }
+  }
+
+  bool AlignmentPipeline::align()
+  {
+    if (!this->m_aligned_batch_link.reserve())
+      {
+	return false;
+      }
+    AlignmentBatchPtr batchPtr;
+    if (!this->m_routed_batch_link.pop(batchPtr))
+      {
+	this->m_aligned_batch_link.unreserve();
+	return false;
+      }
+    if (this->m_ready_batch_count.load() > 0 && this->m_routed_batch_link.shouldResumeProducer())
+      {
+	schedule(ROUTE);
+      }
+    // the batch is aligned on the worker its graph's ID maps to, so one
+    // worker keeps aligning a graph and finds its graph copy still in cache.
+    // its slot in m_aligned_batch_link stays reserved until it gets there
+    uint64_t graphID = batchPtr->graph_ptr->getGraphID();
+    AlignmentBatch* batch = batchPtr.release(); // the task's copy has to be copyable
+    this->m_aligning_count.fetch_add(1);
+    {
+      std::lock_guard< std::mutex > lock(this->m_mutex);
+      ++this->m_outstanding_pump_count;
+    }
+    try
+      {
+	ThreadPool::Instance()->enqueueWithAffinity(graphID, [this, batch]() { alignBatch(AlignmentBatchPtr(batch)); });
+      }
+    catch (...)
+      {
+	delete batch;
+	this->m_aligned_batch_link.unreserve();
+	this->m_aligning_count.fetch_sub(1);
+	std::lock_guard< std::mutex > lock(this->m_mutex);
+	--this->m_outstanding_pump_count;
+	throw;
+      }
+    return true;
+  }
+
+  void AlignmentPipeline::alignBatch(AlignmentBatchPtr batchPtr)
+  {
+    try
+      {
+	if (!this->m_failed.load())
+	  {
+	    auto graphPtr = batchPtr->graph_ptr;
+	    batchPtr->mapping_result_ptr = graphPtr->alignBatch(batchPtr->alignment_ptrs, graphPtr->getGraphContainer());
+	    this->m_aligned_count.fetch_add(batchPtr->alignment_ptrs.size());
+	    this->m_aligned_batch_link.push(std::move(batchPtr));
+	    schedule(AGGREGATE);
+	  }
+      }
+    catch (...)
+      {
+	recordException();
+      }
+    this->m_aligning_count.fetch_sub(1);
+    if (!this->m_failed.load() && !hasWork(ALIGN) && isDrained(ALIGN))
+      {
+	finish(ALIGN);
+      }
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    if (--this->m_outstanding_pump_count == 0)
+      {
+	this->m_condition.notify_all();
+      }
+  }
+
+  bool AlignmentPipeline::aggregate()
+  {
+    AlignmentBatchPtr batchPtr;
+    if (!this->m_aligned_batch_link.pop(batchPtr))
+      {
+	return false;
+      }
+    if (!this->m_routed_batch_link.empty() && this->m_aligned_batch_link.shouldResumeProducer())
+      {
+	schedule(ALIGN);
+      }
+    for (size_t i = 0; i < batchPtr->alignment_ptrs.size(); ++i)
+      {
+	batchPtr->graph_ptr->incrementAlleleCounts(batchPtr->mapping_result_ptr, i, batchPtr->alignment_ptrs[i], this->m_count_accumulator_ptr, batchPtr->graph_idx);
+      }
+    releaseGraph(batchPtr->graph_idx);
+    return true;
+  }
+
+  bool AlignmentPipeline::hasWork(StageType stageType)
+  {
+    switch (stageType)
+      {
+      case DECODE:
+	return !this->m_reader_exhausted.load();
+      case ROUTE:
+	return !this->m_alignment_link.empty() || this->m_ready_batch_count.load() > 0 ||
+	  (this->m_stages[ROUTE].input_closed.load() && this->m_open_graph_count.load() > 0);
+      case ALIGN:
+	return !this->m_routed_batch_link.empty();
+      case AGGREGATE:
+	return !this->m_aligned_batch_link.empty();
+      default:
+	return false;
+      }
+  }
+
+  bool AlignmentPipeline::canResume(StageType stageType)
+  {
+    switch (stageType)
+      {
+      case DECODE:
+	return this->m_alignment_link.shouldResumeProducer();
+      case ROUTE:
+	return this->m_ready_batch_count.load() == 0 || this->m_routed_batch_link.shouldResumeProducer();
+      case ALIGN:
+	return this->m_aligned_batch_link.shouldResumeProducer();
+      default:
+	return true;
+      }
+  }
+
+  void AlignmentPipeline::finish(StageType stageType)
+  {
+    bool finished = false;
+    if (!this->m_stages[stageType].finished.compare_exchange_strong(finished, true) || stageType == AGGREGATE)
+      {
+	// the last pump's own count drop wakes run()
+	return;
+      }
+    StageType nextStageType = static_cast< StageType >(stageType + 1);
+    this->m_stages[nextStageType].input_closed.store(true);
+    schedule(nextStageType);
+  }
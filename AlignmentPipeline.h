@@ -0,0 +1,223 @@
+#ifndef ALIGNMENTPIPELINE_H
+#define ALIGNMENTPIPELINE_H
+
+#include "IAlignmentReader.h"
+#include "GSSWGraph.h"
+#include "AlleleCountAccumulator.h"
+#include "BoundedQueue.hpp"
+#include "ThreadPool.hpp"
+#include "Noncopyable.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+  /*
+   * Streams alignments through four stages on the ThreadPool:
+   *
+   *   decode    pulls alignments from the reader
+   *   route     groups them into batches per graph the alignment overlaps
+   *   align     runs GSSWGraph::alignBatch, each batch on the worker its
+   *             graph's ID maps to through enqueueWithAffinity
+   *   aggregate adds the mappings to the allele counts
+   *
+   * The stages are linked by bounded lock free queues. A stage only takes an
+   * item once it has reserved a slot in the queue after it, so a stage whose
+   * consumer falls behind stops instead of piling up results, and at most
+   * readQueueCapacity alignments plus batchQueueCapacity batches per link are
+   * in memory no matter how many alignments the reader has.
+   *
+   * Each stage runs as pump tasks that work until they run out of input or
+   * output space and then return their worker to the pool. Whoever frees up
+   * input or output for a stalled stage schedules a new pump for it. Decode,
+   * route and aggregate have one pump at a time, align up to one per worker
+   * (aggregate too when counting into an AlleleCountAccumulator). Align's
+   * pumps only hand the batches on, a task per batch aligns it.
+   */
+  class AlignmentPipeline : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< AlignmentPipeline > SharedPtr;
+
+    // graphs on one contig must not overlap and must stay constructed for the life of the pipeline
+    AlignmentPipeline(IAlignmentReader::SharedPtr alignmentReaderPtr, const std::vector< GSSWGraph::SharedPtr >& graphPtrs, size_t batchSize = 64, size_t readQueueCapacity = 4096, size_t batchQueueCapacity = 64);
+    ~AlignmentPipeline();
+
+    // runs the pipeline until every alignment has been counted and rethrows the
+    // first exception a stage threw. can be called once, not from a pool task
+    void run();
+
+    /*
+     * Count into per worker buffers, grouped by graph, and add a graph's
+     * counts to its alleles once all its alignments are done instead of
+     * incrementing the alleles as each batch comes out of align. The
+     * aggregate stage then runs on as many workers as align does. Must be
+     * set before run().
+     */
+    void setCountAccumulator(AlleleCountAccumulator::SharedPtr countAccumulatorPtr);
+
+    typedef std::function< void(GSSWGraph::SharedPtr) > RegionCompleteCallback;
+
+    /*
+     * Called once for every graph as soon as all the alignments overlapping
+     * it have been counted, so its variants can be genotyped and written out
+     * while later regions are still aligning. The reader must then hand out
+     * each contig's alignments together and sorted by position, the contigs
+     * in any order (a BAM's header order, say), run() throws if it doesn't.
+     * Calls are made one at a time from pool workers, not necessarily in
+     * position order. With a count accumulator a graph's counts are merged
+     * into its alleles just before it is reported. Must be set before run().
+     */
+    void setRegionCompleteCallback(RegionCompleteCallback regionCompleteCallback);
+
+    uint64_t getDecodedCount() { return this->m_decoded_count.load(); }
+    uint64_t getUnroutedCount() { return this->m_unrouted_count.load(); }
+    uint64_t getAlignedCount() { return this->m_aligned_count.load(); }
+
+  private:
+    enum StageType { DECODE = 0, ROUTE = 1, ALIGN = 2, AGGREGATE = 3, STAGE_COUNT = 4 };
+
+    struct Stage
+    {
+      std::atomic< uint32_t > active_count; // pumps scheduled or running
+      uint32_t max_active_count;
+      std::atomic< bool > input_closed; // the stage before has finished
+      std::atomic< bool > finished;
+    };
+
+    // the graphs of one contig, [begin_idx, end_idx) of m_graph_ptrs
+    struct ContigGraphs
+    {
+      size_t begin_idx;
+      size_t end_idx;
+      size_t next_open_idx; // graphs before this one get no more alignments, only advanced by route
+    };
+
+    struct AlignmentBatch
+    {
+      GSSWGraph::SharedPtr graph_ptr;
+      size_t graph_idx;
+      std::vector< IAlignment::SharedPtr > alignment_ptrs;
+      GSSWMappingResult::SharedPtr mapping_result_ptr;
+    };
+    typedef std::unique_ptr< AlignmentBatch > AlignmentBatchPtr;
+
+    // a queue plus the count of slots producers have claimed in it, items are
+    // only pushed into claimed slots so the push itself can't fail. to keep
+    // pumps from being scheduled for every single item the consumer is only
+    // woken once wake_count items are waiting, and a producer that stalled on
+    // a full link only resumes once the link has drained to half
+    template< typename T >
+    struct Link
+    {
+    Link(size_t capacity, size_t wakeCount) : queue(capacity), reserved_count(0), item_count(0), wake_count(std::min(wakeCount, queue.capacity())) {}
+
+      bool reserve()
+      {
+	size_t reservedCount = this->reserved_count.load();
+	while (reservedCount < this->queue.capacity())
+	  {
+	    if (this->reserved_count.compare_exchange_weak(reservedCount, reservedCount + 1)) { return true; }
+	  }
+	return false;
+      }
+
+      void unreserve() { this->reserved_count.fetch_sub(1); }
+
+      void push(T&& item)
+      {
+	this->queue.tryPush(std::move(item));
+	this->item_count.fetch_add(1);
+      }
+
+      bool pop(T& item)
+      {
+	if (!this->queue.tryPop(item)) { return false; }
+	this->item_count.fetch_sub(1);
+	this->reserved_count.fetch_sub(1);
+	return true;
+      }
+
+      bool full() { return this->reserved_count.load() >= this->queue.capacity(); }
+      // a slot can stay reserved for as long as the producer works on its item,
+      // the consumer side only looks at items that have actually been pushed
+      bool empty() { return this->item_count.load() == 0; }
+      bool shouldWakeConsumer() { return this->item_count.load() >= this->wake_count; }
+      bool shouldResumeProducer() { return this->reserved_count.load() <= this->queue.capacity() / 2; }
+
+      BoundedQueue< T > queue;
+      std::atomic< size_t > reserved_count;
+      std::atomic< size_t > item_count;
+      size_t wake_count;
+    };
+
+    void schedule(StageType stageType);
+    void runPump(StageType stageType);
+    bool runStage(StageType stageType);
+    bool decode();
+    bool route();
+    bool align();
+    bool aggregate();
+    void alignBatch(AlignmentBatchPtr batchPtr);
+    bool hasWork(StageType stageType);
+    bool isDrained(StageType stageType);
+    void recordException();
+    bool canResume(StageType stageType);
+    void finish(StageType stageType);
+    void routeAlignment(IAlignment::SharedPtr alignmentPtr);
+    ContigGraphs* getContigGraphs(const std::string& referenceID);
+    void closeGraphsBefore(ContigGraphs* contigGraphsPtr, position startPosition);
+    void releaseGraph(size_t graphIdx);
+
+    static const size_t s_alignment_wake_count = 32;
+    IAlignmentReader::SharedPtr m_alignment_reader_ptr;
+    std::vector< GSSWGraph::SharedPtr > m_graph_ptrs; // sorted by contig, then start position
+    std::unordered_map< std::string, ContigGraphs > m_contig_graphs;
+    size_t m_batch_size;
+    Stage m_stages[STAGE_COUNT];
+    Link< IAlignment::SharedPtr > m_alignment_link; // decode to route
+    Link< AlignmentBatchPtr > m_routed_batch_link; // route to align
+    Link< AlignmentBatchPtr > m_aligned_batch_link; // align to aggregate
+    std::atomic< bool > m_reader_exhausted;
+    std::atomic< uint32_t > m_aligning_count; // batches align handed to their graph's worker and not yet pushed on
+    AlleleCountAccumulator::SharedPtr m_count_accumulator_ptr;
+
+    // only touched by the single route pump
+    std::vector< AlignmentBatchPtr > m_pending_batches; // one filling batch per graph
+    std::deque< AlignmentBatchPtr > m_ready_batches; // full batches waiting for a slot in m_routed_batch_link
+    bool m_has_routed;
+    std::string m_last_reference_id; // of the last alignment routed
+    ContigGraphs* m_last_contig_graphs_ptr; // its graphs, null if it has none
+    std::unordered_set< std::string > m_passed_reference_ids; // contigs the alignments have moved on from
+    position m_last_alignment_position;
+    std::atomic< size_t > m_ready_batch_count; // mirrors m_ready_batches for the other stages
+    std::atomic< size_t > m_open_graph_count; // graphs that can still get alignments, only lowered by route
+
+    // per graph, its batches not yet counted plus one until it is closed,
+    // whoever takes it to zero merges its counts and reports the region
+    std::unique_ptr< std::atomic< uint32_t >[] > m_graph_outstanding_counts;
+    RegionCompleteCallback m_region_complete_callback;
+    bool m_report_regions_early; // there is a callback
+    std::mutex m_region_complete_mutex;
+
+    std::atomic< uint64_t > m_decoded_count;
+    std::atomic< uint64_t > m_unrouted_count;
+    std::atomic< uint64_t > m_aligned_count;
+
+    std::atomic< bool > m_failed;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    uint32_t m_outstanding_pump_count; // pumps and align's batch tasks, guarded by m_mutex
+    std::exception_ptr m_exception; // guarded by m_mutex
+  };
+
+#endif
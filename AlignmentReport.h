@@ -4,10 +4,9 @@
 #include "IReference.h"
 #include "IVariantList.h"
 #include "IAlignment.h"
+#include "GSSWMappingResult.h"
 #include "Noncopyable.hpp"
 
-#include "gssw.h"
-
 #include <memory>
 
   class AlignmentReport : private Noncopyable
@@ -15,7 +14,7 @@
   public:
     typedef std::shared_ptr< AlignmentReport > SharedPtr;
 
-    AlignmentReport(IReference::SharedPtr referencePtr, IVariantList::SharedPtr variantListPtr, IAlignment::SharedPtr alignmentPtr, std::shared_ptr< gssw_graph_mapping > graphMappingPtr, position graphStartPosition);
+    AlignmentReport(IReference::SharedPtr referencePtr, IVariantList::SharedPtr variantListPtr, IAlignment::SharedPtr alignmentPtr, GSSWMappingResult::SharedPtr mappingResultPtr, position graphStartPosition);
     ~AlignmentReport();
 
     std::string toString();
@@ -24,7 +23,7 @@
     IReference::SharedPtr m_reference_ptr;
     IVariantList::SharedPtr m_variant_list_ptr;
     IAlignment::SharedPtr m_alignment_ptr;
-    std::shared_ptr< gssw_graph_mapping > m_graph_mapping_ptr;
+    GSSWMappingResult::SharedPtr m_mapping_result_ptr;
     position m_graph_start_position;
   };
 
@@ -6,6 +6,8 @@
 #include "IAlignment.h"
 #include "Sample.h"
 #include <string>
+#include <atomic>
+#include <algorithm>
 
 class VCFFileReader;
 class IAlignmentReader;
@@ -14,12 +16,12 @@ class Allele : public IAllele{
   typedef std::shared_ptr< Allele > SharedPtr;
 
  Allele(const std::string& sequence):
-  m_sequence(sequence), m_allele_meta_data_ptr(std::make_shared< AlleleMetaData>(0,0)){}
+  m_sequence(sequence), m_allele_meta_data_ptr(std::make_shared< AlleleMetaData>(0,0)){ initializeCounts(); }
 
  Allele(const std::string& sequence, AlleleMetaData::SharedPtr alleleMetaDataPtr):
-  m_sequence(sequence), m_allele_meta_data_ptr(alleleMetaDataPtr){}
+  m_sequence(sequence), m_allele_meta_data_ptr(alleleMetaDataPtr){ initializeCounts(); }
 
-  ~Allele(){}
+  ~Allele(){ delete m_count_table_ptr.load(); }
 
   size_t getLength() override {return this->m_sequence.size();}
   const char* getSequence() override {return this->m_sequence.c_str();}
@@ -29,66 +31,42 @@ class Allele : public IAllele{
   virtual AlleleMetaData::SharedPtr getAlleleMetaData() {return this-> m_allele_meta_data_ptr;}
 
   virtual uint32_t getForwardCount(const std::string& sampleName, AlleleCountType alleleCountType) override {
-    std::lock_guard<std::mutex> lock(m_alignment_count_mutex);
-    auto iter = m_alignment_sample_forward_count_map.find(sampleName);
-    return (iter == m_alignment_sample_forward_count_map.end()) ? 0 : iter->second->getScoreCount(alleleCountType);
+    uint32_t sampleID;
+    return Sample::getSampleID(sampleName, sampleID) ? getForwardCount(sampleID, alleleCountType) : 0;
   }
 
   virtual uint32_t getReverseCount(const std::string& sampleName, AlleleCountType alleleCountType) override {
-    std::lock_guard<std::mutex> lock(m_alignment_count_mutex);
-    auto iter =m_alignment_sample_reverse_count_map.find(sampleName);
-    return (iter == m_alignment_sample_reverse_count_map.end()) ? 0 : iter->second->getScoreCount(alleleCountType);
+    uint32_t sampleID;
+    return Sample::getSampleID(sampleName, sampleID) ? getReverseCount(sampleID, alleleCountType) : 0;
   }
 
-  virtual uint32_t getTotalCount(AlleleCountType alleleCountType) override {
-    uint32_t totalCount = 0;
-    for (auto iter : m_alignment_sample_forward_count_map){
-      totalCount += iter.second->getTotalCount();
-    }
+  virtual uint32_t getForwardCount(uint32_t sampleID, AlleleCountType alleleCountType) override {
+    return getCount(sampleID, false, alleleCountType);
+  }
 
-    for (auto iter : m_alignment_sample_reverse_count_map){
-      totalCount += iter.second->getTotalCount();
-    }
-    return totalCount;
+  virtual uint32_t getReverseCount(uint32_t sampleID, AlleleCountType alleleCountType) override {
+    return getCount(sampleID, true, alleleCountType);
   }
-  
+
+  virtual uint32_t getTotalCount(AlleleCountType alleleCountType) override {
+    return m_total_counts[static_cast< size_t >(alleleCountType)].load(std::memory_order_relaxed);
+  }
+
   virtual void incrementForwardCount(std::shared_ptr< Sample > samplePtr, AlleleCountType alleleCountType) override {
-    std::lock_guard< std::mutex > lock(m_alignment_count_mutex);
-    auto iter = m_alignment_sample_reverse_count_map.find(samplePtr->getName());
-    if (iter == m_alignment_sample_reverse_count_map.end()){
-      auto scoreCounterPtr = std::make_shared< ScoreCounter > ();
-      scoreCounterPtr->incrementScoreCount(alleleCountType);
-      m_alignment_sample_reverse_count_map.emplace(samplePtr->getName(), std::make_shared< ScoreCounter >());
-    }
-    else {
-      iter->second->incrementScoreCount(alleleCountType);
-    }
+    incrementCount(false, samplePtr, alleleCountType);
   }
 
-  virtual void incrementReverseCount(std::shared_ptr< Sample > samplePtr, AlleleCountType alleleCountType) override
-  {
-    std::lock_guard< std::mutex > lock(m_alignment_count_mutex);
-    auto iter = m_alignment_sample_reverse_count_map.find(samplePtr->getName());
-    if (iter == m_alignment_sample_reverse_count_map.end())
-      {
-	auto scoreCounterPtr = std::make_shared< ScoreCounter >();
-	scoreCounterPtr->incrementScoreCount(alleleCountType);
-	m_alignment_sample_reverse_count_map.emplace(samplePtr->getName(), std::make_shared< ScoreCounter >());
-	/* iter = m_alignment_sample_reverse_count_map.find(samplePtr->getName()); */
-      }
-    else
-      {
-	iter->second->incrementScoreCount(alleleCountType);
-      }
+  virtual void incrementReverseCount(std::shared_ptr< Sample > samplePtr, AlleleCountType alleleCountType) override {
+    incrementCount(true, samplePtr, alleleCountType);
   }
-  
-  virtual void incrementCount(bool isReverseStrand, std::shared_ptr< Sample > alignmentPtr, AlleleCountType alleleCountType) override {
-    if (isReverseStrand){
-      incrementReverseCount(alignmentPtr, alleleCountType);
-    }
-    else {
-      incrementForwardCount(alignmentPtr, alleleCountType);
-    }
+
+  virtual void incrementCount(bool isReverseStrand, const std::shared_ptr< Sample >& samplePtr, AlleleCountType alleleCountType) override {
+    addCount(isReverseStrand, samplePtr->getSampleID(), alleleCountType, 1);
+  }
+
+  virtual void addCount(bool isReverseStrand, uint32_t sampleID, AlleleCountType alleleCountType, uint32_t count) override {
+    getCountTable(sampleID)->counts[CountTable::getIndex(sampleID, isReverseStrand, alleleCountType)].fetch_add(count, std::memory_order_relaxed);
+    m_total_counts[static_cast< size_t >(alleleCountType)].fetch_add(count, std::memory_order_relaxed);
   }
   
   uint32_t getCommonPrefixSize(IAllele::SharedPtr allelePtr) override
@@ -108,47 +86,70 @@ class Allele : public IAllele{
   }
 
  protected:
-  Allele() {}
-
-  class ScoreCounter{
-  public:
-    typedef std::shared_ptr< ScoreCounter > SharedPtr;
-    ScoreCounter(){
-      m_score_map[AlleleCountType::Ambiguous] = 0;
-      m_score_map[AlleleCountType::LowPercent] = 0;
-      m_score_map[AlleleCountType::SeventyPercent] = 0;
-      m_score_map[AlleleCountType::EightyPercent] =0;
-      m_score_map[AlleleCountType::NinteyPercent] =0;
-      m_score_map[AlleleCountType::NinteyFivePercent] =0;
+  Allele() { initializeCounts(); }
+
+  void initializeCounts(){
+    m_count_table_ptr.store(nullptr);
+    for (auto& totalCount : m_total_counts){
+      totalCount.store(0, std::memory_order_relaxed);
     }
+  }
 
-    void incrementScoreCount(AlleleCountType alleleCountType){
-      ++m_score_map[alleleCountType];
+  /*
+   * Counts for samples [0, sample_capacity), flat as [sample][strand][AlleleCountType].
+   * When a sample beyond the capacity shows up a bigger table is pushed in
+   * front of this one rather than copying it, a writer still holding the old
+   * table may be incrementing it. Readers add up the whole chain.
+   */
+  struct CountTable {
+  CountTable(uint32_t sampleCapacity, CountTable* previous) :
+    sample_capacity(sampleCapacity), counts(new std::atomic< uint32_t >[sampleCapacity * 2 * AlleleCountTypeCount]), previous_ptr(previous) {
+      for (size_t i = 0; i < sampleCapacity * 2 * AlleleCountTypeCount; ++i){
+	counts[i].store(0, std::memory_order_relaxed);
+      }
     }
 
-    uint32_t getScoreCount(AlleleCountType alleleCountType){
-      return m_score_map[alleleCountType];
+    static size_t getIndex(uint32_t sampleID, bool isReverseStrand, AlleleCountType alleleCountType){
+      return ((sampleID * 2) + (isReverseStrand ? 1 : 0)) * AlleleCountTypeCount + static_cast< size_t >(alleleCountType);
     }
 
-    uint32_t getTotalCount() {
-      uint32_t count = 0;
-      for (auto iter: m_score_map){
-	count += iter.second;
+    uint32_t sample_capacity;
+    std::unique_ptr< std::atomic< uint32_t >[] > counts;
+    std::unique_ptr< CountTable > previous_ptr;
+  };
+
+  CountTable* getCountTable(uint32_t sampleID){
+    CountTable* countTablePtr = m_count_table_ptr.load(std::memory_order_acquire);
+    while (countTablePtr == nullptr || countTablePtr->sample_capacity <= sampleID){
+      // size for every sample known so far so a table is normally only built once
+      uint32_t sampleCapacity = std::max< uint32_t >(Sample::getSampleCount(), sampleID + 1);
+      if (countTablePtr != nullptr){
+	sampleCapacity = std::max< uint32_t >(sampleCapacity, countTablePtr->sample_capacity * 2);
       }
-      return count;
+      CountTable* newCountTablePtr = new CountTable(sampleCapacity, countTablePtr);
+      if (m_count_table_ptr.compare_exchange_strong(countTablePtr, newCountTablePtr, std::memory_order_acq_rel)){
+	return newCountTablePtr;
+      }
+      newCountTablePtr->previous_ptr.release();
+      delete newCountTablePtr;
     }
-  private:
-    std::unordered_map< AlleleCountType, uint32_t, AlleleCountTypeHash > m_score_map;
-  };
+    return countTablePtr;
+  }
+
+  uint32_t getCount(uint32_t sampleID, bool isReverseStrand, AlleleCountType alleleCountType){
+    uint32_t count = 0;
+    for (CountTable* countTablePtr = m_count_table_ptr.load(std::memory_order_acquire); countTablePtr != nullptr; countTablePtr = countTablePtr->previous_ptr.get()){
+      if (sampleID < countTablePtr->sample_capacity){
+	count += countTablePtr->counts[CountTable::getIndex(sampleID, isReverseStrand, alleleCountType)].load(std::memory_order_relaxed);
+      }
+    }
+    return count;
+  }
 
   std::string m_sequence;
   AlleleMetaData::SharedPtr m_allele_meta_data_ptr;
-  std::mutex m_alignment_count_mutex;
-  std::unordered_map< std::string, ScoreCounter::SharedPtr > m_alignment_sample_forward_count_map;
-  std::unordered_map< std::string, ScoreCounter::SharedPtr > m_alignment_sample_reverse_count_map;
-  
-
-  
+  std::atomic< CountTable* > m_count_table_ptr;
+  std::atomic< uint32_t > m_total_counts[AlleleCountTypeCount];
 };
 
 #endif
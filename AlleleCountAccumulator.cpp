@@ -0,0 +1,136 @@
+#include "AlleleCountAccumulator.h"
+#include "ThreadPool.hpp"
+
+  AlleleCountAccumulator::AlleleCountAccumulator() :
+    m_worker_buffers(ThreadPool::getMaxThreadCount())
+  {
+  }
+
+  AlleleCountAccumulator::~AlleleCountAccumulator()
+  {
+  }
+
+  void AlleleCountAccumulator::incrementCount(const IAllele::SharedPtr& allelePtr, bool isReverseStrand, const Sample::SharedPtr& samplePtr, AlleleCountType alleleCountType, uint64_t groupKey)
+  {
+    int32_t workerIdx = ThreadPool::getCurrentWorkerIndex();
+    if (workerIdx < 0)
+      {
+	std::lock_guard< std::mutex > lock(this->m_external_buffer_mutex);
+	addToBuffer(*getGroupBuffer(this->m_external_buffer, groupKey), allelePtr, isReverseStrand, samplePtr->getSampleID(), alleleCountType);
+	return;
+      }
+    Buffer* bufferPtr = this->m_worker_buffers[workerIdx].get();
+    if (bufferPtr == nullptr)
+      {
+	std::lock_guard< std::mutex > lock(this->m_mutex);
+	this->m_worker_buffers[workerIdx].reset(new Buffer());
+	bufferPtr = this->m_worker_buffers[workerIdx].get();
+      }
+    addToBuffer(*getGroupBuffer(*bufferPtr, groupKey), allelePtr, isReverseStrand, samplePtr->getSampleID(), alleleCountType);
+  }
+
+  AlleleCountAccumulator::GroupBuffer* AlleleCountAccumulator::getGroupBuffer(Buffer& buffer, uint64_t groupKey)
+  {
+    // only this buffer's worker sets them, a merge may clear the pointer but
+    // not while the worker counts into its group
+    GroupBuffer* groupBufferPtr = buffer.last_group_ptr.load(std::memory_order_relaxed);
+    if (groupBufferPtr != nullptr && buffer.last_group_key.load(std::memory_order_relaxed) == groupKey)
+      {
+	return groupBufferPtr;
+      }
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    auto& groupPtr = buffer.groups[groupKey];
+    if (groupPtr == nullptr)
+      {
+	groupPtr.reset(new GroupBuffer());
+      }
+    buffer.last_group_key.store(groupKey, std::memory_order_relaxed);
+    buffer.last_group_ptr.store(groupPtr.get(), std::memory_order_relaxed);
+    return groupPtr.get();
+  }
+
+  void AlleleCountAccumulator::addToBuffer(GroupBuffer& groupBuffer, const IAllele::SharedPtr& allelePtr, bool isReverseStrand, uint32_t sampleID, AlleleCountType alleleCountType)
+  {
+    auto iter = groupBuffer.allele_indices.find(allelePtr.get());
+    if (iter == groupBuffer.allele_indices.end())
+      {
+	iter = groupBuffer.allele_indices.emplace(allelePtr.get(), groupBuffer.allele_ptrs.size()).first;
+	groupBuffer.allele_ptrs.emplace_back(allelePtr);
+	groupBuffer.allele_counts.emplace_back();
+      }
+    auto& counts = groupBuffer.allele_counts[iter->second];
+    size_t countIdx = ((sampleID * 2) + (isReverseStrand ? 1 : 0)) * AlleleCountTypeCount + static_cast< size_t >(alleleCountType);
+    if (counts.size() <= countIdx)
+      {
+	counts.resize((sampleID + 1) * 2 * AlleleCountTypeCount, 0);
+      }
+    ++counts[countIdx];
+  }
+
+  void AlleleCountAccumulator::mergeGroupBuffer(GroupBuffer& groupBuffer)
+  {
+    for (size_t alleleIdx = 0; alleleIdx < groupBuffer.allele_ptrs.size(); ++alleleIdx)
+      {
+	auto& counts = groupBuffer.allele_counts[alleleIdx];
+	for (size_t countIdx = 0; countIdx < counts.size(); ++countIdx)
+	  {
+	    if (counts[countIdx] == 0) { continue; }
+	    uint32_t sampleID = countIdx / (2 * AlleleCountTypeCount);
+	    bool isReverseStrand = (countIdx / AlleleCountTypeCount) % 2 == 1;
+	    AlleleCountType alleleCountType = static_cast< AlleleCountType >(countIdx % AlleleCountTypeCount);
+	    groupBuffer.allele_ptrs[alleleIdx]->addCount(isReverseStrand, sampleID, alleleCountType, counts[countIdx]);
+	  }
+      }
+  }
+
+  // called with m_mutex held, a finished group's entry goes so the maps don't hold one per group ever counted
+  void AlleleCountAccumulator::mergeGroup(Buffer& buffer, uint64_t groupKey)
+  {
+    auto groupIter = buffer.groups.find(groupKey);
+    if (groupIter == buffer.groups.end())
+      {
+	return;
+      }
+    mergeGroupBuffer(*groupIter->second);
+    if (buffer.last_group_ptr.load(std::memory_order_relaxed) == groupIter->second.get())
+      {
+	buffer.last_group_ptr.store(nullptr, std::memory_order_relaxed);
+      }
+    buffer.groups.erase(groupIter);
+  }
+
+  void AlleleCountAccumulator::merge()
+  {
+    std::lock_guard< std::mutex > externalLock(this->m_external_buffer_mutex);
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    std::vector< Buffer* > bufferPtrs;
+    for (auto& bufferPtr : this->m_worker_buffers)
+      {
+	if (bufferPtr != nullptr) { bufferPtrs.emplace_back(bufferPtr.get()); }
+      }
+    bufferPtrs.emplace_back(&this->m_external_buffer);
+
+    for (auto bufferPtr : bufferPtrs)
+      {
+	for (auto& group : bufferPtr->groups)
+	  {
+	    mergeGroupBuffer(*group.second);
+	  }
+	bufferPtr->groups.clear();
+	bufferPtr->last_group_ptr.store(nullptr, std::memory_order_relaxed);
+      }
+  }
+
+  void AlleleCountAccumulator::merge(uint64_t groupKey)
+  {
+    std::lock_guard< std::mutex > externalLock(this->m_external_buffer_mutex);
+    std::lock_guard< std::mutex > lock(this->m_mutex);
+    for (auto& bufferPtr : this->m_worker_buffers)
+      {
+	if (bufferPtr != nullptr)
+	  {
+	    mergeGroup(*bufferPtr, groupKey);
+	  }
+      }
+    mergeGroup(this->m_external_buffer, groupKey);
+  }
@@ -0,0 +1,77 @@
+#ifndef ALLELECOUNTACCUMULATOR_H
+#define ALLELECOUNTACCUMULATOR_H
+
+#include "IAllele.h"
+#include "Sample.h"
+#include "Types.h"
+#include "Noncopyable.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+  /*
+   * Collects allele count increments in a buffer per ThreadPool worker so
+   * workers counting the same hot alleles don't fight over their counters,
+   * then adds them to the alleles in one go with merge(). Threads outside
+   * the pool share one extra buffer behind a mutex.
+   *
+   * Increments name a group, a graph say, and merge(groupKey) adds just that
+   * group's counts, so a caller that knows a group is done counting can
+   * hand its alleles on while the other groups keep counting.
+   *
+   * A merge walks the buffers in worker order and the alleles of each buffer
+   * in the order they were first counted, adding every non zero
+   * [sample][strand][AlleleCountType] cell with a single addCount. The
+   * resulting counts are the same as incrementing the alleles directly.
+   */
+  class AlleleCountAccumulator : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< AlleleCountAccumulator > SharedPtr;
+    AlleleCountAccumulator();
+    ~AlleleCountAccumulator();
+
+    void incrementCount(const IAllele::SharedPtr& allelePtr, bool isReverseStrand, const Sample::SharedPtr& samplePtr, AlleleCountType alleleCountType, uint64_t groupKey = 0);
+
+    // must not run alongside incrementCount, call it once the counting tasks are done
+    void merge();
+    // must not run alongside incrementCount for groupKey, other groups can go on counting
+    void merge(uint64_t groupKey);
+
+  private:
+    struct GroupBuffer
+    {
+      std::unordered_map< IAllele*, size_t > allele_indices;
+      std::vector< IAllele::SharedPtr > allele_ptrs; // keeps the alleles alive until merged
+      std::vector< std::vector< uint32_t > > allele_counts; // [sample][strand][AlleleCountType] per allele
+    };
+
+    /*
+     * A worker's groups. Only the worker counts into a group, but the map is
+     * guarded by m_mutex as merges erase the groups they are done with. The
+     * worker remembers the group it last counted into so it only takes the
+     * lock when it moves on to another group, a merge of that group clears
+     * it.
+     */
+    struct Buffer
+    {
+      std::unordered_map< uint64_t, std::unique_ptr< GroupBuffer > > groups;
+      std::atomic< uint64_t > last_group_key{0};
+      std::atomic< GroupBuffer* > last_group_ptr{nullptr};
+    };
+
+    GroupBuffer* getGroupBuffer(Buffer& buffer, uint64_t groupKey);
+    static void addToBuffer(GroupBuffer& groupBuffer, const IAllele::SharedPtr& allelePtr, bool isReverseStrand, uint32_t sampleID, AlleleCountType alleleCountType);
+    static void mergeGroupBuffer(GroupBuffer& groupBuffer);
+    static void mergeGroup(Buffer& buffer, uint64_t groupKey);
+
+    std::mutex m_mutex; // adding workers' buffers and groups, and merging
+    std::vector< std::unique_ptr< Buffer > > m_worker_buffers; // only counted into by their worker
+    std::mutex m_external_buffer_mutex;
+    Buffer m_external_buffer;
+  };
+
+#endif
@@ -0,0 +1,143 @@
+#include "BamAlignment.h"
+
+#include <cstring>
+#include <stdexcept>
+
+  const char BamAlignment::s_base_letters[16] = { '=', 'A', 'C', 'M', 'G', 'R', 'S', 'V', 'T', 'W', 'Y', 'H', 'K', 'D', 'B', 'N' };
+  // what gssw_create_nt_table gives the letters: A, C, G, T and everything else
+  const int8_t BamAlignment::s_base_codes[16] = { 4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4 };
+
+  BamAlignment::BamAlignment() :
+    m_reference_index(-1),
+    m_position(0),
+    m_flag(0),
+    m_map_quality(0)
+  {
+  }
+
+  BamAlignment::~BamAlignment()
+  {
+  }
+
+  void BamAlignment::setRecord(const char* record, size_t length)
+  {
+    int32_t referenceIndex;
+    int32_t zeroBasedPosition;
+    uint8_t nameLength;
+    uint16_t cigarCount;
+    int32_t sequenceLength;
+    if (length < s_fixed_size)
+      {
+	throw std::runtime_error("BamAlignment record of " + std::to_string(length) + " bytes is too short");
+      }
+    memcpy(&referenceIndex, record, 4);
+    memcpy(&zeroBasedPosition, record + 4, 4);
+    nameLength = record[8];
+    this->m_map_quality = record[9];
+    memcpy(&cigarCount, record + 12, 2);
+    memcpy(&this->m_flag, record + 14, 2);
+    memcpy(&sequenceLength, record + 16, 4);
+    const char* name = record + s_fixed_size;
+    const char* packedSequence = name + nameLength + (size_t)cigarCount * 4;
+    const char* recordEnd = record + length;
+    if (sequenceLength < 0 || nameLength == 0 || packedSequence > recordEnd || (size_t)(recordEnd - packedSequence) < ((size_t)sequenceLength + 1) / 2 + sequenceLength)
+      {
+	throw std::runtime_error("BamAlignment record's name, CIGAR or sequence runs past its end");
+      }
+    this->m_reference_index = referenceIndex;
+    this->m_reference_id.clear(); // until the reader names it
+    this->m_position = (zeroBasedPosition >= 0) ? zeroBasedPosition + 1 : 0;
+    this->m_name.assign(name, nameLength - 1); // without its NUL
+
+    // two bases a byte, the first in the high bits
+    this->m_sequence.resize(sequenceLength);
+    this->m_encoded_sequence.resize(sequenceLength);
+    for (int32_t i = 0; i < sequenceLength; ++i)
+      {
+	uint8_t base = ((uint8_t)packedSequence[i / 2] >> ((i % 2 == 0) ? 4 : 0)) & 0xf;
+	this->m_sequence[i] = s_base_letters[base];
+	this->m_encoded_sequence[i] = s_base_codes[base];
+      }
+
+    const char* aux = packedSequence + ((size_t)sequenceLength + 1) / 2 + sequenceLength;
+    if (!findReadGroup(aux, recordEnd, this->m_read_group))
+      {
+	this->m_read_group.clear();
+      }
+  }
+
+  // walks the tags to RG:Z, each is two letters, a type and a value whose size the type gives
+  bool BamAlignment::findReadGroup(const char* aux, const char* end, std::string& readGroup)
+  {
+    while (end - aux >= 3)
+      {
+	char type = aux[2];
+	bool isReadGroup = aux[0] == 'R' && aux[1] == 'G' && type == 'Z';
+	const char* value = aux + 3;
+	size_t valueSize = 0;
+	switch (type)
+	  {
+	  case 'A': case 'c': case 'C': valueSize = 1; break;
+	  case 's': case 'S': valueSize = 2; break;
+	  case 'i': case 'I': case 'f': valueSize = 4; break;
+	  case 'Z': case 'H':
+	    {
+	      const char* nul = (const char*)memchr(value, '\0', end - value);
+	      if (nul == nullptr)
+		{
+		  return false;
+		}
+	      if (isReadGroup)
+		{
+		  readGroup.assign(value, nul);
+		  return true;
+		}
+	      valueSize = nul - value + 1;
+	      break;
+	    }
+	  case 'B':
+	    {
+	      if (end - value < 5)
+		{
+		  return false;
+		}
+	      uint32_t count;
+	      memcpy(&count, value + 1, 4);
+	      size_t elementSize = (value[0] == 'c' || value[0] == 'C') ? 1 : (value[0] == 's' || value[0] == 'S') ? 2 : 4;
+	      valueSize = 5 + (size_t)count * elementSize;
+	      break;
+	    }
+	  default:
+	    return false;
+	  }
+	if ((size_t)(end - value) < valueSize)
+	  {
+	    return false;
+	  }
+	aux = value + valueSize;
+      }
+    return false;
+  }
+
+  void BamAlignment::setSequence(char* seq, uint32_t len)
+  {
+    this->m_sequence.assign(seq, len);
+    this->m_encoded_sequence.resize(len);
+    for (uint32_t i = 0; i < len; ++i)
+      {
+	switch (seq[i])
+	  {
+	  case 'A': case 'a': this->m_encoded_sequence[i] = 0; break;
+	  case 'C': case 'c': this->m_encoded_sequence[i] = 1; break;
+	  case 'G': case 'g': this->m_encoded_sequence[i] = 2; break;
+	  case 'T': case 't': this->m_encoded_sequence[i] = 3; break;
+	  default: this->m_encoded_sequence[i] = 4;
+	  }
+      }
+  }
+
+  void BamAlignment::removeSequence()
+  {
+    this->m_sequence.clear();
+    this->m_encoded_sequence.clear();
+  }
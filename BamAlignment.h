@@ -0,0 +1,72 @@
+#ifndef BAMALIGNMENT_H
+#define BAMALIGNMENT_H
+
+#include "IAlignment.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * One BAM record. setRecord unpacks the record's 4 bit bases once, into
+   * letters for getSequence and into the codes gssw aligns with for
+   * getEncodedSequence, so a graph doesn't translate the read again. Only
+   * the fields alignment needs are kept, CIGAR and qualities are skipped.
+   */
+  class BamAlignment : public IAlignment
+  {
+  public:
+    typedef std::shared_ptr< BamAlignment > SharedPtr;
+
+    BamAlignment();
+    ~BamAlignment();
+
+    // record is a BAM record after its block_size, throws std::runtime_error if it's malformed
+    void setRecord(const char* record, size_t length);
+
+    const char* getSequence() override { return this->m_sequence.c_str(); }
+    const int8_t* getEncodedSequence() override { return this->m_encoded_sequence.data(); }
+    position getPosition() override { return this->m_position; }
+    const std::string getReferenceID() override { return this->m_reference_id; }
+    size_t getLength() override { return this->m_sequence.size(); }
+    const std::string getID() override { return this->m_name; }
+    bool isFirstMate() override { return (this->m_flag & s_first_mate_flag) != 0; }
+    bool isMapped() override { return (this->m_flag & s_unmapped_flag) == 0; }
+    bool isReverseStrand() override { return (this->m_flag & s_reverse_strand_flag) != 0; }
+    bool isDuplicate() override { return (this->m_flag & s_duplicate_flag) != 0; }
+    uint16_t getOriginalMapQuality() override { return this->m_map_quality; }
+
+    void setSequence(char* seq, uint32_t len) override;
+    void removeSequence() override;
+    void incrementReferenceCount() override {}
+
+    int32_t getReferenceIndex() { return this->m_reference_index; } // into the header's references, -1 for none
+    void setReferenceID(const std::string& referenceID) { this->m_reference_id = referenceID; } // the reader names getReferenceIndex's reference
+    uint16_t getFlag() { return this->m_flag; }
+    const std::string& getReadGroup() { return this->m_read_group; } // the RG tag, empty without one
+    void setSample(Sample::SharedPtr samplePtr) { this->m_sample_ptr = samplePtr; }
+
+    static const uint16_t s_first_mate_flag = 0x40;
+    static const uint16_t s_unmapped_flag = 0x4;
+    static const uint16_t s_reverse_strand_flag = 0x10;
+    static const uint16_t s_duplicate_flag = 0x400;
+
+  private:
+    static const size_t s_fixed_size = 32; // refID through tlen
+    static const char s_base_letters[16];
+    static const int8_t s_base_codes[16];
+
+    static bool findReadGroup(const char* aux, const char* end, std::string& readGroup);
+
+    int32_t m_reference_index;
+    std::string m_reference_id;
+    position m_position; // one based
+    uint16_t m_flag;
+    uint8_t m_map_quality;
+    std::string m_name;
+    std::string m_sequence;
+    std::vector< int8_t > m_encoded_sequence;
+    std::string m_read_group;
+  };
+
+#endif
@@ -0,0 +1,446 @@
+#include "BamAlignmentReader.h"
+#include "BgzfFile.h"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+  const size_t BamAlignmentReader::s_chunk_size;
+
+  BamAlignmentReader::BamAlignmentReader(const std::string& bamPath) :
+    m_bam_path(bamPath),
+    m_fd(-1),
+    m_file_size(0),
+    m_next_compressed_offset(0),
+    m_max_chunk_count(2 * std::max< uint32_t >(ThreadPool::Instance()->getThreadCount(), 1)),
+    m_current_alignment_idx(0)
+  {
+    this->m_fd = open(bamPath.c_str(), O_RDONLY);
+    if (this->m_fd < 0)
+      {
+	throw std::runtime_error("BamAlignmentReader could not open " + bamPath);
+      }
+    try
+      {
+	struct stat fileStat;
+	if (fstat(this->m_fd, &fileStat) != 0)
+	  {
+	    throw std::runtime_error("BamAlignmentReader could not read " + bamPath);
+	  }
+	this->m_file_size = fileStat.st_size;
+	readHeader();
+      }
+    catch (...)
+      {
+	close(this->m_fd);
+	throw;
+      }
+  }
+
+  BamAlignmentReader::~BamAlignmentReader()
+  {
+    // claim the chunks no task has started and wait for the ones running,
+    // a late task finds its flag taken
+    for (auto& chunkPtr : this->m_chunk_ptrs)
+      {
+	std::call_once(chunkPtr->inflate_flag, []() {});
+	std::call_once(chunkPtr->decode_flag, []() {});
+      }
+    close(this->m_fd);
+  }
+
+  // the size of the whole block at compressedOffset read into block, 0 at the end of the file
+  uint32_t BamAlignmentReader::readBlock(uint64_t compressedOffset, std::vector< char >& block)
+  {
+    if (compressedOffset >= this->m_file_size)
+      {
+	return 0;
+      }
+    block.resize(BgzfFile::s_max_block_size);
+    uint32_t blockSize = 0;
+    if (pread(this->m_fd, block.data(), BgzfFile::s_header_size, compressedOffset) == (ssize_t)BgzfFile::s_header_size)
+      {
+	blockSize = BgzfFile::getBlockSize((const uint8_t*)block.data());
+      }
+    if (blockSize == 0 || pread(this->m_fd, block.data(), blockSize, compressedOffset) != (ssize_t)blockSize)
+      {
+	throw std::runtime_error(this->m_bam_path + " has no whole BGZF block at byte " + std::to_string(compressedOffset));
+      }
+    return blockSize;
+  }
+
+  // magic, the SAM header text and the references, which can end anywhere
+  // in a block, the records after them in that block are carried into the first chunk
+  void BamAlignmentReader::readHeader()
+  {
+    std::string header;
+    std::vector< char > block;
+    std::vector< char > inflated(BgzfFile::s_max_block_size);
+    // the size of the header once header holds all of it, 0 until then
+    auto getHeaderSize = [&header]() -> size_t
+      {
+	size_t offset = 8;
+	int32_t length;
+	if (header.size() < offset)
+	  {
+	    return 0;
+	  }
+	memcpy(&length, header.data() + 4, 4);
+	offset += length;
+	if (length < 0 || header.size() < offset + 4)
+	  {
+	    return 0;
+	  }
+	int32_t referenceCount;
+	memcpy(&referenceCount, header.data() + offset, 4);
+	offset += 4;
+	for (int32_t i = 0; i < referenceCount; ++i)
+	  {
+	    if (header.size() < offset + 4)
+	      {
+		return 0;
+	      }
+	    memcpy(&length, header.data() + offset, 4);
+	    offset += 4 + (size_t)std::max< int32_t >(length, 0) + 4;
+	    if (header.size() < offset)
+	      {
+		return 0;
+	      }
+	  }
+	return offset;
+      };
+    size_t headerSize = 0;
+    while (headerSize == 0)
+      {
+	uint32_t blockSize = readBlock(this->m_next_compressed_offset, block);
+	if (blockSize == 0)
+	  {
+	    throw std::runtime_error(this->m_bam_path + " ends inside its BAM header");
+	  }
+	uint32_t inflatedSize = BgzfFile::inflateBlock((const uint8_t*)block.data(), blockSize, inflated.data(), inflated.size());
+	header.append(inflated.data(), inflatedSize);
+	this->m_next_compressed_offset += blockSize;
+	if (header.size() >= 4 && memcmp(header.data(), "BAM\1", 4) != 0)
+	  {
+	    throw std::runtime_error(this->m_bam_path + " is not a BAM file");
+	  }
+	headerSize = getHeaderSize();
+      }
+
+    int32_t textLength;
+    memcpy(&textLength, header.data() + 4, 4);
+    parseHeaderText(header.substr(8, textLength));
+    int32_t referenceCount;
+    memcpy(&referenceCount, header.data() + 8 + textLength, 4);
+    size_t offset = 12 + textLength;
+    for (int32_t i = 0; i < referenceCount; ++i)
+      {
+	int32_t nameLength;
+	memcpy(&nameLength, header.data() + offset, 4);
+	// the name's length counts its NUL
+	this->m_reference_names.emplace_back(header.data() + offset + 4, (nameLength > 0) ? nameLength - 1 : 0);
+	offset += 4 + std::max< int32_t >(nameLength, 0) + 4;
+      }
+    this->m_carry = header.substr(headerSize);
+  }
+
+  void BamAlignmentReader::parseHeaderText(const std::string& headerText)
+  {
+    std::istringstream headerStream(headerText);
+    std::string line;
+    while (std::getline(headerStream, line))
+      {
+	if (line.compare(0, 4, "@RG\t") != 0)
+	  {
+	    continue;
+	  }
+	std::string readGroup;
+	std::string sampleName;
+	std::istringstream lineStream(line);
+	std::string field;
+	while (std::getline(lineStream, field, '\t'))
+	  {
+	    if (field.compare(0, 3, "ID:") == 0)
+	      {
+		readGroup = field.substr(3);
+	      }
+	    else if (field.compare(0, 3, "SM:") == 0)
+	      {
+		sampleName = field.substr(3);
+	      }
+	  }
+	if (!readGroup.empty())
+	  {
+	    this->m_read_group_sample_ptrs[readGroup] = std::make_shared< Sample >(sampleName.empty() ? readGroup : sampleName, readGroup, this->m_bam_path);
+	  }
+      }
+    if (this->m_read_group_sample_ptrs.empty())
+      {
+	this->m_default_sample_ptr = std::make_shared< Sample >(this->m_bam_path, "", this->m_bam_path);
+      }
+    else if (this->m_read_group_sample_ptrs.size() == 1)
+      {
+	this->m_default_sample_ptr = this->m_read_group_sample_ptrs.begin()->second;
+      }
+  }
+
+  // where the last whole record of data ends, each is its block_size and that many bytes
+  size_t BamAlignmentReader::getRecordsEnd(const char* data, size_t size)
+  {
+    size_t offset = 0;
+    while (size - offset >= 4)
+      {
+	uint32_t blockSize;
+	memcpy(&blockSize, data + offset, 4);
+	if (size - offset - 4 < blockSize)
+	  {
+	    break;
+	  }
+	offset += 4 + (size_t)blockSize;
+      }
+    return offset;
+  }
+
+  void BamAlignmentReader::inflateChunk(Chunk* chunkPtr)
+  {
+    // the footers' ISIZEs size the buffer, then every block inflates straight into it
+    const uint8_t* compressed = (const uint8_t*)chunkPtr->compressed.data();
+    size_t inflatedSize = 0;
+    for (size_t offset = 0; offset < chunkPtr->compressed.size(); offset += BgzfFile::getBlockSize(compressed + offset))
+      {
+	const uint8_t* footer = compressed + offset + BgzfFile::getBlockSize(compressed + offset) - 4;
+	inflatedSize += footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((uint32_t)footer[3] << 24);
+      }
+    chunkPtr->buffer.resize(inflatedSize);
+    size_t bufferOffset = 0;
+    for (size_t offset = 0; offset < chunkPtr->compressed.size(); )
+      {
+	uint32_t blockSize = BgzfFile::getBlockSize(compressed + offset);
+	try
+	  {
+	    bufferOffset += BgzfFile::inflateBlock(compressed + offset, blockSize, chunkPtr->buffer.data() + bufferOffset, inflatedSize - bufferOffset);
+	  }
+	catch (const std::runtime_error& e)
+	  {
+	    throw std::runtime_error(this->m_bam_path + ": " + e.what());
+	  }
+	offset += blockSize;
+      }
+    chunkPtr->buffer.resize(bufferOffset);
+    chunkPtr->is_inflated.store(true, std::memory_order_release);
+  }
+
+  // finds the chunk's whole records, on the caller's thread in file order
+  // since where they start depends on the chunks before, then queues the decode
+  void BamAlignmentReader::splitChunk(const std::shared_ptr< Chunk >& chunkPtr)
+  {
+    const char* buffer = chunkPtr->buffer.data();
+    size_t bufferSize = chunkPtr->buffer.size();
+    size_t bufferOffset = 0;
+    std::string& head = chunkPtr->head;
+    head = std::move(this->m_carry);
+    this->m_carry.clear();
+    size_t headEnd = getRecordsEnd(head.data(), head.size());
+    if (headEnd < head.size())
+      {
+	// finish the record head ends inside of, its length may be cut too
+	size_t partialSize = head.size() - headEnd;
+	if (partialSize < 4)
+	  {
+	    size_t takeSize = std::min(4 - partialSize, bufferSize);
+	    head.append(buffer, takeSize);
+	    bufferOffset += takeSize;
+	    partialSize += takeSize;
+	  }
+	if (partialSize >= 4)
+	  {
+	    uint32_t blockSize;
+	    memcpy(&blockSize, head.data() + headEnd, 4);
+	    size_t takeSize = std::min(4 + (size_t)blockSize - partialSize, bufferSize - bufferOffset);
+	    head.append(buffer + bufferOffset, takeSize);
+	    bufferOffset += takeSize;
+	    if (partialSize + takeSize == 4 + (size_t)blockSize)
+	      {
+		headEnd = head.size();
+	      }
+	  }
+      }
+    if (headEnd < head.size())
+      {
+	// the record runs on past this chunk too
+	this->m_carry.assign(head, headEnd, std::string::npos);
+	head.resize(headEnd);
+	chunkPtr->first_record_offset = chunkPtr->records_end = bufferSize;
+      }
+    else
+      {
+	chunkPtr->first_record_offset = bufferOffset;
+	chunkPtr->records_end = bufferOffset + getRecordsEnd(buffer + bufferOffset, bufferSize - bufferOffset);
+	this->m_carry.assign(buffer + chunkPtr->records_end, bufferSize - chunkPtr->records_end);
+      }
+    chunkPtr->is_split = true;
+    try
+      {
+	// the destructor claims decode_flag before the reader goes, a late task finds it taken
+	ThreadPool::Instance()->enqueue([this, chunkPtr]()
+					{
+					  std::call_once(chunkPtr->decode_flag, [this, &chunkPtr]() { decodeChunk(chunkPtr.get()); });
+					});
+      }
+    catch (const std::runtime_error&)
+      {
+	// the pool is stopped, getNextAlignment decodes the chunk itself
+      }
+  }
+
+  void BamAlignmentReader::decodeRecords(const char* data, size_t size, std::vector< IAlignment::SharedPtr >& alignmentPtrs)
+  {
+    for (size_t offset = 0; offset < size; )
+      {
+	uint32_t blockSize;
+	memcpy(&blockSize, data + offset, 4);
+	auto alignmentPtr = std::make_shared< BamAlignment >();
+	try
+	  {
+	    alignmentPtr->setRecord(data + offset + 4, blockSize);
+	  }
+	catch (const std::runtime_error& e)
+	  {
+	    throw std::runtime_error(this->m_bam_path + ": " + e.what());
+	  }
+	offset += 4 + (size_t)blockSize;
+	if (!alignmentPtr->isMapped())
+	  {
+	    continue;
+	  }
+	int32_t referenceIdx = alignmentPtr->getReferenceIndex();
+	if (referenceIdx >= 0 && (size_t)referenceIdx < this->m_reference_names.size())
+	  {
+	    alignmentPtr->setReferenceID(this->m_reference_names[referenceIdx]);
+	  }
+	auto sampleIter = this->m_read_group_sample_ptrs.find(alignmentPtr->getReadGroup());
+	alignmentPtr->setSample((sampleIter != this->m_read_group_sample_ptrs.end()) ? sampleIter->second : this->m_default_sample_ptr);
+	alignmentPtrs.emplace_back(alignmentPtr);
+      }
+  }
+
+  void BamAlignmentReader::decodeChunk(Chunk* chunkPtr)
+  {
+    chunkPtr->alignment_ptrs.clear(); // from an attempt that threw
+    decodeRecords(chunkPtr->head.data(), chunkPtr->head.size(), chunkPtr->alignment_ptrs);
+    decodeRecords(chunkPtr->buffer.data() + chunkPtr->first_record_offset, chunkPtr->records_end - chunkPtr->first_record_offset, chunkPtr->alignment_ptrs);
+  }
+
+  // keeps m_max_chunk_count chunks queued ahead and splits the ones inflated so far
+  void BamAlignmentReader::scheduleChunks()
+  {
+    while (this->m_chunk_ptrs.size() < this->m_max_chunk_count && this->m_next_compressed_offset < this->m_file_size)
+      {
+	auto chunkPtr = std::make_shared< Chunk >();
+	if (!this->m_free_buffers.empty())
+	  {
+	    chunkPtr->compressed = std::move(this->m_free_buffers.back());
+	    this->m_free_buffers.pop_back();
+	  }
+	if (!this->m_free_buffers.empty())
+	  {
+	    chunkPtr->buffer = std::move(this->m_free_buffers.back());
+	    this->m_free_buffers.pop_back();
+	  }
+	// the blocks that fit whole, the next chunk reads the one cut off again
+	size_t readSize = std::min< uint64_t >(s_chunk_size, this->m_file_size - this->m_next_compressed_offset);
+	chunkPtr->compressed.resize(readSize);
+	if (pread(this->m_fd, chunkPtr->compressed.data(), readSize, this->m_next_compressed_offset) != (ssize_t)readSize)
+	  {
+	    throw std::runtime_error("BamAlignmentReader could not read " + this->m_bam_path);
+	  }
+	const uint8_t* compressed = (const uint8_t*)chunkPtr->compressed.data();
+	size_t blocksSize = 0;
+	while (readSize - blocksSize >= BgzfFile::s_header_size)
+	  {
+	    uint32_t blockSize = BgzfFile::getBlockSize(compressed + blocksSize);
+	    if (blockSize == 0)
+	      {
+		throw std::runtime_error(this->m_bam_path + " has no BGZF block at byte " + std::to_string(this->m_next_compressed_offset + blocksSize));
+	      }
+	    if (blockSize > readSize - blocksSize)
+	      {
+		break;
+	      }
+	    blocksSize += blockSize;
+	  }
+	if (blocksSize == 0)
+	  {
+	    throw std::runtime_error(this->m_bam_path + " ends inside a BGZF block");
+	  }
+	chunkPtr->compressed.resize(blocksSize);
+	this->m_next_compressed_offset += blocksSize;
+	this->m_chunk_ptrs.emplace_back(chunkPtr);
+	try
+	  {
+	    ThreadPool::Instance()->enqueue([this, chunkPtr]()
+					    {
+					      std::call_once(chunkPtr->inflate_flag, [this, &chunkPtr]() { inflateChunk(chunkPtr.get()); });
+					    });
+	  }
+	catch (const std::runtime_error&)
+	  {
+	    // the pool is stopped, getNextAlignment inflates the chunk itself
+	  }
+      }
+    for (auto& chunkPtr : this->m_chunk_ptrs)
+      {
+	if (chunkPtr->is_split)
+	  {
+	    continue;
+	  }
+	if (!chunkPtr->is_inflated.load(std::memory_order_acquire))
+	  {
+	    break;
+	  }
+	splitChunk(chunkPtr);
+      }
+  }
+
+  bool BamAlignmentReader::getNextAlignment(IAlignment::SharedPtr& alignmentPtr)
+  {
+    while (this->m_current_chunk_ptr == nullptr || this->m_current_alignment_idx >= this->m_current_chunk_ptr->alignment_ptrs.size())
+      {
+	if (this->m_current_chunk_ptr != nullptr)
+	  {
+	    this->m_current_chunk_ptr->alignment_ptrs.clear();
+	    this->m_free_buffers.emplace_back(std::move(this->m_current_chunk_ptr->compressed));
+	    this->m_free_buffers.emplace_back(std::move(this->m_current_chunk_ptr->buffer));
+	    this->m_current_chunk_ptr = nullptr;
+	  }
+	scheduleChunks();
+	if (this->m_chunk_ptrs.empty())
+	  {
+	    if (!this->m_carry.empty())
+	      {
+		throw std::runtime_error(this->m_bam_path + " ends inside a record");
+	      }
+	    return false;
+	  }
+	auto chunkPtr = this->m_chunk_ptrs.front();
+	// waits if a worker is on it, does it here if none has started
+	std::call_once(chunkPtr->inflate_flag, [this, &chunkPtr]() { inflateChunk(chunkPtr.get()); });
+	if (!chunkPtr->is_split)
+	  {
+	    splitChunk(chunkPtr);
+	  }
+	std::call_once(chunkPtr->decode_flag, [this, &chunkPtr]() { decodeChunk(chunkPtr.get()); });
+	this->m_chunk_ptrs.pop_front();
+	this->m_current_chunk_ptr = chunkPtr;
+	this->m_current_alignment_idx = 0;
+	scheduleChunks();
+      }
+    alignmentPtr = std::move(this->m_current_chunk_ptr->alignment_ptrs[this->m_current_alignment_idx++]);
+    return true;
+  }
@@ -0,0 +1,92 @@
+#ifndef BAMALIGNMENTREADER_H
+#define BAMALIGNMENTREADER_H
+
+#include "BamAlignment.h"
+#include "IAlignmentReader.h"
+#include "Sample.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * Reads the mapped records of a BAM in file order on the ThreadPool. The
+   * compressed file is cut into chunks of whole BGZF blocks, about
+   * s_chunk_size each, and a task per chunk inflates its blocks into one
+   * buffer, a few chunks ahead of the caller. Records run across blocks and
+   * chunks, so once a chunk is inflated the caller's thread hops over its
+   * record lengths, which is all it reads, and carries a record the chunk
+   * ends inside of into the next one. A second task then decodes the
+   * chunk's records into BamAlignments. The caller waits for a chunk (or
+   * inflates and decodes it right there when no worker has got to it) only
+   * once the one before runs out.
+   *
+   * An alignment's sample is the one its RG tag's @RG line names, or with
+   * no @RG lines in the header one named after the file. There's no .bai
+   * support, the whole file is read.
+   */
+  class BamAlignmentReader : public IAlignmentReader
+  {
+  public:
+    typedef std::shared_ptr< BamAlignmentReader > SharedPtr;
+
+    // throws std::runtime_error if the file can't be read or isn't a BAM
+    BamAlignmentReader(const std::string& bamPath);
+    ~BamAlignmentReader();
+
+    // throws std::runtime_error for a corrupt block or malformed record
+    bool getNextAlignment(IAlignment::SharedPtr& alignmentPtr) override;
+
+    // the header's references, a BamAlignment's getReferenceIndex indexes them
+    const std::vector< std::string >& getReferenceNames() { return this->m_reference_names; }
+
+  private:
+    struct Chunk
+    {
+      std::once_flag inflate_flag;
+      std::once_flag decode_flag;
+      std::atomic< bool > is_inflated;
+      bool is_split; // set by splitChunk, the caller's thread only
+      std::vector< char > compressed; // whole blocks
+      std::vector< char > buffer; // the blocks inflated
+      std::string head; // the whole records carried from the chunks before, decoded ahead of buffer's
+      size_t first_record_offset; // into buffer, past the bytes head took
+      size_t records_end; // into buffer, where the record this chunk ends inside of starts
+      std::vector< IAlignment::SharedPtr > alignment_ptrs; // set once by decode_flag
+
+      Chunk() : is_inflated(false), is_split(false), first_record_offset(0), records_end(0) {}
+    };
+
+    static const size_t s_chunk_size = 1024 * 1024; // compressed
+
+    static size_t getRecordsEnd(const char* data, size_t size);
+    void readHeader();
+    void parseHeaderText(const std::string& headerText);
+    uint32_t readBlock(uint64_t compressedOffset, std::vector< char >& block);
+    void inflateChunk(Chunk* chunkPtr);
+    void splitChunk(const std::shared_ptr< Chunk >& chunkPtr);
+    void decodeRecords(const char* data, size_t size, std::vector< IAlignment::SharedPtr >& alignmentPtrs);
+    void decodeChunk(Chunk* chunkPtr);
+    void scheduleChunks();
+
+    std::string m_bam_path;
+    int m_fd;
+    uint64_t m_file_size;
+    std::vector< std::string > m_reference_names;
+    std::unordered_map< std::string, Sample::SharedPtr > m_read_group_sample_ptrs;
+    Sample::SharedPtr m_default_sample_ptr; // for reads without a known RG, null if there are @RG lines
+    uint64_t m_next_compressed_offset;
+    std::string m_carry; // the bytes of a record the last split chunk ended inside of
+    size_t m_max_chunk_count; // inflated or decoded ahead of the caller
+    std::deque< std::shared_ptr< Chunk > > m_chunk_ptrs; // in file order
+    std::shared_ptr< Chunk > m_current_chunk_ptr;
+    size_t m_current_alignment_idx;
+    std::vector< std::vector< char > > m_free_buffers;
+  };
+
+#endif
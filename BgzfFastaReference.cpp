@@ -0,0 +1,201 @@
+#include "BgzfFastaReference.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+  BgzfFastaReference::BgzfFastaReference(const std::string& fastaPath, size_t cacheBlockCount) :
+    m_fasta_path(fastaPath),
+    m_bgzf_file_ptr(std::make_shared< BgzfFile >(fastaPath)),
+    m_shard_capacity(std::max< size_t >(1, (cacheBlockCount + s_cache_shard_count - 1) / s_cache_shard_count)),
+    m_cache_hit_count(0),
+    m_cache_miss_count(0)
+  {
+    readIndex(fastaPath + ".fai");
+  }
+
+  BgzfFastaReference::~BgzfFastaReference()
+  {
+  }
+
+  void BgzfFastaReference::readIndex(const std::string& indexPath)
+  {
+    std::ifstream indexStream(indexPath);
+    if (!indexStream.good())
+      {
+	throw std::runtime_error("BgzfFastaReference needs an index, run samtools faidx on " + this->m_fasta_path);
+      }
+    std::string line;
+    while (std::getline(indexStream, line))
+      {
+	if (line.empty())
+	  {
+	    continue;
+	  }
+	std::istringstream lineStream(line);
+	std::unique_ptr< Contig > contigPtr(new Contig());
+	if (!std::getline(lineStream, contigPtr->name, '\t') ||
+	    !(lineStream >> contigPtr->length >> contigPtr->offset >> contigPtr->line_bases >> contigPtr->line_width) ||
+	    (contigPtr->length > 0 && (contigPtr->line_bases == 0 || contigPtr->line_width < contigPtr->line_bases)))
+	  {
+	    throw std::runtime_error("BgzfFastaReference malformed index line in " + indexPath + ": " + line);
+	  }
+	this->m_contigs_by_name.emplace(contigPtr->name, contigPtr.get());
+	this->m_contigs.emplace_back(std::move(contigPtr));
+      }
+  }
+
+  BgzfFastaReference::BlockPtr BgzfFastaReference::getBlock(size_t blockIdx)
+  {
+    CacheShard& shard = this->m_cache_shards[blockIdx % s_cache_shard_count];
+    {
+      std::lock_guard< std::mutex > lock(shard.mutex);
+      auto iter = shard.block_iters.find(blockIdx);
+      if (iter != shard.block_iters.end())
+	{
+	  shard.blocks.splice(shard.blocks.begin(), shard.blocks, iter->second);
+	  ++this->m_cache_hit_count;
+	  return iter->second->second;
+	}
+    }
+    ++this->m_cache_miss_count;
+    // inflate outside the lock so the rest of the shard stays readable,
+    // two threads missing the same block at once both inflate it
+    BlockPtr blockPtr = inflateBlock(blockIdx);
+    std::lock_guard< std::mutex > lock(shard.mutex);
+    auto iter = shard.block_iters.find(blockIdx);
+    if (iter != shard.block_iters.end())
+      {
+	return iter->second->second;
+      }
+    shard.blocks.emplace_front(blockIdx, blockPtr);
+    shard.block_iters.emplace(blockIdx, shard.blocks.begin());
+    while (shard.blocks.size() > this->m_shard_capacity)
+      {
+	shard.block_iters.erase(shard.blocks.back().first);
+	shard.blocks.pop_back();
+      }
+    return blockPtr;
+  }
+
+  BgzfFastaReference::BlockPtr BgzfFastaReference::inflateBlock(size_t blockIdx)
+  {
+    std::string* uncompressed = new std::string();
+    BlockPtr blockPtr(uncompressed);
+    this->m_bgzf_file_ptr->inflateBlock(blockIdx, *uncompressed);
+    return blockPtr;
+  }
+
+  // appends the uncompressed bytes in [startOffset, endOffset) minus line breaks
+  void BgzfFastaReference::appendUncompressed(uint64_t startOffset, uint64_t endOffset, std::string& sequence)
+  {
+    size_t blockIdx = this->m_bgzf_file_ptr->getBlockIndex(startOffset);
+    while (startOffset < endOffset)
+      {
+	if (blockIdx >= this->m_bgzf_file_ptr->getBlockCount())
+	  {
+	    throw std::runtime_error("BgzfFastaReference index points past the end of " + this->m_fasta_path);
+	  }
+	BlockPtr blockPtr = getBlock(blockIdx);
+	uint64_t blockStart = this->m_bgzf_file_ptr->getBlockUncompressedOffset(blockIdx);
+	uint64_t blockEnd = std::min< uint64_t >(blockStart + blockPtr->size(), endOffset);
+	for (const char* cursor = blockPtr->data() + (startOffset - blockStart); startOffset < blockEnd; ++cursor, ++startOffset)
+	  {
+	    if (*cursor != '\n' && *cursor != '\r')
+	      {
+		sequence.push_back(*cursor);
+	      }
+	  }
+	++blockIdx;
+      }
+  }
+
+  BgzfFastaReference::Contig* BgzfFastaReference::getContig(const std::string& contigName)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	throw std::invalid_argument("BgzfFastaReference has no contig " + contigName);
+      }
+    return iter->second;
+  }
+
+  void BgzfFastaReference::getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length)
+  {
+    // same conventions as IReference: one based regions include their end, zero based ones don't
+    length = regionPtr->getEndPosition() - regionPtr->getStartPosition();
+    startPosition = regionPtr->getStartPosition();
+    if (regionPtr->getBased() == Region::BASED::ONE)
+      {
+	startPosition -= 1;
+	length += 1;
+      }
+  }
+
+  std::string BgzfFastaReference::getSequenceFromRegion(Region::SharedPtr regionPtr)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    return getSequence(regionPtr->getReferenceID(), startPosition, length);
+  }
+
+  SequenceView BgzfFastaReference::getSequenceViewFromRegion(Region::SharedPtr regionPtr)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    Contig* contigPtr = getContig(regionPtr->getReferenceID());
+    if (startPosition + (uint64_t)length > contigPtr->length)
+      {
+	throw std::invalid_argument("BgzfFastaReference region " + contigPtr->name + ":" + std::to_string(startPosition) + "+" + std::to_string(length) + " is past the contig's end");
+      }
+    std::call_once(contigPtr->read_flag, [&]() { contigPtr->bases = getSequence(contigPtr->name, 0, contigPtr->length); });
+    return { contigPtr->bases.data() + startPosition, length };
+  }
+
+  std::string BgzfFastaReference::getSequence(const std::string& contigName, position startPosition, size_t length)
+  {
+    Contig* contigPtr = getContig(contigName);
+    if (startPosition + (uint64_t)length > contigPtr->length)
+      {
+	throw std::invalid_argument("BgzfFastaReference region " + contigName + ":" + std::to_string(startPosition) + "+" + std::to_string(length) + " is past the contig's end");
+      }
+    std::string sequence;
+    if (length == 0)
+      {
+	return sequence;
+      }
+    sequence.reserve(length);
+    uint64_t lastPosition = startPosition + length - 1;
+    uint64_t startOffset = contigPtr->offset + (startPosition / contigPtr->line_bases) * contigPtr->line_width + (startPosition % contigPtr->line_bases);
+    uint64_t endOffset = contigPtr->offset + (lastPosition / contigPtr->line_bases) * contigPtr->line_width + (lastPosition % contigPtr->line_bases) + 1;
+    appendUncompressed(startOffset, endOffset, sequence);
+    if (sequence.size() != length)
+      {
+	throw std::runtime_error("BgzfFastaReference index for " + contigName + " doesn't match " + this->m_fasta_path);
+      }
+    return sequence;
+  }
+
+  std::vector< std::string > BgzfFastaReference::getContigNames()
+  {
+    std::vector< std::string > contigNames;
+    for (auto& contigPtr : this->m_contigs)
+      {
+	contigNames.emplace_back(contigPtr->name);
+      }
+    return contigNames;
+  }
+
+  bool BgzfFastaReference::getContigLength(const std::string& contigName, uint64_t& length)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	return false;
+      }
+    length = iter->second->length;
+    return true;
+  }
@@ -0,0 +1,95 @@
+#ifndef BGZFFASTAREFERENCE_H
+#define BGZFFASTAREFERENCE_H
+
+#include "BgzfFile.h"
+#include "IReference.h"
+#include "Region.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * An IReference over a bgzip compressed FASTA (.fa.gz). Needs the .fai
+   * samtools faidx writes for it, which gives offsets into the uncompressed
+   * text, and BgzfFile to find the BGZF blocks holding a region.
+   *
+   * Only the blocks a region overlaps are inflated. Inflated blocks go into
+   * an LRU cache shared by every thread, split into shards by block so
+   * threads reading different parts of the genome rarely share a lock.
+   * Graphs next to each other mostly need the same blocks and find them
+   * already inflated.
+   *
+   * Bases live in the cache and can be evicted at any time, so the first
+   * view into a contig reads the whole contig into a copy that stays until
+   * the reference goes. Use getSequenceFromRegion where a copy of the region
+   * will do.
+   */
+  class BgzfFastaReference : public IReference
+  {
+  public:
+    typedef std::shared_ptr< BgzfFastaReference > SharedPtr;
+
+    // throws std::runtime_error if the file or its .fai can't be read or the file isn't BGZF
+    BgzfFastaReference(const std::string& fastaPath, size_t cacheBlockCount = 1024);
+    ~BgzfFastaReference();
+
+    // throw std::invalid_argument for an unknown contig or a region past its end,
+    // std::runtime_error when a block is corrupt
+    std::string getSequenceFromRegion(Region::SharedPtr regionPtr) override;
+    SequenceView getSequenceViewFromRegion(Region::SharedPtr regionPtr) override;
+    std::string getSequence(const std::string& contigName, position startPosition, size_t length); // zero based start
+
+    std::vector< std::string > getContigNames();
+    bool getContigLength(const std::string& contigName, uint64_t& length);
+    uint64_t getCacheHitCount() { return this->m_cache_hit_count.load(); }
+    uint64_t getCacheMissCount() { return this->m_cache_miss_count.load(); }
+
+  private:
+    typedef std::shared_ptr< const std::string > BlockPtr;
+
+    // one .fai line: name, length, offset of the first base, bases and bytes per line
+    struct Contig
+    {
+      std::string name;
+      uint64_t length;
+      uint64_t offset; // into the uncompressed text
+      uint64_t line_bases;
+      uint64_t line_width;
+      std::once_flag read_flag;
+      std::string bases; // set once by read_flag, what views point into
+    };
+
+    // an LRU of inflated blocks, the front is the most recently used
+    struct CacheShard
+    {
+      std::mutex mutex;
+      std::list< std::pair< uint64_t, BlockPtr > > blocks;
+      std::unordered_map< uint64_t, std::list< std::pair< uint64_t, BlockPtr > >::iterator > block_iters;
+    };
+
+    static const size_t s_cache_shard_count = 16;
+
+    void readIndex(const std::string& indexPath);
+    Contig* getContig(const std::string& contigName);
+    static void getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length);
+    BlockPtr getBlock(size_t blockIdx);
+    BlockPtr inflateBlock(size_t blockIdx);
+    void appendUncompressed(uint64_t startOffset, uint64_t endOffset, std::string& sequence);
+
+    std::string m_fasta_path;
+    BgzfFile::SharedPtr m_bgzf_file_ptr;
+    std::vector< std::unique_ptr< Contig > > m_contigs;
+    std::unordered_map< std::string, Contig* > m_contigs_by_name;
+    size_t m_shard_capacity;
+    CacheShard m_cache_shards[s_cache_shard_count];
+    std::atomic< uint64_t > m_cache_hit_count;
+    std::atomic< uint64_t > m_cache_miss_count;
+  };
+
+#endif
@@ -0,0 +1,332 @@
+#include "BgzfFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+  BgzfFile::BgzfFile(const std::string& path) :
+    m_path(path),
+    m_fd(-1),
+    m_file_size(0),
+    m_uncompressed_size(0)
+  {
+    this->m_fd = open(path.c_str(), O_RDONLY);
+    if (this->m_fd < 0)
+      {
+	throw std::runtime_error("BgzfFile could not open " + path);
+      }
+    try
+      {
+	struct stat fileStat;
+	if (fstat(this->m_fd, &fileStat) != 0)
+	  {
+	    throw std::runtime_error("BgzfFile could not read " + path);
+	  }
+	this->m_file_size = fileStat.st_size;
+	readBlockSize(0); // throws if the file doesn't start with a BGZF block
+	std::ifstream gziStream(path + ".gzi");
+	if (gziStream.good())
+	  {
+	    gziStream.close();
+	    readGzi(path + ".gzi");
+	  }
+	else
+	  {
+	    scanBlockOffsets();
+	  }
+      }
+    catch (...)
+      {
+	close(this->m_fd);
+	throw;
+      }
+  }
+
+  BgzfFile::~BgzfFile()
+  {
+    close(this->m_fd);
+  }
+
+  bool BgzfFile::isBgzf(const std::string& path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      {
+	return false;
+      }
+    uint8_t header[s_header_size];
+    bool isBgzf = pread(fd, header, s_header_size, 0) == (ssize_t)s_header_size && getBlockSize(header) != 0;
+    close(fd);
+    return isBgzf;
+  }
+
+  uint32_t BgzfFile::getBlockSize(const uint8_t* header)
+  {
+    // a gzip member with FEXTRA whose only subfield is BC holding BSIZE
+    if (header[0] != 31 || header[1] != 139 || header[2] != 8 || (header[3] & 4) == 0 ||
+	header[10] != 6 || header[11] != 0 || header[12] != 'B' || header[13] != 'C' || header[14] != 2 || header[15] != 0)
+      {
+	return 0;
+      }
+    uint32_t blockSize = (header[16] | (header[17] << 8)) + 1;
+    return (blockSize < s_header_size + s_footer_size) ? 0 : blockSize;
+  }
+
+  uint32_t BgzfFile::inflateBlock(const uint8_t* block, uint32_t blockSize, char* out, size_t outCapacity)
+  {
+    if (blockSize < s_header_size + s_footer_size || getBlockSize(block) != blockSize)
+      {
+	throw std::runtime_error("malformed BGZF block");
+      }
+    const uint8_t* footer = block + blockSize - s_footer_size;
+    uint32_t expectedCrc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((uint32_t)footer[3] << 24);
+    uint32_t uncompressedSize = footer[4] | (footer[5] << 8) | (footer[6] << 16) | ((uint32_t)footer[7] << 24);
+    if (uncompressedSize > s_max_block_size)
+      {
+	throw std::runtime_error("corrupt BGZF block");
+      }
+    if (uncompressedSize > outCapacity)
+      {
+	throw std::runtime_error("BGZF block inflates past the " + std::to_string(outCapacity) + " bytes given to it");
+      }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK) // raw deflate, the gzip framing was parsed above
+      {
+	throw std::runtime_error("could not initialize zlib");
+      }
+    stream.next_in = (Bytef*)block + s_header_size;
+    stream.avail_in = blockSize - s_header_size - s_footer_size;
+    stream.next_out = (Bytef*)out;
+    stream.avail_out = uncompressedSize;
+    int status = inflate(&stream, Z_FINISH);
+    uint64_t inflatedSize = stream.total_out;
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END || inflatedSize != uncompressedSize ||
+	crc32(crc32(0L, Z_NULL, 0), (const Bytef*)out, uncompressedSize) != expectedCrc)
+      {
+	throw std::runtime_error("corrupt BGZF block");
+      }
+    return uncompressedSize;
+  }
+
+  // bgzip's layout: a little endian block count then a compressed and
+  // uncompressed offset for every block but the first
+  void BgzfFile::readGzi(const std::string& gziPath)
+  {
+    std::ifstream gziStream(gziPath, std::ios::binary);
+    uint8_t bytes[16];
+    auto readLittleEndian = [&bytes](size_t idx)
+      {
+	uint64_t value = 0;
+	for (size_t i = 0; i < 8; ++i)
+	  {
+	    value |= (uint64_t)bytes[idx + i] << (8 * i);
+	  }
+	return value;
+      };
+    if (!gziStream.read((char*)bytes, 8))
+      {
+	throw std::runtime_error("BgzfFile malformed block index " + gziPath);
+      }
+    uint64_t blockCount = readLittleEndian(0);
+    this->m_block_offsets.reserve(blockCount + 1);
+    this->m_block_offsets.push_back({0, 0});
+    for (uint64_t i = 0; i < blockCount; ++i)
+      {
+	if (!gziStream.read((char*)bytes, 16))
+	  {
+	    throw std::runtime_error("BgzfFile malformed block index " + gziPath);
+	  }
+	BlockOffset blockOffset = {readLittleEndian(0), readLittleEndian(8)};
+	if (blockOffset.compressed_offset >= this->m_file_size || blockOffset.compressed_offset <= this->m_block_offsets.back().compressed_offset ||
+	    blockOffset.uncompressed_offset < this->m_block_offsets.back().uncompressed_offset)
+	  {
+	    throw std::runtime_error("BgzfFile block index " + gziPath + " doesn't fit " + this->m_path);
+	  }
+	this->m_block_offsets.push_back(blockOffset);
+      }
+    const BlockOffset& lastBlockOffset = this->m_block_offsets.back();
+    this->m_uncompressed_size = lastBlockOffset.uncompressed_offset + readUncompressedSize(lastBlockOffset.compressed_offset, readBlockSize(lastBlockOffset.compressed_offset));
+  }
+
+  // without a .gzi, hop from block header to block header, the sizes in the
+  // headers and footers are all that's needed
+  void BgzfFile::scanBlockOffsets()
+  {
+    uint64_t compressedOffset = 0;
+    uint64_t uncompressedOffset = 0;
+    while (compressedOffset < this->m_file_size)
+      {
+	uint32_t blockSize = readBlockSize(compressedOffset);
+	this->m_block_offsets.push_back({compressedOffset, uncompressedOffset});
+	uncompressedOffset += readUncompressedSize(compressedOffset, blockSize);
+	compressedOffset += blockSize;
+      }
+    this->m_uncompressed_size = uncompressedOffset;
+  }
+
+  uint32_t BgzfFile::readBlockSize(uint64_t compressedOffset)
+  {
+    uint8_t header[s_header_size];
+    uint32_t blockSize = 0;
+    if (pread(this->m_fd, header, s_header_size, compressedOffset) != (ssize_t)s_header_size || (blockSize = getBlockSize(header)) == 0)
+      {
+	throw std::runtime_error("BgzfFile " + this->m_path + " is not BGZF compressed at offset " + std::to_string(compressedOffset));
+      }
+    if (compressedOffset + blockSize > this->m_file_size)
+      {
+	throw std::runtime_error("BgzfFile truncated block in " + this->m_path);
+      }
+    return blockSize;
+  }
+
+  uint32_t BgzfFile::readUncompressedSize(uint64_t compressedOffset, uint32_t blockSize)
+  {
+    uint8_t isize[4];
+    if (pread(this->m_fd, isize, 4, compressedOffset + blockSize - 4) != 4)
+      {
+	throw std::runtime_error("BgzfFile truncated block in " + this->m_path);
+      }
+    uint32_t uncompressedSize = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+    if (uncompressedSize > s_max_block_size)
+      {
+	throw std::runtime_error("BgzfFile corrupt block in " + this->m_path + " at offset " + std::to_string(compressedOffset));
+      }
+    return uncompressedSize;
+  }
+
+  uint64_t BgzfFile::getBlockEnd(size_t blockIdx)
+  {
+    return (blockIdx + 1 < this->m_block_offsets.size()) ? this->m_block_offsets[blockIdx + 1].uncompressed_offset : this->m_uncompressed_size;
+  }
+
+  size_t BgzfFile::getBlockIndex(uint64_t uncompressedOffset)
+  {
+    if (uncompressedOffset >= this->m_uncompressed_size)
+      {
+	return this->m_block_offsets.size();
+      }
+    // the last of the blocks starting at or before the offset, so never an empty one
+    auto blockIter = std::upper_bound(this->m_block_offsets.begin(), this->m_block_offsets.end(), uncompressedOffset,
+				      [](uint64_t offset, const BlockOffset& blockOffset) { return offset < blockOffset.uncompressed_offset; });
+    return (blockIter - this->m_block_offsets.begin()) - 1;
+  }
+
+  uint64_t BgzfFile::getUncompressedOffset(uint64_t virtualOffset)
+  {
+    uint64_t compressedOffset = virtualOffset >> 16;
+    uint64_t blockOffset = virtualOffset & 0xffff;
+    auto blockIter = std::lower_bound(this->m_block_offsets.begin(), this->m_block_offsets.end(), compressedOffset,
+				      [](const BlockOffset& blockOffset, uint64_t offset) { return blockOffset.compressed_offset < offset; });
+    if (blockIter == this->m_block_offsets.end() && blockOffset == 0)
+      {
+	return this->m_uncompressed_size; // the end of the file, or an end of file marker a .gzi left out
+      }
+    size_t blockIdx = blockIter - this->m_block_offsets.begin();
+    if (blockIter == this->m_block_offsets.end() || blockIter->compressed_offset != compressedOffset ||
+	blockIter->uncompressed_offset + blockOffset > getBlockEnd(blockIdx))
+      {
+	throw std::runtime_error("BgzfFile " + this->m_path + " has no block for virtual offset " + std::to_string(virtualOffset));
+      }
+    return blockIter->uncompressed_offset + blockOffset;
+  }
+
+  void BgzfFile::inflateBlock(size_t blockIdx, std::string& uncompressed)
+  {
+    uint64_t compressedOffset = this->m_block_offsets[blockIdx].compressed_offset;
+    uint32_t blockSize = readBlockSize(compressedOffset);
+    std::unique_ptr< uint8_t[] > compressed(new uint8_t[blockSize]);
+    if (pread(this->m_fd, compressed.get(), blockSize, compressedOffset) != (ssize_t)blockSize)
+      {
+	throw std::runtime_error("BgzfFile truncated block in " + this->m_path);
+      }
+    uncompressed.resize(getBlockEnd(blockIdx) - this->m_block_offsets[blockIdx].uncompressed_offset);
+    try
+      {
+	if (inflateBlock(compressed.get(), blockSize, &uncompressed[0], uncompressed.size()) != uncompressed.size())
+	  {
+	    throw std::runtime_error("BGZF block doesn't match the block index");
+	  }
+      }
+    catch (const std::runtime_error& e)
+      {
+	throw std::runtime_error("BgzfFile " + this->m_path + " at offset " + std::to_string(compressedOffset) + ": " + e.what());
+      }
+  }
+
+  size_t BgzfFile::read(uint64_t offset, char* buffer, size_t size)
+  {
+    if (offset >= this->m_uncompressed_size || size == 0)
+      {
+	return 0;
+      }
+    size = std::min< uint64_t >(size, this->m_uncompressed_size - offset);
+    size_t firstBlockIdx = getBlockIndex(offset);
+    size_t lastBlockIdx = getBlockIndex(offset + size - 1);
+    // the blocks are next to each other in the file, read them all at once
+    uint64_t compressedStart = this->m_block_offsets[firstBlockIdx].compressed_offset;
+    uint64_t compressedEnd = (lastBlockIdx + 1 < this->m_block_offsets.size()) ? this->m_block_offsets[lastBlockIdx + 1].compressed_offset : this->m_file_size;
+    std::vector< uint8_t > compressed(compressedEnd - compressedStart);
+    if (pread(this->m_fd, compressed.data(), compressed.size(), compressedStart) != (ssize_t)compressed.size())
+      {
+	throw std::runtime_error("BgzfFile could not read " + this->m_path);
+      }
+
+    std::unique_ptr< char[] > partialBlock;
+    size_t readSize = 0;
+    for (size_t blockIdx = firstBlockIdx; blockIdx <= lastBlockIdx; ++blockIdx)
+      {
+	uint64_t blockStart = this->m_block_offsets[blockIdx].uncompressed_offset;
+	uint64_t blockLength = getBlockEnd(blockIdx) - blockStart;
+	if (blockLength == 0)
+	  {
+	    continue;
+	  }
+	uint64_t compressedOffset = this->m_block_offsets[blockIdx].compressed_offset;
+	const uint8_t* block = compressed.data() + (compressedOffset - compressedStart);
+	size_t available = compressed.size() - (compressedOffset - compressedStart);
+	try
+	  {
+	    uint32_t blockSize = (available >= s_header_size) ? getBlockSize(block) : 0;
+	    if (blockSize == 0 || blockSize > available)
+	      {
+		throw std::runtime_error("malformed BGZF block");
+	      }
+	    uint64_t blockSkip = offset + readSize - blockStart;
+	    if (blockSkip == 0 && blockLength <= size - readSize)
+	      {
+		// the whole block is wanted, inflate it straight into the caller's buffer
+		if (inflateBlock(block, blockSize, buffer + readSize, blockLength) != blockLength)
+		  {
+		    throw std::runtime_error("BGZF block doesn't match the block index");
+		  }
+		readSize += blockLength;
+		continue;
+	      }
+	    if (partialBlock == nullptr)
+	      {
+		partialBlock.reset(new char[s_max_block_size]);
+	      }
+	    if (inflateBlock(block, blockSize, partialBlock.get(), s_max_block_size) != blockLength)
+	      {
+		throw std::runtime_error("BGZF block doesn't match the block index");
+	      }
+	    size_t copySize = std::min< uint64_t >(blockLength - blockSkip, size - readSize);
+	    memcpy(buffer + readSize, partialBlock.get() + blockSkip, copySize);
+	    readSize += copySize;
+	  }
+	catch (const std::runtime_error& e)
+	  {
+	    throw std::runtime_error("BgzfFile " + this->m_path + " at offset " + std::to_string(compressedOffset) + ": " + e.what());
+	  }
+      }
+    return readSize;
+  }
@@ -0,0 +1,85 @@
+#ifndef BGZFFILE_H
+#define BGZFFILE_H
+
+#include "Noncopyable.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * Random access to the uncompressed bytes of a BGZF file (bgzip, BAM,
+   * tabix). The file is a series of gzip members of at most 64 kb
+   * uncompressed each, so knowing where every block starts, compressed and
+   * uncompressed, is enough to read any range by inflating only the blocks
+   * it overlaps. Block starts come from the .gzi bgzip writes next to the
+   * file, or without one from the block headers, which doesn't need
+   * anything inflated.
+   *
+   * Nothing is cached and every read preads and inflates into the caller's
+   * memory, so reads from any number of threads don't share state.
+   */
+  class BgzfFile : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< BgzfFile > SharedPtr;
+
+    static const size_t s_header_size = 18;
+    static const size_t s_footer_size = 8;
+    static const size_t s_max_block_size = 65536; // compressed and uncompressed
+
+    // throws std::runtime_error if the file can't be read or isn't BGZF
+    BgzfFile(const std::string& path);
+    ~BgzfFile();
+
+    // whether the file starts with a BGZF block
+    static bool isBgzf(const std::string& path);
+
+    std::string getPath() { return this->m_path; }
+    uint64_t getUncompressedSize() { return this->m_uncompressed_size; }
+
+    // like pread over the uncompressed bytes, fewer than size only at the end,
+    // throws std::runtime_error for a corrupt block
+    size_t read(uint64_t offset, char* buffer, size_t size);
+
+    // a virtual offset as tabix and BAM indexes store them, the block's
+    // compressed offset << 16 | the offset into the block, as an offset into
+    // the uncompressed bytes. Throws std::runtime_error if no block starts there
+    uint64_t getUncompressedOffset(uint64_t virtualOffset);
+
+    size_t getBlockCount() { return this->m_block_offsets.size(); }
+    // the block holding an uncompressed offset, getBlockCount() past the end
+    size_t getBlockIndex(uint64_t uncompressedOffset);
+    uint64_t getBlockUncompressedOffset(size_t blockIdx) { return this->m_block_offsets[blockIdx].uncompressed_offset; }
+    void inflateBlock(size_t blockIdx, std::string& uncompressed);
+
+    // the size of the block starting at header, which needs s_header_size
+    // bytes, or 0 if it isn't a BGZF block header
+    static uint32_t getBlockSize(const uint8_t* header);
+    // inflates the blockSize bytes of a whole block into out, which holds
+    // outCapacity bytes, and returns how many it inflated to. Throws
+    // std::runtime_error if the block is corrupt or doesn't fit
+    static uint32_t inflateBlock(const uint8_t* block, uint32_t blockSize, char* out, size_t outCapacity);
+
+  private:
+    struct BlockOffset
+    {
+      uint64_t compressed_offset;
+      uint64_t uncompressed_offset;
+    };
+
+    void readGzi(const std::string& gziPath);
+    void scanBlockOffsets();
+    uint32_t readBlockSize(uint64_t compressedOffset); // BSIZE + 1, the whole block's size
+    uint32_t readUncompressedSize(uint64_t compressedOffset, uint32_t blockSize); // the footer's ISIZE
+    uint64_t getBlockEnd(size_t blockIdx); // the uncompressed offset the block ends at
+
+    std::string m_path;
+    int m_fd;
+    uint64_t m_file_size;
+    uint64_t m_uncompressed_size;
+    std::vector< BlockOffset > m_block_offsets; // every block in file order, empty ones included
+  };
+
+#endif
@@ -0,0 +1,310 @@
+#include "BinningIndex.h"
+#include "BgzfFile.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+  const uint64_t BinningIndex::s_no_offset;
+
+  BinningIndex::BinningIndex(uint32_t minShift, uint32_t depth) :
+    m_min_shift(minShift),
+    m_depth(depth),
+    m_virtual_offsets(false)
+  {
+  }
+
+  BinningIndex::~BinningIndex()
+  {
+  }
+
+  void BinningIndex::getRegionBounds(Region::SharedPtr regionPtr, uint64_t& beginPosition, uint64_t& endPosition)
+  {
+    // same conventions as IReference: one based regions include their end, zero based ones don't
+    beginPosition = regionPtr->getStartPosition();
+    endPosition = regionPtr->getEndPosition();
+    if (regionPtr->getBased() == Region::BASED::ONE && beginPosition > 0)
+      {
+	beginPosition -= 1;
+      }
+  }
+
+  uint32_t BinningIndex::getBin(uint64_t beginPosition, uint64_t endPosition, uint32_t minShift, uint32_t depth)
+  {
+    uint64_t lastPosition = (endPosition > beginPosition) ? endPosition - 1 : beginPosition;
+    uint32_t shift = minShift;
+    for (uint32_t level = depth; level > 0; --level, shift += 3)
+      {
+	if ((beginPosition >> shift) == (lastPosition >> shift))
+	  {
+	    // the bins of the levels above come first, 8^l of them on level l
+	    return ((1u << (3 * level)) - 1) / 7 + (uint32_t)(beginPosition >> shift);
+	  }
+      }
+    return 0;
+  }
+
+  void BinningIndex::getOverlappingBins(uint64_t beginPosition, uint64_t endPosition, uint32_t minShift, uint32_t depth, std::vector< uint32_t >& bins)
+  {
+    uint64_t maxPosition = 1ull << (minShift + 3 * depth);
+    endPosition = std::min(endPosition, maxPosition);
+    if (beginPosition >= endPosition)
+      {
+	return;
+      }
+    uint64_t lastPosition = endPosition - 1;
+    for (uint32_t level = 0; level <= depth; ++level)
+      {
+	uint32_t shift = minShift + 3 * (depth - level);
+	uint32_t levelOffset = ((1u << (3 * level)) - 1) / 7;
+	for (uint64_t bin = beginPosition >> shift; bin <= (lastPosition >> shift); ++bin)
+	  {
+	    bins.emplace_back(levelOffset + (uint32_t)bin);
+	  }
+      }
+  }
+
+  BinningIndex::SharedPtr BinningIndex::readIndexFile(const std::string& indexPath)
+  {
+    BgzfFile indexFile(indexPath);
+    std::string data(indexFile.getUncompressedSize(), '\0');
+    if (indexFile.read(0, &data[0], data.size()) != data.size())
+      {
+	throw std::runtime_error("BinningIndex could not read " + indexPath);
+      }
+    size_t cursor = 0;
+    auto readBytes = [&](size_t size)
+      {
+	if (data.size() - cursor < size)
+	  {
+	    throw std::runtime_error("BinningIndex truncated index " + indexPath);
+	  }
+	cursor += size;
+	return data.data() + (cursor - size);
+      };
+    auto readInt = [&](size_t size)
+      {
+	const char* bytes = readBytes(size);
+	uint64_t value = 0;
+	for (size_t i = 0; i < size; ++i)
+	  {
+	    value |= (uint64_t)(uint8_t)bytes[i] << (8 * i);
+	  }
+	return value;
+      };
+
+    std::string magic(readBytes(4), 4);
+    bool isCsi = (magic == std::string("CSI\1", 4));
+    if (!isCsi && magic != std::string("TBI\1", 4))
+      {
+	throw std::runtime_error("BinningIndex " + indexPath + " is neither a tabix nor a CSI index");
+      }
+    uint32_t minShift = 14;
+    uint32_t depth = 5;
+    uint64_t contigCount = 0;
+    std::string names;
+    // tabix's header: the format, the sequence, begin and end columns, the
+    // comment character, lines to skip and then the NUL separated contig names
+    auto readTabixHeader = [&]()
+      {
+	readBytes(6 * 4);
+	uint64_t namesLength = readInt(4);
+	names.assign(readBytes(namesLength), namesLength);
+      };
+    if (isCsi)
+      {
+	minShift = readInt(4);
+	depth = readInt(4);
+	uint64_t auxLength = readInt(4);
+	size_t auxStart = cursor;
+	readBytes(auxLength);
+	if (auxLength >= 7 * 4)
+	  {
+	    cursor = auxStart;
+	    readTabixHeader(); // CSI for VCF keeps tabix's header in its aux data
+	    cursor = auxStart + auxLength;
+	  }
+	contigCount = readInt(4);
+      }
+    else
+      {
+	contigCount = readInt(4);
+	readTabixHeader();
+      }
+    if (depth == 0 || depth > 9 || minShift + 3 * depth > 63)
+      {
+	throw std::runtime_error("BinningIndex " + indexPath + " has unsupported bins");
+      }
+
+    auto indexPtr = std::make_shared< BinningIndex >(minShift, depth);
+    indexPtr->m_virtual_offsets = true;
+    for (size_t nameStart = 0; nameStart < names.size(); )
+      {
+	size_t nameEnd = std::min(names.find('\0', nameStart), names.size());
+	indexPtr->getContigIndex(names.substr(nameStart, nameEnd - nameStart), true);
+	nameStart = nameEnd + 1;
+      }
+    if (indexPtr->m_contig_names.size() != contigCount)
+      {
+	throw std::runtime_error("BinningIndex " + indexPath + " doesn't name its " + std::to_string(contigCount) + " contigs");
+      }
+
+    uint32_t metadataBin = indexPtr->getBinCount(); // a pseudo bin holding counts, not records
+    for (auto& contigIndexPtr : indexPtr->m_contig_indices)
+      {
+	uint64_t binCount = readInt(4);
+	for (uint64_t i = 0; i < binCount; ++i)
+	  {
+	    uint32_t bin = readInt(4);
+	    uint64_t binMinOffset = isCsi ? readInt(8) : 0;
+	    uint64_t chunkCount = readInt(4);
+	    std::vector< Chunk > chunks;
+	    for (uint64_t j = 0; j < chunkCount; ++j)
+	      {
+		uint64_t beginOffset = readInt(8);
+		chunks.push_back({beginOffset, readInt(8)});
+	      }
+	    if (bin == metadataBin)
+	      {
+		continue;
+	      }
+	    if (isCsi)
+	      {
+		contigIndexPtr->bin_min_offsets[bin] = binMinOffset;
+	      }
+	    auto& binChunks = contigIndexPtr->bin_chunks[bin];
+	    binChunks.insert(binChunks.end(), chunks.begin(), chunks.end());
+	  }
+	if (!isCsi)
+	  {
+	    uint64_t windowCount = readInt(4);
+	    if (windowCount > (data.size() - cursor) / 8)
+	      {
+		throw std::runtime_error("BinningIndex truncated index " + indexPath);
+	      }
+	    contigIndexPtr->window_min_offsets.resize(windowCount);
+	    for (auto& windowMinOffset : contigIndexPtr->window_min_offsets)
+	      {
+		windowMinOffset = readInt(8);
+	      }
+	  }
+      }
+    return indexPtr;
+  }
+
+  BinningIndex::ContigIndex* BinningIndex::getContigIndex(const std::string& contigName, bool create)
+  {
+    auto iter = this->m_contig_idxs.find(contigName);
+    if (iter != this->m_contig_idxs.end())
+      {
+	return this->m_contig_indices[iter->second].get();
+      }
+    if (!create)
+      {
+	return nullptr;
+      }
+    this->m_contig_idxs.emplace(contigName, this->m_contig_names.size());
+    this->m_contig_names.emplace_back(contigName);
+    this->m_contig_indices.emplace_back(new ContigIndex());
+    return this->m_contig_indices.back().get();
+  }
+
+  void BinningIndex::addRecord(const std::string& contigName, uint64_t beginPosition, uint64_t endPosition, uint64_t beginOffset, uint64_t endOffset)
+  {
+    ContigIndex* contigIndexPtr = getContigIndex(contigName, true);
+    endPosition = std::max(endPosition, beginPosition + 1);
+    auto& chunks = contigIndexPtr->bin_chunks[getBin(beginPosition, endPosition, this->m_min_shift, this->m_depth)];
+    if (!chunks.empty() && chunks.back().end_offset == beginOffset)
+      {
+	chunks.back().end_offset = endOffset;
+      }
+    else
+      {
+	chunks.push_back({beginOffset, endOffset});
+      }
+    uint64_t lastWindow = (endPosition - 1) >> this->m_min_shift;
+    if (contigIndexPtr->window_min_offsets.size() <= lastWindow)
+      {
+	contigIndexPtr->window_min_offsets.resize(lastWindow + 1, s_no_offset);
+      }
+    for (uint64_t window = beginPosition >> this->m_min_shift; window <= lastWindow; ++window)
+      {
+	contigIndexPtr->window_min_offsets[window] = std::min(contigIndexPtr->window_min_offsets[window], beginOffset);
+      }
+  }
+
+  // no record overlapping [beginPosition, endPosition) starts before this
+  uint64_t BinningIndex::getMinOffset(ContigIndex* contigIndexPtr, uint64_t beginPosition, uint64_t endPosition)
+  {
+    uint64_t minOffset = s_no_offset;
+    if (!contigIndexPtr->window_min_offsets.empty())
+      {
+	// the smallest over every window of the region rather than just the
+	// first, so records added out of position order aren't skipped
+	uint64_t lastWindow = std::min< uint64_t >((endPosition - 1) >> this->m_min_shift, contigIndexPtr->window_min_offsets.size() - 1);
+	for (uint64_t window = beginPosition >> this->m_min_shift; window <= lastWindow; ++window)
+	  {
+	    minOffset = std::min(minOffset, contigIndexPtr->window_min_offsets[window]);
+	  }
+      }
+    else
+      {
+	// CSI keeps it per bin, the nearest bin up from the region's first leaf that has one
+	for (uint32_t bin = getBin(beginPosition, beginPosition + 1, this->m_min_shift, this->m_depth); ; bin = (bin - 1) >> 3)
+	  {
+	    auto iter = contigIndexPtr->bin_min_offsets.find(bin);
+	    if (iter != contigIndexPtr->bin_min_offsets.end())
+	      {
+		minOffset = iter->second;
+		break;
+	      }
+	    if (bin == 0)
+	      {
+		break;
+	      }
+	  }
+      }
+    return (minOffset == s_no_offset) ? 0 : minOffset;
+  }
+
+  std::vector< BinningIndex::Chunk > BinningIndex::getChunks(const std::string& contigName, uint64_t beginPosition, uint64_t endPosition)
+  {
+    std::vector< Chunk > chunks;
+    ContigIndex* contigIndexPtr = getContigIndex(contigName, false);
+    if (contigIndexPtr == nullptr || beginPosition >= endPosition)
+      {
+	return chunks;
+      }
+    std::vector< uint32_t > bins;
+    getOverlappingBins(beginPosition, endPosition, this->m_min_shift, this->m_depth, bins);
+    uint64_t minOffset = getMinOffset(contigIndexPtr, beginPosition, endPosition);
+    for (auto bin : bins)
+      {
+	auto iter = contigIndexPtr->bin_chunks.find(bin);
+	if (iter == contigIndexPtr->bin_chunks.end())
+	  {
+	    continue;
+	  }
+	for (auto& chunk : iter->second)
+	  {
+	    if (chunk.end_offset > minOffset)
+	      {
+		chunks.push_back({std::max(chunk.begin_offset, minOffset), chunk.end_offset});
+	      }
+	  }
+      }
+    std::sort(chunks.begin(), chunks.end(), [](const Chunk& a, const Chunk& b) { return a.begin_offset < b.begin_offset; });
+    size_t mergedCount = 0;
+    for (auto& chunk : chunks)
+      {
+	if (mergedCount > 0 && chunk.begin_offset <= chunks[mergedCount - 1].end_offset)
+	  {
+	    chunks[mergedCount - 1].end_offset = std::max(chunks[mergedCount - 1].end_offset, chunk.end_offset);
+	  }
+	else
+	  {
+	    chunks[mergedCount++] = chunk;
+	  }
+      }
+    chunks.resize(mergedCount);
+    return chunks;
+  }
@@ -0,0 +1,88 @@
+#ifndef BINNINGINDEX_H
+#define BINNINGINDEX_H
+
+#include "Noncopyable.hpp"
+#include "Region.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * The binning scheme tabix, CSI and BAM indexes share. A contig is cut
+   * into 2^minShift base leaves, every level above groups eight bins of the
+   * level below, and a record goes into the smallest bin that holds it. The
+   * records overlapping a region can then only be in the bins on the paths
+   * from the region's leaves up to the root, a few per level. Each bin keeps
+   * the ranges (chunks) of the file its records are in, and the smallest
+   * offset of a record overlapping each leaf window lets a query skip the
+   * chunks that end before any record reaching the region starts.
+   *
+   * Offsets are whatever the caller uses to find records again: tabix and
+   * CSI files store BGZF virtual offsets (hasVirtualOffsets), an index built
+   * with addRecord can use plain file offsets or positions in a list.
+   *
+   * Building isn't thread safe, queries on a built index are.
+   */
+  class BinningIndex : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< BinningIndex > SharedPtr;
+
+    struct Chunk
+    {
+      uint64_t begin_offset;
+      uint64_t end_offset;
+    };
+
+    // 16 kb leaves, six levels above them reach past the largest position, tabix uses five
+    BinningIndex(uint32_t minShift = 14, uint32_t depth = 6);
+    ~BinningIndex();
+
+    // a tabix (.tbi) or CSI (.csi) index, throws std::runtime_error if it's malformed
+    static SharedPtr readIndexFile(const std::string& indexPath);
+
+    // a record at [beginPosition, endPosition) on the contig, zero based,
+    // whose bytes are at [beginOffset, endOffset). Records can be added in
+    // any order, those added one after the other in file order share chunks
+    void addRecord(const std::string& contigName, uint64_t beginPosition, uint64_t endPosition, uint64_t beginOffset, uint64_t endOffset);
+
+    // the ranges holding every record overlapping [beginPosition, endPosition)
+    // on the contig, sorted and merged, plus records that don't overlap it
+    std::vector< Chunk > getChunks(const std::string& contigName, uint64_t beginPosition, uint64_t endPosition);
+
+    std::vector< std::string > getContigNames() { return this->m_contig_names; }
+    bool hasVirtualOffsets() { return this->m_virtual_offsets; }
+
+    // the region as zero based positions, its end left out
+    static void getRegionBounds(Region::SharedPtr regionPtr, uint64_t& beginPosition, uint64_t& endPosition);
+    // the bins on the paths from the leaves of [beginPosition, endPosition) to the root
+    static void getOverlappingBins(uint64_t beginPosition, uint64_t endPosition, uint32_t minShift, uint32_t depth, std::vector< uint32_t >& bins);
+    // the smallest bin holding all of [beginPosition, endPosition)
+    static uint32_t getBin(uint64_t beginPosition, uint64_t endPosition, uint32_t minShift, uint32_t depth);
+
+  private:
+    struct ContigIndex
+    {
+      std::unordered_map< uint32_t, std::vector< Chunk > > bin_chunks;
+      std::unordered_map< uint32_t, uint64_t > bin_min_offsets; // CSI's, the smallest offset of a record in or under the bin
+      std::vector< uint64_t > window_min_offsets; // tabix's linear index, UINT64_MAX for windows no record overlaps
+    };
+
+    static const uint64_t s_no_offset = UINT64_MAX;
+
+    ContigIndex* getContigIndex(const std::string& contigName, bool create);
+    uint64_t getMinOffset(ContigIndex* contigIndexPtr, uint64_t beginPosition, uint64_t endPosition);
+    uint32_t getBinCount() { return ((1u << (3 * (this->m_depth + 1))) - 1) / 7; }
+
+    uint32_t m_min_shift;
+    uint32_t m_depth;
+    bool m_virtual_offsets;
+    std::vector< std::string > m_contig_names;
+    std::vector< std::unique_ptr< ContigIndex > > m_contig_indices; // in m_contig_names order
+    std::unordered_map< std::string, size_t > m_contig_idxs;
+  };
+
+#endif
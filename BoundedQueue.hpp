@@ -0,0 +1,129 @@
+#ifndef BOUNDEDQUEUE_HPP
+#define BOUNDEDQUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <stdint.h>
+
+#include "Noncopyable.hpp"
+
+  /*
+   * Bounded lock free multi producer multi consumer queue (Dmitry Vyukov's
+   * array queue). Every cell carries a sequence number that tells producers
+   * and consumers whose turn it is, so neither side ever waits on the other.
+   * tryPush fails when the queue is full, tryPop when it is empty.
+   */
+  template< typename T >
+  class BoundedQueue : private Noncopyable
+  {
+  public:
+  BoundedQueue(size_t capacity) :
+    m_capacity(roundUpToPowerOfTwo(capacity)),
+    m_mask(m_capacity - 1),
+    m_cells(new Cell[m_capacity]),
+    m_enqueue_position(0),
+    m_dequeue_position(0)
+    {
+      for (size_t i = 0; i < this->m_capacity; ++i)
+	{
+	  this->m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+    }
+
+    ~BoundedQueue()
+      {
+      }
+
+    bool tryPush(T&& item)
+    {
+      Cell* cell;
+      size_t position = this->m_enqueue_position.load(std::memory_order_relaxed);
+      for (;;)
+	{
+	  cell = &this->m_cells[position & this->m_mask];
+	  size_t sequence = cell->sequence.load(std::memory_order_acquire);
+	  intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+	  if (difference == 0)
+	    {
+	      if (this->m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+		{
+		  break;
+		}
+	    }
+	  else if (difference < 0)
+	    {
+	      return false; // full
+	    }
+	  else
+	    {
+	      position = this->m_enqueue_position.load(std::memory_order_relaxed);
+	    }
+	}
+      cell->item = std::move(item);
+      cell->sequence.store(position + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool tryPop(T& item)
+    {
+      Cell* cell;
+      size_t position = this->m_dequeue_position.load(std::memory_order_relaxed);
+      for (;;)
+	{
+	  cell = &this->m_cells[position & this->m_mask];
+	  size_t sequence = cell->sequence.load(std::memory_order_acquire);
+	  intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+	  if (difference == 0)
+	    {
+	      if (this->m_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+		{
+		  break;
+		}
+	    }
+	  else if (difference < 0)
+	    {
+	      return false; // empty
+	    }
+	  else
+	    {
+	      position = this->m_dequeue_position.load(std::memory_order_relaxed);
+	    }
+	}
+      item = std::move(cell->item);
+      cell->item = T();
+      cell->sequence.store(position + this->m_mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    size_t capacity() { return this->m_capacity; }
+
+  private:
+    struct Cell
+    {
+      std::atomic< size_t > sequence;
+      T item;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+      size_t powerOfTwo = 2;
+      while (powerOfTwo < value)
+	{
+	  powerOfTwo <<= 1;
+	}
+      return powerOfTwo;
+    }
+
+    size_t m_capacity;
+    size_t m_mask;
+    std::unique_ptr< Cell[] > m_cells;
+    // producers and consumers each get their own cache line
+    char m_padding_before_enqueue[64];
+    std::atomic< size_t > m_enqueue_position;
+    char m_padding_before_dequeue[64];
+    std::atomic< size_t > m_dequeue_position;
+    char m_padding_after_dequeue[64];
+  };
+
+#endif
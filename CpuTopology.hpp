@@ -0,0 +1,249 @@
+#ifndef CPUTOPOLOGY_HPP
+#define CPUTOPOLOGY_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <cctype>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Noncopyable.hpp"
+
+  /*
+   * Logical cpus this process may run on, with the physical core, socket and
+   * NUMA node each one belongs to. Read once from sysfs, on systems without
+   * it every cpu is treated as its own core on a single node.
+   */
+  class CpuTopology : private Noncopyable
+  {
+  public:
+    struct LogicalCpu
+    {
+      uint32_t cpu_id;
+      uint32_t core_id;
+      uint32_t package_id;
+      uint32_t numa_node;
+    };
+
+    static CpuTopology* Instance()
+    {
+      static CpuTopology* s_topology = new CpuTopology();
+      return s_topology;
+    }
+
+    const std::vector< LogicalCpu >& getLogicalCpus() { return this->m_logical_cpus; }
+    uint32_t getPhysicalCoreCount() { return this->m_physical_core_count; }
+    uint32_t getNumaNodeCount() { return this->m_numa_node_count; }
+
+    /*
+     * Logical cpus in the order workers should be placed on them. One
+     * hyperthread of every physical core comes before any second sibling, so
+     * the first getPhysicalCoreCount() workers each get a core of their own.
+     * Within each of those tiers cpus are either grouped by NUMA node, so
+     * neighbouring workers share a node, or dealt round robin across nodes.
+     */
+    std::vector< LogicalCpu > getPlacementOrder(bool groupByNumaNode)
+    {
+      std::vector< LogicalCpu > sortedCpus = this->m_logical_cpus;
+      std::sort(sortedCpus.begin(), sortedCpus.end(), [](const LogicalCpu& a, const LogicalCpu& b)
+		{
+		  if (a.numa_node != b.numa_node) { return a.numa_node < b.numa_node; }
+		  if (a.package_id != b.package_id) { return a.package_id < b.package_id; }
+		  if (a.core_id != b.core_id) { return a.core_id < b.core_id; }
+		  return a.cpu_id < b.cpu_id;
+		});
+
+      // tier n holds the n-th hyperthread of every core, still in node order
+      std::vector< std::vector< LogicalCpu > > tiers;
+      for (size_t i = 0; i < sortedCpus.size(); )
+	{
+	  size_t j = i;
+	  while (j < sortedCpus.size() && sortedCpus[j].numa_node == sortedCpus[i].numa_node &&
+		 sortedCpus[j].package_id == sortedCpus[i].package_id && sortedCpus[j].core_id == sortedCpus[i].core_id)
+	    {
+	      if (tiers.size() <= j - i) { tiers.resize(j - i + 1); }
+	      tiers[j - i].emplace_back(sortedCpus[j]);
+	      ++j;
+	    }
+	  i = j;
+	}
+
+      std::vector< LogicalCpu > placementOrder;
+      for (auto& tier : tiers)
+	{
+	  if (groupByNumaNode)
+	    {
+	      placementOrder.insert(placementOrder.end(), tier.begin(), tier.end());
+	      continue;
+	    }
+	  std::vector< std::vector< LogicalCpu > > nodeCpus;
+	  for (auto& cpu : tier)
+	    {
+	      if (nodeCpus.empty() || nodeCpus.back()[0].numa_node != cpu.numa_node) { nodeCpus.emplace_back(); }
+	      nodeCpus.back().emplace_back(cpu);
+	    }
+	  for (size_t round = 0, dealt = 0; dealt < tier.size(); ++round)
+	    {
+	      for (auto& cpus : nodeCpus)
+		{
+		  if (round < cpus.size())
+		    {
+		      placementOrder.emplace_back(cpus[round]);
+		      ++dealt;
+		    }
+		}
+	    }
+	}
+      return placementOrder;
+    }
+
+    // restricts the thread to one logical cpu, returns false if the platform doesn't allow it
+    static bool pinThread(std::thread& thread, uint32_t cpuId)
+    {
+#ifdef __linux__
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      CPU_SET(cpuId, &cpuSet);
+      return pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+      return false;
+#endif
+    }
+
+    // lets the thread run on any cpu the process was started with again
+    bool unpinThread(std::thread& thread)
+    {
+#ifdef __linux__
+      cpu_set_t cpuSet;
+      CPU_ZERO(&cpuSet);
+      for (auto& cpu : this->m_logical_cpus)
+	{
+	  CPU_SET(cpu.cpu_id, &cpuSet);
+	}
+      return pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+      return false;
+#endif
+    }
+
+  private:
+  CpuTopology() :
+    m_physical_core_count(0),
+    m_numa_node_count(0)
+    {
+#ifdef __linux__
+      readSysfsTopology();
+#endif
+      if (this->m_logical_cpus.empty())
+	{
+	  uint32_t cpuCount = std::max(std::thread::hardware_concurrency(), 1u);
+	  for (uint32_t i = 0; i < cpuCount; ++i)
+	    {
+	      this->m_logical_cpus.push_back({i, i, 0, 0});
+	    }
+	}
+
+      std::vector< std::pair< uint32_t, uint32_t > > cores;
+      std::vector< uint32_t > nodes;
+      for (auto& cpu : this->m_logical_cpus)
+	{
+	  cores.emplace_back(cpu.package_id, cpu.core_id);
+	  nodes.emplace_back(cpu.numa_node);
+	}
+      std::sort(cores.begin(), cores.end());
+      std::sort(nodes.begin(), nodes.end());
+      this->m_physical_core_count = std::unique(cores.begin(), cores.end()) - cores.begin();
+      this->m_numa_node_count = std::unique(nodes.begin(), nodes.end()) - nodes.begin();
+    }
+
+#ifdef __linux__
+    void readSysfsTopology()
+    {
+      // only the cpus we are allowed on, a taskset or cgroup may hide the rest
+      cpu_set_t allowedCpus;
+      CPU_ZERO(&allowedCpus);
+      if (sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus) != 0)
+	{
+	  return;
+	}
+
+      std::vector< int32_t > cpuNodes;
+      DIR* nodeDir = opendir("/sys/devices/system/node");
+      if (nodeDir != nullptr)
+	{
+	  struct dirent* entry;
+	  while ((entry = readdir(nodeDir)) != nullptr)
+	    {
+	      std::string name = entry->d_name;
+	      if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(name[4]))
+		{
+		  continue;
+		}
+	      uint32_t node = std::stoul(name.substr(4));
+	      for (auto cpuId : readCpuList("/sys/devices/system/node/" + name + "/cpulist"))
+		{
+		  if (cpuNodes.size() <= cpuId) { cpuNodes.resize(cpuId + 1, -1); }
+		  cpuNodes[cpuId] = node;
+		}
+	    }
+	  closedir(nodeDir);
+	}
+
+      for (auto cpuId : readCpuList("/sys/devices/system/cpu/online"))
+	{
+	  if (cpuId >= CPU_SETSIZE || !CPU_ISSET(cpuId, &allowedCpus))
+	    {
+	      continue;
+	    }
+	  std::string topologyPath = "/sys/devices/system/cpu/cpu" + std::to_string(cpuId) + "/topology/";
+	  int32_t coreId = readInteger(topologyPath + "core_id");
+	  int32_t packageId = readInteger(topologyPath + "physical_package_id");
+	  int32_t node = (cpuId < cpuNodes.size()) ? cpuNodes[cpuId] : -1;
+	  this->m_logical_cpus.push_back({cpuId, (coreId < 0) ? cpuId : (uint32_t)coreId, (packageId < 0) ? 0 : (uint32_t)packageId, (node < 0) ? 0 : (uint32_t)node});
+	}
+    }
+
+    // parses the "0-3,8,10-11" format sysfs uses for cpu masks
+    static std::vector< uint32_t > readCpuList(const std::string& path)
+    {
+      std::vector< uint32_t > cpuIds;
+      std::ifstream in(path);
+      std::string range;
+      while (std::getline(in, range, ','))
+	{
+	  uint32_t first, last;
+	  char dash;
+	  std::istringstream rangeStream(range);
+	  if (!(rangeStream >> first)) { continue; }
+	  last = (rangeStream >> dash >> last) ? last : first;
+	  for (uint32_t cpuId = first; cpuId <= last; ++cpuId)
+	    {
+	      cpuIds.push_back(cpuId);
+	    }
+	}
+      return cpuIds;
+    }
+
+    static int32_t readInteger(const std::string& path)
+    {
+      std::ifstream in(path);
+      int32_t value;
+      return (in >> value) ? value : -1;
+    }
+#endif
+
+    std::vector< LogicalCpu > m_logical_cpus;
+    uint32_t m_physical_core_count;
+    uint32_t m_numa_node_count;
+  };
+
+#endif
@@ -0,0 +1,227 @@
+#include "FastaReference.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+  FastaReference::FastaReference(const std::string& fastaPath) :
+    m_fasta_path(fastaPath),
+    m_data(nullptr),
+    m_data_size(0)
+  {
+    mapFile();
+    std::ifstream indexStream(fastaPath + ".fai");
+    if (indexStream.good())
+      {
+	indexStream.close();
+	readIndex(fastaPath + ".fai");
+      }
+    else
+      {
+	buildIndex();
+      }
+  }
+
+  FastaReference::~FastaReference()
+  {
+    if (this->m_data != nullptr)
+      {
+	munmap((void*)this->m_data, this->m_data_size);
+      }
+  }
+
+  void FastaReference::mapFile()
+  {
+    int fd = open(this->m_fasta_path.c_str(), O_RDONLY);
+    if (fd < 0)
+      {
+	throw std::runtime_error("FastaReference could not open " + this->m_fasta_path);
+      }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+      {
+	close(fd);
+	throw std::runtime_error("FastaReference could not read " + this->m_fasta_path);
+      }
+    this->m_data_size = fileStat.st_size;
+    void* data = mmap(nullptr, this->m_data_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+      {
+	this->m_data_size = 0;
+	throw std::runtime_error("FastaReference could not map " + this->m_fasta_path);
+      }
+    // reads jump around the genome, read ahead would mostly fetch pages nobody asked for
+    madvise(data, this->m_data_size, MADV_RANDOM);
+    this->m_data = (const char*)data;
+  }
+
+  void FastaReference::readIndex(const std::string& indexPath)
+  {
+    std::ifstream indexStream(indexPath);
+    std::string line;
+    while (std::getline(indexStream, line))
+      {
+	if (line.empty())
+	  {
+	    continue;
+	  }
+	std::istringstream lineStream(line);
+	std::string name;
+	uint64_t length, offset, lineBases, lineWidth;
+	if (!std::getline(lineStream, name, '\t') || !(lineStream >> length >> offset >> lineBases >> lineWidth))
+	  {
+	    throw std::runtime_error("FastaReference malformed index line in " + indexPath + ": " + line);
+	  }
+	addContig(name, length, offset, lineBases, lineWidth);
+      }
+  }
+
+  // the same fields samtools faidx writes, the lines of a contig must all be
+  // as long as its first one except for the last
+  void FastaReference::buildIndex()
+  {
+    const char* data = this->m_data;
+    const char* end = this->m_data + this->m_data_size;
+    const char* cursor = data;
+    while (cursor < end)
+      {
+	if (*cursor != '>')
+	  {
+	    throw std::runtime_error("FastaReference expected a '>' header in " + this->m_fasta_path);
+	  }
+	const char* headerEnd = (const char*)memchr(cursor, '\n', end - cursor);
+	headerEnd = (headerEnd == nullptr) ? end : headerEnd;
+	const char* nameEnd = cursor + 1;
+	while (nameEnd < headerEnd && !isspace(*nameEnd)) { ++nameEnd; }
+	std::string name(cursor + 1, nameEnd);
+
+	cursor = (headerEnd < end) ? headerEnd + 1 : end;
+	uint64_t offset = cursor - data;
+	uint64_t length = 0;
+	uint64_t lineBases = 0;
+	uint64_t lineWidth = 0;
+	while (cursor < end && *cursor != '>')
+	  {
+	    const char* lineEnd = (const char*)memchr(cursor, '\n', end - cursor);
+	    const char* nextLine = (lineEnd == nullptr) ? end : lineEnd + 1;
+	    lineEnd = (lineEnd == nullptr) ? end : lineEnd;
+	    uint64_t bases = lineEnd - cursor;
+	    if (bases > 0 && cursor[bases - 1] == '\r') { --bases; }
+	    if (lineBases == 0)
+	      {
+		lineBases = bases;
+		lineWidth = nextLine - cursor;
+	      }
+	    length += bases;
+	    cursor = nextLine;
+	  }
+	addContig(name, length, offset, lineBases, lineWidth);
+      }
+  }
+
+  void FastaReference::addContig(const std::string& name, uint64_t length, uint64_t offset, uint64_t lineBases, uint64_t lineWidth)
+  {
+    if (length > 0)
+      {
+	uint64_t lastBaseOffset = (lineBases == 0) ? 0 : offset + ((length - 1) / lineBases) * lineWidth + (length - 1) % lineBases;
+	if (lineBases == 0 || lineWidth < lineBases || lastBaseOffset >= this->m_data_size)
+	  {
+	    throw std::runtime_error("FastaReference index entry for " + name + " doesn't fit " + this->m_fasta_path);
+	  }
+      }
+    std::unique_ptr< Contig > contigPtr(new Contig());
+    contigPtr->name = name;
+    contigPtr->length = length;
+    contigPtr->offset = offset;
+    contigPtr->line_bases = lineBases;
+    contigPtr->line_width = lineWidth;
+    this->m_contigs_by_name.emplace(name, contigPtr.get());
+    this->m_contigs.emplace_back(std::move(contigPtr));
+  }
+
+  FastaReference::Contig* FastaReference::getContig(const std::string& contigName)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	throw std::invalid_argument("FastaReference has no contig " + contigName);
+      }
+    return iter->second;
+  }
+
+  SequenceView FastaReference::getSequenceViewFromRegion(Region::SharedPtr regionPtr)
+  {
+    // same conventions as IReference: one based regions include their end, zero based ones don't
+    uint64_t sequenceLength = regionPtr->getEndPosition() - regionPtr->getStartPosition();
+    position startPosition = regionPtr->getStartPosition();
+    if (regionPtr->getBased() == Region::BASED::ONE)
+      {
+	startPosition -= 1;
+	sequenceLength += 1;
+      }
+    return getSequenceView(regionPtr->getReferenceID(), startPosition, sequenceLength);
+  }
+
+  SequenceView FastaReference::getSequenceView(const std::string& contigName, position startPosition, size_t length)
+  {
+    Contig* contigPtr = getContig(contigName);
+    if (startPosition + (uint64_t)length > contigPtr->length)
+      {
+	throw std::invalid_argument("FastaReference region " + contigName + ":" + std::to_string(startPosition) + "+" + std::to_string(length) + " is past the contig's end");
+      }
+    if (length == 0)
+      {
+	return {this->m_data + contigPtr->offset, 0};
+      }
+    uint64_t firstLine = startPosition / contigPtr->line_bases;
+    uint64_t lastLine = (startPosition + length - 1) / contigPtr->line_bases;
+    if (firstLine == lastLine)
+      {
+	return {this->m_data + contigPtr->offset + (firstLine * contigPtr->line_width) + (startPosition % contigPtr->line_bases), length};
+      }
+    std::call_once(contigPtr->compact_flag, [this, contigPtr]() { compactContig(contigPtr); });
+    return {contigPtr->compacted_sequence.get() + startPosition, length};
+  }
+
+  void FastaReference::compactContig(Contig* contigPtr)
+  {
+    std::unique_ptr< char[] > compactedSequence(new char[contigPtr->length]);
+    const char* line = this->m_data + contigPtr->offset;
+    for (uint64_t copied = 0; copied < contigPtr->length; line += contigPtr->line_width)
+      {
+	uint64_t bases = std::min(contigPtr->line_bases, contigPtr->length - copied);
+	memcpy(compactedSequence.get() + copied, line, bases);
+	copied += bases;
+      }
+    contigPtr->compacted_sequence = std::move(compactedSequence);
+  }
+
+  std::vector< std::string > FastaReference::getContigNames()
+  {
+    std::vector< std::string > contigNames;
+    for (auto& contigPtr : this->m_contigs)
+      {
+	contigNames.emplace_back(contigPtr->name);
+      }
+    return contigNames;
+  }
+
+  bool FastaReference::getContigLength(const std::string& contigName, uint64_t& length)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	return false;
+      }
+    length = iter->second->length;
+    return true;
+  }
@@ -0,0 +1,70 @@
+#ifndef FASTAREFERENCE_H
+#define FASTAREFERENCE_H
+
+#include "IReference.h"
+#include "Region.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+  /*
+   * An IReference over an uncompressed FASTA file that is mapped into memory
+   * rather than read, so opening even a whole genome only costs parsing the
+   * .fai index and every process on the machine shares the same pages.
+   * Without a .fai next to the file the index is built by scanning it once.
+   *
+   * Views point straight into the mapping when the region falls within one
+   * line of the file. A region spanning line breaks needs the contig's bases
+   * without the newlines, so the first such request compacts that contig
+   * into memory once and later views of it point there.
+   *
+   * Regions are looked up by their reference ID, which has to be one of the
+   * contig names.
+   */
+  class FastaReference : public IReference
+  {
+  public:
+    typedef std::shared_ptr< FastaReference > SharedPtr;
+
+    // throws std::runtime_error if the file can't be mapped or its index is malformed
+    FastaReference(const std::string& fastaPath);
+    ~FastaReference();
+
+    // throws std::invalid_argument for an unknown contig or a region past its end
+    SequenceView getSequenceViewFromRegion(Region::SharedPtr regionPtr) override;
+    SequenceView getSequenceView(const std::string& contigName, position startPosition, size_t length); // zero based start
+
+    std::vector< std::string > getContigNames();
+    bool getContigLength(const std::string& contigName, uint64_t& length);
+
+  private:
+    // one .fai line: name, length, offset of the first base, bases and bytes per line
+    struct Contig
+    {
+      std::string name;
+      uint64_t length;
+      uint64_t offset;
+      uint64_t line_bases;
+      uint64_t line_width;
+      std::once_flag compact_flag;
+      std::unique_ptr< char[] > compacted_sequence; // set once by compact_flag
+    };
+
+    void mapFile();
+    void readIndex(const std::string& indexPath);
+    void buildIndex();
+    void addContig(const std::string& name, uint64_t length, uint64_t offset, uint64_t lineBases, uint64_t lineWidth);
+    Contig* getContig(const std::string& contigName);
+    void compactContig(Contig* contigPtr);
+
+    std::string m_fasta_path;
+    const char* m_data;
+    size_t m_data_size;
+    std::vector< std::unique_ptr< Contig > > m_contigs;
+    std::unordered_map< std::string, Contig* > m_contigs_by_name;
+  };
+
+#endif
@@ -1,5 +1,7 @@
 #include "GSSWGraph.h"
 #include "AlignmentReporter.h"
+#include "SymbolicAllele.h"
+#include "VariantOverlapIndex.h"
 
 #include <mutex>
 #include <iostream>
@@ -11,17 +13,22 @@
 
   uint32_t GSSWGraph::s_next_id = 0;
   std::mutex GSSWGraph::s_lock;
+  std::atomic< uint64_t > GSSWGraph::s_next_graph_id(0);
   GSSWGraph::GSSWGraph(IReference::SharedPtr referencePtr, IVariantList::SharedPtr variantListPtr, Region::SharedPtr regionPtr, int matchValue, int misMatchValue, int gapOpenValue, int gapExtensionValue, uint32_t numGraphCopies) :
     IGraph(referencePtr, variantListPtr),
     m_match(matchValue),
     m_mismatch(misMatchValue),
     m_gap_open(gapOpenValue),
     m_gap_extension(gapExtensionValue),
-    m_variant_list_ptr(variantListPtr),
     m_region_ptr(regionPtr),
+    m_graph_id(s_next_graph_id.fetch_add(1)),
+    m_num_graph_copies(numGraphCopies),
     m_total_graph_length(0),
     m_skipped(false),
-    m_num_graph_copies(numGraphCopies)
+    m_variant_list_ptr(variantListPtr),
+    m_waiting_count(0),
+    m_wait_count(0),
+    m_released_count(0)
   {
     this->m_nt_table = gssw_create_nt_table();
     this->m_mat = gssw_create_score_matrix(this->m_match, this->m_mismatch);
@@ -39,20 +46,31 @@
     std::vector< gssw_node* > altAndRefVertices;
     position currentReferencePosition = this->m_region_ptr->getStartPosition();
 
+    // streamed once, lists reading a file only hold the variants a graph is using
+    std::vector< IVariant::SharedPtr > listVariantPtrs;
     while (this->m_variant_list_ptr->getNextVariant(variantPtr))
       {
-	if (variantPtr->shouldSkip())
+	listVariantPtrs.emplace_back(variantPtr);
+      }
+    // the variants are threaded one after another, one overlapping a variant before it has no place in the graph
+    VariantOverlapIndex variantOverlapIndex(listVariantPtrs);
+    std::vector< bool > variantSkips = variantOverlapIndex.getOverlapSkips();
+    for (size_t variantIdx = 0; variantIdx < listVariantPtrs.size(); ++variantIdx)
+      {
+	if (variantSkips[variantIdx])
 	  {
 	    m_skipped = true;
 	    continue;
 	  }
+	variantPtr = listVariantPtrs[variantIdx];
+	this->m_variant_ptrs.emplace_back(variantPtr);
 	referenceSize = variantPtr->getPosition() - currentReferencePosition;
 	if (referenceSize > 0)
 	  {
 	    auto refRegionPtr = std::make_shared< Region >(this->m_region_ptr->getReferenceID(), currentReferencePosition, variantPtr->getPosition() - 1, Region::BASED::ONE); // minus one because we don't want to include the actual variant position
-	    std::string referenceSequenceString = this->m_reference_ptr->getSequenceFromRegion(refRegionPtr);
-	    auto referenceAllelePtr = std::make_shared< Allele >(referenceSequenceString);
-	    auto referenceNode = addReferenceVertex(variantPtr->getRegions()[0]->getStartPosition(), referenceAllelePtr, altAndRefVertices);
+	    int8_t* referenceNum;
+	    auto referenceAllelePtr = getReferenceAllele(refRegionPtr, referenceNum);
+	    auto referenceNode = addReferenceVertex(variantPtr->getRegions()[0]->getStartPosition(), referenceAllelePtr, altAndRefVertices, referenceNum);
 	    altAndRefVertices.clear();
 	    altAndRefVertices.push_back(referenceNode);
 	    m_total_graph_length += referenceSize;
@@ -66,17 +84,37 @@
     if (referenceSize > 0)
       {
 	auto refRegionPtr = std::make_shared< Region >(this->m_region_ptr->getReferenceID(), currentReferencePosition, this->m_region_ptr->getEndPosition(), Region::BASED::ONE);
-	std::string referenceSequenceString = this->m_reference_ptr->getSequenceFromRegion(refRegionPtr);
-	auto referenceAllelePtr = std::make_shared< Allele >(referenceSequenceString);
-	addReferenceVertex(currentReferencePosition, referenceAllelePtr, altAndRefVertices);
+	int8_t* referenceNum;
+	auto referenceAllelePtr = getReferenceAllele(refRegionPtr, referenceNum);
+	addReferenceVertex(currentReferencePosition, referenceAllelePtr, altAndRefVertices, referenceNum);
       }
     generateGraphCopies();
   }
 
-  gssw_node* GSSWGraph::addReferenceVertex(position position, IAllele::SharedPtr referenceAllelePtr, std::vector< gssw_node* > altAndRefVertices)
+  // a packed reference unpacks straight to the node's codes, the letters are made from those
+  IAllele::SharedPtr GSSWGraph::getReferenceAllele(Region::SharedPtr refRegionPtr, int8_t*& referenceNum)
+  {
+    referenceNum = NULL;
+    auto packedReferencePtr = std::dynamic_pointer_cast< PackedReference >(this->m_reference_ptr);
+    if (packedReferencePtr == nullptr)
+      {
+	return std::make_shared< Allele >(this->m_reference_ptr->getSequenceFromRegion(refRegionPtr));
+      }
+    size_t length = refRegionPtr->getEndPosition() - refRegionPtr->getStartPosition() + 1;
+    referenceNum = (int8_t*)malloc(length);
+    packedReferencePtr->getNumericSequenceFromRegion(refRegionPtr, referenceNum);
+    std::string referenceSequenceString(length, 'N');
+    for (size_t i = 0; i < length; ++i)
+      {
+	referenceSequenceString[i] = "ACGTN"[referenceNum[i]];
+      }
+    return std::make_shared< Allele >(referenceSequenceString);
+  }
+
+  gssw_node* GSSWGraph::addReferenceVertex(position position, IAllele::SharedPtr referenceAllelePtr, std::vector< gssw_node* > altAndRefVertices, int8_t* referenceNum)
   {
     this->m_reference_fragments.emplace_back(referenceAllelePtr);
-    auto referenceNodePtr = gssw_node_create_alt(position, referenceAllelePtr->getSequence(), referenceAllelePtr->getLength(), referenceAllelePtr, true, this->m_nt_table, this->m_mat);
+    auto referenceNodePtr = gssw_node_create_alt(position, referenceAllelePtr->getSequence(), referenceAllelePtr->getLength(), referenceAllelePtr, true, this->m_nt_table, this->m_mat, referenceNum);
     gssw_graph_add_node(this->m_graph_ptr, referenceNodePtr);
     for (auto iter = altAndRefVertices.begin(); iter != altAndRefVertices.end(); ++iter)
       {
@@ -89,6 +127,17 @@
   {
     size_t tmpLength = 0;
     std::vector< gssw_node* > vertices;
+    // symbolic alleles only get the bases around their breakpoints
+    std::vector< IAllele::SharedPtr > allelePtrs = variantPtr->getAltAllelePtrs();
+    allelePtrs.emplace_back(variantPtr->getRefAllelePtr());
+    for (auto& allelePtr : allelePtrs)
+      {
+	auto symbolicAllelePtr = std::dynamic_pointer_cast< SymbolicAllele >(allelePtr);
+	if (symbolicAllelePtr != nullptr)
+	  {
+	    symbolicAllelePtr->setReference(this->m_reference_ptr, s_symbolic_allele_flank_length);
+	  }
+      }
     for (auto altAllelePtr : variantPtr->getAltAllelePtrs())
       {
 	auto altAlleleNode = gssw_node_create_alt(variantPtr->getPosition(), variantPtr->getRefAllelePtr()->getSequence(), variantPtr->getRefAllelePtr()->getLength(), altAllelePtr, false, this->m_nt_table, this->m_mat);
@@ -112,8 +161,10 @@
     return vertices;
   }
 
-  GSSWGraph::GSSWGraphMappingPtr GSSWGraph::traceBackAlignment(IAlignment::SharedPtr alignmentPtr, std::shared_ptr< GSSWGraphContainer > graphContainer)
+  GSSWMappingResult::SharedPtr GSSWGraph::traceBackAlignment(IAlignment::SharedPtr alignmentPtr, std::shared_ptr< GSSWGraphContainer > graphContainer)
   {
+    // nothing returned refers to the container, so it goes back to the pool as this returns
+    GraphContainerReleaser graphContainerReleaser(this, graphContainer);
     gssw_graph* g = graphContainer->graph_ptr;
     int8_t* nt_table = graphContainer->nt_table;
     int8_t* mat = graphContainer->mat;
@@ -121,33 +172,131 @@
     gssw_graph_fill(g, alignmentPtr->getSequence(), alignmentPtr->getLength(), nt_table, mat, this->m_gap_open, this->m_gap_extension, 15, 2);
     gssw_graph_mapping* graphMapping = gssw_graph_trace_back(g, alignmentPtr->getSequence(), alignmentPtr->getLength(),m_match,m_mismatch,m_gap_open,m_gap_extension);
 
-    {
-      std::unique_lock< std::mutex > lock(m_traceback_lock);
-      m_graph_container_ptrs_queue.emplace(graphContainer);
-    }
-    this->m_condition.notify_one();
+    auto mappingResultPtr = std::make_shared< GSSWMappingResult >(1);
+    copyGraphMapping(graphMapping, mappingResultPtr, 0);
+    gssw_graph_mapping_destroy(graphMapping);
+    return mappingResultPtr;
+  }
+
+  void GSSWGraph::copyGraphMapping(gssw_graph_mapping* graphMapping, GSSWMappingResult::SharedPtr mappingResultPtr, size_t idx)
+  {
+    auto& record = mappingResultPtr->m_records[idx];
+    record.score = graphMapping->score;
+    record.position = graphMapping->position;
+    record.node_offset = mappingResultPtr->m_node_mappings.size();
+    record.node_count = graphMapping->cigar.length;
 
     gssw_node_cigar* nc = graphMapping->cigar.elements;
-    for (int i = 0; i < graphMapping->cigar.length; ++i, ++nc)
+    for (uint32_t i = 0; i < graphMapping->cigar.length; ++i, ++nc)
       {
-	nc->node->cigar = nc->cigar;
+	GSSWNodeMapping nodeMapping;
+	nodeMapping.node_id = nc->node->id;
+	nodeMapping.node_ordinal = this->m_node_id_to_ordinal.find(nc->node->id)->second; // find, this runs on many threads at once
+	nodeMapping.cigar_offset = mappingResultPtr->m_cigar_operations.size();
+	nodeMapping.cigar_count = nc->cigar->length;
+	for (int32_t j = 0; j < nc->cigar->length; ++j)
+	  {
+	    GSSWCigarOperation cigarOperation;
+	    cigarOperation.type = nc->cigar->elements[j].type;
+	    cigarOperation.length = nc->cigar->elements[j].length;
+	    mappingResultPtr->m_cigar_operations.emplace_back(cigarOperation);
+	  }
+	mappingResultPtr->m_node_mappings.emplace_back(nodeMapping);
       }
+  }
+
+  GSSWMappingResult::SharedPtr GSSWGraph::alignBatch(const IAlignment::SharedPtr* alignmentPtrs, size_t alignmentCount, std::shared_ptr< GSSWGraphContainer > graphContainer)
+  {
+    GraphContainerReleaser graphContainerReleaser(this, graphContainer);
+    gssw_graph* g = graphContainer->graph_ptr;
+    int8_t* nt_table = graphContainer->nt_table;
+    int8_t* mat = graphContainer->mat;
+    auto mappingResultPtr = std::make_shared< GSSWMappingResult >(alignmentCount);
+
+    // visit the reads grouped by length so the encoded read buffer and the
+    // query profile allocation carry over from one read to the next
+    std::vector< size_t > alignmentOrder(alignmentCount);
+    for (size_t i = 0; i < alignmentCount; ++i) { alignmentOrder[i] = i; }
+    std::stable_sort(alignmentOrder.begin(), alignmentOrder.end(), [alignmentPtrs](size_t a, size_t b)
+		     {
+		       return alignmentPtrs[a]->getLength() < alignmentPtrs[b]->getLength();
+		     });
 
-    auto graphMappingDeletor = [](gssw_graph_mapping* gm)
+    std::vector< int8_t > readNum;
+    gssw_profile* profile = NULL;
+    for (auto idx : alignmentOrder)
       {
-	gssw_graph_mapping_destroy(gm);
-      };
-    return std::shared_ptr< gssw_graph_mapping >(graphMapping, graphMappingDeletor);
+	const char* readSequence = alignmentPtrs[idx]->getSequence();
+	size_t readLength = alignmentPtrs[idx]->getLength();
+	const int8_t* encodedSequence = alignmentPtrs[idx]->getEncodedSequence();
+	if (encodedSequence == NULL)
+	  {
+	    if (readNum.size() < readLength)
+	      {
+		readNum.resize(readLength);
+	      }
+	    for (size_t i = 0; i < readLength; ++i)
+	      {
+		readNum[i] = nt_table[(int)readSequence[i]];
+	      }
+	    encodedSequence = readNum.data();
+	  }
+	profile = gssw_init_reuse(profile, encodedSequence, readLength, mat, 5, 2);
+	gssw_graph_fill_profile(g, profile, this->m_gap_open, this->m_gap_extension, 15);
+	gssw_graph_mapping* graphMapping = gssw_graph_trace_back(g, readSequence, readLength, m_match, m_mismatch, m_gap_open, m_gap_extension);
+	copyGraphMapping(graphMapping, mappingResultPtr, idx);
+	gssw_graph_mapping_destroy(graphMapping);
+      }
+    if (profile != NULL)
+      {
+	gssw_init_destroy(profile);
+      }
+    return mappingResultPtr;
   }
 
-  void GSSWGraph::recordAlignmentVariants(std::shared_ptr< gssw_graph_mapping > graphMapping, IAlignment::SharedPtr alignmentPtr)
+  GSSWMappingResult::SharedPtr GSSWGraph::alignBatch(const std::vector< IAlignment::SharedPtr >& alignmentPtrs, std::shared_ptr< GSSWGraphContainer > graphContainer)
+  {
+    return alignBatch(alignmentPtrs.data(), alignmentPtrs.size(), graphContainer);
+  }
+
+  void GSSWGraph::recordAlignmentVariants(GSSWMappingResult::SharedPtr mappingResultPtr, IAlignment::SharedPtr alignmentPtr)
   {
     // this->m_variant_list_ptr->rewind();
     throw "you will need to implement IVariantList::rewind";
-    auto alignmentReport = std::make_shared< AlignmentReport >(this->m_reference_ptr, this->m_variant_list_ptr, alignmentPtr, graphMapping, this->m_region_ptr->getStartPosition());
+    auto alignmentReport = std::make_shared< AlignmentReport >(this->m_reference_ptr, this->m_variant_list_ptr, alignmentPtr, mappingResultPtr, this->m_region_ptr->getStartPosition());
     AlignmentReporter::Instance()->addAlignmentReport(alignmentReport);
   }
 
+  // counts mapping idx against every allele it passes through, graded by how
+  // close its score is to a perfect match of the whole read
+  void GSSWGraph::incrementAlleleCounts(const GSSWMappingResult::SharedPtr& mappingResultPtr, size_t idx, const IAlignment::SharedPtr& alignmentPtr, const AlleleCountAccumulator::SharedPtr& countAccumulatorPtr, uint64_t groupKey)
+  {
+    const Sample::SharedPtr& samplePtr = alignmentPtr->getSample();
+    size_t perfectScore = alignmentPtr->getLength() * this->m_match;
+    if (samplePtr == nullptr || perfectScore == 0)
+      {
+	return;
+      }
+    uint32_t scorePercent = (std::max< int32_t >(mappingResultPtr->getScore(idx), 0) * 100) / perfectScore;
+    AlleleCountType alleleCountType = scoreToAlleleCountType(scorePercent);
+    for (uint32_t i = 0; i < mappingResultPtr->getNodeCount(idx); ++i)
+      {
+	const IAllele::SharedPtr& allelePtr = getAllelePtrFromNodeID(mappingResultPtr->getNodeMapping(idx, i).node_id);
+	if (allelePtr == nullptr)
+	  {
+	    continue;
+	  }
+	if (countAccumulatorPtr != nullptr)
+	  {
+	    countAccumulatorPtr->incrementCount(allelePtr, alignmentPtr->isReverseStrand(), samplePtr, alleleCountType, groupKey);
+	  }
+	else
+	  {
+	    allelePtr->incrementCount(alignmentPtr->isReverseStrand(), samplePtr, alleleCountType);
+	  }
+      }
+  }
+
   IVariant::SharedPtr GSSWGraph::getVariantFromNodeID(const uint32_t nodeID)
   {
     if (this->m_variants_map.find(nodeID) != this->m_variants_map.end())
@@ -161,8 +310,9 @@
   {
   }
 
-  IAllele::SharedPtr GSSWGraph::getAllelePtrFromNodeID(uint32_t id)
+  const IAllele::SharedPtr& GSSWGraph::getAllelePtrFromNodeID(uint32_t id)
   {
+    static const IAllele::SharedPtr s_null_allele_ptr;
     auto iter = m_node_id_to_allele_ptrs.find(id);
     if (iter != m_node_id_to_allele_ptrs.end())
       {
@@ -170,54 +320,187 @@
       }
     else
       {
-	return nullptr;
+	return s_null_allele_ptr;
+      }
+  }
+
+  uint32_t GSSWGraph::getThreadOrdinal()
+  {
+    static std::atomic< uint32_t > s_next_thread_ordinal(0);
+    static thread_local uint32_t s_thread_ordinal = s_next_thread_ordinal.fetch_add(1);
+    return s_thread_ordinal;
+  }
+
+  std::shared_ptr< GSSWGraphContainer > GSSWGraph::tryGetGraphContainer()
+  {
+    // each thread starts probing at its own slot so that, with as many copies
+    // as threads, a thread keeps reusing the same copy and never collides.
+    // built copies are preferred, a new copy is only cloned when all of them are busy.
+    // with several NUMA nodes pool worker n owns slot n + 1 and clones it itself
+    // even if other copies are free, so the copy is first touched, and stays, on
+    // that worker's node. On one node there's nothing to gain from the extra copy
+    size_t count = this->m_graph_container_ptrs.size();
+    int32_t workerIdx = ThreadPool::getCurrentWorkerIndex();
+    size_t preferredIdx = (workerIdx >= 0) ? (workerIdx + 1) % count : getThreadOrdinal() % count;
+    bool claimOwnSlot = workerIdx >= 0 && CpuTopology::Instance()->getNumaNodeCount() > 1;
+    // pass 0 is a worker's own slot in any state, pass 1 built copies, pass 2 empty slots
+    for (uint32_t pass = claimOwnSlot ? 0 : 1; pass < 3; ++pass)
+      {
+	bool wantPopulated = (pass == 1);
+	for (size_t i = 0; i < ((pass == 0) ? 1 : count); ++i)
+	  {
+	    auto& graphContainerPtr = this->m_graph_container_ptrs[(preferredIdx + i) % count];
+	    bool expected = false;
+	    if ((pass != 0 && graphContainerPtr->populated.load(std::memory_order_relaxed) != wantPopulated) ||
+		graphContainerPtr->in_use.load(std::memory_order_relaxed) ||
+		!graphContainerPtr->in_use.compare_exchange_strong(expected, true))
+	      {
+		continue;
+	      }
+	    if (graphContainerPtr->graph_ptr == NULL)
+	      {
+		populateGraphContainer(graphContainerPtr);
+		graphContainerPtr->miss_count.store(graphContainerPtr->miss_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	      }
+	    else
+	      {
+		graphContainerPtr->hit_count.store(graphContainerPtr->hit_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	      }
+	    return graphContainerPtr;
+	  }
       }
+    return nullptr;
   }
 
   std::shared_ptr< GSSWGraphContainer > GSSWGraph::getGraphContainer()
   {
+    auto graphContainerPtr = tryGetGraphContainer();
+    if (graphContainerPtr != nullptr)
+      {
+	return graphContainerPtr;
+      }
+
+    // every copy is busy, block until releaseGraphContainer hands one back
     std::unique_lock< std::mutex > lock(m_traceback_lock);
-    this->m_condition.wait(lock, [this]{ return !this->m_graph_container_ptrs_queue.empty(); });
-    auto graphContainerPtr = this->m_graph_container_ptrs_queue.front();
-    this->m_graph_container_ptrs_queue.pop();
+    ++this->m_wait_count;
+    ++this->m_waiting_count;
+    this->m_condition.wait(lock, [this, &graphContainerPtr]
+			   {
+			     graphContainerPtr = tryGetGraphContainer();
+			     return graphContainerPtr != nullptr;
+			   });
+    --this->m_waiting_count;
     return graphContainerPtr;
   }
 
-  void GSSWGraph::generateGraphCopies()
+  void GSSWGraph::releaseGraphContainer(std::shared_ptr< GSSWGraphContainer > graphContainerPtr)
   {
-    for (uint32_t tc = 0; tc < m_num_graph_copies; ++tc)
+    graphContainerPtr->in_use.store(false);
+    // the waiter registers before it rescans, so a zero count here means it will see this copy free
+    if (this->m_waiting_count.load() > 0)
       {
-	int8_t* nt_table = gssw_create_nt_table();
-	int8_t* mat = mat = gssw_create_score_matrix(this->m_match, this->m_mismatch);
-	gssw_graph* g = gssw_graph_create(100);
+	std::lock_guard< std::mutex > lock(m_traceback_lock);
+	this->m_condition.notify_all();
+      }
+  }
 
-	std::unordered_map< int, gssw_node* > oldToNewNodeMap;
-	for (auto i = 0; i < m_graph_ptr->size; ++i)
+  size_t GSSWGraph::releaseIdleGraphCopies()
+  {
+    // the first slot holds the graph the copies are cloned from, it is never released
+    size_t releasedCount = 0;
+    for (size_t i = 1; i < this->m_graph_container_ptrs.size(); ++i)
+      {
+	auto& graphContainerPtr = this->m_graph_container_ptrs[i];
+	bool expected = false;
+	if (!graphContainerPtr->populated.load(std::memory_order_relaxed) ||
+	    !graphContainerPtr->in_use.compare_exchange_strong(expected, true))
+	  {
+	    continue;
+	  }
+	if (graphContainerPtr->graph_ptr != NULL)
 	  {
-	    auto node = gssw_node_copy(this->m_graph_ptr->nodes[i], nt_table);
-	    gssw_graph_add_node(g, node);
+	    graphContainerPtr->clear();
+	    ++releasedCount;
+	  }
+	releaseGraphContainer(graphContainerPtr);
+      }
+    this->m_released_count += releasedCount;
+    return releasedCount;
+  }
 
-	    oldToNewNodeMap.emplace(this->m_graph_ptr->nodes[i]->id, node);
+  GSSWGraphPoolStatistics GSSWGraph::getGraphPoolStatistics()
+  {
+    GSSWGraphPoolStatistics statistics = {};
+    for (auto& graphContainerPtr : this->m_graph_container_ptrs)
+      {
+	statistics.hits += graphContainerPtr->hit_count.load(std::memory_order_relaxed);
+	statistics.misses += graphContainerPtr->miss_count.load(std::memory_order_relaxed);
+	if (graphContainerPtr->populated.load(std::memory_order_relaxed))
+	  {
+	    ++statistics.live_copies;
 	  }
-	for (auto i = 0; i < m_graph_ptr->size; ++i)
+      }
+    statistics.waits = this->m_wait_count.load();
+    statistics.released = this->m_released_count.load();
+    statistics.capacity = this->m_graph_container_ptrs.size();
+    return statistics;
+  }
+
+  void GSSWGraph::populateGraphContainer(std::shared_ptr< GSSWGraphContainer > graphContainerPtr)
+  {
+    // only reads node sequences and edges of the source graph, which alignment never writes
+    int8_t* nt_table = gssw_create_nt_table();
+    int8_t* mat = gssw_create_score_matrix(this->m_match, this->m_mismatch);
+    gssw_graph* g = gssw_graph_create(100);
+
+    std::unordered_map< int, gssw_node* > oldToNewNodeMap;
+    for (auto i = 0; i < m_graph_ptr->size; ++i)
+      {
+	auto node = gssw_node_copy(this->m_graph_ptr->nodes[i]);
+	gssw_graph_add_node(g, node);
+
+	oldToNewNodeMap.emplace(this->m_graph_ptr->nodes[i]->id, node);
+      }
+    for (auto i = 0; i < m_graph_ptr->size; ++i)
+      {
+	gssw_node* oldStartNode = this->m_graph_ptr->nodes[i];
+	for (auto nextIdx = 0; nextIdx < this->m_graph_ptr->nodes[i]->count_next; ++nextIdx)
 	  {
-	    gssw_node* oldStartNode = this->m_graph_ptr->nodes[i];
-	    for (auto nextIdx = 0; nextIdx < this->m_graph_ptr->nodes[i]->count_next; ++nextIdx)
-	      {
-		gssw_node* oldEndNode = this->m_graph_ptr->nodes[i]->next[nextIdx];
-		if (oldToNewNodeMap.find(oldStartNode->id) == oldToNewNodeMap.end() || oldToNewNodeMap.find(oldEndNode->id) == oldToNewNodeMap.end()) { std::cout << "skipping!!!" << std::endl; }
-		gssw_node* newStartNode = oldToNewNodeMap[oldStartNode->id];
-		gssw_node* newEndNode = oldToNewNodeMap[oldEndNode->id];
-		gssw_nodes_add_edge(newStartNode, newEndNode);
-	      }
+	    gssw_node* oldEndNode = this->m_graph_ptr->nodes[i]->next[nextIdx];
+	    if (oldToNewNodeMap.find(oldStartNode->id) == oldToNewNodeMap.end() || oldToNewNodeMap.find(oldEndNode->id) == oldToNewNodeMap.end()) { std::cout << "skipping!!!" << std::endl; }
+	    gssw_node* newStartNode = oldToNewNodeMap[oldStartNode->id];
+	    gssw_node* newEndNode = oldToNewNodeMap[oldEndNode->id];
+	    gssw_nodes_add_edge(newStartNode, newEndNode);
 	  }
-	auto graphContainerPtr = std::make_shared< GSSWGraphContainer >(nt_table, mat, g);
-	m_graph_container_ptrs.emplace_back(graphContainerPtr);
-	m_graph_container_ptrs_queue.emplace(graphContainerPtr);
+      }
+    graphContainerPtr->nt_table = nt_table;
+    graphContainerPtr->mat = mat;
+    graphContainerPtr->graph_ptr = g;
+    graphContainerPtr->populated.store(true, std::memory_order_relaxed);
+  }
+
+  void GSSWGraph::generateGraphCopies()
+  {
+    // one slot per pool thread plus one for the calling thread, only m_num_graph_copies
+    // of them are cloned up front, the others are filled in when every built copy is busy.
+    // on a NUMA machine nothing is cloned here, every worker clones its own copy on its own node
+    uint32_t capacity = std::max(m_num_graph_copies, ThreadPool::Instance()->getThreadCount()) + 1;
+    uint32_t eagerCopyCount = (CpuTopology::Instance()->getNumaNodeCount() > 1) ? 0 : m_num_graph_copies;
+    for (uint32_t i = 0; i < this->m_graph_ptr->size; ++i)
+      {
+	this->m_node_id_to_ordinal.emplace(this->m_graph_ptr->nodes[i]->id, i);
       }
     auto graphContainerPtr = std::make_shared< GSSWGraphContainer >(this->m_nt_table, this->m_mat, this->m_graph_ptr);
     m_graph_container_ptrs.emplace_back(graphContainerPtr);
-    m_graph_container_ptrs_queue.emplace(graphContainerPtr);
+    for (uint32_t tc = 1; tc < capacity; ++tc)
+      {
+	auto copyContainerPtr = std::make_shared< GSSWGraphContainer >();
+	if (tc <= eagerCopyCount)
+	  {
+	    populateGraphContainer(copyContainerPtr);
+	  }
+	m_graph_container_ptrs.emplace_back(copyContainerPtr);
+      }
   }
 
   void getAllPaths(gssw_node* node, std::string currentPath, std::string nodeIDs, int numberOfSibs, std::vector< std::tuple< std::string, std::string > >& paths)
@@ -4,13 +4,17 @@
 #include <tuple>
 #include <deque>
 #include <map>
-#include <queue>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include "IGraph.h"
 #include "IReference.h"
+#include "PackedReference.h"
 #include "IVariantList.h"
 #include "Allele.h"
+#include "GSSWMappingResult.h"
+#include "AlleleCountAccumulator.h"
 #include "ThreadPool.hpp"
 
 #include "gssw.h"
@@ -18,23 +22,54 @@
   class GSSWGraphContainer
   {
   public:
+  GSSWGraphContainer() :
+    nt_table(NULL), mat(NULL), graph_ptr(NULL), in_use(false), populated(false), hit_count(0), miss_count(0)
+    {
+    }
+
   GSSWGraphContainer(int8_t* NTtable, int8_t* mat, gssw_graph* graphPtr) :
-    nt_table(NTtable), mat(mat), graph_ptr(graphPtr)
+    nt_table(NTtable), mat(mat), graph_ptr(graphPtr), in_use(false), populated(true), hit_count(0), miss_count(0)
     {
-      lock.unlock();
     }
 
     ~GSSWGraphContainer()
       {
-	gssw_graph_destroy(this->graph_ptr);
-	free(this->nt_table);
-	free(this->mat);
+	clear();
       }
 
+    // frees the graph copy, the slot stays in the pool and is cloned again when needed
+    void clear()
+    {
+      if (this->graph_ptr != NULL)
+	{
+	  gssw_graph_destroy(this->graph_ptr);
+	}
+      free(this->nt_table);
+      free(this->mat);
+      this->graph_ptr = NULL;
+      this->nt_table = NULL;
+      this->mat = NULL;
+      this->populated.store(false, std::memory_order_relaxed);
+    }
+
     int8_t* nt_table;
     int8_t* mat;
     gssw_graph* graph_ptr;
-    std::mutex lock;
+    std::atomic< bool > in_use; // claimed with a CAS by the thread aligning against this copy
+    std::atomic< bool > populated; // hint only, graph_ptr is authoritative once in_use is held
+    // only written by the thread holding in_use, so no read-modify-write is needed
+    std::atomic< uint64_t > hit_count;
+    std::atomic< uint64_t > miss_count;
+  };
+
+  struct GSSWGraphPoolStatistics
+  {
+    uint64_t hits; // a built copy was free
+    uint64_t misses; // a copy had to be cloned
+    uint64_t waits; // every slot was busy and the thread blocked
+    uint64_t released; // copies freed by releaseIdleGraphCopies
+    uint32_t live_copies;
+    uint32_t capacity;
   };
 
   class GSSWGraph : public IGraph
@@ -42,33 +77,60 @@
   public:
     typedef std::shared_ptr< GSSWGraph > SharedPtr;
     typedef std::shared_ptr< gssw_graph > GSSWGraphPtr;
-    typedef std::shared_ptr< gssw_graph_mapping > GSSWGraphMappingPtr;
 
     GSSWGraph(IReference::SharedPtr referencePtr, IVariantList::SharedPtr variantListPtr, Region::SharedPtr regionPtr, int matchValue, int misMatchValue, int gapOpenValue, int gapExtensionValue, uint32_t numGraphCopies);
     virtual ~GSSWGraph();
 
     virtual void constructGraph() override;
-    GSSWGraphMappingPtr traceBackAlignment(IAlignment::SharedPtr alignmentPtr, std::shared_ptr< GSSWGraphContainer > graphContainer);
-    /* GSSWGraphMappingPtr traceBackAlignment(IAlignment::SharedPtr alignmentPtr); */
+    GSSWMappingResult::SharedPtr traceBackAlignment(IAlignment::SharedPtr alignmentPtr, std::shared_ptr< GSSWGraphContainer > graphContainer);
+    GSSWMappingResult::SharedPtr alignBatch(const IAlignment::SharedPtr* alignmentPtrs, size_t alignmentCount, std::shared_ptr< GSSWGraphContainer > graphContainer);
+    GSSWMappingResult::SharedPtr alignBatch(const std::vector< IAlignment::SharedPtr >& alignmentPtrs, std::shared_ptr< GSSWGraphContainer > graphContainer);
     IVariant::SharedPtr getVariantFromNodeID(const uint32_t nodeID);
-    void recordAlignmentVariants(std::shared_ptr< gssw_graph_mapping > graphMapping, IAlignment::SharedPtr alignmentPtr);
+    void recordAlignmentVariants(GSSWMappingResult::SharedPtr mappingResultPtr, IAlignment::SharedPtr alignmentPtr);
+    // counts straight into the alleles, or into countAccumulatorPtr when given
+    void incrementAlleleCounts(const GSSWMappingResult::SharedPtr& mappingResultPtr, size_t idx, const IAlignment::SharedPtr& alignmentPtr, const AlleleCountAccumulator::SharedPtr& countAccumulatorPtr = nullptr, uint64_t groupKey = 0);
     gssw_graph* getGSSWGraph() { return this->m_graph_ptr; }
     int32_t getMatchValue() { return m_match; }
-    IAllele::SharedPtr getAllelePtrFromNodeID(uint32_t id);
+    const IAllele::SharedPtr& getAllelePtrFromNodeID(uint32_t id); // a null pointer for a node without an allele
+    // the variants the graph was built from, in position order, skipped ones left out
+    const std::vector< IVariant::SharedPtr >& getVariantPtrs() { return this->m_variant_ptrs; }
     size_t getTotalGraphLength() { return m_total_graph_length; }
     std::string getSkipped() { return (m_skipped) ? "skipped" : "not skipped"; }
+    // unique per graph, pass it to ThreadPool::enqueueWithAffinity so one worker aligns most of this graph's reads
+    uint64_t getGraphID() { return m_graph_id; }
 
-    position getStartPosition() { this->m_region_ptr->getStartPosition(); }
-    position getEndPosition() override {  this->m_region_ptr->getEndPosition(); }
+    std::string getReferenceID() { return this->m_region_ptr->getReferenceID(); }
+    position getStartPosition() { return this->m_region_ptr->getStartPosition(); }
+    position getEndPosition() override { return this->m_region_ptr->getEndPosition(); }
     std::shared_ptr< GSSWGraphContainer > getGraphContainer();
+    void releaseGraphContainer(std::shared_ptr< GSSWGraphContainer > graphContainerPtr);
+    size_t releaseIdleGraphCopies();
+    GSSWGraphPoolStatistics getGraphPoolStatistics();
 
     std::vector< std::tuple< std::string, std::string > > generateAllPaths();
 
   protected:
 
     void generateGraphCopies();
+    void populateGraphContainer(std::shared_ptr< GSSWGraphContainer > graphContainerPtr);
+    void copyGraphMapping(gssw_graph_mapping* graphMapping, GSSWMappingResult::SharedPtr mappingResultPtr, size_t idx);
     std::vector< gssw_node* > addAlternateVertices(const std::vector< gssw_node* >& altAndRefVertices, IVariant::SharedPtr variantPtr);
-    gssw_node* addReferenceVertex(position position, IAllele::SharedPtr refAllelePtr, std::vector< gssw_node* > altAndRefVertices);
+    gssw_node* addReferenceVertex(position position, IAllele::SharedPtr refAllelePtr, std::vector< gssw_node* > altAndRefVertices, int8_t* referenceNum = NULL);
+    IAllele::SharedPtr getReferenceAllele(Region::SharedPtr refRegionPtr, int8_t*& referenceNum);
+
+    // hands a claimed graph copy back when it goes out of scope, so an alignment that throws doesn't keep it in_use
+    class GraphContainerReleaser : private ::Noncopyable
+    {
+    public:
+    GraphContainerReleaser(GSSWGraph* graphPtr, const std::shared_ptr< GSSWGraphContainer >& graphContainerPtr) : m_graph_ptr(graphPtr), m_graph_container_ptr(graphContainerPtr) {}
+      ~GraphContainerReleaser() { this->m_graph_ptr->releaseGraphContainer(this->m_graph_container_ptr); }
+
+    private:
+      GSSWGraph* m_graph_ptr;
+      std::shared_ptr< GSSWGraphContainer > m_graph_container_ptr;
+    };
+
+    static const uint32_t s_symbolic_allele_flank_length = 1000; // bases kept on each side of a symbolic allele's breakpoints, more than a read spans
 
     std::deque< GSSWGraphPtr > m_gssw_contigs;
     int32_t m_match;
@@ -81,9 +143,12 @@
     Region::SharedPtr m_region_ptr;
     static uint32_t s_next_id;
     static std::mutex s_lock;
-    uint32_t m_num_graph_copies;
+    static std::atomic< uint64_t > s_next_graph_id;
+    uint64_t m_graph_id;
+    uint32_t m_num_graph_copies; // copies built eagerly, the rest of the pool is cloned on demand
     std::map< uint32_t, std::tuple< INode::SharedPtr, uint32_t, std::vector< IAlignment::SharedPtr > > > m_variant_counter;
     std::map< uint32_t, IVariant::SharedPtr > m_variants_map;
+    std::vector< IVariant::SharedPtr > m_variant_ptrs;
     std::vector< std::shared_ptr< GSSWGraphContainer > > m_graph_container_ptrs;
 
     size_t m_total_graph_length;
@@ -95,7 +160,8 @@
 				    IAllele::SharedPtr allelePtr,
 				    bool isReference,
 				    const int8_t* nt_table,
-				    const int8_t* score_matrix)
+				    const int8_t* score_matrix,
+				    int8_t* num = NULL) // the allele's nt_table codes if already known, the node takes ownership
     {
       gssw_node* n = (gssw_node*)calloc(1, sizeof(gssw_node));
       n->ref_len = referenceLength;
@@ -123,7 +189,7 @@
       n->len = allelePtr->getLength();
       n->seq = (char*)allelePtr->getSequence();
       n->data = (void*)allelePtr.get();
-      n->num = gssw_create_num(n->seq, n->len, nt_table);
+      n->num = (num != NULL) ? num : gssw_create_num(n->seq, n->len, nt_table);
       n->count_prev = 0;
       n->count_next = 0;
       n->alignment = NULL;
@@ -131,7 +197,7 @@
       return n;
     }
 
-    gssw_node* gssw_node_copy(gssw_node* node, int8_t* nt_table)
+    gssw_node* gssw_node_copy(gssw_node* node)
     {
       gssw_node* n = (gssw_node*)calloc(1, sizeof(gssw_node));
       n->ref_len = node->ref_len;
@@ -141,7 +207,9 @@
       n->len = node->len;
       n->seq = node->seq;
       n->data = node->data;
-      n->num = gssw_create_num(n->seq, n->len, nt_table);
+      // same sequence and table as the original, so its codes can be copied as they are
+      n->num = (int8_t*)malloc(n->len);
+      memcpy(n->num, node->num, n->len);
       n->count_prev = 0;
       n->count_next = 0;
       n->alignment = NULL;
@@ -151,13 +219,19 @@
 
   private:
     void graphConstructed();
+    std::shared_ptr< GSSWGraphContainer > tryGetGraphContainer();
+    static uint32_t getThreadOrdinal();
     IVariantList::SharedPtr m_variant_list_ptr;
     std::vector< IAllele::SharedPtr > m_reference_fragments; // contains the reference fragments so they are deleted when the graph is deleted
     std::unordered_map< uint32_t, IAllele::SharedPtr > m_node_id_to_allele_ptrs;
+    std::unordered_map< uint32_t, uint32_t > m_node_id_to_ordinal;
 
+    // only used by threads that find every graph copy busy, see getGraphContainer
     std::mutex m_traceback_lock;
     std::condition_variable m_condition;
-    std::queue< std::shared_ptr< GSSWGraphContainer > > m_graph_container_ptrs_queue;
+    std::atomic< uint32_t > m_waiting_count;
+    std::atomic< uint64_t > m_wait_count;
+    std::atomic< uint64_t > m_released_count;
 
   };
 
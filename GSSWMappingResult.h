@@ -0,0 +1,87 @@
+#ifndef GSSWMAPPINGRESULT_H
+#define GSSWMAPPINGRESULT_H
+
+#include "Noncopyable.hpp"
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+  struct GSSWCigarOperation
+  {
+    char type;
+    uint32_t length;
+  };
+
+  // one node visited by a mapping, node_ordinal is the index of the node in
+  // gssw_graph::nodes, which is the same for every copy of a GSSWGraph
+  struct GSSWNodeMapping
+  {
+    uint32_t node_ordinal;
+    uint32_t node_id;
+    uint32_t cigar_offset;
+    uint32_t cigar_count;
+  };
+
+  struct GSSWMappingRecord
+  {
+    int16_t score;
+    int32_t position; // position in the first node
+    uint32_t node_offset;
+    uint32_t node_count;
+  };
+
+  /*
+   * Owned copy of one or more gssw_graph_mappings. Nothing in here points
+   * into a gssw_graph, so the graph copy the reads were aligned against can
+   * be handed to another thread as soon as traceback finishes. All mappings
+   * share the same node and cigar buffers so a batch is stored contiguously.
+   */
+  class GSSWMappingResult : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< GSSWMappingResult > SharedPtr;
+
+  GSSWMappingResult(size_t size) :
+    m_records(size, GSSWMappingRecord())
+    {
+    }
+
+    ~GSSWMappingResult()
+      {
+      }
+
+    size_t size() { return this->m_records.size(); }
+    int16_t getScore(size_t idx = 0) { return this->m_records[idx].score; }
+    int32_t getPosition(size_t idx = 0) { return this->m_records[idx].position; }
+    uint32_t getNodeCount(size_t idx = 0) { return this->m_records[idx].node_count; }
+    const GSSWNodeMapping& getNodeMapping(size_t idx, uint32_t nodeIdx) { return this->m_node_mappings[this->m_records[idx].node_offset + nodeIdx]; }
+    const GSSWCigarOperation* getCigarOperations(const GSSWNodeMapping& nodeMapping) { return this->m_cigar_operations.data() + nodeMapping.cigar_offset; }
+
+    // same layout gssw_print_graph_mapping writes, score@position:id[cigar]...
+    std::string toString(size_t idx = 0)
+    {
+      std::string mappingString = std::to_string(getScore(idx)) + "@" + std::to_string(getPosition(idx)) + ":";
+      for (uint32_t i = 0; i < getNodeCount(idx); ++i)
+	{
+	  auto& nodeMapping = getNodeMapping(idx, i);
+	  auto cigarOperations = getCigarOperations(nodeMapping);
+	  mappingString += std::to_string(nodeMapping.node_id) + "[";
+	  for (uint32_t j = 0; j < nodeMapping.cigar_count; ++j)
+	    {
+	      mappingString += std::to_string(cigarOperations[j].length) + cigarOperations[j].type;
+	    }
+	  mappingString += "]";
+	}
+      return mappingString;
+    }
+
+  private:
+    friend class GSSWGraph;
+    std::vector< GSSWMappingRecord > m_records;
+    std::vector< GSSWNodeMapping > m_node_mappings;
+    std::vector< GSSWCigarOperation > m_cigar_operations;
+  };
+
+#endif
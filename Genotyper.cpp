@@ -0,0 +1,152 @@
+#include "Genotyper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+  const uint32_t Genotyper::s_max_genotype_quality;
+
+  Genotyper::Genotyper()
+  {
+    // chance that a read counted on an allele really came from another one,
+    // the worse the alignment score the likelier it was placed on the wrong allele
+    const double errorRates[AlleleCountTypeCount] = { 0.01, 0.03, 0.08, 0.15, 0.3, 0.5 };
+    for (size_t i = 0; i < AlleleCountTypeCount; ++i)
+      {
+	this->m_log_correct[i] = std::log10(1.0 - errorRates[i]);
+	this->m_log_error[i] = std::log10(errorRates[i]);
+      }
+  }
+
+  Genotyper::~Genotyper()
+  {
+  }
+
+  VariantGenotypes Genotyper::genotypeVariant(IVariant::SharedPtr variantPtr)
+  {
+    VariantGenotypes variantGenotypes;
+    variantGenotypes.variant_ptr = variantPtr;
+    std::vector< IAllele::SharedPtr > allelePtrs = variantPtr->getAltAllelePtrs();
+    allelePtrs.insert(allelePtrs.begin(), variantPtr->getRefAllelePtr());
+    uint32_t sampleCount = Sample::getSampleCount();
+    variantGenotypes.sample_genotypes.reserve(sampleCount);
+    for (uint32_t sampleID = 0; sampleID < sampleCount; ++sampleID)
+      {
+	variantGenotypes.sample_genotypes.emplace_back(genotypeSample(sampleID, allelePtrs));
+      }
+    return variantGenotypes;
+  }
+
+  std::vector< VariantGenotypes > Genotyper::genotypeGraph(GSSWGraph::SharedPtr graphPtr)
+  {
+    std::vector< VariantGenotypes > graphGenotypes;
+    for (auto& variantPtr : graphPtr->getVariantPtrs())
+      {
+	graphGenotypes.emplace_back(genotypeVariant(variantPtr));
+      }
+    return graphGenotypes;
+  }
+
+  SampleGenotype Genotyper::genotypeSample(uint32_t sampleID, const std::vector< IAllele::SharedPtr >& allelePtrs)
+  {
+    uint32_t alleleCount = allelePtrs.size();
+    uint32_t genotypeCount = (alleleCount * (alleleCount + 1)) / 2;
+    SampleGenotype sampleGenotype;
+    sampleGenotype.sample_id = sampleID;
+    sampleGenotype.depth = 0;
+    sampleGenotype.allele_indices[0] = 0;
+    sampleGenotype.allele_indices[1] = 0;
+    sampleGenotype.genotype_likelihoods.assign(genotypeCount, 0.0);
+    sampleGenotype.phred_likelihoods.assign(genotypeCount, 0);
+    sampleGenotype.genotype_quality = 0;
+    if (alleleCount < 2)
+      {
+	return sampleGenotype;
+      }
+
+    // log10 of a read's likelihood under one haplotype, and under a genotype
+    // whose two haplotypes differ on whether they carry the read's allele
+    double logHalf = std::log10(0.5);
+    double logOtherAllele = std::log10(alleleCount - 1.0);
+    for (uint32_t alleleIdx = 0; alleleIdx < alleleCount; ++alleleIdx)
+      {
+	for (size_t typeIdx = 0; typeIdx < AlleleCountTypeCount; ++typeIdx)
+	  {
+	    AlleleCountType alleleCountType = static_cast< AlleleCountType >(typeIdx);
+	    if (alleleCountType == AlleleCountType::Ambiguous)
+	      {
+		continue;
+	      }
+	    uint32_t count = allelePtrs[alleleIdx]->getForwardCount(sampleID, alleleCountType) + allelePtrs[alleleIdx]->getReverseCount(sampleID, alleleCountType);
+	    if (count == 0)
+	      {
+		continue;
+	      }
+	    sampleGenotype.depth += count;
+	    double logCorrect = this->m_log_correct[typeIdx];
+	    double logWrong = this->m_log_error[typeIdx] - logOtherAllele;
+	    double logMixed = logHalf + std::log10(std::pow(10.0, logCorrect) + std::pow(10.0, logWrong));
+	    for (uint32_t k = 0; k < alleleCount; ++k)
+	      {
+		for (uint32_t j = 0; j <= k; ++j)
+		  {
+		    uint32_t carried = (j == alleleIdx) + (k == alleleIdx);
+		    double logLikelihood = (carried == 2) ? logCorrect : ((carried == 1) ? logMixed : logWrong);
+		    sampleGenotype.genotype_likelihoods[getGenotypeIndex(j, k)] += count * logLikelihood;
+		  }
+	      }
+	  }
+      }
+    if (sampleGenotype.depth == 0)
+      {
+	return sampleGenotype;
+      }
+
+    size_t bestIdx = std::max_element(sampleGenotype.genotype_likelihoods.begin(), sampleGenotype.genotype_likelihoods.end()) - sampleGenotype.genotype_likelihoods.begin();
+    double bestLikelihood = sampleGenotype.genotype_likelihoods[bestIdx];
+    uint32_t secondBestPhred = s_max_phred;
+    for (size_t i = 0; i < genotypeCount; ++i)
+      {
+	double phred = std::round(-10.0 * (sampleGenotype.genotype_likelihoods[i] - bestLikelihood));
+	sampleGenotype.phred_likelihoods[i] = (uint32_t)std::min< double >(phred, s_max_phred);
+	if (i != bestIdx)
+	  {
+	    secondBestPhred = std::min(secondBestPhred, sampleGenotype.phred_likelihoods[i]);
+	  }
+      }
+    sampleGenotype.genotype_quality = std::min(secondBestPhred, s_max_genotype_quality);
+    for (uint32_t k = 0; k < alleleCount; ++k)
+      {
+	for (uint32_t j = 0; j <= k; ++j)
+	  {
+	    if (getGenotypeIndex(j, k) == bestIdx)
+	      {
+		sampleGenotype.allele_indices[0] = j;
+		sampleGenotype.allele_indices[1] = k;
+	      }
+	  }
+      }
+    return sampleGenotype;
+  }
+
+  std::string Genotyper::getGenotypeString(const SampleGenotype& sampleGenotype)
+  {
+    std::ostringstream genotypeStream;
+    if (sampleGenotype.depth == 0)
+      {
+	genotypeStream << "./.:0:.:.:.";
+	return genotypeStream.str();
+      }
+    genotypeStream << sampleGenotype.allele_indices[0] << "/" << sampleGenotype.allele_indices[1] << ":" << sampleGenotype.depth << ":" << sampleGenotype.genotype_quality << ":";
+    for (size_t i = 0; i < sampleGenotype.phred_likelihoods.size(); ++i)
+      {
+	genotypeStream << ((i > 0) ? "," : "") << sampleGenotype.phred_likelihoods[i];
+      }
+    genotypeStream << ":" << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < sampleGenotype.genotype_likelihoods.size(); ++i)
+      {
+	genotypeStream << ((i > 0) ? "," : "") << sampleGenotype.genotype_likelihoods[i];
+      }
+    return genotypeStream.str();
+  }
@@ -0,0 +1,69 @@
+#ifndef GENOTYPER_H
+#define GENOTYPER_H
+
+#include "IVariant.h"
+#include "GSSWGraph.h"
+#include "Sample.h"
+#include "Types.h"
+#include "Noncopyable.hpp"
+
+#include <memory>
+#include <vector>
+
+  struct SampleGenotype
+  {
+    uint32_t sample_id;
+    uint32_t depth; // reads counted on the variant's alleles, ambiguous ones left out
+    uint32_t allele_indices[2]; // GT, 0 is the reference allele
+    std::vector< double > genotype_likelihoods; // GL, log10, in VCF genotype order
+    std::vector< uint32_t > phred_likelihoods; // PL, 0 for the most likely genotype
+    uint32_t genotype_quality; // GQ
+  };
+
+  struct VariantGenotypes
+  {
+    IVariant::SharedPtr variant_ptr;
+    std::vector< SampleGenotype > sample_genotypes; // indexed by sample ID
+  };
+
+  /*
+   * Diploid genotype likelihoods straight from the allele counts. The counts
+   * an Allele keeps per sample, strand and AlleleCountType are sufficient
+   * statistics for the model, so a variant is genotyped in time proportional
+   * to its alleles and genotypes no matter how many reads were counted, and
+   * a region can be genotyped as soon as its counting is done.
+   *
+   * Every read counted on allele i is treated as evidence for i with an
+   * error rate taken from how well it aligned (its AlleleCountType). Under
+   * genotype j/k the read's likelihood is the mean of its likelihood under
+   * either haplotype: 1 - e when the haplotype is i, e / (alleles - 1) when
+   * it is not. Ambiguous reads carry no evidence and are left out.
+   */
+  class Genotyper : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< Genotyper > SharedPtr;
+    Genotyper();
+    ~Genotyper();
+
+    // every sample known to Sample::getSampleCount(), indexed by sample ID
+    VariantGenotypes genotypeVariant(IVariant::SharedPtr variantPtr);
+    std::vector< VariantGenotypes > genotypeGraph(GSSWGraph::SharedPtr graphPtr);
+
+    // GT:DP:GQ:PL:GL as it goes in a VCF sample column
+    static std::string getGenotypeString(const SampleGenotype& sampleGenotype);
+
+    // index of genotype j/k (j <= k) in the GL and PL arrays
+    static size_t getGenotypeIndex(uint32_t j, uint32_t k) { return (k * (k + 1)) / 2 + j; }
+
+  private:
+    static const uint32_t s_max_phred = 255;
+    static const uint32_t s_max_genotype_quality = 99;
+
+    SampleGenotype genotypeSample(uint32_t sampleID, const std::vector< IAllele::SharedPtr >& allelePtrs);
+
+    double m_log_correct[AlleleCountTypeCount]; // log10(1 - e) per AlleleCountType
+    double m_log_error[AlleleCountTypeCount]; // log10(e), split over the other alleles when used
+  };
+
+#endif
@@ -21,25 +21,30 @@ class IAlignment : private Noncopyable{
   virtual ~IAlignment() {delete this->m_mapping_mutex;}
 
   virtual const char* getSequence() = 0;
-  virtual const position getPosition() = 0;
-  virtual const size_t getLength() = 0;
+  // the sequence as gssw_create_nt_table codes it (A 0, C 1, G 2, T 3, anything else 4),
+  // NULL if the alignment doesn't keep it encoded and the graph should encode it
+  virtual const int8_t* getEncodedSequence() {return NULL;}
+  virtual position getPosition() = 0;
+  // the contig getPosition is on, empty if the alignment doesn't know it
+  virtual const std::string getReferenceID() {return "";}
+  virtual size_t getLength() = 0;
   virtual const std::string getID() {return "";}
-  virtual const bool isFirstMate() {return false;}
-  virtual const bool isMapped() {return false;}
-  virtual const bool isReverseStrand() {return false;}
-  virtual const bool isDuplicate() {return false;}
-  virtual const uint16_t getOriginalMapQuality() {return 0;}
+  virtual bool isFirstMate() {return false;}
+  virtual bool isMapped() {return false;}
+  virtual bool isReverseStrand() {return false;}
+  virtual bool isDuplicate() {return false;}
+  virtual uint16_t getOriginalMapQuality() {return 0;}
   virtual std::vector< std::shared_ptr< IMapping> > getMappingPtrs() {return this->m_mapping_ptrs;}
   virtual void addMapping(std::shared_ptr< IMapping > mappingPtr){
     std::lock_guard< std::recursive_mutex > r_lock(*this->m_mapping_mutex);
     m_mapping_ptrs.emplace_back(mappingPtr);
   }
   std::recursive_mutex* getMappingMutex() {return this->m_mapping_mutex;}
-  const Sample::SharedPtr getSample() {return m_sample_ptr;}
+  const Sample::SharedPtr& getSample() {return m_sample_ptr;}
   
-  virtual const void setSequence(char* seq, uint32_t len) = 0;
-  virtual const void removeSequence() = 0;
-  virtual const void incrementReferenceCount() =0;
+  virtual void setSequence(char* seq, uint32_t len) = 0;
+  virtual void removeSequence() = 0;
+  virtual void incrementReferenceCount() =0;
 
  protected:
   std::mutex m_mutex;
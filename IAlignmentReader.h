@@ -0,0 +1,25 @@
+#ifndef IALIGNMENTREADER_H
+#define IALIGNMENTREADER_H
+
+#include "IAlignment.h"
+#include "Noncopyable.hpp"
+
+#include <memory>
+
+  /*
+   * An interface for alignment readers, mirrors IVariantList::getNextVariant.
+   * Readers hand out decoded alignments one at a time so that callers never
+   * need to hold every alignment of a region in memory.
+   */
+  class IAlignmentReader : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< IAlignmentReader > SharedPtr;
+    IAlignmentReader() {}
+    virtual ~IAlignmentReader() {}
+
+    // returns false once the reader is exhausted
+    virtual bool getNextAlignment(IAlignment::SharedPtr& alignmentPtr) = 0;
+  };
+
+#endif
@@ -4,6 +4,7 @@
 #include "Types.h"
 #include "Noncopyable.hpp"
 
+#include <memory>
 #include <unordered_map>
 #include <iostream>
 
@@ -28,11 +29,14 @@ class IAllele : private Noncopyable, public std::enable_shared_from_this< IAllel
   
   virtual uint32_t getForwardCount(const std::string& sampleName, AlleleCountType alleleCountType) = 0;
   virtual uint32_t getReverseCount(const std::string& sampleName, AlleleCountType alleleCountType) = 0;
+  virtual uint32_t getForwardCount(uint32_t sampleID, AlleleCountType alleleCountType) = 0;
+  virtual uint32_t getReverseCount(uint32_t sampleID, AlleleCountType alleleCountType) = 0;
   virtual uint32_t getTotalCount(AlleleCountType alleleCountType) = 0;
   
   virtual void incrementForwardCount(std::shared_ptr< Sample > alignmentPtr, AlleleCountType alleleCountType) = 0;
   virtual void incrementReverseCount(std::shared_ptr< Sample > alignmentPtr, AlleleCountType alleleCountType) =0;
-  virtual void incrementCount(bool isReverseStrand, std::shared_ptr< Sample > alignmentPtr, AlleleCountType alleleCountType) = 0;
+  virtual void incrementCount(bool isReverseStrand, const std::shared_ptr< Sample >& alignmentPtr, AlleleCountType alleleCountType) = 0;
+  virtual void addCount(bool isReverseStrand, uint32_t sampleID, AlleleCountType alleleCountType, uint32_t count) = 0;
   
   void setVariantWPtr(std::weak_ptr< IVariant > variantWPtr){m_variant_wptr = variantWPtr;}
   std::weak_ptr< IVariant > getVariantWPtr() {return m_variant_wptr;}
@@ -4,10 +4,19 @@
 #include <iostream>
 #include <stdint.h>
 #include <memory>
+#include <string>
 
 #include "Region.h"
 #include "Types.h"
 
+// bases owned by the reference, valid for as long as the reference is
+struct SequenceView {
+  const char* sequence;
+  size_t length;
+
+  std::string toString() const {return std::string(sequence, length);}
+};
+
 class IReference : private Noncopyable{
  public:
   typedef std::shared_ptr<IReference> SharedPtr;
@@ -15,17 +24,22 @@ class IReference : private Noncopyable{
   IReference(){}
   virtual ~IReference() {}
 
-  virtual const char* getSequence() {m_sequence.c_str();}
-  virtual size_t getSequenceSize(){m_sequence.size();}
-  virtual std::string getSequenceFromRegion(Region::SharedPtr regionPtr) {
+  virtual const char* getSequence() {return m_sequence.c_str();}
+  virtual size_t getSequenceSize(){return m_sequence.size();}
+
+  // the region's bases without copying them
+  virtual SequenceView getSequenceViewFromRegion(Region::SharedPtr regionPtr) {
     uint64_t sequenceLength = regionPtr->getEndPosition()-regionPtr->getStartPosition();
     uint32_t startPosition = regionPtr->getStartPosition() - this->m_region->getStartPosition();
     if (regionPtr->getBased() == Region::BASED::ONE){
       startPosition -=1;
       sequenceLength +=1;
     }
-    std::string sequence = std::string(this->m_sequence.c_str() + startPosition, sequenceLength);
-    return sequence;
+    return {this->m_sequence.c_str() + startPosition, sequenceLength};
+  }
+
+  virtual std::string getSequenceFromRegion(Region::SharedPtr regionPtr) {
+    return getSequenceViewFromRegion(regionPtr).toString();
   }
 
   Region::SharedPtr getRegion() {return this->m_region;}
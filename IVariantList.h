@@ -29,6 +29,9 @@
     virtual size_t getCount() = 0;
     virtual void sort() = 0;
     virtual std::vector< IVariant::SharedPtr > getAllVariantPtrs() = 0;
+    // the variants overlapping the region through an index, not a pass over
+    // the list, so region workers can each fetch their own from one list
+    virtual IVariantList::SharedPtr getVariantsInRegion(Region::SharedPtr regionPtr) = 0;
   };
 
 
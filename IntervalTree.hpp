@@ -0,0 +1,178 @@
+#ifndef INTERVALTREE_HPP
+#define INTERVALTREE_HPP
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "Noncopyable.hpp"
+
+  /*
+   * Implicit augmented interval tree (Heng Li's cgranges). The intervals are
+   * kept in one array sorted by begin and the array itself is the tree: the
+   * node at index i sits on level k where k is the number of trailing one
+   * bits of i, its children are i - 2^(k-1) and i + 2^(k-1). Each node also
+   * holds the largest end in its subtree, so a query skips every subtree
+   * that ends before the query begins.
+   *
+   * Intervals are zero based and half open. Add them all, call index once,
+   * then query from as many threads as needed. Building is O(n log n), a
+   * query O(log n + overlaps).
+   */
+  template< typename T >
+  class IntervalTree : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< IntervalTree > SharedPtr;
+
+  IntervalTree() :
+    m_max_level(-1),
+    m_is_indexed(true)
+    {
+    }
+
+    ~IntervalTree()
+      {
+      }
+
+    void add(uint64_t beginPosition, uint64_t endPosition, const T& value)
+    {
+      this->m_intervals.push_back({beginPosition, endPosition, endPosition, value});
+      this->m_is_indexed = false;
+    }
+
+    void index()
+    {
+      std::stable_sort(this->m_intervals.begin(), this->m_intervals.end(),
+		       [](const Interval& a, const Interval& b) { return a.begin_position < b.begin_position; });
+      int64_t count = this->m_intervals.size();
+      this->m_max_level = -1;
+      this->m_is_indexed = true;
+      if (count == 0)
+	{
+	  return;
+	}
+      // leaves are the even indices, their subtrees are themselves
+      int64_t lastIdx = 0;
+      uint64_t lastMaxEnd = 0;
+      for (int64_t i = 0; i < count; i += 2)
+	{
+	  lastIdx = i;
+	  lastMaxEnd = this->m_intervals[i].max_end_position = this->m_intervals[i].end_position;
+	}
+      int32_t level = 1;
+      for (; (1ll << level) <= count; ++level)
+	{
+	  int64_t childOffset = 1ll << (level - 1);
+	  for (int64_t i = (childOffset << 1) - 1; i < count; i += childOffset << 2)
+	    {
+	      // a right child past the end of the array stands for the last subtree that exists
+	      uint64_t leftMaxEnd = this->m_intervals[i - childOffset].max_end_position;
+	      uint64_t rightMaxEnd = (i + childOffset < count) ? this->m_intervals[i + childOffset].max_end_position : lastMaxEnd;
+	      this->m_intervals[i].max_end_position = std::max(this->m_intervals[i].end_position, std::max(leftMaxEnd, rightMaxEnd));
+	    }
+	  // move lastIdx up to its parent
+	  lastIdx = ((lastIdx >> level) & 1) ? lastIdx - childOffset : lastIdx + childOffset;
+	  if (lastIdx < count)
+	    {
+	      lastMaxEnd = std::max(lastMaxEnd, this->m_intervals[lastIdx].max_end_position);
+	    }
+	}
+      this->m_max_level = level - 1;
+    }
+
+    // appends the values of the intervals overlapping [beginPosition, endPosition) in begin order
+    void getOverlapping(uint64_t beginPosition, uint64_t endPosition, std::vector< T >& values) const
+    {
+      if (this->m_max_level < 0)
+	{
+	  return;
+	}
+      struct StackEntry
+      {
+	int32_t level;
+	int64_t idx;
+	bool left_done;
+      };
+      int64_t count = this->m_intervals.size();
+      StackEntry stack[64];
+      int32_t stackSize = 0;
+      stack[stackSize++] = { this->m_max_level, (1ll << this->m_max_level) - 1, false };
+      while (stackSize > 0)
+	{
+	  StackEntry entry = stack[--stackSize];
+	  if (entry.level <= 3)
+	    {
+	      // small subtrees are scanned in array order
+	      int64_t firstIdx = entry.idx >> entry.level << entry.level;
+	      int64_t lastIdx = std::min< int64_t >(firstIdx + (1ll << (entry.level + 1)) - 1, count);
+	      for (int64_t i = firstIdx; i < lastIdx && this->m_intervals[i].begin_position < endPosition; ++i)
+		{
+		  if (beginPosition < this->m_intervals[i].end_position)
+		    {
+		      values.push_back(this->m_intervals[i].value);
+		    }
+		}
+	    }
+	  else if (!entry.left_done)
+	    {
+	      int64_t leftIdx = entry.idx - (1ll << (entry.level - 1));
+	      stack[stackSize++] = { entry.level, entry.idx, true };
+	      if (leftIdx >= count || this->m_intervals[leftIdx].max_end_position > beginPosition)
+		{
+		  stack[stackSize++] = { entry.level - 1, leftIdx, false };
+		}
+	    }
+	  else if (entry.idx < count && this->m_intervals[entry.idx].begin_position < endPosition)
+	    {
+	      if (beginPosition < this->m_intervals[entry.idx].end_position)
+		{
+		  values.push_back(this->m_intervals[entry.idx].value);
+		}
+	      stack[stackSize++] = { entry.level - 1, entry.idx + (1ll << (entry.level - 1)), false };
+	    }
+	}
+    }
+
+    /*
+     * The values grouped into clusters of intervals that overlap directly or
+     * through other intervals, in begin order. One pass over the sorted
+     * array, a new cluster starts at the first interval that begins at or
+     * past everything before it.
+     */
+    std::vector< std::vector< T > > getClusters() const
+    {
+      std::vector< std::vector< T > > clusters;
+      uint64_t clusterEndPosition = 0;
+      for (auto& interval : this->m_intervals)
+	{
+	  if (clusters.empty() || interval.begin_position >= clusterEndPosition)
+	    {
+	      clusters.emplace_back();
+	      clusterEndPosition = interval.end_position;
+	    }
+	  clusters.back().push_back(interval.value);
+	  clusterEndPosition = std::max(clusterEndPosition, interval.end_position);
+	}
+      return clusters;
+    }
+
+    size_t size() const { return this->m_intervals.size(); }
+    bool isIndexed() const { return this->m_is_indexed; }
+
+  private:
+    struct Interval
+    {
+      uint64_t begin_position;
+      uint64_t end_position;
+      uint64_t max_end_position; // of the subtree this interval is the root of
+      T value;
+    };
+
+    std::vector< Interval > m_intervals;
+    int32_t m_max_level;
+    bool m_is_indexed;
+  };
+
+#endif
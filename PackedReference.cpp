@@ -0,0 +1,384 @@
+#include "PackedReference.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+  PackedReference::PackedReference(const std::string& fastaPath, const std::string& cachePath) :
+    m_mapped_data(nullptr),
+    m_mapped_size(0),
+    m_packed_size(0)
+  {
+    std::string packedCachePath = cachePath.empty() ? fastaPath + ".packed" : cachePath;
+    struct stat fastaStat;
+    if (stat(fastaPath.c_str(), &fastaStat) != 0)
+      {
+	// no FASTA to compare against, a cache on its own is still usable
+	if (!loadCache(packedCachePath, 0, 0))
+	  {
+	    throw std::runtime_error("PackedReference could not read " + fastaPath + " or " + packedCachePath);
+	  }
+	return;
+      }
+    if (!loadCache(packedCachePath, fastaStat.st_size, fastaStat.st_mtime))
+      {
+	buildFromFasta(fastaPath, packedCachePath, fastaStat.st_size, fastaStat.st_mtime);
+      }
+  }
+
+  PackedReference::~PackedReference()
+  {
+    if (this->m_mapped_data != nullptr)
+      {
+	munmap((void*)this->m_mapped_data, this->m_mapped_size);
+      }
+  }
+
+  // fastaSize 0 skips the check that the cache was built from the current FASTA
+  bool PackedReference::loadCache(const std::string& cachePath, uint64_t fastaSize, int64_t fastaModifiedTime)
+  {
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0)
+      {
+	return false;
+      }
+    struct stat cacheStat;
+    if (fstat(fd, &cacheStat) != 0 || (size_t)cacheStat.st_size < sizeof(CacheHeader))
+      {
+	close(fd);
+	return false;
+      }
+    size_t mappedSize = cacheStat.st_size;
+    void* mappedData = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mappedData == MAP_FAILED)
+      {
+	return false;
+      }
+
+    const char* data = (const char*)mappedData;
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = header.magic == s_cache_magic && header.version == s_cache_version &&
+      (fastaSize == 0 || (header.fasta_size == fastaSize && header.fasta_modified_time == fastaModifiedTime)) &&
+      header.n_run_offset + header.n_run_count * sizeof(NRun) <= mappedSize && header.packed_offset + header.packed_size <= mappedSize &&
+      header.n_run_offset % 8 == 0;
+    const NRun* nRuns = (const NRun*)(data + header.n_run_offset);
+    const uint8_t* packedBases = (const uint8_t*)(data + header.packed_offset);
+    uint64_t offset = sizeof(CacheHeader);
+    for (uint32_t i = 0; valid && i < header.contig_count; ++i)
+      {
+	uint64_t nameLength;
+	if (offset + sizeof(nameLength) > mappedSize) { valid = false; break; }
+	memcpy(&nameLength, data + offset, sizeof(nameLength));
+	offset += sizeof(nameLength);
+	if (offset + padToEight(nameLength) + 4 * sizeof(uint64_t) > mappedSize) { valid = false; break; }
+	std::string name(data + offset, nameLength);
+	offset += padToEight(nameLength);
+	uint64_t fields[4]; // length, packed offset, first N run, N run count
+	memcpy(fields, data + offset, sizeof(fields));
+	offset += sizeof(fields);
+	if (fields[1] + (fields[0] + 3) / 4 > header.packed_size || fields[2] + fields[3] > header.n_run_count) { valid = false; break; }
+	addContig(name, fields[0], packedBases + fields[1], nRuns + fields[2], fields[3]);
+      }
+    if (!valid)
+      {
+	this->m_contigs.clear();
+	this->m_contigs_by_name.clear();
+	munmap(mappedData, mappedSize);
+	return false;
+      }
+    this->m_mapped_data = data;
+    this->m_mapped_size = mappedSize;
+    this->m_packed_size = header.packed_size;
+    return true;
+  }
+
+  void PackedReference::buildFromFasta(const std::string& fastaPath, const std::string& cachePath, uint64_t fastaSize, int64_t fastaModifiedTime)
+  {
+    std::ifstream fastaStream(fastaPath);
+    if (!fastaStream.good())
+      {
+	throw std::runtime_error("PackedReference could not open " + fastaPath);
+      }
+
+    // packed into the owned buffers first, offsets rather than pointers since they grow
+    struct ContigRecord
+    {
+      std::string name;
+      uint64_t length;
+      uint64_t packed_offset;
+      uint64_t n_run_index;
+    };
+    std::vector< ContigRecord > contigRecords;
+    int8_t baseCodes[256];
+    memset(baseCodes, -1, sizeof(baseCodes));
+    baseCodes['A'] = baseCodes['a'] = 0;
+    baseCodes['C'] = baseCodes['c'] = 1;
+    baseCodes['G'] = baseCodes['g'] = 2;
+    baseCodes['T'] = baseCodes['t'] = 3;
+
+    std::string line;
+    while (std::getline(fastaStream, line))
+      {
+	if (!line.empty() && line[0] == '>')
+	  {
+	    size_t nameEnd = 1;
+	    while (nameEnd < line.size() && !isspace(line[nameEnd])) { ++nameEnd; }
+	    contigRecords.push_back({ line.substr(1, nameEnd - 1), 0, this->m_owned_bases.size(), this->m_owned_n_runs.size() });
+	    continue;
+	  }
+	if (contigRecords.empty())
+	  {
+	    continue;
+	  }
+	ContigRecord& contigRecord = contigRecords.back();
+	for (char base : line)
+	  {
+	    if (base == '\r') { continue; }
+	    int8_t code = baseCodes[(uint8_t)base];
+	    uint64_t basePosition = contigRecord.length++;
+	    if (basePosition % 4 == 0)
+	      {
+		this->m_owned_bases.push_back(0);
+	      }
+	    if (code < 0)
+	      {
+		bool extendsRun = this->m_owned_n_runs.size() > contigRecord.n_run_index && this->m_owned_n_runs.back().start + this->m_owned_n_runs.back().length == basePosition;
+		if (extendsRun) { ++this->m_owned_n_runs.back().length; }
+		else { this->m_owned_n_runs.push_back({ basePosition, 1 }); }
+		code = 0;
+	      }
+	    this->m_owned_bases.back() |= (uint8_t)(code << ((basePosition % 4) * 2));
+	  }
+      }
+
+    // write the cache under a temporary name so another process never maps half of it
+    std::string temporaryPath = cachePath + ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream cacheStream(temporaryPath, std::ios::binary);
+      CacheHeader header;
+      header.magic = s_cache_magic;
+      header.version = s_cache_version;
+      header.contig_count = contigRecords.size();
+      header.fasta_size = fastaSize;
+      header.fasta_modified_time = fastaModifiedTime;
+      header.n_run_count = this->m_owned_n_runs.size();
+      header.packed_size = this->m_owned_bases.size();
+      uint64_t contigTableSize = 0;
+      for (auto& contigRecord : contigRecords)
+	{
+	  contigTableSize += sizeof(uint64_t) + padToEight(contigRecord.name.size()) + 4 * sizeof(uint64_t);
+	}
+      header.n_run_offset = sizeof(CacheHeader) + contigTableSize;
+      header.packed_offset = header.n_run_offset + header.n_run_count * sizeof(NRun);
+      cacheStream.write((const char*)&header, sizeof(header));
+      const char padding[8] = { 0 };
+      for (size_t i = 0; i < contigRecords.size(); ++i)
+	{
+	  uint64_t nameLength = contigRecords[i].name.size();
+	  uint64_t nRunEnd = (i + 1 < contigRecords.size()) ? contigRecords[i + 1].n_run_index : this->m_owned_n_runs.size();
+	  uint64_t fields[4] = { contigRecords[i].length, contigRecords[i].packed_offset, contigRecords[i].n_run_index, nRunEnd - contigRecords[i].n_run_index };
+	  cacheStream.write((const char*)&nameLength, sizeof(nameLength));
+	  cacheStream.write(contigRecords[i].name.c_str(), nameLength);
+	  cacheStream.write(padding, padToEight(nameLength) - nameLength);
+	  cacheStream.write((const char*)fields, sizeof(fields));
+	}
+      cacheStream.write((const char*)this->m_owned_n_runs.data(), this->m_owned_n_runs.size() * sizeof(NRun));
+      cacheStream.write((const char*)this->m_owned_bases.data(), this->m_owned_bases.size());
+      cacheStream.close();
+      if (cacheStream.good() && rename(temporaryPath.c_str(), cachePath.c_str()) == 0 && loadCache(cachePath, fastaSize, fastaModifiedTime))
+	{
+	  std::vector< uint8_t >().swap(this->m_owned_bases);
+	  std::vector< NRun >().swap(this->m_owned_n_runs);
+	  return;
+	}
+      std::remove(temporaryPath.c_str());
+    }
+
+    // the cache couldn't be written, serve from the buffers instead
+    for (size_t i = 0; i < contigRecords.size(); ++i)
+      {
+	uint64_t nRunEnd = (i + 1 < contigRecords.size()) ? contigRecords[i + 1].n_run_index : this->m_owned_n_runs.size();
+	addContig(contigRecords[i].name, contigRecords[i].length, this->m_owned_bases.data() + contigRecords[i].packed_offset, this->m_owned_n_runs.data() + contigRecords[i].n_run_index, nRunEnd - contigRecords[i].n_run_index);
+      }
+    this->m_packed_size = this->m_owned_bases.size();
+  }
+
+  void PackedReference::addContig(const std::string& name, uint64_t length, const uint8_t* packedBases, const NRun* nRuns, uint64_t nRunCount)
+  {
+    std::unique_ptr< PackedContig > contigPtr(new PackedContig());
+    contigPtr->name = name;
+    contigPtr->length = length;
+    contigPtr->packed_bases = packedBases;
+    contigPtr->n_runs = nRuns;
+    contigPtr->n_run_count = nRunCount;
+    this->m_contigs_by_name.emplace(name, contigPtr.get());
+    this->m_contigs.emplace_back(std::move(contigPtr));
+  }
+
+  PackedReference::PackedContig* PackedReference::getContig(const std::string& contigName, position startPosition, size_t length)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	throw std::invalid_argument("PackedReference has no contig " + contigName);
+      }
+    if (startPosition + (uint64_t)length > iter->second->length)
+      {
+	throw std::invalid_argument("PackedReference region " + contigName + ":" + std::to_string(startPosition) + "+" + std::to_string(length) + " is past the contig's end");
+      }
+    return iter->second;
+  }
+
+  void PackedReference::getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length)
+  {
+    // same conventions as IReference: one based regions include their end, zero based ones don't
+    length = regionPtr->getEndPosition() - regionPtr->getStartPosition();
+    startPosition = regionPtr->getStartPosition();
+    if (regionPtr->getBased() == Region::BASED::ONE)
+      {
+	startPosition -= 1;
+	length += 1;
+      }
+  }
+
+  std::string PackedReference::getSequenceFromRegion(Region::SharedPtr regionPtr)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    std::string sequence(length, 'N');
+    getSequence(regionPtr->getReferenceID(), startPosition, length, &sequence[0]);
+    return sequence;
+  }
+
+  SequenceView PackedReference::getSequenceViewFromRegion(Region::SharedPtr regionPtr)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    PackedContig* contigPtr = getContig(regionPtr->getReferenceID(), startPosition, length);
+    std::call_once(contigPtr->unpack_flag, [&]()
+		   {
+		     std::string unpackedBases(contigPtr->length, 'N');
+		     getSequence(contigPtr->name, 0, contigPtr->length, &unpackedBases[0]);
+		     contigPtr->unpacked_bases.swap(unpackedBases);
+		   });
+    return { contigPtr->unpacked_bases.data() + startPosition, length };
+  }
+
+  void PackedReference::getNumericSequenceFromRegion(Region::SharedPtr regionPtr, int8_t* numericSequence)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    getNumericSequence(regionPtr->getReferenceID(), startPosition, length, numericSequence);
+  }
+
+  void PackedReference::getNumericSequence(const std::string& contigName, position startPosition, size_t length, int8_t* numericSequence)
+  {
+    PackedContig* contigPtr = getContig(contigName, startPosition, length);
+    unpackCodes(contigPtr->packed_bases, startPosition, length, numericSequence);
+    maskNRuns(contigPtr, startPosition, length, numericSequence);
+  }
+
+  void PackedReference::getSequence(const std::string& contigName, position startPosition, size_t length, char* sequence)
+  {
+    // unpack the codes into the caller's buffer and turn them into letters in place
+    getNumericSequence(contigName, startPosition, length, (int8_t*)sequence);
+    static const char s_code_bases[5] = { 'A', 'C', 'G', 'T', 'N' };
+    for (size_t i = 0; i < length; ++i)
+      {
+	sequence[i] = s_code_bases[(uint8_t)sequence[i]];
+      }
+  }
+
+  void PackedReference::unpackCodes(const uint8_t* packedBases, uint64_t startPosition, size_t length, int8_t* codes)
+  {
+    size_t i = 0;
+    for (; i < length && ((startPosition + i) & 3) != 0; ++i)
+      {
+	codes[i] = (packedBases[(startPosition + i) >> 2] >> (((startPosition + i) & 3) * 2)) & 3;
+      }
+#ifdef __SSE2__
+    // 16 packed bytes to 64 codes: split out the four two bit fields of every
+    // byte, then interleave them back into base order
+    const __m128i fieldMask = _mm_set1_epi8(3);
+    for (; i + 64 <= length; i += 64)
+      {
+	__m128i packed = _mm_loadu_si128((const __m128i*)(packedBases + ((startPosition + i) >> 2)));
+	__m128i field0 = _mm_and_si128(packed, fieldMask);
+	__m128i field1 = _mm_and_si128(_mm_srli_epi16(packed, 2), fieldMask);
+	__m128i field2 = _mm_and_si128(_mm_srli_epi16(packed, 4), fieldMask);
+	__m128i field3 = _mm_and_si128(_mm_srli_epi16(packed, 6), fieldMask);
+	__m128i low01 = _mm_unpacklo_epi8(field0, field1);
+	__m128i high01 = _mm_unpackhi_epi8(field0, field1);
+	__m128i low23 = _mm_unpacklo_epi8(field2, field3);
+	__m128i high23 = _mm_unpackhi_epi8(field2, field3);
+	_mm_storeu_si128((__m128i*)(codes + i), _mm_unpacklo_epi16(low01, low23));
+	_mm_storeu_si128((__m128i*)(codes + i + 16), _mm_unpackhi_epi16(low01, low23));
+	_mm_storeu_si128((__m128i*)(codes + i + 32), _mm_unpacklo_epi16(high01, high23));
+	_mm_storeu_si128((__m128i*)(codes + i + 48), _mm_unpackhi_epi16(high01, high23));
+      }
+#endif
+    for (; i + 4 <= length; i += 4)
+      {
+	uint8_t packed = packedBases[(startPosition + i) >> 2];
+	codes[i] = packed & 3;
+	codes[i + 1] = (packed >> 2) & 3;
+	codes[i + 2] = (packed >> 4) & 3;
+	codes[i + 3] = (packed >> 6) & 3;
+      }
+    for (; i < length; ++i)
+      {
+	codes[i] = (packedBases[(startPosition + i) >> 2] >> (((startPosition + i) & 3) * 2)) & 3;
+      }
+  }
+
+  void PackedReference::maskNRuns(const PackedContig* contigPtr, uint64_t startPosition, size_t length, int8_t* codes)
+  {
+    const NRun* runsEnd = contigPtr->n_runs + contigPtr->n_run_count;
+    // the first run ending after the start, runs don't overlap so their ends are sorted too
+    const NRun* run = std::upper_bound(contigPtr->n_runs, runsEnd, startPosition, [](uint64_t pos, const NRun& nRun) { return pos < nRun.start + nRun.length; });
+    uint64_t endPosition = startPosition + length;
+    for (; run != runsEnd && run->start < endPosition; ++run)
+      {
+	uint64_t maskStart = std::max(run->start, startPosition);
+	uint64_t maskEnd = std::min(run->start + run->length, endPosition);
+	memset(codes + (maskStart - startPosition), 4, maskEnd - maskStart);
+      }
+  }
+
+  std::vector< std::string > PackedReference::getContigNames()
+  {
+    std::vector< std::string > contigNames;
+    for (auto& contigPtr : this->m_contigs)
+      {
+	contigNames.emplace_back(contigPtr->name);
+      }
+    return contigNames;
+  }
+
+  bool PackedReference::getContigLength(const std::string& contigName, uint64_t& length)
+  {
+    auto iter = this->m_contigs_by_name.find(contigName);
+    if (iter == this->m_contigs_by_name.end())
+      {
+	return false;
+      }
+    length = iter->second->length;
+    return true;
+  }
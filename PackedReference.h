@@ -0,0 +1,116 @@
+#ifndef PACKEDREFERENCE_H
+#define PACKEDREFERENCE_H
+
+#include "IReference.h"
+#include "Region.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * A reference held at two bits per base, a quarter of what the text takes.
+   * Anything that isn't A, C, G or T (N and the other IUPAC codes) is packed
+   * as A and recorded in a sorted list of N runs that is laid over the bases
+   * when they are unpacked, so those positions come back as N.
+   *
+   * The packed form is built from the FASTA once and written to a cache file
+   * (the FASTA path plus ".packed" unless told otherwise) that later runs map
+   * straight in. The cache remembers the FASTA's size and modification time
+   * and is rebuilt when they no longer match. If the cache can't be written
+   * the packed reference is just kept in memory.
+   *
+   * getNumericSequence writes the codes gssw_create_nt_table gives each base
+   * (A 0, C 1, G 2, T 3, anything else 4) straight into a caller's buffer,
+   * unpacking with SSE2 where available, so graph nodes can be built without
+   * going through characters. Packed bases can't be viewed in place, so the
+   * first view into a contig unpacks the whole contig into a copy that stays
+   * until the reference goes, a byte per base. Use getSequenceFromRegion
+   * where a copy of the region will do.
+   */
+  class PackedReference : public IReference
+  {
+  public:
+    typedef std::shared_ptr< PackedReference > SharedPtr;
+
+    // throws std::runtime_error if neither a valid cache nor the FASTA can be read
+    PackedReference(const std::string& fastaPath, const std::string& cachePath = "");
+    ~PackedReference();
+
+    std::string getSequenceFromRegion(Region::SharedPtr regionPtr) override;
+    SequenceView getSequenceViewFromRegion(Region::SharedPtr regionPtr) override;
+
+    // zero based start, throw std::invalid_argument for an unknown contig or a range past its end
+    void getNumericSequence(const std::string& contigName, position startPosition, size_t length, int8_t* numericSequence);
+    void getNumericSequenceFromRegion(Region::SharedPtr regionPtr, int8_t* numericSequence);
+    void getSequence(const std::string& contigName, position startPosition, size_t length, char* sequence); // upper case
+
+    std::vector< std::string > getContigNames();
+    bool getContigLength(const std::string& contigName, uint64_t& length);
+    size_t getPackedSize() { return this->m_packed_size; }
+
+  private:
+    struct NRun
+    {
+      uint64_t start;
+      uint64_t length;
+    };
+
+    struct PackedContig
+    {
+      std::string name;
+      uint64_t length;
+      const uint8_t* packed_bases; // four bases a byte, the first in the low bits
+      const NRun* n_runs;
+      uint64_t n_run_count;
+      std::once_flag unpack_flag;
+      std::string unpacked_bases; // set once by unpack_flag, what views point into
+    };
+
+    /*
+     * Cache file layout, native byte order since it never leaves the machine:
+     *   header
+     *   per contig: name length, name padded to 8 bytes, length, offset of its
+     *               bases in the packed section, first N run and N run count
+     *   N runs      every contig's, each contig's sorted by start
+     *   packed      bases, each contig starting on a new byte
+     */
+    struct CacheHeader
+    {
+      uint64_t magic;
+      uint32_t version;
+      uint32_t contig_count;
+      uint64_t fasta_size;
+      int64_t fasta_modified_time;
+      uint64_t n_run_offset;
+      uint64_t n_run_count;
+      uint64_t packed_offset;
+      uint64_t packed_size;
+    };
+
+    static const uint64_t s_cache_magic = 0x4645524b43415047; // "GPACKREF"
+    static const uint32_t s_cache_version = 1;
+    static uint64_t padToEight(uint64_t size) { return (size + 7) & ~(uint64_t)7; }
+
+    bool loadCache(const std::string& cachePath, uint64_t fastaSize, int64_t fastaModifiedTime);
+    void buildFromFasta(const std::string& fastaPath, const std::string& cachePath, uint64_t fastaSize, int64_t fastaModifiedTime);
+    void addContig(const std::string& name, uint64_t length, const uint8_t* packedBases, const NRun* nRuns, uint64_t nRunCount);
+    PackedContig* getContig(const std::string& contigName, position startPosition, size_t length);
+    static void getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length);
+    static void unpackCodes(const uint8_t* packedBases, uint64_t startPosition, size_t length, int8_t* codes);
+    static void maskNRuns(const PackedContig* contigPtr, uint64_t startPosition, size_t length, int8_t* codes);
+
+    std::vector< std::unique_ptr< PackedContig > > m_contigs;
+    std::unordered_map< std::string, PackedContig* > m_contigs_by_name;
+    // the cache file's mapping, or the buffer the FASTA was packed into when it couldn't be written
+    const char* m_mapped_data;
+    size_t m_mapped_size;
+    std::vector< uint8_t > m_owned_bases;
+    std::vector< NRun > m_owned_n_runs;
+    size_t m_packed_size;
+  };
+
+#endif
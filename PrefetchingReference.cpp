@@ -0,0 +1,213 @@
+#include "PrefetchingReference.h"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+  PrefetchingReference::PrefetchingReference(IReference::SharedPtr referencePtr, size_t capacity) :
+    m_reference_ptr(referencePtr),
+    m_capacity(capacity),
+    m_window_bases(0),
+    m_longest_window(0),
+    m_window_hit_count(0),
+    m_window_miss_count(0)
+  {
+  }
+
+  PrefetchingReference::~PrefetchingReference()
+  {
+  }
+
+  void PrefetchingReference::getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length)
+  {
+    // same conventions as IReference: one based regions include their end, zero based ones don't
+    length = regionPtr->getEndPosition() - regionPtr->getStartPosition();
+    startPosition = regionPtr->getStartPosition();
+    if (regionPtr->getBased() == Region::BASED::ONE)
+      {
+	startPosition -= 1;
+	length += 1;
+      }
+  }
+
+  void PrefetchingReference::prefetchRegions(const std::vector< Region::SharedPtr >& regionPtrs)
+  {
+    struct Range
+    {
+      std::string contig_name;
+      position start_position;
+      position end_position;
+    };
+    std::vector< Range > ranges;
+    ranges.reserve(regionPtrs.size());
+    for (auto& regionPtr : regionPtrs)
+      {
+	position startPosition;
+	size_t length;
+	getRegionRange(regionPtr, startPosition, length);
+	if (length == 0)
+	  {
+	    continue;
+	  }
+	if (length > MAX_POSITION - startPosition)
+	  {
+	    throw std::out_of_range("PrefetchingReference region ends past the last position");
+	  }
+	ranges.push_back({regionPtr->getReferenceID(), startPosition, static_cast< position >(startPosition + length)});
+      }
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b)
+	      {
+		return (a.contig_name != b.contig_name) ? a.contig_name < b.contig_name : a.start_position < b.start_position;
+	      });
+
+    // every region ends up whole inside one window. windows past the capacity
+    // would only push out the ones before them, so queuing stops there and
+    // the regions left over are read as their graphs ask for them
+    std::vector< WindowPtr > windowPtrs;
+    size_t queuedBases = 0;
+    for (size_t i = 0; i < ranges.size() && queuedBases < this->m_capacity;)
+      {
+	Range window = ranges[i];
+	for (++i; i < ranges.size(); ++i)
+	  {
+	    if (ranges[i].contig_name != window.contig_name ||
+		ranges[i].start_position > window.end_position + s_merge_gap ||
+		std::max(window.end_position, ranges[i].end_position) - window.start_position > s_max_window_length)
+	      {
+		break;
+	      }
+	    window.end_position = std::max(window.end_position, ranges[i].end_position);
+	  }
+	size_t windowLength = window.end_position - window.start_position;
+	if (findWindow(window.contig_name, window.start_position, windowLength) == nullptr)
+	  {
+	    if (!windowPtrs.empty() && queuedBases + windowLength > this->m_capacity)
+	      {
+		break;
+	      }
+	    windowPtrs.emplace_back(addWindow(window.contig_name, window.start_position, windowLength));
+	    queuedBases += windowLength;
+	  }
+      }
+
+    // the tasks hold the wrapped reference and their window rather than this,
+    // so they can outlive it
+    auto referencePtr = this->m_reference_ptr;
+    try
+      {
+	for (auto& windowPtr : windowPtrs)
+	  {
+	    ThreadPool::Instance()->enqueue([referencePtr, windowPtr]()
+					    {
+					      std::call_once(windowPtr->fill_flag, [&]() { fillWindow(referencePtr, windowPtr); });
+					    });
+	  }
+      }
+    catch (const std::runtime_error&)
+      {
+	// the pool is stopped, the windows are filled on first use instead
+      }
+  }
+
+  std::string PrefetchingReference::getSequenceFromRegion(Region::SharedPtr regionPtr)
+  {
+    position startPosition;
+    size_t length;
+    getRegionRange(regionPtr, startPosition, length);
+    const std::string& contigName = regionPtr->getReferenceID();
+    WindowPtr windowPtr = findWindow(contigName, startPosition, length);
+    if (windowPtr != nullptr)
+      {
+	++this->m_window_hit_count;
+      }
+    else
+      {
+	++this->m_window_miss_count;
+	windowPtr = addWindow(contigName, startPosition, length);
+      }
+    // if the prefetch task hasn't started on it yet fill it here, if it's partway through wait for it
+    std::call_once(windowPtr->fill_flag, [&]() { fillWindow(this->m_reference_ptr, windowPtr); });
+    if (windowPtr->fill_failed)
+      {
+	return this->m_reference_ptr->getSequenceFromRegion(regionPtr);
+      }
+    return windowPtr->sequence.substr(startPosition - windowPtr->start_position, length);
+  }
+
+  SequenceView PrefetchingReference::getSequenceViewFromRegion(Region::SharedPtr regionPtr)
+  {
+    return this->m_reference_ptr->getSequenceViewFromRegion(regionPtr);
+  }
+
+  PrefetchingReference::WindowPtr PrefetchingReference::findWindow(const std::string& contigName, position startPosition, size_t length)
+  {
+    std::lock_guard< std::mutex > lock(this->m_windows_mutex);
+    auto contigIter = this->m_windows_by_contig.find(contigName);
+    if (contigIter == this->m_windows_by_contig.end())
+      {
+	return nullptr;
+      }
+    // windows can overlap, only the ones starting within the longest window's length can cover the range
+    auto& windows = contigIter->second;
+    auto iter = windows.upper_bound(startPosition);
+    while (iter != windows.begin())
+      {
+	--iter;
+	if (iter->first + this->m_longest_window < startPosition)
+	  {
+	    break;
+	  }
+	if (iter->first + iter->second->length >= startPosition + length)
+	  {
+	    return iter->second;
+	  }
+      }
+    return nullptr;
+  }
+
+  PrefetchingReference::WindowPtr PrefetchingReference::addWindow(const std::string& contigName, position startPosition, size_t length)
+  {
+    WindowPtr windowPtr = std::make_shared< Window >();
+    windowPtr->contig_name = contigName;
+    windowPtr->start_position = startPosition;
+    windowPtr->length = length;
+
+    std::lock_guard< std::mutex > lock(this->m_windows_mutex);
+    this->m_windows_by_contig[contigName].emplace(startPosition, windowPtr);
+    this->m_windows.emplace_back(windowPtr);
+    this->m_window_bases += length;
+    this->m_longest_window = std::max(this->m_longest_window, length);
+    // whoever is still using a dropped window keeps it alive
+    while (this->m_window_bases > this->m_capacity && this->m_windows.size() > 1)
+      {
+	WindowPtr oldestPtr = this->m_windows.front();
+	this->m_windows.pop_front();
+	this->m_window_bases -= oldestPtr->length;
+	auto& windows = this->m_windows_by_contig[oldestPtr->contig_name];
+	auto range = windows.equal_range(oldestPtr->start_position);
+	for (auto iter = range.first; iter != range.second; ++iter)
+	  {
+	    if (iter->second == oldestPtr)
+	      {
+		windows.erase(iter);
+		break;
+	      }
+	  }
+      }
+    return windowPtr;
+  }
+
+  void PrefetchingReference::fillWindow(IReference::SharedPtr referencePtr, WindowPtr windowPtr)
+  {
+    auto regionPtr = std::make_shared< Region >(windowPtr->contig_name, windowPtr->start_position, windowPtr->start_position + windowPtr->length, Region::BASED::ZERO);
+    // a throw here would leave fill_flag unset and every region in the
+    // window retrying the fill, and failing, on every request
+    try
+      {
+	windowPtr->sequence = referencePtr->getSequenceFromRegion(regionPtr);
+      }
+    catch (const std::exception&)
+      {
+	windowPtr->fill_failed = true;
+      }
+  }
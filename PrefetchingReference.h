@@ -0,0 +1,86 @@
+#ifndef PREFETCHINGREFERENCE_H
+#define PREFETCHINGREFERENCE_H
+
+#include "IReference.h"
+#include "Region.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * Wraps another IReference and serves getSequenceFromRegion out of
+   * contiguous windows of bases copied from it ahead of time. Give
+   * prefetchRegions the regions whose graphs are about to be built: regions
+   * that overlap or sit close together are merged into one window and every
+   * window is filled by a ThreadPool task, so by the time constructGraph asks
+   * for the reference between its variants the bases are already in memory.
+   * A graph that gets to its window before the task does fills the window
+   * itself rather than waiting behind other tasks.
+   *
+   * A request no window covers is read from the wrapped reference into a new
+   * window of its own, so asking again is served from memory. When the
+   * wrapped reference can't fill a window, one of the merged regions runs
+   * past its contig's end say, the regions in it are read one by one
+   * instead, so only the bad ones throw. Windows are
+   * dropped oldest first once they hold more than the capacity given, and
+   * prefetchRegions queues no more windows than fit in it.
+   *
+   * Views still come from the wrapped reference, windows don't live as long
+   * as views have to.
+   */
+  class PrefetchingReference : public IReference
+  {
+  public:
+    typedef std::shared_ptr< PrefetchingReference > SharedPtr;
+
+    PrefetchingReference(IReference::SharedPtr referencePtr, size_t capacity = 64 * 1024 * 1024);
+    ~PrefetchingReference();
+
+    void prefetchRegions(const std::vector< Region::SharedPtr >& regionPtrs);
+    std::string getSequenceFromRegion(Region::SharedPtr regionPtr) override;
+    SequenceView getSequenceViewFromRegion(Region::SharedPtr regionPtr) override;
+
+    uint64_t getWindowHitCount() { return this->m_window_hit_count.load(); }
+    uint64_t getWindowMissCount() { return this->m_window_miss_count.load(); }
+
+  private:
+    struct Window
+    {
+      std::string contig_name;
+      position start_position; // zero based
+      size_t length;
+      std::once_flag fill_flag;
+      std::string sequence; // set once by fill_flag
+      bool fill_failed = false; // set once by fill_flag, a region in the window is past its contig's end, say
+    };
+    typedef std::shared_ptr< Window > WindowPtr;
+
+    // regions this far apart still share a window, reading the gap is cheaper than another fetch
+    static const size_t s_merge_gap = 4096;
+    // windows stop growing past this, a region that doesn't fit starts the next one
+    static const size_t s_max_window_length = 4 * 1024 * 1024;
+
+    static void getRegionRange(Region::SharedPtr regionPtr, position& startPosition, size_t& length);
+    WindowPtr findWindow(const std::string& contigName, position startPosition, size_t length);
+    WindowPtr addWindow(const std::string& contigName, position startPosition, size_t length);
+    static void fillWindow(IReference::SharedPtr referencePtr, WindowPtr windowPtr);
+
+    IReference::SharedPtr m_reference_ptr;
+    size_t m_capacity;
+    std::mutex m_windows_mutex;
+    std::unordered_map< std::string, std::multimap< position, WindowPtr > > m_windows_by_contig;
+    std::deque< WindowPtr > m_windows; // oldest first
+    size_t m_window_bases;
+    size_t m_longest_window;
+    std::atomic< uint64_t > m_window_hit_count;
+    std::atomic< uint64_t > m_window_miss_count;
+  };
+
+#endif
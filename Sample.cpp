@@ -4,7 +4,8 @@
   Sample::Sample(const std::string& sampleName, const std::string& readGroup, const std::string& samplePath) :
     m_sample_name(sampleName),
     m_sample_readgroup(readGroup),
-    m_sample_path(samplePath)
+    m_sample_path(samplePath),
+    m_sample_id(internSampleName(sampleName))
   {
   }
 
@@ -12,6 +13,53 @@
   {
   }
 
-  std::string Sample::getName() { return m_sample_name; }
-  std::string Sample::getReadgroup() { return m_sample_readgroup; }
-  std::string Sample::getPath() { return m_sample_path; }
+  const std::string& Sample::getName() { return m_sample_name; }
+  const std::string& Sample::getReadgroup() { return m_sample_readgroup; }
+  const std::string& Sample::getPath() { return m_sample_path; }
+
+  uint32_t Sample::getSampleCount()
+  {
+    return getSampleNameTable().count.load(std::memory_order_acquire);
+  }
+
+  bool Sample::getSampleID(const std::string& sampleName, uint32_t& sampleID)
+  {
+    SampleNameTable& table = getSampleNameTable();
+    std::lock_guard< std::mutex > lock(table.mutex);
+    auto iter = table.ids.find(sampleName);
+    if (iter == table.ids.end())
+      {
+	return false;
+      }
+    sampleID = iter->second;
+    return true;
+  }
+
+  std::string Sample::getSampleName(uint32_t sampleID)
+  {
+    SampleNameTable& table = getSampleNameTable();
+    std::lock_guard< std::mutex > lock(table.mutex);
+    return (sampleID < table.names.size()) ? table.names[sampleID] : "";
+  }
+
+  uint32_t Sample::internSampleName(const std::string& sampleName)
+  {
+    SampleNameTable& table = getSampleNameTable();
+    std::lock_guard< std::mutex > lock(table.mutex);
+    auto iter = table.ids.find(sampleName);
+    if (iter != table.ids.end())
+      {
+	return iter->second;
+      }
+    uint32_t sampleID = table.names.size();
+    table.ids.emplace(sampleName, sampleID);
+    table.names.emplace_back(sampleName);
+    table.count.store(sampleID + 1, std::memory_order_release);
+    return sampleID;
+  }
+
+  Sample::SampleNameTable& Sample::getSampleNameTable()
+  {
+    static SampleNameTable* s_sample_name_table = new SampleNameTable();
+    return *s_sample_name_table;
+  }
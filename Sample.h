@@ -4,6 +4,11 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
 
 #include "Noncopyable.hpp"
 
@@ -15,14 +20,39 @@
     Sample() = delete;
     ~Sample();
 
-    std::string getName();
-    std::string getReadgroup();
-    std::string getPath();
+    const std::string& getName();
+    const std::string& getReadgroup();
+    const std::string& getPath();
+
+    /*
+     * Every distinct sample name is given a small dense ID the first time a
+     * Sample with that name is constructed. Samples sharing a name (one per
+     * read group, say) share the ID, so per sample data can be kept in flat
+     * arrays indexed by it instead of maps keyed by the name.
+     */
+    uint32_t getSampleID() { return this->m_sample_id; }
+
+    static uint32_t getSampleCount();
+    static bool getSampleID(const std::string& sampleName, uint32_t& sampleID);
+    static std::string getSampleName(uint32_t sampleID);
 
   private:
+    // the interned names, IDs are handed out in construction order and never reused
+    struct SampleNameTable
+    {
+      std::mutex mutex;
+      std::unordered_map< std::string, uint32_t > ids;
+      std::vector< std::string > names;
+      std::atomic< uint32_t > count;
+    };
+
+    static SampleNameTable& getSampleNameTable();
+    static uint32_t internSampleName(const std::string& sampleName);
+
     std::string m_sample_name;
     std::string m_sample_readgroup;
     std::string m_sample_path;
+    uint32_t m_sample_id;
   };
 
 #endif
@@ -0,0 +1,155 @@
+#include "SymbolicAllele.h"
+
+#include <algorithm>
+
+  SymbolicAllele::SymbolicAllele(const std::string& symbol, const std::string& referenceID, const std::vector< Segment >& segments) :
+    Allele(symbol),
+    m_reference_id(referenceID),
+    m_segments(segments),
+    m_is_expanded(false)
+  {
+  }
+
+  SymbolicAllele::~SymbolicAllele()
+  {
+  }
+
+  bool SymbolicAllele::getSegments(const std::string& symbol, position startPosition, position endPosition, std::vector< Segment >& segments)
+  {
+    if (endPosition <= startPosition)
+      {
+	return false;
+      }
+    if (symbol == "<DEL>")
+      {
+	segments = { { startPosition, startPosition, false } };
+      }
+    else if (symbol == "<DUP>" || symbol == "<DUP:TANDEM>")
+      {
+	segments = { { startPosition, endPosition, false }, { startPosition + 1, endPosition, false } };
+      }
+    else if (symbol == "<INV>")
+      {
+	segments = { { startPosition, startPosition, false }, { startPosition + 1, endPosition, true } };
+      }
+    else
+      {
+	return false;
+      }
+    return true;
+  }
+
+  void SymbolicAllele::createAlleles(const std::string& refSequence, const std::vector< std::string >& altSequences, const std::string& referenceID, position startPosition, position endPosition,
+				     IAllele::SharedPtr& refAllelePtr, std::vector< IAllele::SharedPtr >& altAllelePtrs)
+  {
+    bool hasSymbolicAllele = false;
+    std::vector< Segment > segments;
+    for (auto& altSequence : altSequences)
+      {
+	if (getSegments(altSequence, startPosition, endPosition, segments))
+	  {
+	    altAllelePtrs.emplace_back(std::make_shared< SymbolicAllele >(altSequence, referenceID, segments));
+	    hasSymbolicAllele = true;
+	  }
+	else
+	  {
+	    altAllelePtrs.emplace_back(std::make_shared< Allele >(altSequence));
+	  }
+      }
+    if (hasSymbolicAllele)
+      {
+	refAllelePtr = std::make_shared< SymbolicAllele >(refSequence, referenceID, std::vector< Segment >{ { startPosition, endPosition, false } });
+      }
+    else
+      {
+	refAllelePtr = std::make_shared< Allele >(refSequence);
+      }
+  }
+
+  uint64_t SymbolicAllele::getExpandedLength()
+  {
+    uint64_t expandedLength = 0;
+    for (auto& segment : this->m_segments)
+      {
+	expandedLength += segment.end_position - segment.start_position + 1;
+      }
+    return expandedLength;
+  }
+
+  void SymbolicAllele::setReference(IReference::SharedPtr referencePtr, uint32_t flankLength)
+  {
+    std::lock_guard< std::mutex > lock(this->m_expand_mutex);
+    if (this->m_is_expanded)
+      {
+	return;
+      }
+    // the offsets into the expanded allele within flankLength of a breakpoint, merged
+    std::vector< std::pair< uint64_t, uint64_t > > keptRanges;
+    uint64_t segmentOffset = 0;
+    keptRanges.emplace_back(0, std::min< uint64_t >(flankLength, getExpandedLength()));
+    for (auto& segment : this->m_segments)
+      {
+	segmentOffset += segment.end_position - segment.start_position + 1;
+	uint64_t beginOffset = (segmentOffset > flankLength) ? segmentOffset - flankLength : 0;
+	uint64_t endOffset = std::min< uint64_t >(segmentOffset + flankLength, getExpandedLength());
+	if (beginOffset <= keptRanges.back().second)
+	  {
+	    keptRanges.back().second = std::max(keptRanges.back().second, endOffset);
+	  }
+	else
+	  {
+	    keptRanges.emplace_back(beginOffset, endOffset);
+	  }
+      }
+    std::string sequence;
+    for (auto& keptRange : keptRanges)
+      {
+	appendExpandedSequence(referencePtr, keptRange.first, keptRange.second, sequence);
+      }
+    this->m_sequence = std::move(sequence);
+    this->m_is_expanded = true;
+  }
+
+  // the bases at [beginOffset, endOffset) of the expanded allele
+  void SymbolicAllele::appendExpandedSequence(IReference::SharedPtr referencePtr, uint64_t beginOffset, uint64_t endOffset, std::string& sequence)
+  {
+    uint64_t segmentOffset = 0;
+    for (auto& segment : this->m_segments)
+      {
+	uint64_t segmentBegin = segmentOffset;
+	segmentOffset += segment.end_position - segment.start_position + 1;
+	// the part of [beginOffset, endOffset) in this segment, from the segment's start
+	uint64_t pieceBegin = std::max(beginOffset, segmentBegin);
+	uint64_t pieceEnd = std::min(endOffset, segmentOffset);
+	if (pieceBegin >= pieceEnd)
+	  {
+	    continue;
+	  }
+	pieceBegin -= segmentBegin;
+	pieceEnd -= segmentBegin;
+	if (!segment.is_reverse_complement)
+	  {
+	    auto regionPtr = std::make_shared< Region >(this->m_reference_id, segment.start_position + pieceBegin, segment.start_position + pieceEnd - 1, Region::BASED::ONE);
+	    sequence += referencePtr->getSequenceFromRegion(regionPtr);
+	    continue;
+	  }
+	// the piece's first base is the last of the reference it comes from
+	auto regionPtr = std::make_shared< Region >(this->m_reference_id, segment.end_position - pieceEnd + 1, segment.end_position - pieceBegin, Region::BASED::ONE);
+	std::string pieceSequence = referencePtr->getSequenceFromRegion(regionPtr);
+	for (auto iter = pieceSequence.rbegin(); iter != pieceSequence.rend(); ++iter)
+	  {
+	    switch (*iter)
+	      {
+	      case 'A': sequence += 'T'; break;
+	      case 'C': sequence += 'G'; break;
+	      case 'G': sequence += 'C'; break;
+	      case 'T': sequence += 'A'; break;
+	      case 'a': sequence += 't'; break;
+	      case 'c': sequence += 'g'; break;
+	      case 'g': sequence += 'c'; break;
+	      case 't': sequence += 'a'; break;
+	      default: sequence += *iter;
+	      }
+	  }
+      }
+  }
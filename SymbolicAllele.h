@@ -0,0 +1,65 @@
+#ifndef SYMBOLICALLELE_H
+#define SYMBOLICALLELE_H
+
+#include "Allele.h"
+#include "IReference.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+  /*
+   * A <DEL>, <DUP> or <INV> allele, or the reference span such an allele
+   * replaces, kept as the stretches of reference it is made of instead of
+   * as bases. A deletion is its padding base, a tandem duplication the span
+   * followed by a second copy of it, an inversion the padding base followed
+   * by the span reverse complemented.
+   *
+   * Until setReference the sequence is the allele as the VCF wrote it.
+   * setReference then fetches only the bases within flankLength of the
+   * allele's ends and of the joins between its stretches, the breakpoints a
+   * read can span, and leaves out the rest of a long event, so a megabase
+   * deletion costs a few thousand bases rather than a megabase.
+   */
+  class SymbolicAllele : public Allele
+  {
+  public:
+    typedef std::shared_ptr< SymbolicAllele > SharedPtr;
+
+    // one based, both ends included
+    struct Segment
+    {
+      position start_position;
+      position end_position;
+      bool is_reverse_complement;
+    };
+
+    SymbolicAllele(const std::string& symbol, const std::string& referenceID, const std::vector< Segment >& segments);
+    ~SymbolicAllele();
+
+    /*
+     * A record's alleles. When an ALT is <DEL>, <DUP>, <DUP:TANDEM> or <INV>
+     * and the record runs from startPosition, its padding base, through
+     * endPosition, its INFO END, those alts and REF are SymbolicAlleles and
+     * every other allele is an Allele of its text.
+     */
+    static void createAlleles(const std::string& refSequence, const std::vector< std::string >& altSequences, const std::string& referenceID, position startPosition, position endPosition,
+			      IAllele::SharedPtr& refAllelePtr, std::vector< IAllele::SharedPtr >& altAllelePtrs);
+
+    // expands the allele the first time it's called, later calls keep that
+    // sequence. Call it before the allele is read from other threads
+    void setReference(IReference::SharedPtr referencePtr, uint32_t flankLength);
+    // the length the allele would have with nothing left out
+    uint64_t getExpandedLength();
+
+  private:
+    static bool getSegments(const std::string& symbol, position startPosition, position endPosition, std::vector< Segment >& segments);
+    void appendExpandedSequence(IReference::SharedPtr referencePtr, uint64_t beginOffset, uint64_t endOffset, std::string& sequence);
+
+    std::string m_reference_id;
+    std::vector< Segment > m_segments;
+    std::mutex m_expand_mutex;
+    bool m_is_expanded;
+  };
+
+#endif
@@ -2,17 +2,134 @@
 #define THREADPOOL_HPP
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
+#include <type_traits>
 #include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <cstdlib>
 
 #include "Noncopyable.hpp"
+#include "WorkStealingDeque.hpp"
+#include "CpuTopology.hpp"
 
+  class ThreadPoolTask
+  {
+  public:
+    ThreadPoolTask() : m_enqueue_time(0) {}
+    virtual ~ThreadPoolTask() {}
+
+    virtual void run() = 0;
+    // called by the worker once run returns, pool owned tasks delete themselves
+    virtual void finished() { delete this; }
+
+  private:
+    friend class ThreadPool;
+    uint64_t m_enqueue_time; // steady clock ns, for the enqueue to start latency
+  };
+
+  // a task enqueueBulk queues, owned by the caller so finished leaves it alone
+  class ThreadPoolBulkTask : public ThreadPoolTask
+  {
+  public:
+    void finished() override {}
+  };
+
+  class TaskGroup;
+
+  struct ThreadPoolWorkerStatistics
+  {
+    uint32_t index;
+    bool active; // false once retired by setThreadCount
+    uint64_t tasks_submitted; // by tasks running on this worker
+    uint64_t tasks_completed;
+    uint64_t tasks_stolen; // taken from another worker's deque or backed up mailbox
+    uint64_t busy_ns;
+    uint64_t idle_ns; // looking for work or asleep
+    uint64_t peak_queue_depth; // own deque or mailbox
+  };
+
+  /*
+   * Snapshot of the ThreadPool counters. The totals include tasks submitted
+   * and run by threads outside the pool, which the per worker rows don't.
+   */
+  struct ThreadPoolStatistics
+  {
+    static const uint32_t s_latency_bucket_count = 40;
+
+    uint64_t tasks_submitted;
+    uint64_t tasks_completed;
+    uint64_t tasks_stolen;
+    uint64_t queued_tasks; // approximate
+    uint64_t peak_queue_depth; // deepest any single queue has been, the injection queue included
+    uint64_t latency_histogram[s_latency_bucket_count]; // enqueue to start, bucket i counts [2^i, 2^(i+1)) ns
+    std::vector< ThreadPoolWorkerStatistics > workers;
+
+    // upper bound, in ns, of the bucket that holds the given fraction of task latencies
+    uint64_t getLatencyPercentile(double fraction) const
+    {
+      uint64_t latencyCount = 0;
+      for (uint32_t i = 0; i < s_latency_bucket_count; ++i)
+	{
+	  latencyCount += this->latency_histogram[i];
+	}
+      uint64_t seenCount = 0;
+      for (uint32_t i = 0; i < s_latency_bucket_count; ++i)
+	{
+	  seenCount += this->latency_histogram[i];
+	  if (latencyCount > 0 && seenCount >= fraction * latencyCount)
+	    {
+	      return 2ull << i;
+	    }
+	}
+      return 0;
+    }
+  };
+
+  struct ThreadPoolTopologyPolicy
+  {
+  ThreadPoolTopologyPolicy() : pin_workers(false), group_by_numa_node(true), threads_per_core(1.0) {}
+
+    // each worker runs on one logical cpu, see CpuTopology::getPlacementOrder. off by default,
+    // every process on a shared node would pin to the same cpus in the same order
+    bool pin_workers;
+    bool group_by_numa_node; // neighbouring workers share a node and thieves steal from their own node first
+    double threads_per_core; // workers per physical core, above 1 oversubscribes
+  };
+
+  /*
+   * Every worker owns a work stealing deque. Tasks enqueued from inside a
+   * worker are pushed onto that worker's deque, tasks enqueued from any
+   * other thread go to a shared injection queue. An idle worker pops its
+   * own deque first, then the injection queue, then steals from the others.
+   *
+   * Workers live in a fixed array of slots so thieves can walk it while the
+   * pool is resized. A worker that is retired finishes the tasks left on its
+   * own deque and exits, its slot is reused if the pool grows again.
+   *
+   * By default there is one worker per physical core with workers grouped
+   * per NUMA node, left unpinned unless ThreadPoolTopologyPolicy asks.
+   * Worker indices are stable, so with pinned workers per worker state
+   * allocated by the worker itself stays on that worker's node.
+   *
+   * Tasks enqueued with an affinity key go to the mailbox of the worker the
+   * key hashes to, so work on the same data keeps hitting the same caches.
+   * Other workers leave a mailbox alone until it backs up past
+   * s_affinity_steal_threshold tasks.
+   */
   class ThreadPool : private Noncopyable
   {
   public:
@@ -24,38 +141,93 @@
 
     uint32_t getThreadCount()
     {
-      return m_thread_count;
+      return m_thread_count.load();
     }
 
+    // index of the calling worker, or -1 when called from outside the pool
+    static int32_t getCurrentWorkerIndex()
+    {
+      Worker* worker = currentWorker();
+      return (worker != nullptr) ? (int32_t)worker->index : -1;
+    }
+
+    // worker indices are always below this, whatever the thread count
+    static uint32_t getMaxThreadCount()
+    {
+      return s_max_thread_count;
+    }
+
+    ThreadPoolTopologyPolicy getTopologyPolicy()
+    {
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
+      return this->m_topology_policy;
+    }
+
+    // re-places the running workers and resizes the pool to threads_per_core
+    // workers per physical core, call setThreadCount afterwards to override the count
+    void setTopologyPolicy(const ThreadPoolTopologyPolicy& topologyPolicy)
+    {
+      if (currentWorker() != nullptr)
+	{
+	  throw std::logic_error("setTopologyPolicy called from inside a ThreadPool task");
+	}
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
+      this->m_topology_policy = topologyPolicy;
+      this->m_placement = CpuTopology::Instance()->getPlacementOrder(topologyPolicy.group_by_numa_node);
+      this->m_steal_from_own_node_first.store(topologyPolicy.group_by_numa_node && CpuTopology::Instance()->getNumaNodeCount() > 1);
+      for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
+	{
+	  placeWorker(this->m_worker_slots[i].load());
+	}
+      resize(getTopologyThreadCount(topologyPolicy));
+    }
+
+    // blocks until every queued task has run and all workers are idle, the
+    // worker threads are left running. must not be called from inside a task
     void joinAll()
     {
-      stop();
-      start();
+      if (currentWorker() != nullptr)
+	{
+	  throw std::logic_error("joinAll called from inside a ThreadPool task");
+	}
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
+      std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+      ++this->m_barrier_waiting_count;
+      this->m_idle_condition.wait(lock, [this]{ return isQuiescent(); });
+      --this->m_barrier_waiting_count;
     }
 
     void start()
     {
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
       if (this->m_stopped)
 	{
 	  {
 	    std::unique_lock<std::mutex> lock(m_tasks_mutex);
 	    this->m_stopped = false;
-	    this->m_workers.clear();
 	  }
-	  init();
+	  for (uint32_t i = 0; i < this->m_thread_count.load(); ++i)
+	    {
+	      startWorker(i);
+	    }
 	}
     }
 
     void stop()
     {
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
       {
 	std::unique_lock<std::mutex> lock(m_tasks_mutex);
 	this->m_stopped = true;
       }
       this->m_condition.notify_all();
-      for (std::thread& worker : this->m_workers)
+      for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
 	{
-	  worker.join();
+	  Worker* worker = this->m_worker_slots[i].load();
+	  if (worker->thread.joinable())
+	    {
+	      worker->thread.join();
+	    }
 	}
     }
 
@@ -69,78 +241,1029 @@
 									  std::bind(std::forward< F >(funct), std::forward< Args >(args)...)
 									  );
       std::shared_ptr< std::future< return_type > > res = std::make_shared< std::future< return_type > >(task->get_future());
+      submit(new FunctionTask([task](){(*task)();}));
+      return res;
+    }
+
+    // like enqueue, but tasks sharing an affinity key (a graph or region ID) run on the same worker
+    template<class F, class... Args>
+    auto enqueueWithAffinity(uint64_t affinityKey, F&& funct, Args&&... args)
+      -> std::shared_ptr< std::future< typename std::result_of< F(Args...) >::type > >
     {
-      std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
-      if (this->m_stopped)
+      using return_type = typename std::result_of< F(Args...) >::type;
+
+      auto task = std::make_shared< std::packaged_task< return_type() > >(
+									  std::bind(std::forward< F >(funct), std::forward< Args >(args)...)
+									  );
+      std::shared_ptr< std::future< return_type > > res = std::make_shared< std::future< return_type > >(task->get_future());
+      submitWithAffinity(affinityKey, new FunctionTask([task](){(*task)();}));
+      return res;
+    }
+
+    // enqueues count caller owned tasks with a single lock acquisition (none from
+    // inside a worker), the tasks must stay alive until they have finished
+    template< class T >
+    void enqueueBulk(T* tasks, size_t count)
+    {
+      static_assert(std::is_base_of< ThreadPoolBulkTask, T >::value, "enqueueBulk tasks must derive from ThreadPoolBulkTask");
+      uint64_t enqueueTime = getTimestamp();
+      for (size_t i = 0; i < count; ++i)
+	{
+	  tasks[i].m_enqueue_time = enqueueTime;
+	}
+      Worker* worker = currentWorker();
+      if (worker != nullptr)
 	{
-	  throw std::runtime_error("enqueue on stopped ThreadPool");
+	  if (this->m_stopped)
+	    {
+	      throw std::runtime_error("enqueue on stopped ThreadPool");
+	    }
+	  for (size_t i = 0; i < count; ++i)
+	    {
+	      worker->tasks.push(&tasks[i]);
+	    }
+	  worker->counters.raise(worker->counters.peak_queue_depth, worker->tasks.size());
 	}
-      this->m_tasks.emplace([task](){(*task)();});
+      else
+	{
+	  std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+	  if (this->m_stopped)
+	    {
+	      throw std::runtime_error("enqueue on stopped ThreadPool");
+	    }
+	  for (size_t i = 0; i < count; ++i)
+	    {
+	      this->m_tasks.push_back(&tasks[i]);
+	    }
+	  injectedCountChanged();
+	}
+      countersFor(worker).add(countersFor(worker).tasks_submitted, count);
+      notifySleepers(count);
+    }
+
+    // calls funct(idx) for every idx in [begin, end), grainSize indices per task,
+    // and returns once all of them have run
+    template< class F >
+    void parallelFor(size_t begin, size_t end, size_t grainSize, F&& funct);
+
+    // runs one queued task on the calling thread, lets threads that wait on
+    // other tasks help out instead of blocking a worker
+    bool runPendingTask()
+    {
+      Worker* worker = currentWorker();
+      if (worker != nullptr)
+	{
+	  ThreadPoolTask* task = findTask(worker);
+	  if (task == nullptr) { return false; }
+	  // busy time is already counted by the task we are nested in
+	  runTask(worker->counters, task);
+	  return true;
+	}
+
+      // counted before the task leaves the queues so joinAll never sees it in neither place
+      this->m_external_task_count.fetch_add(1);
+      ThreadPoolTask* task = popInjectedTask();
+      for (uint32_t i = 0; task == nullptr && i < this->m_worker_slot_count.load(); ++i)
+	{
+	  Worker* victim = this->m_worker_slots[i].load();
+	  task = victim->tasks.steal();
+	  if (task == nullptr && victim->mailbox_size.load(std::memory_order_relaxed) > s_affinity_steal_threshold)
+	    {
+	      task = popMailboxTask(victim);
+	    }
+	}
+      if (task != nullptr)
+	{
+	  runTask(this->m_external_counters, task);
+	}
+      if (this->m_external_task_count.fetch_sub(1) == 1 && this->m_barrier_waiting_count.load() > 0)
+	{
+	  std::lock_guard< std::mutex > lock(this->m_tasks_mutex);
+	  this->m_idle_condition.notify_all();
+	}
+      return task != nullptr;
     }
-    this->m_condition.notify_one();
-    return res;
-  }
 
+    // starts or retires individual workers, the others keep running
     void setThreadCount(uint32_t threadCount)
     {
-      this->m_thread_count = threadCount;
-      stop();
-      start();
+      if (threadCount == 0 || threadCount > s_max_thread_count)
+	{
+	  throw std::invalid_argument("ThreadPool thread count must be between 1 and " + std::to_string(s_max_thread_count));
+	}
+      if (currentWorker() != nullptr)
+	{
+	  throw std::logic_error("setThreadCount called from inside a ThreadPool task");
+	}
+      std::lock_guard< std::mutex > resizeLock(this->m_resize_mutex);
+      resize(threadCount);
     }
 
+  // approximate, doesn't take any lock
   int getTaskCount()
   {
-    std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
-    return this->m_tasks.size();
+    int taskCount = this->m_injected_count.load();
+    for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
+      {
+	Worker* worker = this->m_worker_slots[i].load();
+	taskCount += worker->tasks.size() + worker->mailbox_size.load();
+      }
+    return taskCount;
+  }
+
+  // can be called at any time, counters are read while the workers keep running
+  ThreadPoolStatistics getStatistics()
+  {
+    ThreadPoolStatistics statistics = ThreadPoolStatistics();
+    statistics.queued_tasks = this->m_injected_count.load();
+    statistics.peak_queue_depth = this->m_peak_injected_count.load();
+    addCounters(statistics, this->m_external_counters);
+    uint32_t threadCount = this->m_thread_count.load();
+    for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
+      {
+	Worker* worker = this->m_worker_slots[i].load();
+	ThreadPoolWorkerStatistics workerStatistics;
+	workerStatistics.index = i;
+	workerStatistics.active = i < threadCount;
+	workerStatistics.tasks_submitted = worker->counters.tasks_submitted.load(std::memory_order_relaxed);
+	workerStatistics.tasks_completed = worker->counters.tasks_completed.load(std::memory_order_relaxed);
+	workerStatistics.tasks_stolen = worker->counters.tasks_stolen.load(std::memory_order_relaxed);
+	workerStatistics.busy_ns = worker->counters.busy_ns.load(std::memory_order_relaxed);
+	workerStatistics.idle_ns = worker->counters.idle_ns.load(std::memory_order_relaxed);
+	workerStatistics.peak_queue_depth = std::max(worker->counters.peak_queue_depth.load(std::memory_order_relaxed), worker->peak_mailbox_depth.load(std::memory_order_relaxed));
+	statistics.workers.emplace_back(workerStatistics);
+	addCounters(statistics, worker->counters);
+	statistics.queued_tasks += worker->tasks.size() + worker->mailbox_size.load();
+	statistics.peak_queue_depth = std::max(statistics.peak_queue_depth, workerStatistics.peak_queue_depth);
+      }
+    return statistics;
+  }
+
+  void dumpStatistics(std::ostream& out)
+  {
+    auto statistics = getStatistics();
+    out << "tasks_submitted\t" << statistics.tasks_submitted << std::endl;
+    out << "tasks_completed\t" << statistics.tasks_completed << std::endl;
+    out << "tasks_stolen\t" << statistics.tasks_stolen << std::endl;
+    out << "queued_tasks\t" << statistics.queued_tasks << std::endl;
+    out << "peak_queue_depth\t" << statistics.peak_queue_depth << std::endl;
+    out << "latency_p50_ns\t" << statistics.getLatencyPercentile(0.5) << std::endl;
+    out << "latency_p99_ns\t" << statistics.getLatencyPercentile(0.99) << std::endl;
+    for (uint32_t i = 0; i < ThreadPoolStatistics::s_latency_bucket_count; ++i)
+      {
+	if (statistics.latency_histogram[i] > 0)
+	  {
+	    out << "latency_below_ns\t" << (2ull << i) << "\t" << statistics.latency_histogram[i] << std::endl;
+	  }
+      }
+    out << "worker\tactive\tsubmitted\tcompleted\tstolen\tbusy_ns\tidle_ns\tutilization\tpeak_queue_depth" << std::endl;
+    for (auto& worker : statistics.workers)
+      {
+	uint64_t totalTime = worker.busy_ns + worker.idle_ns;
+	out << worker.index << "\t" << worker.active << "\t" << worker.tasks_submitted << "\t" << worker.tasks_completed << "\t" <<
+	  worker.tasks_stolen << "\t" << worker.busy_ns << "\t" << worker.idle_ns << "\t" <<
+	  ((totalTime > 0) ? (double)worker.busy_ns / totalTime : 0.0) << "\t" << worker.peak_queue_depth << std::endl;
+      }
+  }
+
+  bool dumpStatistics(const std::string& path)
+  {
+    std::ofstream out(path);
+    if (!out)
+      {
+	return false;
+      }
+    dumpStatistics(out);
+    return (bool)out;
+  }
+
+  // writes the statistics to path when the program exits, the last path given wins
+  void dumpStatisticsAtExit(const std::string& path)
+  {
+    {
+      std::lock_guard< std::mutex > lock(this->m_statistics_path_mutex);
+      this->m_statistics_path = path;
+    }
+    static bool s_registered = (std::atexit([]()
+					     {
+					       ThreadPool* threadPool = ThreadPool::Instance();
+					       std::lock_guard< std::mutex > lock(threadPool->m_statistics_path_mutex);
+					       threadPool->dumpStatistics(threadPool->m_statistics_path);
+					     }) == 0);
+    (void)s_registered;
   }
 
 private:
 
+  /*
+   * Counters of one worker live on their own cache lines and are only written
+   * by that worker, so a plain load and store is enough to bump them. The
+   * counters of threads outside the pool are shared and use fetch_add.
+   */
+  struct TaskCounters
+  {
+  TaskCounters(bool isShared) :
+    shared(isShared), tasks_submitted(0), tasks_completed(0), tasks_stolen(0), busy_ns(0), idle_ns(0), peak_queue_depth(0)
+    {
+      for (uint32_t i = 0; i < ThreadPoolStatistics::s_latency_bucket_count; ++i)
+	{
+	  this->latency_histogram[i].store(0);
+	}
+    }
+
+    void add(std::atomic< uint64_t >& counter, uint64_t value)
+    {
+      if (this->shared)
+	{
+	  counter.fetch_add(value, std::memory_order_relaxed);
+	}
+      else
+	{
+	  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+    }
+
+    // only called by the owner or with a lock held
+    void raise(std::atomic< uint64_t >& peak, uint64_t value)
+    {
+      if (value > peak.load(std::memory_order_relaxed))
+	{
+	  peak.store(value, std::memory_order_relaxed);
+	}
+    }
+
+    void addLatency(uint64_t latency)
+    {
+      uint32_t bucket = 63 - __builtin_clzll(latency | 1);
+      add(this->latency_histogram[std::min(bucket, ThreadPoolStatistics::s_latency_bucket_count - 1)], 1);
+    }
+
+    char padding[64]; // keeps the counters off the cache lines thieves read
+    bool shared;
+    std::atomic< uint64_t > tasks_submitted;
+    std::atomic< uint64_t > tasks_completed;
+    std::atomic< uint64_t > tasks_stolen;
+    std::atomic< uint64_t > busy_ns;
+    std::atomic< uint64_t > idle_ns;
+    std::atomic< uint64_t > peak_queue_depth;
+    std::atomic< uint64_t > latency_histogram[ThreadPoolStatistics::s_latency_bucket_count];
+  };
+
+  class FunctionTask : public ThreadPoolTask
+  {
+  public:
+  FunctionTask(std::function< void() >&& funct) : m_funct(std::move(funct)) {}
+    void run() override { m_funct(); }
+  private:
+    std::function< void() > m_funct;
+  };
+
+  struct Worker : private Noncopyable
+  {
+  Worker(uint32_t idx) : index(idx), steal_seed(idx * 2654435761u + 1), retiring(false), numa_node(0), sleeping(false), mailbox_size(0), peak_mailbox_depth(0), mailbox_open(false), counters(false) {}
+
+    uint32_t index;
+    uint32_t steal_seed;
+    std::atomic< bool > retiring;
+    std::atomic< uint32_t > numa_node;
+    std::atomic< bool > sleeping;
+    WorkStealingDeque< ThreadPoolTask > tasks;
+    std::mutex mailbox_mutex;
+    std::deque< ThreadPoolTask* > mailbox; // affinity tasks routed to this worker, guarded by mailbox_mutex
+    std::atomic< size_t > mailbox_size;
+    std::atomic< uint64_t > peak_mailbox_depth; // written with mailbox_mutex held
+    bool mailbox_open; // guarded by mailbox_mutex, closed once the worker has exited
+    std::thread thread;
+    TaskCounters counters;
+  };
+
   ThreadPool() :
-    m_thread_count(std::thread::hardware_concurrency() * 2),
-    m_stopped(false)
+    m_worker_slots(new std::atomic< Worker* >[s_max_thread_count]),
+    m_worker_slot_count(0),
+    m_placement(CpuTopology::Instance()->getPlacementOrder(m_topology_policy.group_by_numa_node)),
+    m_steal_from_own_node_first(m_topology_policy.group_by_numa_node && CpuTopology::Instance()->getNumaNodeCount() > 1),
+    m_stopped(false),
+    m_thread_count(getTopologyThreadCount(m_topology_policy)),
+    m_sleeping_count(0),
+    m_running_worker_count(0),
+    m_barrier_waiting_count(0),
+    m_external_task_count(0),
+    m_injected_count(0),
+    m_peak_injected_count(0),
+    m_external_counters(true)
   {
-    init();
+    for (uint32_t i = 0; i < s_max_thread_count; ++i)
+      {
+	this->m_worker_slots[i].store(nullptr);
+      }
+    for (uint32_t i = 0; i < this->m_thread_count.load(); ++i)
+      {
+	startWorker(i);
+      }
   }
 
   ~ThreadPool()
   {
     stop();
+    for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
+      {
+	delete this->m_worker_slots[i].load();
+      }
+  }
+
+  static uint32_t getTopologyThreadCount(const ThreadPoolTopologyPolicy& topologyPolicy)
+  {
+    double threadCount = CpuTopology::Instance()->getPhysicalCoreCount() * topologyPolicy.threads_per_core + 0.5;
+    if (threadCount < 1) { return 1; }
+    if (threadCount > s_max_thread_count) { return s_max_thread_count; }
+    return (uint32_t)threadCount;
   }
 
-  void init()
+  static Worker*& currentWorker()
   {
-    for (size_t i = 0; i < this->m_thread_count; ++i)
+    static thread_local Worker* s_current_worker = nullptr;
+    return s_current_worker;
+  }
+
+  // called with m_resize_mutex held
+  void startWorker(uint32_t idx)
+  {
+    Worker* worker = this->m_worker_slots[idx].load();
+    if (worker == nullptr)
+      {
+	// slots are filled in order, thieves only look below m_worker_slot_count
+	worker = new Worker(idx);
+	this->m_worker_slots[idx].store(worker);
+	this->m_worker_slot_count.store(idx + 1);
+      }
+    worker->retiring.store(false);
+    {
+      std::lock_guard< std::mutex > mailboxLock(worker->mailbox_mutex);
+      worker->mailbox_open = true;
+    }
+    worker->thread = std::thread([this, worker]{ workerLoop(worker); });
+    placeWorker(worker);
+  }
+
+  // called with m_resize_mutex held, workers past the end of the placement order wrap around
+  void placeWorker(Worker* worker)
+  {
+    auto& cpu = this->m_placement[worker->index % this->m_placement.size()];
+    worker->numa_node.store(cpu.numa_node);
+    if (!worker->thread.joinable())
+      {
+	return;
+      }
+    // best effort, a worker that can't be pinned still runs
+    if (this->m_topology_policy.pin_workers)
+      {
+	CpuTopology::pinThread(worker->thread, cpu.cpu_id);
+      }
+    else
+      {
+	CpuTopology::Instance()->unpinThread(worker->thread);
+      }
+  }
+
+  // called with m_resize_mutex held
+  void resize(uint32_t threadCount)
+  {
+    uint32_t currentCount = this->m_thread_count.load();
+    if (this->m_stopped)
+      {
+	// start() launches them
+	this->m_thread_count.store(threadCount);
+	return;
+      }
+    if (threadCount > currentCount)
+      {
+	for (uint32_t i = currentCount; i < threadCount; ++i)
+	  {
+	    startWorker(i);
+	  }
+	this->m_thread_count.store(threadCount);
+      }
+    else
       {
-	this->m_workers.emplace_back(
-				     [this]
-				     {
-				       for (;;)
-					 {
-					   std::function< void() > task;
-					   {
-					     std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
-					     this->m_condition.wait(lock,
-								    [this]{ return this->m_stopped || !this->m_tasks.empty(); });
-					     if (this->m_stopped && this->m_tasks.empty()) { return; }
-					     task = std::move(this->m_tasks.front());
-					     this->m_tasks.pop();
-					   }
-					   task();
-					 }
-				     }
-				     );
+	this->m_thread_count.store(threadCount);
+	for (uint32_t i = threadCount; i < currentCount; ++i)
+	  {
+	    retireWorker(i);
+	  }
       }
   }
 
-  static ThreadPool* s_threadpool;
-  std::vector< std::thread > m_workers;
-  std::queue< std::function< void() > > m_tasks;
+  // called with m_resize_mutex held
+  void retireWorker(uint32_t idx)
+  {
+    Worker* worker = this->m_worker_slots[idx].load();
+    {
+      std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+      worker->retiring.store(true);
+    }
+    this->m_condition.notify_all();
+    worker->thread.join();
+  }
+
+  void submit(ThreadPoolTask* task)
+  {
+    task->m_enqueue_time = getTimestamp();
+    Worker* worker = currentWorker();
+    if (worker != nullptr)
+      {
+	worker->tasks.push(task);
+	worker->counters.raise(worker->counters.peak_queue_depth, worker->tasks.size());
+      }
+    else
+      {
+	std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+	if (this->m_stopped)
+	  {
+	    delete task;
+	    throw std::runtime_error("enqueue on stopped ThreadPool");
+	  }
+	this->m_tasks.push_back(task);
+	injectedCountChanged();
+      }
+    countersFor(worker).add(countersFor(worker).tasks_submitted, 1);
+    notifySleepers(1);
+  }
 
+  void submitWithAffinity(uint64_t affinityKey, ThreadPoolTask* task)
+  {
+    // splitmix64 finaliser, consecutive graph IDs land on different workers
+    affinityKey = (affinityKey ^ (affinityKey >> 30)) * 0xbf58476d1ce4e5b9ull;
+    affinityKey = (affinityKey ^ (affinityKey >> 27)) * 0x94d049bb133111ebull;
+    affinityKey ^= affinityKey >> 31;
+    Worker* worker = this->m_worker_slots[affinityKey % this->m_thread_count.load()].load();
+    size_t mailboxSize = 0;
+    task->m_enqueue_time = getTimestamp();
+    if (worker != nullptr)
+      {
+	std::lock_guard< std::mutex > mailboxLock(worker->mailbox_mutex);
+	if (worker->mailbox_open)
+	  {
+	    worker->mailbox.push_back(task);
+	    mailboxSize = worker->mailbox_size.fetch_add(1) + 1;
+	    worker->counters.raise(worker->peak_mailbox_depth, mailboxSize);
+	  }
+      }
+    if (mailboxSize == 0)
+      {
+	// the worker was retired or the pool stopped while we picked it
+	submit(task);
+	return;
+      }
+    countersFor(currentWorker()).add(countersFor(currentWorker()).tasks_submitted, 1);
+    if (mailboxSize > s_affinity_steal_threshold)
+      {
+	// backed up, let a thief help
+	notifySleepers(1);
+	return;
+      }
+    // pairs with the store to sleeping in waitForTask. only the owner may take
+    // this task, so wake everyone rather than one worker that would ignore it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker->sleeping.load(std::memory_order_relaxed))
+      {
+	std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+	this->m_condition.notify_all();
+      }
+  }
+
+  ThreadPoolTask* popMailboxTask(Worker* worker)
+  {
+    if (worker->mailbox_size.load(std::memory_order_relaxed) == 0)
+      {
+	return nullptr;
+      }
+    std::lock_guard< std::mutex > mailboxLock(worker->mailbox_mutex);
+    if (worker->mailbox.empty())
+      {
+	return nullptr;
+      }
+    ThreadPoolTask* task = worker->mailbox.front();
+    worker->mailbox.pop_front();
+    worker->mailbox_size.fetch_sub(1);
+    return task;
+  }
+
+  // refuses affinity tasks from now on unless some arrived since the worker last looked
+  bool closeMailbox(Worker* worker)
+  {
+    std::lock_guard< std::mutex > mailboxLock(worker->mailbox_mutex);
+    if (!worker->mailbox.empty())
+      {
+	return false;
+      }
+    worker->mailbox_open = false;
+    return true;
+  }
+
+  void notifySleepers(size_t taskCount)
+  {
+    // pairs with the increment of m_sleeping_count in waitForTask, either the
+    // sleeper sees the new tasks when it rescans or we see the sleeper here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->m_sleeping_count.load(std::memory_order_relaxed) > 0)
+      {
+	std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+	if (taskCount > 1)
+	  {
+	    this->m_condition.notify_all();
+	  }
+	else
+	  {
+	    this->m_condition.notify_one();
+	  }
+      }
+  }
+
+  static uint64_t getTimestamp()
+  {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  TaskCounters& countersFor(Worker* worker)
+  {
+    return (worker != nullptr) ? worker->counters : this->m_external_counters;
+  }
+
+  static void addCounters(ThreadPoolStatistics& statistics, TaskCounters& counters)
+  {
+    statistics.tasks_submitted += counters.tasks_submitted.load(std::memory_order_relaxed);
+    statistics.tasks_completed += counters.tasks_completed.load(std::memory_order_relaxed);
+    statistics.tasks_stolen += counters.tasks_stolen.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < ThreadPoolStatistics::s_latency_bucket_count; ++i)
+      {
+	statistics.latency_histogram[i] += counters.latency_histogram[i].load(std::memory_order_relaxed);
+      }
+  }
+
+  // called with m_tasks_mutex held
+  void injectedCountChanged()
+  {
+    this->m_injected_count.store(this->m_tasks.size());
+    if (this->m_tasks.size() > this->m_peak_injected_count.load())
+      {
+	this->m_peak_injected_count.store(this->m_tasks.size());
+      }
+  }
+
+  // returns when the task started, the task may be gone once this returns
+  uint64_t runTask(TaskCounters& counters, ThreadPoolTask* task)
+  {
+    uint64_t startTime = getTimestamp();
+    counters.addLatency((startTime > task->m_enqueue_time) ? startTime - task->m_enqueue_time : 0);
+    task->run();
+    task->finished();
+    counters.add(counters.tasks_completed, 1);
+    return startTime;
+  }
+
+  ThreadPoolTask* popInjectedTask()
+  {
+    // idle workers probe here on every findTask, so the lock is only taken
+    // when there looks to be something to pop. a task pushed right after
+    // the check is found by the probe after, or by waitForTask under the lock
+    if (this->m_injected_count.load(std::memory_order_acquire) == 0)
+      {
+	return nullptr;
+      }
+    std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+    if (this->m_tasks.empty())
+      {
+	return nullptr;
+      }
+    ThreadPoolTask* task = this->m_tasks.front();
+    this->m_tasks.pop_front();
+    injectedCountChanged();
+    return task;
+  }
+
+  ThreadPoolTask* stealTask(Worker* thief)
+  {
+    // retiring workers past m_thread_count drain their own deques
+    uint32_t workerCount = this->m_thread_count.load();
+    // xorshift so that thieves don't all hammer the same victim
+    thief->steal_seed ^= thief->steal_seed << 13;
+    thief->steal_seed ^= thief->steal_seed >> 17;
+    thief->steal_seed ^= thief->steal_seed << 5;
+    uint32_t startIdx = thief->steal_seed % workerCount;
+    // the first pass only robs workers on the thief's own NUMA node
+    uint32_t thiefNode = thief->numa_node.load(std::memory_order_relaxed);
+    for (uint32_t pass = this->m_steal_from_own_node_first.load(std::memory_order_relaxed) ? 0 : 1; pass < 2; ++pass)
+      {
+	for (uint32_t i = 0; i < workerCount; ++i)
+	  {
+	    Worker* victim = this->m_worker_slots[(startIdx + i) % workerCount].load();
+	    // slots are still being filled while the first workers start up
+	    if (victim == thief || victim == nullptr ||
+		(pass == 0 && victim->numa_node.load(std::memory_order_relaxed) != thiefNode))
+	      {
+		continue;
+	      }
+	    ThreadPoolTask* task = victim->tasks.steal();
+	    if (task == nullptr && victim->mailbox_size.load(std::memory_order_relaxed) > s_affinity_steal_threshold)
+	      {
+		task = popMailboxTask(victim);
+	      }
+	    if (task != nullptr)
+	      {
+		return task;
+	      }
+	  }
+      }
+    return nullptr;
+  }
+
+  ThreadPoolTask* findTask(Worker* worker)
+  {
+    ThreadPoolTask* task = worker->tasks.pop();
+    if (task == nullptr)
+      {
+	task = popMailboxTask(worker);
+      }
+    if (task == nullptr && !worker->retiring.load())
+      {
+	task = popInjectedTask();
+	if (task == nullptr)
+	  {
+	    task = stealTask(worker);
+	    if (task != nullptr)
+	      {
+		worker->counters.add(worker->counters.tasks_stolen, 1);
+	      }
+	  }
+      }
+    return task;
+  }
+
+  // called with m_tasks_mutex held. with a runner, only counts the
+  // mailboxes it may take from: its own and the backed up ones
+  bool hasQueuedTasks(Worker* runner = nullptr)
+  {
+    if (!this->m_tasks.empty())
+      {
+	return true;
+      }
+    for (uint32_t i = 0; i < this->m_worker_slot_count.load(); ++i)
+      {
+	Worker* worker = this->m_worker_slots[i].load();
+	size_t mailboxSize = worker->mailbox_size.load();
+	if (!worker->tasks.empty() ||
+	    (mailboxSize > 0 && (runner == nullptr || runner == worker || mailboxSize > s_affinity_steal_threshold)))
+	  {
+	    return true;
+	  }
+      }
+    return false;
+  }
+
+  // called with m_tasks_mutex held
+  bool isQuiescent()
+  {
+    return this->m_sleeping_count.load() == this->m_running_worker_count &&
+      this->m_external_task_count.load() == 0 &&
+      !hasQueuedTasks();
+  }
+
+  // returns false once the worker should exit: the pool is stopped or the
+  // worker is retired, and there is nothing left for it to run
+  bool waitForTask(Worker* worker)
+  {
+    std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+    this->m_sleeping_count.fetch_add(1);
+    worker->sleeping.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->m_barrier_waiting_count.load() > 0)
+      {
+	this->m_idle_condition.notify_all();
+      }
+    this->m_condition.wait(lock, [this, worker]{ return this->m_stopped || worker->retiring.load() || hasQueuedTasks(worker); });
+    worker->sleeping.store(false);
+    this->m_sleeping_count.fetch_sub(1);
+    if (worker->retiring.load())
+      {
+	return !worker->tasks.empty() || worker->mailbox_size.load() > 0;
+      }
+    return !this->m_stopped || hasQueuedTasks(worker);
+  }
+
+  void workerLoop(Worker* worker)
+  {
+    currentWorker() = worker;
+    {
+      std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+      ++this->m_running_worker_count;
+    }
+    uint64_t idleStartTime = getTimestamp();
+    for (;;)
+      {
+	ThreadPoolTask* task = findTask(worker);
+	for (uint32_t spin = 0; task == nullptr && spin < s_idle_spin_count; ++spin)
+	  {
+	    std::this_thread::yield();
+	    task = findTask(worker);
+	  }
+	if (task == nullptr)
+	  {
+	    if (!waitForTask(worker) && closeMailbox(worker)) { break; }
+	    continue;
+	  }
+	uint64_t startTime = runTask(worker->counters, task);
+	uint64_t endTime = getTimestamp();
+	worker->counters.add(worker->counters.idle_ns, startTime - idleStartTime);
+	worker->counters.add(worker->counters.busy_ns, endTime - startTime);
+	idleStartTime = endTime;
+      }
+    worker->counters.add(worker->counters.idle_ns, getTimestamp() - idleStartTime);
+    {
+      std::unique_lock< std::mutex > lock(this->m_tasks_mutex);
+      --this->m_running_worker_count;
+      if (this->m_barrier_waiting_count.load() > 0)
+	{
+	  this->m_idle_condition.notify_all();
+	}
+    }
+    currentWorker() = nullptr;
+  }
+
+  static const uint32_t s_idle_spin_count = 16;
+  static const size_t s_affinity_steal_threshold = 4;
+  static const uint32_t s_max_thread_count = 1024;
+  std::unique_ptr< std::atomic< Worker* >[] > m_worker_slots;
+  std::atomic< uint32_t > m_worker_slot_count; // slots below this hold a Worker, running or not
+  std::deque< ThreadPoolTask* > m_tasks; // injection queue for submissions from non worker threads
+  ThreadPoolTopologyPolicy m_topology_policy; // guarded by m_resize_mutex
+  std::vector< CpuTopology::LogicalCpu > m_placement; // guarded by m_resize_mutex, worker i runs on m_placement[i % size]
+  std::atomic< bool > m_steal_from_own_node_first;
+
+  std::mutex m_resize_mutex; // serialises start, stop, joinAll, setThreadCount and setTopologyPolicy
   std::mutex m_tasks_mutex;
   std::condition_variable m_condition;
-  bool m_stopped;
-  uint32_t m_thread_count;
+  std::condition_variable m_idle_condition; // signalled when a worker goes idle while joinAll waits
+  std::atomic< bool > m_stopped; // written under m_tasks_mutex, read without it on the worker path
+  std::atomic< uint32_t > m_thread_count;
+  std::atomic< uint32_t > m_sleeping_count;
+  uint32_t m_running_worker_count; // guarded by m_tasks_mutex
+  std::atomic< uint32_t > m_barrier_waiting_count;
+  std::atomic< uint32_t > m_external_task_count;
+  std::atomic< uint64_t > m_injected_count; // m_tasks.size() for readers that don't hold m_tasks_mutex
+  std::atomic< uint64_t > m_peak_injected_count;
+  TaskCounters m_external_counters; // tasks submitted or run by threads outside the pool
+  std::mutex m_statistics_path_mutex;
+  std::string m_statistics_path;
 };
 
+  /*
+   * A set of tasks that can be waited on together. Tasks are stored in the
+   * group rather than allocated one by one: run() places the functor in a
+   * small inline buffer of a task taken from a chunk of 64, runBulk() keeps
+   * one copy of the functor and one contiguous array of index tasks.
+   * run and runBulk must be called from one thread at a time.
+   */
+  class TaskGroup : private Noncopyable
+  {
+  public:
+  TaskGroup(ThreadPool* threadPool = ThreadPool::Instance()) :
+    m_thread_pool(threadPool),
+    m_pending_count(0),
+    m_next_task_idx(s_chunk_size)
+    {
+    }
+
+    ~TaskGroup()
+      {
+	waitForTasks();
+      }
+
+    template< class F >
+    void run(F&& funct)
+    {
+      if (this->m_next_task_idx == s_chunk_size)
+	{
+	  this->m_task_chunks.emplace_back(new InlineTask[s_chunk_size]);
+	  this->m_next_task_idx = 0;
+	}
+      InlineTask* task = &this->m_task_chunks.back()[this->m_next_task_idx++];
+      task->set(this, std::forward< F >(funct));
+      this->m_pending_count.fetch_add(1);
+      try
+	{
+	  this->m_thread_pool->enqueueBulk(task, 1);
+	}
+      catch (...)
+	{
+	  taskFinished();
+	  throw;
+	}
+    }
+
+    // calls funct(idx) for idx in [0, count)
+    template< class F >
+    void runBulk(size_t count, F&& funct)
+    {
+      if (count == 0) { return; }
+      typedef typename std::decay< F >::type functor_type;
+      auto batch = new Batch< functor_type >(this, count, std::forward< F >(funct));
+      this->m_batches.emplace_back(batch);
+      this->m_pending_count.fetch_add(count);
+      try
+	{
+	  this->m_thread_pool->enqueueBulk(batch->tasks.get(), count);
+	}
+      catch (...)
+	{
+	  for (size_t i = 0; i < count; ++i) { taskFinished(); }
+	  throw;
+	}
+    }
+
+    // helps running queued tasks while the group's tasks are outstanding,
+    // rethrows the first exception one of them threw
+    void wait()
+    {
+      waitForTasks();
+      std::exception_ptr exception;
+      {
+	std::lock_guard< std::mutex > lock(this->m_mutex);
+	std::swap(exception, this->m_exception);
+      }
+      if (exception)
+	{
+	  std::rethrow_exception(exception);
+	}
+    }
+
+  private:
+    class GroupTask : public ThreadPoolBulkTask
+    {
+    public:
+    GroupTask() : m_group(nullptr) {}
+
+      void finished() override { m_group->taskFinished(); }
+
+    protected:
+      void invoke(void (*invoker)(void*, size_t), void* functor, size_t idx)
+      {
+	try
+	  {
+	    invoker(functor, idx);
+	  }
+	catch (...)
+	  {
+	    m_group->setException(std::current_exception());
+	  }
+      }
+
+      TaskGroup* m_group;
+    };
+
+    class InlineTask : public GroupTask
+    {
+    public:
+    InlineTask() : m_functor(nullptr), m_invoker(nullptr), m_destroyer(nullptr) {}
+      ~InlineTask()
+	{
+	  if (m_destroyer != nullptr) { m_destroyer(m_functor, m_functor != (void*)m_storage); }
+	}
+
+      template< class F >
+      void set(TaskGroup* group, F&& funct)
+      {
+	typedef typename std::decay< F >::type functor_type;
+	this->m_group = group;
+	bool fitsInline = sizeof(functor_type) <= sizeof(m_storage) && alignof(functor_type) <= alignof(std::max_align_t);
+	// only functors too big for the inline buffer fall back to the heap
+	m_functor = fitsInline ? new (m_storage) functor_type(std::forward< F >(funct)) : new functor_type(std::forward< F >(funct));
+	m_invoker = [](void* functor, size_t) { (*static_cast< functor_type* >(functor))(); };
+	m_destroyer = [](void* functor, bool onHeap)
+	  {
+	    if (onHeap) { delete static_cast< functor_type* >(functor); }
+	    else { static_cast< functor_type* >(functor)->~functor_type(); }
+	  };
+      }
+
+      void run() override { invoke(m_invoker, m_functor, 0); }
+
+    private:
+      alignas(std::max_align_t) unsigned char m_storage[48];
+      void* m_functor;
+      void (*m_invoker)(void*, size_t);
+      void (*m_destroyer)(void*, bool);
+    };
+
+    class IndexTask : public GroupTask
+    {
+    public:
+      void run() override { invoke(m_invoker, m_functor, m_idx); }
+
+      void (*m_invoker)(void*, size_t);
+      void* m_functor;
+      size_t m_idx;
+      friend class TaskGroup;
+    };
+
+    struct BatchBase
+    {
+      virtual ~BatchBase() {}
+    };
+
+    template< class F >
+    struct Batch : public BatchBase
+    {
+    Batch(TaskGroup* group, size_t count, F funct) :
+      functor(std::move(funct)), tasks(new IndexTask[count])
+      {
+	for (size_t i = 0; i < count; ++i)
+	  {
+	    tasks[i].m_group = group;
+	    tasks[i].m_functor = &functor;
+	    tasks[i].m_invoker = [](void* f, size_t idx) { (*static_cast< F* >(f))(idx); };
+	    tasks[i].m_idx = i;
+	  }
+      }
+
+      F functor;
+      std::unique_ptr< IndexTask[] > tasks;
+    };
+
+    void waitForTasks()
+    {
+      while (this->m_pending_count.load() > 0)
+	{
+	  if (this->m_thread_pool->runPendingTask())
+	    {
+	      continue;
+	    }
+	  // nothing left to help with, the remaining tasks are running elsewhere
+	  std::unique_lock< std::mutex > lock(this->m_mutex);
+	  this->m_condition.wait(lock, [this]{ return this->m_pending_count.load() == 0; });
+	}
+      // the last task drops the count to zero while holding the mutex, once we
+      // can take it that task is done touching the group and it may be destroyed
+      std::lock_guard< std::mutex > lock(this->m_mutex);
+      this->m_task_chunks.clear();
+      this->m_batches.clear();
+      this->m_next_task_idx = s_chunk_size;
+    }
+
+    void taskFinished()
+    {
+      size_t pendingCount = this->m_pending_count.load();
+      for (;;)
+	{
+	  if (pendingCount > 1)
+	    {
+	      if (this->m_pending_count.compare_exchange_weak(pendingCount, pendingCount - 1)) { return; }
+	      continue;
+	    }
+	  std::lock_guard< std::mutex > lock(this->m_mutex);
+	  if (this->m_pending_count.compare_exchange_strong(pendingCount, pendingCount - 1))
+	    {
+	      this->m_condition.notify_all();
+	      return;
+	    }
+	}
+    }
+
+    void setException(std::exception_ptr exception)
+    {
+      std::lock_guard< std::mutex > lock(this->m_mutex);
+      if (!this->m_exception)
+	{
+	  this->m_exception = exception;
+	}
+    }
+
+    static const size_t s_chunk_size = 64;
+    ThreadPool* m_thread_pool;
+    std::atomic< size_t > m_pending_count;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::exception_ptr m_exception;
+    std::vector< std::unique_ptr< InlineTask[] > > m_task_chunks;
+    size_t m_next_task_idx;
+    std::vector< std::unique_ptr< BatchBase > > m_batches;
+  };
+
+  template< class F >
+  void ThreadPool::parallelFor(size_t begin, size_t end, size_t grainSize, F&& funct)
+  {
+    if (begin >= end) { return; }
+    grainSize = std::max< size_t >(grainSize, 1);
+    size_t chunkCount = (end - begin + grainSize - 1) / grainSize;
+    TaskGroup taskGroup(this);
+    taskGroup.runBulk(chunkCount, [&funct, begin, end, grainSize](size_t chunkIdx)
+		      {
+			size_t chunkEnd = std::min(end, begin + (chunkIdx + 1) * grainSize);
+			for (size_t idx = begin + chunkIdx * grainSize; idx < chunkEnd; ++idx)
+			  {
+			    funct(idx);
+			  }
+		      });
+    taskGroup.wait();
+  }
+
 #endif
@@ -11,6 +11,7 @@
   typedef uint32_t position;
   static position MAX_POSITION = std::numeric_limits< position >::max();
   enum class AlleleCountType { NinteyFivePercent = 0, NinteyPercent = 1, EightyPercent = 2, SeventyPercent = 3, LowPercent = 4, Ambiguous = 5 };
+  static const size_t AlleleCountTypeCount = 6;
   static const std::vector< AlleleCountType > AllAlleleCountTypes = { AlleleCountType::NinteyFivePercent, AlleleCountType::NinteyPercent, AlleleCountType::EightyPercent, AlleleCountType::SeventyPercent, AlleleCountType::LowPercent, AlleleCountType::Ambiguous };
   struct AlleleCountTypeHash
   {
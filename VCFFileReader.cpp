@@ -0,0 +1,806 @@
+#include "VCFFileReader.h"
+#include "ThreadPool.hpp"
+#include "VariantList.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+  const size_t VCFFileReader::s_line_read_size;
+
+  VCFFileReader::VCFFileReader(const std::string& vcfPath) :
+    m_vcf_path(vcfPath),
+    m_fd(-1),
+    m_file_size(0),
+    m_records_offset(0),
+    m_header_ptr(std::make_shared< VCFHeader >()),
+    m_pool_ptr(std::make_shared< VariantPool >()),
+    m_next_chunk_offset(0),
+    m_max_chunk_count(2 * std::max< uint32_t >(ThreadPool::Instance()->getThreadCount(), 1)),
+    m_current_variant_idx(0),
+    m_process_overlapping_alleles(false),
+    m_returned_count(0),
+    m_variants_loaded(false),
+    m_next_variant_idx(0)
+  {
+    if (BgzfFile::isBgzf(vcfPath))
+      {
+	this->m_bgzf_file_ptr = std::make_shared< BgzfFile >(vcfPath);
+	this->m_file_size = this->m_bgzf_file_ptr->getUncompressedSize();
+      }
+    else
+      {
+	this->m_fd = open(vcfPath.c_str(), O_RDONLY);
+	if (this->m_fd < 0)
+	  {
+	    throw std::runtime_error("VCFFileReader could not open " + vcfPath);
+	  }
+      }
+    try
+      {
+	struct stat fileStat;
+	if (this->m_fd >= 0)
+	  {
+	    if (fstat(this->m_fd, &fileStat) != 0)
+	      {
+		throw std::runtime_error("VCFFileReader could not read " + vcfPath);
+	      }
+	    this->m_file_size = fileStat.st_size;
+	  }
+	readHeader();
+	this->m_next_chunk_offset = this->m_records_offset;
+      }
+    catch (...)
+      {
+	if (this->m_fd >= 0)
+	  {
+	    close(this->m_fd);
+	  }
+	throw;
+      }
+  }
+
+  VCFFileReader::~VCFFileReader()
+  {
+    // claim the ranges no task has started so none starts on a closed file,
+    // and wait for the ones being parsed
+    for (auto& chunkPtr : this->m_chunk_ptrs)
+      {
+	std::call_once(chunkPtr->parse_flag, []() {});
+      }
+    if (this->m_fd >= 0)
+      {
+	close(this->m_fd);
+      }
+  }
+
+  VCFFileReader::VariantPool::~VariantPool()
+  {
+    for (auto variantPtr : this->free_variants)
+      {
+	delete variantPtr;
+      }
+    for (auto blockPtr : this->free_blocks)
+      {
+	::operator delete(blockPtr);
+      }
+  }
+
+  Variant* VCFFileReader::VariantPool::acquireVariant()
+  {
+    {
+      std::lock_guard< std::mutex > lock(this->mutex);
+      if (!this->free_variants.empty())
+	{
+	  Variant* variantPtr = this->free_variants.back();
+	  this->free_variants.pop_back();
+	  return variantPtr;
+	}
+    }
+    return new Variant();
+  }
+
+  void VCFFileReader::VariantPool::releaseVariant(Variant* variantPtr)
+  {
+    std::lock_guard< std::mutex > lock(this->mutex);
+    this->free_variants.emplace_back(variantPtr);
+  }
+
+  void* VCFFileReader::VariantPool::allocateBlock(size_t size)
+  {
+    {
+      std::lock_guard< std::mutex > lock(this->mutex);
+      if (this->block_size == 0)
+	{
+	  this->block_size = size;
+	}
+      if (size == this->block_size && !this->free_blocks.empty())
+	{
+	  void* blockPtr = this->free_blocks.back();
+	  this->free_blocks.pop_back();
+	  return blockPtr;
+	}
+    }
+    return ::operator new(size);
+  }
+
+  void VCFFileReader::VariantPool::releaseBlock(void* blockPtr, size_t size)
+  {
+    {
+      std::lock_guard< std::mutex > lock(this->mutex);
+      if (size == this->block_size)
+	{
+	  this->free_blocks.emplace_back(blockPtr);
+	  return;
+	}
+    }
+    ::operator delete(blockPtr);
+  }
+
+  // returns the newline ending the record starting at line, or end if there
+  // isn't one, and where its first s_max_field_count fields start
+  const char* VCFFileReader::scanRecord(const char* line, const char* end, uint32_t* fieldStarts, size_t& fieldCount)
+  {
+    const char* cursor = line;
+    fieldStarts[0] = 0;
+    fieldCount = 1;
+#ifdef __SSE2__
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    for (; cursor + 16 <= end; cursor += 16)
+      {
+	__m128i bytes = _mm_loadu_si128((const __m128i*)cursor);
+	uint32_t newlineMask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newlines));
+	uint32_t mask = newlineMask;
+	if (fieldCount < s_max_field_count)
+	  {
+	    mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, tabs));
+	  }
+	while (mask != 0)
+	  {
+	    uint32_t bit = __builtin_ctz(mask);
+	    if (newlineMask & (1u << bit))
+	      {
+		return cursor + bit;
+	      }
+	    fieldStarts[fieldCount++] = (cursor + bit + 1) - line;
+	    mask &= mask - 1;
+	    if (fieldCount == s_max_field_count)
+	      {
+		mask &= newlineMask;
+	      }
+	  }
+      }
+#endif
+    for (; cursor < end; ++cursor)
+      {
+	if (*cursor == '\n')
+	  {
+	    return cursor;
+	  }
+	if (*cursor == '\t' && fieldCount < s_max_field_count)
+	  {
+	    fieldStarts[fieldCount++] = (cursor + 1) - line;
+	  }
+      }
+    return end;
+  }
+
+  // a record's CHROM through REF, and INFO's END for alleles reaching past
+  // REF, as zero based positions with the end left out. False if POS isn't a
+  // position or there's no REF
+  bool VCFFileReader::getRecordBounds(const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t& beginPosition, uint64_t& endPosition)
+  {
+    const size_t refIdx = static_cast< size_t >(Variant::Field::REF);
+    const size_t infoIdx = static_cast< size_t >(Variant::Field::INFO);
+    position variantPosition;
+    if (fieldCount <= refIdx + 1 || !Variant::parsePosition(line + fieldStarts[1], fieldStarts[2] - fieldStarts[1] - 1, variantPosition))
+      {
+	return false;
+      }
+    beginPosition = (variantPosition > 0) ? variantPosition - 1 : 0;
+    endPosition = beginPosition + std::max< uint32_t >(fieldStarts[refIdx + 1] - fieldStarts[refIdx] - 1, 1);
+    if (fieldCount > infoIdx)
+      {
+	const char* info = line + fieldStarts[infoIdx];
+	const char* infoEnd = (fieldCount > infoIdx + 1) ? line + fieldStarts[infoIdx + 1] - 1 : lineEnd;
+	for (const char* entry = info; entry < infoEnd; )
+	  {
+	    const char* entryEnd = (const char*)memchr(entry, ';', infoEnd - entry);
+	    entryEnd = (entryEnd == nullptr) ? infoEnd : entryEnd;
+	    position infoEndPosition;
+	    if (entryEnd - entry > 4 && memcmp(entry, "END=", 4) == 0)
+	      {
+		if (Variant::parsePosition(entry + 4, entryEnd - entry - 4, infoEndPosition))
+		  {
+		    endPosition = std::max< uint64_t >(endPosition, infoEndPosition);
+		  }
+		break;
+	      }
+	    entry = entryEnd + 1;
+	  }
+      }
+    return true;
+  }
+
+  ssize_t VCFFileReader::readAt(uint64_t offset, char* buffer, size_t size)
+  {
+    if (this->m_bgzf_file_ptr != nullptr)
+      {
+	return this->m_bgzf_file_ptr->read(offset, buffer, size);
+      }
+    return pread(this->m_fd, buffer, size, offset);
+  }
+
+  void VCFFileReader::readHeader()
+  {
+    std::vector< char > readBuffer(s_header_buffer_size);
+    std::string headerText;
+    size_t lineStart = 0;
+    while (true)
+      {
+	size_t lineEnd = headerText.find('\n', lineStart);
+	if (lineEnd == std::string::npos)
+	  {
+	    ssize_t readSize = readAt(headerText.size(), readBuffer.data(), readBuffer.size());
+	    if (readSize < 0)
+	      {
+		throw std::runtime_error("VCFFileReader could not read " + this->m_vcf_path);
+	      }
+	    if (readSize > 0)
+	      {
+		headerText.append(readBuffer.data(), readSize);
+		continue;
+	      }
+	    lineEnd = headerText.size();
+	  }
+	std::string line = headerText.substr(lineStart, lineEnd - lineStart);
+	if (line.empty() || line[0] != '#')
+	  {
+	    break;
+	  }
+	this->m_header_ptr->addHeaderLine(line);
+	lineStart = lineEnd + 1;
+	if (line.size() > 1 && line[1] != '#') // the #CHROM line ends the header
+	  {
+	    this->m_records_offset = std::min< uint64_t >(lineStart, this->m_file_size);
+	    return;
+	  }
+      }
+    throw std::runtime_error("VCFFileReader found no #CHROM line in " + this->m_vcf_path);
+  }
+
+  // calls lineFunct(line, lineEnd, fieldStarts, fieldCount, lineOffset) for
+  // every line starting in [startOffset, endOffset), line breaks left out
+  template< class F >
+  void VCFFileReader::forEachLine(uint64_t startOffset, uint64_t endOffset, std::vector< char >& buffer, F&& lineFunct)
+  {
+    // reading from the byte before the range tells whether a line starts right at startOffset
+    uint64_t readOffset = (startOffset == this->m_records_offset) ? startOffset : startOffset - 1;
+    size_t readSize = 0;
+    auto readMore = [&](size_t size)
+      {
+	if (buffer.size() < readSize + size)
+	  {
+	    buffer.resize(readSize + size);
+	  }
+	ssize_t bytesRead = readAt(readOffset + readSize, buffer.data() + readSize, size);
+	if (bytesRead < 0)
+	  {
+	    throw std::runtime_error("VCFFileReader could not read " + this->m_vcf_path);
+	  }
+	readSize += bytesRead;
+	return bytesRead > 0;
+      };
+    readMore(endOffset - readOffset);
+
+    size_t lineStart = 0;
+    if (readOffset != startOffset)
+      {
+	const char* newline = (const char*)memchr(buffer.data(), '\n', readSize);
+	if (newline == nullptr)
+	  {
+	    return; // a line started before the range covers all of it
+	  }
+	lineStart = (newline - buffer.data()) + 1;
+      }
+    uint32_t fieldStarts[s_max_field_count];
+    size_t fieldCount;
+    while (readOffset + lineStart < endOffset)
+      {
+	size_t newlineOffset = scanRecord(buffer.data() + lineStart, buffer.data() + readSize, fieldStarts, fieldCount) - buffer.data();
+	if (newlineOffset == readSize && readMore(std::max(s_line_read_size, readSize)))
+	  {
+	    continue;
+	  }
+	// readMore grows the buffer even when the file has ended, so the last line is found again in it
+	const char* data = buffer.data();
+	const char* newline = data + newlineOffset;
+	const char* lineEnd = (newline > data + lineStart && newline[-1] == '\r') ? newline - 1 : newline;
+	lineFunct(data + lineStart, lineEnd, fieldStarts, fieldCount, readOffset + lineStart);
+	lineStart = (newline - data) + 1;
+      }
+  }
+
+  // calls chunkFunct(chunkIdx, startOffset, endOffset) for every range of the records on the ThreadPool and waits for them
+  template< class F >
+  void VCFFileReader::forEachChunk(F&& chunkFunct)
+  {
+    size_t chunkCount = ((this->m_file_size - this->m_records_offset) + s_chunk_size - 1) / s_chunk_size;
+    auto runChunk = [this, &chunkFunct](size_t chunkIdx)
+      {
+	uint64_t startOffset = this->m_records_offset + (chunkIdx * s_chunk_size);
+	chunkFunct(chunkIdx, startOffset, std::min< uint64_t >(startOffset + s_chunk_size, this->m_file_size));
+      };
+    bool poolRunning = true;
+    try
+      {
+	ThreadPool::Instance()->parallelFor(0, chunkCount, 1, runChunk);
+      }
+    catch (const std::runtime_error&)
+      {
+	poolRunning = false; // nothing was enqueued, or a range failed and will fail again below
+      }
+    if (!poolRunning)
+      {
+	for (size_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx)
+	  {
+	    runChunk(chunkIdx);
+	  }
+      }
+  }
+
+  Variant::SharedPtr VCFFileReader::createVariant(const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t lineOffset)
+  {
+    Variant::SharedPtr variantPtr(this->m_pool_ptr->acquireVariant(), VariantRecycler{this->m_pool_ptr}, PoolAllocator< Variant >(this->m_pool_ptr));
+    try
+      {
+	variantPtr->setRecord(line, lineEnd - line, fieldStarts, fieldCount);
+      }
+    catch (const std::runtime_error& e)
+      {
+	throw std::runtime_error(this->m_vcf_path + " at byte " + std::to_string(lineOffset) + ": " + e.what());
+      }
+    return variantPtr;
+  }
+
+  void VCFFileReader::parseChunk(Chunk* chunkPtr)
+  {
+    chunkPtr->variant_ptrs.clear(); // from an attempt that threw
+    forEachLine(chunkPtr->start_offset, chunkPtr->end_offset, chunkPtr->buffer,
+		[this, chunkPtr](const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t lineOffset)
+		{
+		  if (line != lineEnd && *line != '#')
+		    {
+		      chunkPtr->variant_ptrs.emplace_back(createVariant(line, lineEnd, fieldStarts, fieldCount, lineOffset));
+		    }
+		});
+  }
+
+  // keeps m_max_chunk_count ranges queued or parsed ahead
+  void VCFFileReader::scheduleChunks()
+  {
+    while (this->m_chunk_ptrs.size() < this->m_max_chunk_count && this->m_next_chunk_offset < this->m_file_size)
+      {
+	auto chunkPtr = std::make_shared< Chunk >();
+	chunkPtr->start_offset = this->m_next_chunk_offset;
+	chunkPtr->end_offset = std::min< uint64_t >(this->m_next_chunk_offset + s_chunk_size, this->m_file_size);
+	if (!this->m_free_buffers.empty())
+	  {
+	    chunkPtr->buffer = std::move(this->m_free_buffers.back());
+	    this->m_free_buffers.pop_back();
+	  }
+	if (!this->m_free_variant_lists.empty())
+	  {
+	    chunkPtr->variant_ptrs = std::move(this->m_free_variant_lists.back());
+	    this->m_free_variant_lists.pop_back();
+	  }
+	this->m_next_chunk_offset = chunkPtr->end_offset;
+	this->m_chunk_ptrs.emplace_back(chunkPtr);
+	try
+	  {
+	    // the destructor claims parse_flag before the file is closed, a late task finds it taken
+	    ThreadPool::Instance()->enqueue([this, chunkPtr]()
+					    {
+					      std::call_once(chunkPtr->parse_flag, [this, &chunkPtr]() { parseChunk(chunkPtr.get()); });
+					    });
+	  }
+	catch (const std::runtime_error&)
+	  {
+	    // the pool is stopped, readVariant parses the range itself
+	  }
+      }
+  }
+
+  bool VCFFileReader::readVariant(Variant::SharedPtr& variantPtr)
+  {
+    while (this->m_current_chunk_ptr == nullptr || this->m_current_variant_idx >= this->m_current_chunk_ptr->variant_ptrs.size())
+      {
+	if (this->m_current_chunk_ptr != nullptr)
+	  {
+	    this->m_current_chunk_ptr->variant_ptrs.clear();
+	    this->m_free_buffers.emplace_back(std::move(this->m_current_chunk_ptr->buffer));
+	    this->m_free_variant_lists.emplace_back(std::move(this->m_current_chunk_ptr->variant_ptrs));
+	    this->m_current_chunk_ptr = nullptr;
+	  }
+	scheduleChunks();
+	if (this->m_chunk_ptrs.empty())
+	  {
+	    return false;
+	  }
+	auto chunkPtr = this->m_chunk_ptrs.front();
+	// waits if a worker is parsing it, parses it here if none has started
+	std::call_once(chunkPtr->parse_flag, [this, &chunkPtr]() { parseChunk(chunkPtr.get()); });
+	this->m_chunk_ptrs.pop_front();
+	this->m_current_chunk_ptr = chunkPtr;
+	this->m_current_variant_idx = 0;
+	scheduleChunks();
+      }
+    variantPtr = std::move(this->m_current_chunk_ptr->variant_ptrs[this->m_current_variant_idx++]);
+    if (this->m_process_overlapping_alleles)
+      {
+	variantPtr->processOverlappingAlleles();
+      }
+    return true;
+  }
+
+  bool VCFFileReader::getNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (this->m_variants_loaded)
+      {
+	if (this->m_next_variant_idx >= this->m_variant_ptrs.size())
+	  {
+	    return false;
+	  }
+	variantPtr = this->m_variant_ptrs[this->m_next_variant_idx++];
+      }
+    else if (this->m_peeked_variant_ptr != nullptr)
+      {
+	variantPtr = std::move(this->m_peeked_variant_ptr);
+	this->m_peeked_variant_ptr = nullptr;
+      }
+    else
+      {
+	Variant::SharedPtr nextVariantPtr;
+	if (!readVariant(nextVariantPtr))
+	  {
+	    return false;
+	  }
+	variantPtr = std::move(nextVariantPtr);
+      }
+    ++this->m_returned_count;
+    return true;
+  }
+
+  bool VCFFileReader::peekNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (this->m_variants_loaded)
+      {
+	if (this->m_next_variant_idx >= this->m_variant_ptrs.size())
+	  {
+	    return false;
+	  }
+	variantPtr = this->m_variant_ptrs[this->m_next_variant_idx];
+	return true;
+      }
+    if (this->m_peeked_variant_ptr == nullptr && !readVariant(this->m_peeked_variant_ptr))
+      {
+	return false;
+      }
+    variantPtr = this->m_peeked_variant_ptr;
+    return true;
+  }
+
+  void VCFFileReader::processOverlappingAlleles()
+  {
+    this->m_process_overlapping_alleles = true;
+    if (this->m_peeked_variant_ptr != nullptr)
+      {
+	this->m_peeked_variant_ptr->processOverlappingAlleles();
+      }
+    for (size_t i = this->m_next_variant_idx; i < this->m_variant_ptrs.size(); ++i)
+      {
+	this->m_variant_ptrs[i]->processOverlappingAlleles();
+      }
+  }
+
+  size_t VCFFileReader::getCount()
+  {
+    if (this->m_variants_loaded)
+      {
+	return this->m_returned_count + (this->m_variant_ptrs.size() - this->m_next_variant_idx);
+      }
+    // count the whole file without parsing it or moving the stream
+    size_t chunkCount = ((this->m_file_size - this->m_records_offset) + s_chunk_size - 1) / s_chunk_size;
+    std::vector< size_t > recordCounts(chunkCount, 0);
+    forEachChunk([this, &recordCounts](size_t chunkIdx, uint64_t startOffset, uint64_t endOffset)
+		 {
+		   std::vector< char > buffer;
+		   size_t recordCount = 0;
+		   forEachLine(startOffset, endOffset, buffer, [&recordCount](const char* line, const char* lineEnd, const uint32_t*, size_t, uint64_t)
+			       {
+				 recordCount += (line != lineEnd && *line != '#') ? 1 : 0;
+			       });
+		   recordCounts[chunkIdx] = recordCount;
+		 });
+    size_t recordCount = 0;
+    for (auto chunkRecordCount : recordCounts)
+      {
+	recordCount += chunkRecordCount;
+      }
+    return recordCount;
+  }
+
+  // whether sort would leave the records as they are, looking only at CHROM and POS
+  bool VCFFileReader::isRecordOrderSorted()
+  {
+    size_t chunkCount = ((this->m_file_size - this->m_records_offset) + s_chunk_size - 1) / s_chunk_size;
+    std::vector< std::vector< ContigRun > > chunkContigRuns(chunkCount);
+    forEachChunk([this, &chunkContigRuns](size_t chunkIdx, uint64_t startOffset, uint64_t endOffset)
+		 {
+		   std::vector< char > buffer;
+		   auto& contigRuns = chunkContigRuns[chunkIdx];
+		   forEachLine(startOffset, endOffset, buffer, [&contigRuns](const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t)
+			       {
+				 if (line == lineEnd || *line == '#')
+				   {
+				     return;
+				   }
+				 size_t contigNameLength = (fieldCount > 1) ? fieldStarts[1] - 1 : lineEnd - line;
+				 position variantPosition = 0;
+				 bool isValid = fieldCount > 2 && Variant::parsePosition(line + fieldStarts[1], fieldStarts[2] - fieldStarts[1] - 1, variantPosition);
+				 if (contigRuns.empty() || contigRuns.back().contig_name.size() != contigNameLength ||
+				     contigRuns.back().contig_name.compare(0, contigNameLength, line, contigNameLength) != 0)
+				   {
+				     contigRuns.push_back({std::string(line, contigNameLength), variantPosition, variantPosition, isValid});
+				   }
+				 else
+				   {
+				     // a malformed record counts as out of order, loading the records reports it
+				     contigRuns.back().is_sorted &= isValid && variantPosition >= contigRuns.back().last_position;
+				     contigRuns.back().last_position = variantPosition;
+				   }
+			       });
+		 });
+
+    // the same ranks sort uses
+    std::unordered_map< std::string, size_t > contigRanks;
+    for (auto& contigName : this->m_header_ptr->getContigNames())
+      {
+	contigRanks.emplace(contigName, contigRanks.size());
+      }
+    std::unordered_set< std::string > seenContigNames;
+    const ContigRun* previousRunPtr = nullptr;
+    size_t previousRank = 0;
+    for (auto& contigRuns : chunkContigRuns)
+      {
+	for (auto& contigRun : contigRuns)
+	  {
+	    if (!contigRun.is_sorted)
+	      {
+		return false;
+	      }
+	    if (previousRunPtr != nullptr && previousRunPtr->contig_name == contigRun.contig_name)
+	      {
+		if (contigRun.first_position < previousRunPtr->last_position)
+		  {
+		    return false;
+		  }
+		previousRunPtr = &contigRun;
+		continue;
+	      }
+	    size_t rank = contigRanks.emplace(contigRun.contig_name, contigRanks.size()).first->second;
+	    if (!seenContigNames.insert(contigRun.contig_name).second || (previousRunPtr != nullptr && rank < previousRank))
+	      {
+		return false;
+	      }
+	    previousRunPtr = &contigRun;
+	    previousRank = rank;
+	  }
+      }
+    return true;
+  }
+
+  void VCFFileReader::loadVariants()
+  {
+    if (this->m_variants_loaded)
+      {
+	return;
+      }
+    if (this->m_peeked_variant_ptr != nullptr)
+      {
+	this->m_variant_ptrs.emplace_back(std::move(this->m_peeked_variant_ptr));
+	this->m_peeked_variant_ptr = nullptr;
+      }
+    Variant::SharedPtr variantPtr;
+    while (readVariant(variantPtr))
+      {
+	this->m_variant_ptrs.emplace_back(std::move(variantPtr));
+	variantPtr = nullptr;
+      }
+    this->m_variants_loaded = true;
+  }
+
+  void VCFFileReader::sort()
+  {
+    if (!this->m_variants_loaded && isRecordOrderSorted())
+      {
+	return;
+      }
+    loadVariants();
+    std::unordered_map< std::string, size_t > contigRanks;
+    for (auto& contigName : this->m_header_ptr->getContigNames())
+      {
+	contigRanks.emplace(contigName, contigRanks.size());
+      }
+    struct SortKey
+    {
+      size_t contig_rank;
+      position variant_position;
+      size_t variant_idx;
+    };
+    std::vector< SortKey > sortKeys;
+    sortKeys.reserve(this->m_variant_ptrs.size() - this->m_next_variant_idx);
+    bool isSorted = true;
+    for (size_t i = this->m_next_variant_idx; i < this->m_variant_ptrs.size(); ++i)
+      {
+	auto rankIter = contigRanks.emplace(this->m_variant_ptrs[i]->getChrom(), contigRanks.size()).first;
+	SortKey sortKey = {rankIter->second, this->m_variant_ptrs[i]->getPosition(), i};
+	if (!sortKeys.empty() && (sortKey.contig_rank < sortKeys.back().contig_rank ||
+				  (sortKey.contig_rank == sortKeys.back().contig_rank && sortKey.variant_position < sortKeys.back().variant_position)))
+	  {
+	    isSorted = false;
+	  }
+	sortKeys.push_back(sortKey);
+      }
+    if (isSorted)
+      {
+	return;
+      }
+    std::stable_sort(sortKeys.begin(), sortKeys.end(), [](const SortKey& a, const SortKey& b)
+		     {
+		       return (a.contig_rank != b.contig_rank) ? a.contig_rank < b.contig_rank : a.variant_position < b.variant_position;
+		     });
+    std::vector< IVariant::SharedPtr > sortedVariantPtrs(this->m_variant_ptrs.begin(), this->m_variant_ptrs.begin() + this->m_next_variant_idx);
+    for (auto& sortKey : sortKeys)
+      {
+	sortedVariantPtrs.emplace_back(std::move(this->m_variant_ptrs[sortKey.variant_idx]));
+      }
+    this->m_variant_ptrs = std::move(sortedVariantPtrs);
+  }
+
+  std::vector< IVariant::SharedPtr > VCFFileReader::getAllVariantPtrs()
+  {
+    loadVariants();
+    return std::vector< IVariant::SharedPtr >(this->m_variant_ptrs.begin() + this->m_next_variant_idx, this->m_variant_ptrs.end());
+  }
+
+  void VCFFileReader::loadIndex()
+  {
+    if (this->m_bgzf_file_ptr != nullptr)
+      {
+	for (auto indexSuffix : {".tbi", ".csi"})
+	  {
+	    std::ifstream indexStream(this->m_vcf_path + indexSuffix);
+	    if (indexStream.good())
+	      {
+		this->m_index_ptr = BinningIndex::readIndexFile(this->m_vcf_path + indexSuffix);
+		return;
+	      }
+	  }
+      }
+    buildIndex();
+  }
+
+  // indexes the records by their offsets into the uncompressed text
+  void VCFFileReader::buildIndex()
+  {
+    struct IndexRecord
+    {
+      size_t contig_idx;
+      uint64_t begin_position;
+      uint64_t end_position;
+      uint64_t begin_offset;
+      uint64_t end_offset;
+    };
+    auto indexPtr = std::make_shared< BinningIndex >();
+    std::mutex indexMutex;
+    forEachChunk([this, &indexPtr, &indexMutex](size_t, uint64_t startOffset, uint64_t endOffset)
+		 {
+		   std::vector< char > buffer;
+		   std::vector< std::string > contigNames;
+		   std::vector< IndexRecord > indexRecords;
+		   forEachLine(startOffset, endOffset, buffer, [&](const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t lineOffset)
+			       {
+				 if (line == lineEnd || *line == '#')
+				   {
+				     return;
+				   }
+				 IndexRecord indexRecord;
+				 if (!getRecordBounds(line, lineEnd, fieldStarts, fieldCount, indexRecord.begin_position, indexRecord.end_position))
+				   {
+				     throw std::runtime_error(this->m_vcf_path + " at byte " + std::to_string(lineOffset) + ": malformed record");
+				   }
+				 size_t contigNameLength = fieldStarts[1] - 1;
+				 if (contigNames.empty() || contigNames.back().compare(0, std::string::npos, line, contigNameLength) != 0)
+				   {
+				     contigNames.emplace_back(line, contigNameLength);
+				   }
+				 indexRecord.contig_idx = contigNames.size() - 1;
+				 indexRecord.begin_offset = lineOffset;
+				 indexRecord.end_offset = lineOffset + (lineEnd - line) + 1;
+				 indexRecords.push_back(indexRecord);
+			       });
+		   std::lock_guard< std::mutex > lock(indexMutex);
+		   for (auto& indexRecord : indexRecords)
+		     {
+		       indexPtr->addRecord(contigNames[indexRecord.contig_idx], indexRecord.begin_position, indexRecord.end_position, indexRecord.begin_offset, indexRecord.end_offset);
+		     }
+		 });
+    this->m_index_ptr = indexPtr;
+  }
+
+  IVariantList::SharedPtr VCFFileReader::getVariantsInRegion(Region::SharedPtr regionPtr)
+  {
+    std::call_once(this->m_index_flag, [this]() { loadIndex(); });
+    uint64_t beginPosition;
+    uint64_t endPosition;
+    BinningIndex::getRegionBounds(regionPtr, beginPosition, endPosition);
+    std::string contigName = regionPtr->getReferenceID();
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    std::vector< char > buffer;
+    for (auto& chunk : this->m_index_ptr->getChunks(contigName, beginPosition, endPosition))
+      {
+	uint64_t startOffset = chunk.begin_offset;
+	uint64_t endOffset = chunk.end_offset;
+	if (this->m_index_ptr->hasVirtualOffsets())
+	  {
+	    startOffset = this->m_bgzf_file_ptr->getUncompressedOffset(startOffset);
+	    endOffset = this->m_bgzf_file_ptr->getUncompressedOffset(endOffset);
+	  }
+	startOffset = std::max(startOffset, this->m_records_offset);
+	endOffset = std::min(endOffset, this->m_file_size);
+	if (startOffset >= endOffset)
+	  {
+	    continue;
+	  }
+	forEachLine(startOffset, endOffset, buffer, [&](const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t lineOffset)
+		    {
+		      size_t contigNameLength = (fieldCount > 1) ? fieldStarts[1] - 1 : lineEnd - line;
+		      if (line == lineEnd || *line == '#' || contigNameLength != contigName.size() || contigName.compare(0, contigNameLength, line, contigNameLength) != 0)
+			{
+			  return;
+			}
+		      uint64_t recordBegin;
+		      uint64_t recordEnd;
+		      // a malformed record is left to setRecord to report
+		      if (getRecordBounds(line, lineEnd, fieldStarts, fieldCount, recordBegin, recordEnd) && (recordBegin >= endPosition || recordEnd <= beginPosition))
+			{
+			  return;
+			}
+		      Variant::SharedPtr variantPtr = createVariant(line, lineEnd, fieldStarts, fieldCount, lineOffset);
+		      if (this->m_process_overlapping_alleles)
+			{
+			  variantPtr->processOverlappingAlleles();
+			}
+		      variantPtrs.emplace_back(std::move(variantPtr));
+		    });
+      }
+    auto isBefore = [](const IVariant::SharedPtr& a, const IVariant::SharedPtr& b) { return a->getPosition() < b->getPosition(); };
+    if (!std::is_sorted(variantPtrs.begin(), variantPtrs.end(), isBefore))
+      {
+	std::stable_sort(variantPtrs.begin(), variantPtrs.end(), isBefore);
+      }
+    return std::make_shared< VariantList >(std::move(variantPtrs));
+  }
@@ -0,0 +1,213 @@
+#ifndef VCFFILEREADER_H
+#define VCFFILEREADER_H
+
+#include "BgzfFile.h"
+#include "BinningIndex.h"
+#include "IVariantList.h"
+#include "Variant.h"
+#include "VCFHeader.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+  /*
+   * Reads the records of a VCF in parallel, plain or bgzip compressed, a
+   * compressed one through BgzfFile so offsets below are into the
+   * uncompressed text either way. Past the header the text is cut into
+   * byte ranges of s_chunk_size, a range owns the lines that start inside
+   * it, so every range finds its own first and last line without looking
+   * at the others. Ranges are parsed by ThreadPool tasks a few ahead of the
+   * caller and handed out in file order, the next range is waited for (or
+   * parsed right there when no worker has got to it yet) only once the
+   * current one runs out. Each record is split with one
+   * pass that finds the tabs before the first sample and the newline, 16
+   * bytes at a time with SSE2 where available. Only the line and where its
+   * fields start are copied into the Variant, see Variant for what is
+   * parsed later.
+   *
+   * Variants the caller has dropped are reused for later records, along with
+   * the shared_ptr bookkeeping around them, and a range's buffers are reused
+   * by the ranges after it, so getNextVariant and peekNextVariant only
+   * allocate once per range.
+   *
+   * sort first checks the order of the records with a parallel pass that
+   * only reads CHROM and POS, an already sorted file is left streaming. An
+   * unsorted one, and getAllVariantPtrs, read the remaining records into
+   * memory and serve the variants from there after. Records already
+   * returned by getNextVariant are not read again.
+   *
+   * getVariantsInRegion reads only the ranges of the file a BinningIndex
+   * points it to. A compressed VCF uses the .tbi or .csi next to it, other
+   * files are indexed by a parallel pass over CHROM, POS, REF and INFO's END
+   * the first time they are queried. Queries parse their records again,
+   * they don't return the variants getNextVariant did, and leave the stream
+   * where it was.
+   */
+  class VCFFileReader : public IVariantList
+  {
+  public:
+    typedef std::shared_ptr< VCFFileReader > SharedPtr;
+
+    // throws std::runtime_error if the file can't be read or has no #CHROM line
+    VCFFileReader(const std::string& vcfPath);
+    ~VCFFileReader();
+
+    VCFHeader::SharedPtr getHeader() { return this->m_header_ptr; }
+
+    // these throw std::runtime_error for a malformed record
+    void processOverlappingAlleles() override;
+    bool getNextVariant(IVariant::SharedPtr& variantPtr) override;
+    bool peekNextVariant(IVariant::SharedPtr& variantPtr) override;
+    size_t getCount() override; // the records in the file, those already returned included
+    void sort() override; // by ##contig order, contigs without one after in the order they appear, then position
+    std::vector< IVariant::SharedPtr > getAllVariantPtrs() override; // the records getNextVariant hasn't returned yet
+    // in position order, can be called from several threads at once
+    IVariantList::SharedPtr getVariantsInRegion(Region::SharedPtr regionPtr) override;
+
+  private:
+    // variants and shared_ptr control blocks waiting to be reused, shared by
+    // everything handed out so they can be returned from any thread
+    struct VariantPool
+    {
+      ~VariantPool();
+      Variant* acquireVariant();
+      void releaseVariant(Variant* variantPtr);
+      void* allocateBlock(size_t size);
+      void releaseBlock(void* blockPtr, size_t size);
+
+      std::mutex mutex;
+      std::vector< Variant* > free_variants;
+      std::vector< void* > free_blocks;
+      size_t block_size = 0; // every control block is the same type
+    };
+
+    /*
+     * The allocator and recycler live in the control blocks and only hold
+     * the pool weakly: a pooled variant's enable_shared_from_this keeps its
+     * last control block alive, a strong reference from there would keep
+     * the pool alive from inside itself. Once the reader and pool are gone
+     * they free directly.
+     */
+    template< class T >
+    struct PoolAllocator
+    {
+      typedef T value_type;
+
+      PoolAllocator(const std::shared_ptr< VariantPool >& poolPtr) : pool_wptr(poolPtr) {}
+      template< class U > PoolAllocator(const PoolAllocator< U >& other) : pool_wptr(other.pool_wptr) {}
+
+      T* allocate(size_t count)
+      {
+	auto poolPtr = this->pool_wptr.lock();
+	return (T*)((poolPtr != nullptr) ? poolPtr->allocateBlock(count * sizeof(T)) : ::operator new(count * sizeof(T)));
+      }
+
+      void deallocate(T* ptr, size_t count)
+      {
+	auto poolPtr = this->pool_wptr.lock();
+	if (poolPtr != nullptr)
+	  {
+	    poolPtr->releaseBlock(ptr, count * sizeof(T));
+	  }
+	else
+	  {
+	    ::operator delete(ptr);
+	  }
+      }
+
+      template< class U > bool operator==(const PoolAllocator< U >& other) const { return !this->pool_wptr.owner_before(other.pool_wptr) && !other.pool_wptr.owner_before(this->pool_wptr); }
+      template< class U > bool operator!=(const PoolAllocator< U >& other) const { return !(*this == other); }
+
+      std::weak_ptr< VariantPool > pool_wptr;
+    };
+
+    struct VariantRecycler
+    {
+      void operator()(Variant* variantPtr) const
+      {
+	auto poolPtr = this->pool_wptr.lock();
+	if (poolPtr != nullptr)
+	  {
+	    poolPtr->releaseVariant(variantPtr);
+	  }
+	else
+	  {
+	    delete variantPtr;
+	  }
+      }
+
+      std::weak_ptr< VariantPool > pool_wptr;
+    };
+
+    // the lines starting in [start_offset, end_offset) of the file
+    struct Chunk
+    {
+      std::once_flag parse_flag;
+      uint64_t start_offset;
+      uint64_t end_offset;
+      std::vector< char > buffer;
+      std::vector< Variant::SharedPtr > variant_ptrs; // set once by parse_flag
+    };
+
+    // consecutive records on one contig
+    struct ContigRun
+    {
+      std::string contig_name;
+      position first_position;
+      position last_position;
+      bool is_sorted;
+    };
+
+    // CHROM through FORMAT and the first sample, the samples after it aren't split
+    static const size_t s_max_field_count = static_cast< size_t >(Variant::Field::FORMAT) + 2;
+    static const size_t s_header_buffer_size = 64 * 1024;
+    static const size_t s_chunk_size = 4 * 1024 * 1024;
+    static const size_t s_line_read_size = 64 * 1024; // read at a time past a range's end to finish its last line
+
+    static const char* scanRecord(const char* line, const char* end, uint32_t* fieldStarts, size_t& fieldCount);
+    static bool getRecordBounds(const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t& beginPosition, uint64_t& endPosition);
+    ssize_t readAt(uint64_t offset, char* buffer, size_t size);
+    void readHeader();
+    template< class F >
+    void forEachLine(uint64_t startOffset, uint64_t endOffset, std::vector< char >& buffer, F&& lineFunct);
+    template< class F >
+    void forEachChunk(F&& chunkFunct);
+    Variant::SharedPtr createVariant(const char* line, const char* lineEnd, const uint32_t* fieldStarts, size_t fieldCount, uint64_t lineOffset);
+    void parseChunk(Chunk* chunkPtr);
+    void scheduleChunks();
+    bool readVariant(Variant::SharedPtr& variantPtr);
+    bool isRecordOrderSorted();
+    void loadVariants();
+    void loadIndex();
+    void buildIndex();
+
+    std::string m_vcf_path;
+    int m_fd; // -1 for a compressed file
+    BgzfFile::SharedPtr m_bgzf_file_ptr;
+    uint64_t m_file_size; // uncompressed
+    uint64_t m_records_offset; // where the first line after the header starts
+    VCFHeader::SharedPtr m_header_ptr;
+    std::shared_ptr< VariantPool > m_pool_ptr;
+    uint64_t m_next_chunk_offset;
+    size_t m_max_chunk_count; // parsed or being parsed ahead of the caller
+    std::deque< std::shared_ptr< Chunk > > m_chunk_ptrs; // in file order
+    std::shared_ptr< Chunk > m_current_chunk_ptr;
+    size_t m_current_variant_idx;
+    std::vector< std::vector< char > > m_free_buffers;
+    std::vector< std::vector< Variant::SharedPtr > > m_free_variant_lists;
+    Variant::SharedPtr m_peeked_variant_ptr;
+    bool m_process_overlapping_alleles;
+    size_t m_returned_count;
+    bool m_variants_loaded;
+    std::vector< IVariant::SharedPtr > m_variant_ptrs; // set once the records are loaded
+    size_t m_next_variant_idx;
+    std::once_flag m_index_flag;
+    BinningIndex::SharedPtr m_index_ptr; // set by the first getVariantsInRegion
+  };
+
+#endif
@@ -0,0 +1,103 @@
+#include "VCFHeader.h"
+
+  VCFHeader::VCFHeader() :
+    m_all_samples_active(true)
+  {
+  }
+
+  VCFHeader::~VCFHeader()
+  {
+  }
+
+  void VCFHeader::addHeaderLine(const std::string& headerLine)
+  {
+    std::string line = headerLine;
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+      {
+	line.pop_back();
+      }
+    if (line.compare(0, 2, "##") == 0)
+      {
+	static const std::string contigPrefix = "##contig=<ID=";
+	if (line.compare(0, contigPrefix.size(), contigPrefix) == 0)
+	  {
+	    size_t idEnd = line.find_first_of(",>", contigPrefix.size());
+	    this->m_contig_names.emplace_back(line.substr(contigPrefix.size(), idEnd - contigPrefix.size()));
+	  }
+	this->m_meta_lines.emplace_back(line);
+      }
+    else if (line.compare(0, 1, "#") == 0)
+      {
+	this->m_column_names.clear();
+	this->m_column_positions.clear();
+	size_t columnStart = 1;
+	for (size_t tab = line.find('\t', columnStart); ; tab = line.find('\t', columnStart))
+	  {
+	    setColumn(line.substr(columnStart, tab - columnStart));
+	    if (tab == std::string::npos)
+	      {
+		break;
+	      }
+	    columnStart = tab + 1;
+	  }
+      }
+  }
+
+  std::string VCFHeader::getHeader()
+  {
+    std::string header;
+    for (auto& metaLine : this->m_meta_lines)
+      {
+	header += metaLine + "\n";
+      }
+    for (size_t i = 0; i < this->m_column_names.size(); ++i)
+      {
+	header += ((i == 0) ? "#" : "\t") + this->m_column_names[i];
+      }
+    return header;
+  }
+
+  std::vector< std::string > VCFHeader::getSampleNames()
+  {
+    std::vector< std::string > sampleNames;
+    for (size_t i = s_format_column_position + 1; i < this->m_column_names.size(); ++i)
+      {
+	sampleNames.emplace_back(this->m_column_names[i]);
+      }
+    return sampleNames;
+  }
+
+  int32_t VCFHeader::getColumnPosition(const std::string& columnTitle)
+  {
+    auto iter = this->m_column_positions.find(columnTitle);
+    return (iter == this->m_column_positions.end()) ? -1 : iter->second;
+  }
+
+  std::vector< std::string > VCFHeader::getColumnNames()
+  {
+    return this->m_column_names;
+  }
+
+  void VCFHeader::setColumn(const std::string& column)
+  {
+    this->m_column_positions.emplace(column, this->m_column_names.size());
+    this->m_column_names.emplace_back(column);
+  }
+
+  bool VCFHeader::isSampleColumnName(const std::string& headerName)
+  {
+    int32_t columnPosition = getColumnPosition(headerName);
+    return columnPosition > (int32_t)s_format_column_position;
+  }
+
+  bool VCFHeader::isActiveSampleColumnname(const std::string& sampleName)
+  {
+    return isSampleColumnName(sampleName) && (this->m_all_samples_active || this->m_active_sample_names.count(sampleName) > 0);
+  }
+
+  void VCFHeader::setActiveSampleNames(const std::vector< std::string >& sampleNames)
+  {
+    this->m_all_samples_active = false;
+    this->m_active_sample_names.clear();
+    this->m_active_sample_names.insert(sampleNames.begin(), sampleNames.end());
+  }
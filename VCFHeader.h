@@ -0,0 +1,51 @@
+#ifndef VCFHEADER_H
+#define VCFHEADER_H
+
+#include "IHeader.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+  /*
+   * The meta information (##) lines and the column names (#CHROM) line of a
+   * VCF. Columns after FORMAT are samples, all of them are active until
+   * setActiveSampleNames narrows them down.
+   */
+  class VCFHeader : public IHeader
+  {
+  public:
+    typedef std::shared_ptr< VCFHeader > SharedPtr;
+
+    VCFHeader();
+    ~VCFHeader();
+
+    // a whole header line with or without its newline, ## lines are kept as
+    // they are and a #CHROM line replaces the columns
+    void addHeaderLine(const std::string& headerLine);
+
+    std::string getHeader() override;
+    std::vector< std::string > getSampleNames() override;
+    int32_t getColumnPosition(const std::string& columnTitle) override; // -1 when there's no such column
+    std::vector< std::string > getColumnNames() override;
+    void setColumn(const std::string& column) override; // appends a column, after FORMAT that's a sample
+    bool isActiveSampleColumnname(const std::string& sampleName) override;
+    bool isSampleColumnName(const std::string& headerName) override;
+
+    void setActiveSampleNames(const std::vector< std::string >& sampleNames);
+    // the contigs declared by ##contig lines, in the order they were declared
+    std::vector< std::string > getContigNames() { return this->m_contig_names; }
+
+  private:
+    static const size_t s_format_column_position = 8;
+
+    std::vector< std::string > m_meta_lines;
+    std::vector< std::string > m_column_names;
+    std::unordered_map< std::string, int32_t > m_column_positions;
+    std::vector< std::string > m_contig_names;
+    bool m_all_samples_active;
+    std::unordered_set< std::string > m_active_sample_names;
+  };
+
+#endif
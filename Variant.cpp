@@ -0,0 +1,260 @@
+#include "Variant.h"
+#include "SymbolicAllele.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+  Variant::Variant() :
+    m_position(0),
+    m_reference_size(0),
+    m_skip(false),
+    m_alleles_loaded(false)
+  {
+    // every field empty until a record is set
+    for (size_t i = 0; i < static_cast< size_t >(Field::FORMAT) + 2; ++i)
+      {
+	this->m_field_starts[i] = i;
+      }
+  }
+
+  Variant::~Variant()
+  {
+  }
+
+  void Variant::setRecord(const char* line, size_t length, const uint32_t* fieldStarts, size_t fieldCount)
+  {
+    if (fieldCount < s_fixed_field_count)
+      {
+	throw std::runtime_error("Variant malformed record, fewer than 8 fields: " + std::string(line, std::min< size_t >(length, 200)));
+      }
+    this->m_line.assign(line, length);
+    size_t lastField = static_cast< size_t >(Field::FORMAT) + 1; // the first sample, its start ends FORMAT
+    for (size_t i = 0; i <= lastField; ++i)
+      {
+	this->m_field_starts[i] = (i < fieldCount) ? fieldStarts[i] : length + 1;
+      }
+
+    if (!parsePosition(getField(Field::POS), getFieldLength(Field::POS), this->m_position) || getFieldLength(Field::REF) == 0)
+      {
+	throw std::runtime_error("Variant malformed record: " + std::string(line, std::min< size_t >(length, 200)));
+      }
+    // symbolic alleles cover the reference through INFO's END
+    this->m_reference_size = getFieldLength(Field::REF);
+    std::string endValue;
+    position endPosition;
+    if (memchr(getField(Field::ALT), '<', getFieldLength(Field::ALT)) != nullptr && getInfoValue("END", endValue) &&
+	parsePosition(endValue.data(), endValue.size(), endPosition) && endPosition >= this->m_position)
+      {
+	this->m_reference_size = std::max< uint32_t >(this->m_reference_size, endPosition - this->m_position + 1);
+      }
+    this->m_skip = false;
+    this->m_alleles_loaded = false;
+    this->m_ref_allele_ptr = nullptr;
+    this->m_alt_allele_ptrs.clear();
+    this->m_region_ptrs.clear();
+  }
+
+  bool Variant::parsePosition(const char* field, size_t length, position& parsedPosition)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; ++i)
+      {
+	if (field[i] < '0' || field[i] > '9' || value > MAX_POSITION)
+	  {
+	    return false;
+	  }
+	value = (value * 10) + (field[i] - '0');
+      }
+    if (length == 0 || value > MAX_POSITION)
+      {
+	return false;
+      }
+    parsedPosition = value;
+    return true;
+  }
+
+  std::string Variant::getChrom() const
+  {
+    return std::string(getField(Field::CHROM), getFieldLength(Field::CHROM));
+  }
+
+  void Variant::loadAlleles()
+  {
+    std::lock_guard< std::mutex > lock(this->m_alleles_mutex);
+    if (this->m_alleles_loaded)
+      {
+	return;
+      }
+    std::vector< std::string > altSequences;
+    const char* alt = getField(Field::ALT);
+    const char* altEnd = alt + getFieldLength(Field::ALT);
+    if (!(altEnd - alt == 1 && *alt == '.')) // '.' when there are no alternate alleles
+      {
+	while (alt < altEnd)
+	  {
+	    const char* comma = (const char*)memchr(alt, ',', altEnd - alt);
+	    comma = (comma == nullptr) ? altEnd : comma;
+	    altSequences.emplace_back(alt, comma);
+	    alt = comma + 1;
+	  }
+      }
+    SymbolicAllele::createAlleles(std::string(getField(Field::REF), getFieldLength(Field::REF)), altSequences, getChrom(), this->m_position, this->m_position + this->m_reference_size - 1,
+				  this->m_ref_allele_ptr, this->m_alt_allele_ptrs);
+    this->m_alleles_loaded = true;
+  }
+
+  IAllele::SharedPtr Variant::getRefAllelePtr()
+  {
+    loadAlleles();
+    return this->m_ref_allele_ptr;
+  }
+
+  std::vector< IAllele::SharedPtr > Variant::getAltAllelePtrs()
+  {
+    loadAlleles();
+    return this->m_alt_allele_ptrs;
+  }
+
+  void Variant::processOverlappingAlleles()
+  {
+    loadAlleles();
+    this->m_ref_allele_ptr->setVariantWPtr(shared_from_this());
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	altAllelePtr->setVariantWPtr(shared_from_this());
+      }
+  }
+
+  uint32_t Variant::getAllelePrefixOverlapMaxCount(IAllele::SharedPtr allelePtr)
+  {
+    loadAlleles();
+    uint32_t maxCount = 0;
+    if (allelePtr != this->m_ref_allele_ptr)
+      {
+	maxCount = allelePtr->getCommonPrefixSize(this->m_ref_allele_ptr);
+      }
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	if (allelePtr != altAllelePtr)
+	  {
+	    maxCount = std::max(maxCount, allelePtr->getCommonPrefixSize(altAllelePtr));
+	  }
+      }
+    return maxCount;
+  }
+
+  uint32_t Variant::getAlleleSuffixOverlapMaxCount(IAllele::SharedPtr allelePtr)
+  {
+    loadAlleles();
+    uint32_t maxCount = 0;
+    if (allelePtr != this->m_ref_allele_ptr)
+      {
+	maxCount = allelePtr->getCommonSuffixSize(this->m_ref_allele_ptr);
+      }
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	if (allelePtr != altAllelePtr)
+	  {
+	    maxCount = std::max(maxCount, allelePtr->getCommonSuffixSize(altAllelePtr));
+	  }
+      }
+    return maxCount;
+  }
+
+  std::string Variant::getVariantLine(IHeader::SharedPtr /* headerPtr */)
+  {
+    return this->m_line;
+  }
+
+  std::vector< Region::SharedPtr > Variant::getRegions()
+  {
+    std::vector< Region::SharedPtr > regionPtrs;
+    regionPtrs.reserve(this->m_region_ptrs.size() + 1);
+    regionPtrs.emplace_back(std::make_shared< Region >(getChrom(), this->m_position, this->m_position + getReferenceSize() - 1, Region::BASED::ONE));
+    regionPtrs.insert(regionPtrs.end(), this->m_region_ptrs.begin(), this->m_region_ptrs.end());
+    return regionPtrs;
+  }
+
+  void Variant::addRegion(Region::SharedPtr regionPtr)
+  {
+    this->m_region_ptrs.emplace_back(regionPtr);
+  }
+
+  bool Variant::doesOverlap(IVariant::SharedPtr variantPtr)
+  {
+    std::string chrom = variantPtr->getChrom();
+    if (chrom.size() != getFieldLength(Field::CHROM) || chrom.compare(0, chrom.size(), getField(Field::CHROM), chrom.size()) != 0)
+      {
+	return false;
+      }
+    position lastPosition = this->m_position + getReferenceSize() - 1;
+    position otherLastPosition = variantPtr->getPosition() + variantPtr->getReferenceSize() - 1;
+    return this->m_position <= otherLastPosition && variantPtr->getPosition() <= lastPosition;
+  }
+
+  // the longest allele, measured without building the alleles
+  uint32_t Variant::getVariantSize()
+  {
+    uint32_t variantSize = getFieldLength(Field::REF);
+    const char* alt = getField(Field::ALT);
+    const char* altEnd = alt + getFieldLength(Field::ALT);
+    while (alt < altEnd)
+      {
+	const char* comma = (const char*)memchr(alt, ',', altEnd - alt);
+	comma = (comma == nullptr) ? altEnd : comma;
+	variantSize = std::max< uint32_t >(variantSize, comma - alt);
+	alt = comma + 1;
+      }
+    return variantSize;
+  }
+
+  bool Variant::isStructuralVariant()
+  {
+    const char* alt = getField(Field::ALT);
+    const char* altEnd = alt + getFieldLength(Field::ALT);
+    // symbolic alleles and breakends
+    if (std::find(alt, altEnd, '<') != altEnd || std::find(alt, altEnd, '[') != altEnd || std::find(alt, altEnd, ']') != altEnd)
+      {
+	return true;
+      }
+    return getVariantSize() >= s_structural_variant_size;
+  }
+
+  bool Variant::getInfoValue(const std::string& key, std::string& value)
+  {
+    const char* entry = getField(Field::INFO);
+    const char* infoEnd = entry + getFieldLength(Field::INFO);
+    while (entry < infoEnd)
+      {
+	const char* entryEnd = (const char*)memchr(entry, ';', infoEnd - entry);
+	entryEnd = (entryEnd == nullptr) ? infoEnd : entryEnd;
+	const char* keyEnd = (const char*)memchr(entry, '=', entryEnd - entry);
+	keyEnd = (keyEnd == nullptr) ? entryEnd : keyEnd;
+	if ((size_t)(keyEnd - entry) == key.size() && key.compare(0, key.size(), entry, key.size()) == 0)
+	  {
+	    value.assign((keyEnd < entryEnd) ? keyEnd + 1 : entryEnd, entryEnd);
+	    return true;
+	  }
+	entry = entryEnd + 1;
+      }
+    return false;
+  }
+
+  bool Variant::getSampleColumn(size_t sampleIdx, std::string& column)
+  {
+    const char* lineEnd = this->m_line.data() + this->m_line.size();
+    const char* columnStart = this->m_line.data() + this->m_field_starts[static_cast< size_t >(Field::FORMAT) + 1];
+    for (size_t i = 0; i < sampleIdx && columnStart < lineEnd; ++i)
+      {
+	const char* tab = (const char*)memchr(columnStart, '\t', lineEnd - columnStart);
+	columnStart = (tab == nullptr) ? lineEnd + 1 : tab + 1;
+      }
+    if (columnStart > lineEnd)
+      {
+	return false;
+      }
+    const char* columnEnd = (const char*)memchr(columnStart, '\t', lineEnd - columnStart);
+    column.assign(columnStart, (columnEnd == nullptr) ? lineEnd : columnEnd);
+    return true;
+  }
@@ -0,0 +1,87 @@
+#ifndef VARIANT_H
+#define VARIANT_H
+
+#include "IVariant.h"
+#include "Allele.h"
+#include "Region.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * One VCF record. The record's line is kept as it was read together with
+   * where each fixed field starts, nothing else is parsed up front but the
+   * position. The alleles are only turned into Allele objects the first time
+   * a graph asks for them, <DEL>, <DUP> and <INV> as SymbolicAlleles over
+   * the reference up to INFO's END. INFO and the sample columns are only
+   * searched when asked for.
+   *
+   * VCFFileReader recycles variants nobody references anymore, setRecord
+   * reuses the line's and allele list's storage, so a variant's state
+   * belongs to the record it was last given.
+   */
+  class Variant : public IVariant
+  {
+  public:
+    typedef std::shared_ptr< Variant > SharedPtr;
+
+    enum class Field { CHROM = 0, POS = 1, ID = 2, REF = 3, ALT = 4, QUAL = 5, FILTER = 6, INFO = 7, FORMAT = 8 };
+    static const size_t s_fixed_field_count = 8; // CHROM through INFO, FORMAT and samples are optional
+
+    Variant();
+    ~Variant();
+
+    // fieldStarts holds where each of the first fieldCount tab separated fields
+    // starts in line, throws std::runtime_error for a malformed record
+    void setRecord(const char* line, size_t length, const uint32_t* fieldStarts, size_t fieldCount);
+
+    position getPosition() override { return this->m_position; }
+    std::string getChrom() const override;
+    IAllele::SharedPtr getRefAllelePtr() override;
+    std::vector< IAllele::SharedPtr > getAltAllelePtrs() override;
+    void processOverlappingAlleles() override;
+    uint32_t getAllelePrefixOverlapMaxCount(IAllele::SharedPtr allelePtr) override;
+    uint32_t getAlleleSuffixOverlapMaxCount(IAllele::SharedPtr allelePtr) override;
+    std::string getVariantLine(IHeader::SharedPtr headerPtr) override;
+    bool shouldSkip() override { return this->m_skip; }
+    void setSkip(bool skip) override { this->m_skip = skip; }
+    std::vector< Region::SharedPtr > getRegions() override;
+    bool doesOverlap(IVariant::SharedPtr variantPtr) override;
+    uint32_t getReferenceSize() override { return this->m_reference_size; } // through INFO's END for symbolic alleles
+    void addRegion(Region::SharedPtr regionPtr) override;
+    uint32_t getVariantSize() override;
+    bool isStructuralVariant() override;
+
+    // the field's bytes, valid until the variant is given another record
+    const char* getField(Field field) const { return this->m_line.data() + this->m_field_starts[static_cast< size_t >(field)]; }
+    uint32_t getFieldLength(Field field) const { return this->m_field_starts[static_cast< size_t >(field) + 1] - this->m_field_starts[static_cast< size_t >(field)] - 1; }
+    // INFO's key=value entries and flags, a flag's value is empty
+    bool getInfoValue(const std::string& key, std::string& value);
+    // the idx'th column after FORMAT
+    bool getSampleColumn(size_t sampleIdx, std::string& column);
+
+    // a POS field, false unless it's all digits and fits a position
+    static bool parsePosition(const char* field, size_t length, position& parsedPosition);
+
+  private:
+    static const uint32_t s_structural_variant_size = 50;
+
+    void loadAlleles();
+
+    std::string m_line;
+    // where CHROM through FORMAT start, plus one past the end of the line, an
+    // absent field starts and ends one past the end of the line
+    uint32_t m_field_starts[static_cast< size_t >(Field::FORMAT) + 2];
+    position m_position;
+    uint32_t m_reference_size;
+    bool m_skip;
+    std::mutex m_alleles_mutex;
+    bool m_alleles_loaded;
+    IAllele::SharedPtr m_ref_allele_ptr;
+    std::vector< IAllele::SharedPtr > m_alt_allele_ptrs;
+    std::vector< Region::SharedPtr > m_region_ptrs;
+  };
+
+#endif
@@ -0,0 +1,108 @@
+#include "VariantList.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+  VariantList::VariantList(std::vector< IVariant::SharedPtr > variantPtrs) :
+    m_variant_ptrs(std::move(variantPtrs)),
+    m_next_variant_idx(0)
+  {
+  }
+
+  VariantList::~VariantList()
+  {
+  }
+
+  void VariantList::processOverlappingAlleles()
+  {
+    for (auto& variantPtr : this->m_variant_ptrs)
+      {
+	variantPtr->processOverlappingAlleles();
+      }
+  }
+
+  bool VariantList::getNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (this->m_next_variant_idx >= this->m_variant_ptrs.size())
+      {
+	return false;
+      }
+    variantPtr = this->m_variant_ptrs[this->m_next_variant_idx++];
+    return true;
+  }
+
+  bool VariantList::peekNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (this->m_next_variant_idx >= this->m_variant_ptrs.size())
+      {
+	return false;
+      }
+    variantPtr = this->m_variant_ptrs[this->m_next_variant_idx];
+    return true;
+  }
+
+  void VariantList::sort()
+  {
+    std::unordered_map< std::string, size_t > contigRanks;
+    for (auto& variantPtr : this->m_variant_ptrs)
+      {
+	contigRanks.emplace(variantPtr->getChrom(), contigRanks.size());
+      }
+    std::stable_sort(this->m_variant_ptrs.begin() + this->m_next_variant_idx, this->m_variant_ptrs.end(),
+		     [&contigRanks](const IVariant::SharedPtr& a, const IVariant::SharedPtr& b)
+		     {
+		       size_t aRank = contigRanks[a->getChrom()];
+		       size_t bRank = contigRanks[b->getChrom()];
+		       return (aRank != bRank) ? aRank < bRank : a->getPosition() < b->getPosition();
+		     });
+    std::lock_guard< std::mutex > lock(this->m_index_mutex);
+    this->m_index_ptr = nullptr;
+  }
+
+  std::vector< IVariant::SharedPtr > VariantList::getAllVariantPtrs()
+  {
+    return std::vector< IVariant::SharedPtr >(this->m_variant_ptrs.begin() + this->m_next_variant_idx, this->m_variant_ptrs.end());
+  }
+
+  void VariantList::buildIndex()
+  {
+    this->m_index_ptr = std::make_shared< BinningIndex >();
+    for (size_t i = 0; i < this->m_variant_ptrs.size(); ++i)
+      {
+	auto& variantPtr = this->m_variant_ptrs[i];
+	uint64_t beginPosition = (variantPtr->getPosition() > 0) ? variantPtr->getPosition() - 1 : 0;
+	this->m_index_ptr->addRecord(variantPtr->getChrom(), beginPosition, beginPosition + variantPtr->getReferenceSize(), i, i + 1);
+      }
+  }
+
+  IVariantList::SharedPtr VariantList::getVariantsInRegion(Region::SharedPtr regionPtr)
+  {
+    BinningIndex::SharedPtr indexPtr;
+    {
+      std::lock_guard< std::mutex > lock(this->m_index_mutex);
+      if (this->m_index_ptr == nullptr)
+	{
+	  buildIndex();
+	}
+      indexPtr = this->m_index_ptr;
+    }
+    uint64_t beginPosition;
+    uint64_t endPosition;
+    BinningIndex::getRegionBounds(regionPtr, beginPosition, endPosition);
+    std::string contigName = regionPtr->getReferenceID();
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    for (auto& chunk : indexPtr->getChunks(contigName, beginPosition, endPosition))
+      {
+	for (uint64_t i = chunk.begin_offset; i < chunk.end_offset; ++i)
+	  {
+	    auto& variantPtr = this->m_variant_ptrs[i];
+	    uint64_t variantBegin = (variantPtr->getPosition() > 0) ? variantPtr->getPosition() - 1 : 0;
+	    uint64_t variantEnd = variantBegin + std::max< uint32_t >(variantPtr->getReferenceSize(), 1);
+	    if (variantBegin < endPosition && variantEnd > beginPosition && variantPtr->getChrom() == contigName)
+	      {
+		variantPtrs.emplace_back(variantPtr);
+	      }
+	  }
+      }
+    return std::make_shared< VariantList >(std::move(variantPtrs));
+  }
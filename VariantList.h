@@ -0,0 +1,44 @@
+#ifndef VARIANTLIST_H
+#define VARIANTLIST_H
+
+#include "IVariantList.h"
+#include "BinningIndex.h"
+
+#include <mutex>
+#include <vector>
+
+  /*
+   * An IVariantList over variants already in memory, what region queries
+   * hand back. The first getVariantsInRegion puts every variant into a
+   * BinningIndex with its place in the list standing in for a file offset,
+   * so a query only looks at the variants in the bins overlapping the
+   * region, not the whole list. sort drops the index, the next query builds
+   * it again.
+   */
+  class VariantList : public IVariantList
+  {
+  public:
+    typedef std::shared_ptr< VariantList > SharedPtr;
+
+    VariantList(std::vector< IVariant::SharedPtr > variantPtrs);
+    ~VariantList();
+
+    void processOverlappingAlleles() override;
+    bool getNextVariant(IVariant::SharedPtr& variantPtr) override;
+    bool peekNextVariant(IVariant::SharedPtr& variantPtr) override;
+    size_t getCount() override { return this->m_variant_ptrs.size(); }
+    void sort() override; // contigs in the order they first appear, then position
+    std::vector< IVariant::SharedPtr > getAllVariantPtrs() override; // the variants getNextVariant hasn't returned yet
+    // every variant overlapping the region, returned or not, in list order
+    IVariantList::SharedPtr getVariantsInRegion(Region::SharedPtr regionPtr) override;
+
+  private:
+    void buildIndex();
+
+    std::vector< IVariant::SharedPtr > m_variant_ptrs;
+    size_t m_next_variant_idx;
+    std::mutex m_index_mutex;
+    BinningIndex::SharedPtr m_index_ptr; // built by the first query
+  };
+
+#endif
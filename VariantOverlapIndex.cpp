@@ -0,0 +1,151 @@
+#include "VariantOverlapIndex.h"
+#include "BinningIndex.h"
+
+#include <algorithm>
+#include <numeric>
+
+  VariantOverlapIndex::VariantOverlapIndex(const std::vector< IVariant::SharedPtr >& variantPtrs) :
+    m_variant_ptrs(variantPtrs)
+  {
+    for (size_t i = 0; i < this->m_variant_ptrs.size(); ++i)
+      {
+	for (auto& regionPtr : this->m_variant_ptrs[i]->getRegions())
+	  {
+	    auto& treePtr = this->m_contig_trees[regionPtr->getReferenceID()];
+	    if (treePtr == nullptr)
+	      {
+		treePtr = std::make_shared< IntervalTree< size_t > >();
+	      }
+	    uint64_t beginPosition;
+	    uint64_t endPosition;
+	    BinningIndex::getRegionBounds(regionPtr, beginPosition, endPosition);
+	    treePtr->add(beginPosition, std::max(endPosition, beginPosition + 1), i);
+	  }
+      }
+    for (auto& contigTree : this->m_contig_trees)
+      {
+	contigTree.second->index();
+      }
+  }
+
+  VariantOverlapIndex::~VariantOverlapIndex()
+  {
+  }
+
+  // sorted and without duplicates, a variant can overlap through several of its regions
+  void VariantOverlapIndex::getOverlappingIdxs(const std::vector< Region::SharedPtr >& regionPtrs, std::vector< size_t >& variantIdxs)
+  {
+    for (auto& regionPtr : regionPtrs)
+      {
+	auto contigIter = this->m_contig_trees.find(regionPtr->getReferenceID());
+	if (contigIter == this->m_contig_trees.end())
+	  {
+	    continue;
+	  }
+	uint64_t beginPosition;
+	uint64_t endPosition;
+	BinningIndex::getRegionBounds(regionPtr, beginPosition, endPosition);
+	contigIter->second->getOverlapping(beginPosition, std::max(endPosition, beginPosition + 1), variantIdxs);
+      }
+    std::sort(variantIdxs.begin(), variantIdxs.end());
+    variantIdxs.erase(std::unique(variantIdxs.begin(), variantIdxs.end()), variantIdxs.end());
+  }
+
+  std::vector< IVariant::SharedPtr > VariantOverlapIndex::getOverlappingVariants(Region::SharedPtr regionPtr)
+  {
+    std::vector< size_t > variantIdxs;
+    getOverlappingIdxs({ regionPtr }, variantIdxs);
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    variantPtrs.reserve(variantIdxs.size());
+    for (auto variantIdx : variantIdxs)
+      {
+	variantPtrs.emplace_back(this->m_variant_ptrs[variantIdx]);
+      }
+    return variantPtrs;
+  }
+
+  std::vector< IVariant::SharedPtr > VariantOverlapIndex::getOverlappingVariants(IVariant::SharedPtr variantPtr)
+  {
+    std::vector< size_t > variantIdxs;
+    getOverlappingIdxs(variantPtr->getRegions(), variantIdxs);
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    variantPtrs.reserve(variantIdxs.size());
+    for (auto variantIdx : variantIdxs)
+      {
+	if (this->m_variant_ptrs[variantIdx] != variantPtr)
+	  {
+	    variantPtrs.emplace_back(this->m_variant_ptrs[variantIdx]);
+	  }
+      }
+    return variantPtrs;
+  }
+
+  std::vector< std::vector< IVariant::SharedPtr > > VariantOverlapIndex::getClusters()
+  {
+    // each contig's clusters come from one pass over its tree, a variant with
+    // regions on several contigs joins its clusters there together
+    std::vector< size_t > parentIdxs(this->m_variant_ptrs.size());
+    std::iota(parentIdxs.begin(), parentIdxs.end(), 0);
+    auto findRoot = [&parentIdxs](size_t variantIdx)
+      {
+	while (parentIdxs[variantIdx] != variantIdx)
+	  {
+	    variantIdx = parentIdxs[variantIdx] = parentIdxs[parentIdxs[variantIdx]];
+	  }
+	return variantIdx;
+      };
+    for (auto& contigTree : this->m_contig_trees)
+      {
+	for (auto& cluster : contigTree.second->getClusters())
+	  {
+	    size_t rootIdx = findRoot(cluster[0]);
+	    for (auto variantIdx : cluster)
+	      {
+		size_t otherRootIdx = findRoot(variantIdx);
+		// the smaller index is the root, so a cluster's root is its first variant
+		parentIdxs[std::max(rootIdx, otherRootIdx)] = std::min(rootIdx, otherRootIdx);
+		rootIdx = std::min(rootIdx, otherRootIdx);
+	      }
+	  }
+      }
+    std::vector< std::vector< IVariant::SharedPtr > > clusters;
+    std::vector< size_t > clusterIdxs(this->m_variant_ptrs.size());
+    for (size_t i = 0; i < this->m_variant_ptrs.size(); ++i)
+      {
+	size_t rootIdx = findRoot(i);
+	if (rootIdx == i)
+	  {
+	    clusterIdxs[i] = clusters.size();
+	    clusters.emplace_back();
+	  }
+	clusters[clusterIdxs[rootIdx]].emplace_back(this->m_variant_ptrs[i]);
+      }
+    return clusters;
+  }
+
+  std::vector< bool > VariantOverlapIndex::getOverlapSkips()
+  {
+    std::vector< bool > skips(this->m_variant_ptrs.size());
+    for (size_t i = 0; i < this->m_variant_ptrs.size(); ++i)
+      {
+	skips[i] = this->m_variant_ptrs[i]->shouldSkip();
+      }
+    std::vector< size_t > variantIdxs;
+    for (size_t i = 0; i < this->m_variant_ptrs.size(); ++i)
+      {
+	if (skips[i])
+	  {
+	    continue;
+	  }
+	variantIdxs.clear();
+	getOverlappingIdxs(this->m_variant_ptrs[i]->getRegions(), variantIdxs);
+	for (auto variantIdx : variantIdxs)
+	  {
+	    if (variantIdx > i)
+	      {
+		skips[variantIdx] = true;
+	      }
+	  }
+      }
+    return skips;
+  }
@@ -0,0 +1,58 @@
+#ifndef VARIANTOVERLAPINDEX_H
+#define VARIANTOVERLAPINDEX_H
+
+#include "IVariant.h"
+#include "IntervalTree.hpp"
+#include "Noncopyable.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+  /*
+   * An interval tree per contig over every region of a set of variants, as
+   * IVariant::getRegions gives them, so overlaps are found without comparing
+   * variants pairwise. A large SV spanning thousands of small variants costs
+   * one query instead of thousands of doesOverlap calls. Regions are taken
+   * to cover at least one position, as variants with an empty reference
+   * still sit at theirs.
+   */
+  class VariantOverlapIndex : private Noncopyable
+  {
+  public:
+    typedef std::shared_ptr< VariantOverlapIndex > SharedPtr;
+
+    VariantOverlapIndex(const std::vector< IVariant::SharedPtr >& variantPtrs);
+    ~VariantOverlapIndex();
+
+    // in the order the variants were given
+    std::vector< IVariant::SharedPtr > getOverlappingVariants(Region::SharedPtr regionPtr);
+    // the variants overlapping any of its regions, not counting itself
+    std::vector< IVariant::SharedPtr > getOverlappingVariants(IVariant::SharedPtr variantPtr);
+
+    /*
+     * The variants grouped so that variants overlapping each other, directly
+     * or through others, share a cluster, what has to go into one graph.
+     * Clusters are ordered by their first variant and hold their variants in
+     * the order they were given.
+     */
+    std::vector< std::vector< IVariant::SharedPtr > > getClusters();
+
+    /*
+     * Picks the variants a graph can thread one after another: in the order
+     * they were given every variant not already skipped marks the ones after
+     * it that overlap it. Returns a flag per variant, in that order, set for
+     * the ones to skip, those whose shouldSkip was set included. The variants
+     * themselves are left alone, other graphs may share them.
+     */
+    std::vector< bool > getOverlapSkips();
+
+  private:
+    void getOverlappingIdxs(const std::vector< Region::SharedPtr >& regionPtrs, std::vector< size_t >& variantIdxs);
+
+    std::vector< IVariant::SharedPtr > m_variant_ptrs;
+    std::unordered_map< std::string, IntervalTree< size_t >::SharedPtr > m_contig_trees;
+  };
+
+#endif
@@ -0,0 +1,582 @@
+#include "VariantStore.h"
+#include "BinningIndex.h"
+#include "SymbolicAllele.h"
+#include "VariantList.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+  const char VariantStore::s_magic[8] = { 'S', 'V', 'M', 'S', 'T', 'O', 'R', 'E' };
+
+  /*
+   * A variant read in place from the mapping, everything but the alleles
+   * comes straight from its record.
+   */
+  class VariantStore::StoredVariant : public IVariant
+  {
+  public:
+    StoredVariant(std::shared_ptr< const Mapping > mappingPtr, size_t variantIdx);
+    ~StoredVariant();
+
+    position getPosition() override { return this->m_record->position; }
+    std::string getChrom() const override;
+    IAllele::SharedPtr getRefAllelePtr() override;
+    std::vector< IAllele::SharedPtr > getAltAllelePtrs() override;
+    void processOverlappingAlleles() override;
+    uint32_t getAllelePrefixOverlapMaxCount(IAllele::SharedPtr allelePtr) override;
+    uint32_t getAlleleSuffixOverlapMaxCount(IAllele::SharedPtr allelePtr) override;
+    std::string getVariantLine(IHeader::SharedPtr headerPtr) override;
+    bool shouldSkip() override { return this->m_skip; }
+    void setSkip(bool skip) override { this->m_skip = skip; }
+    std::vector< Region::SharedPtr > getRegions() override;
+    bool doesOverlap(IVariant::SharedPtr variantPtr) override;
+    uint32_t getReferenceSize() override { return this->m_record->reference_size; }
+    void addRegion(Region::SharedPtr regionPtr) override { this->m_region_ptrs.emplace_back(regionPtr); }
+    uint32_t getVariantSize() override { return this->m_record->variant_size; }
+    bool isStructuralVariant() override { return (this->m_record->flags & s_structural_variant_flag) != 0; }
+
+  private:
+    void loadAlleles();
+
+    std::shared_ptr< const Mapping > m_mapping_ptr;
+    const RecordEntry* m_record;
+    bool m_skip;
+    std::mutex m_alleles_mutex;
+    bool m_alleles_loaded;
+    IAllele::SharedPtr m_ref_allele_ptr;
+    std::vector< IAllele::SharedPtr > m_alt_allele_ptrs;
+    std::vector< Region::SharedPtr > m_region_ptrs;
+  };
+
+  VariantStore::StoredVariant::StoredVariant(std::shared_ptr< const Mapping > mappingPtr, size_t variantIdx) :
+    m_mapping_ptr(mappingPtr),
+    m_record(mappingPtr->records + variantIdx),
+    m_skip(false),
+    m_alleles_loaded(false)
+  {
+  }
+
+  VariantStore::StoredVariant::~StoredVariant()
+  {
+  }
+
+  std::string VariantStore::StoredVariant::getChrom() const
+  {
+    const ContigEntry& contig = this->m_mapping_ptr->contigs[this->m_record->contig_idx];
+    return std::string(this->m_mapping_ptr->bytes + contig.name_offset, contig.name_length);
+  }
+
+  void VariantStore::StoredVariant::loadAlleles()
+  {
+    std::lock_guard< std::mutex > lock(this->m_alleles_mutex);
+    if (this->m_alleles_loaded)
+      {
+	return;
+      }
+    const AlleleEntry* alleles = this->m_mapping_ptr->alleles + this->m_record->first_allele_idx;
+    std::vector< std::string > altSequences;
+    for (uint32_t i = 1; i < this->m_record->allele_count; ++i)
+      {
+	altSequences.emplace_back(unpackAllele(alleles[i], this->m_mapping_ptr->bytes));
+      }
+    SymbolicAllele::createAlleles(unpackAllele(alleles[0], this->m_mapping_ptr->bytes), altSequences, getChrom(), this->m_record->position, this->m_record->position + getReferenceSize() - 1,
+				  this->m_ref_allele_ptr, this->m_alt_allele_ptrs);
+    this->m_alleles_loaded = true;
+  }
+
+  IAllele::SharedPtr VariantStore::StoredVariant::getRefAllelePtr()
+  {
+    loadAlleles();
+    return this->m_ref_allele_ptr;
+  }
+
+  std::vector< IAllele::SharedPtr > VariantStore::StoredVariant::getAltAllelePtrs()
+  {
+    loadAlleles();
+    return this->m_alt_allele_ptrs;
+  }
+
+  void VariantStore::StoredVariant::processOverlappingAlleles()
+  {
+    loadAlleles();
+    this->m_ref_allele_ptr->setVariantWPtr(shared_from_this());
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	altAllelePtr->setVariantWPtr(shared_from_this());
+      }
+  }
+
+  uint32_t VariantStore::StoredVariant::getAllelePrefixOverlapMaxCount(IAllele::SharedPtr allelePtr)
+  {
+    loadAlleles();
+    uint32_t maxCount = 0;
+    if (allelePtr != this->m_ref_allele_ptr)
+      {
+	maxCount = allelePtr->getCommonPrefixSize(this->m_ref_allele_ptr);
+      }
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	if (allelePtr != altAllelePtr)
+	  {
+	    maxCount = std::max(maxCount, allelePtr->getCommonPrefixSize(altAllelePtr));
+	  }
+      }
+    return maxCount;
+  }
+
+  uint32_t VariantStore::StoredVariant::getAlleleSuffixOverlapMaxCount(IAllele::SharedPtr allelePtr)
+  {
+    loadAlleles();
+    uint32_t maxCount = 0;
+    if (allelePtr != this->m_ref_allele_ptr)
+      {
+	maxCount = allelePtr->getCommonSuffixSize(this->m_ref_allele_ptr);
+      }
+    for (auto& altAllelePtr : this->m_alt_allele_ptrs)
+      {
+	if (allelePtr != altAllelePtr)
+	  {
+	    maxCount = std::max(maxCount, allelePtr->getCommonSuffixSize(altAllelePtr));
+	  }
+      }
+    return maxCount;
+  }
+
+  std::string VariantStore::StoredVariant::getVariantLine(IHeader::SharedPtr /* headerPtr */)
+  {
+    const char* line = this->m_mapping_ptr->bytes + this->m_record->line_offset;
+    if (this->m_record->flags & s_whole_line_flag)
+      {
+	return std::string(line, this->m_record->line_length);
+      }
+    // put REF and ALT back where they were cut out
+    const AlleleEntry* alleles = this->m_mapping_ptr->alleles + this->m_record->first_allele_idx;
+    std::string variantLine(line, this->m_record->alleles_column);
+    variantLine += unpackAllele(alleles[0], this->m_mapping_ptr->bytes) + "\t";
+    for (uint32_t i = 1; i < this->m_record->allele_count; ++i)
+      {
+	variantLine += ((i > 1) ? "," : "") + unpackAllele(alleles[i], this->m_mapping_ptr->bytes);
+      }
+    variantLine += (this->m_record->allele_count > 1) ? "\t" : ".\t";
+    variantLine.append(line + this->m_record->alleles_column, this->m_record->line_length - this->m_record->alleles_column);
+    return variantLine;
+  }
+
+  std::vector< Region::SharedPtr > VariantStore::StoredVariant::getRegions()
+  {
+    std::vector< Region::SharedPtr > regionPtrs;
+    regionPtrs.reserve(this->m_region_ptrs.size() + 1);
+    regionPtrs.emplace_back(std::make_shared< Region >(getChrom(), this->m_record->position, this->m_record->position + getReferenceSize() - 1, Region::BASED::ONE));
+    regionPtrs.insert(regionPtrs.end(), this->m_region_ptrs.begin(), this->m_region_ptrs.end());
+    return regionPtrs;
+  }
+
+  bool VariantStore::StoredVariant::doesOverlap(IVariant::SharedPtr variantPtr)
+  {
+    if (variantPtr->getChrom() != getChrom())
+      {
+	return false;
+      }
+    position lastPosition = this->m_record->position + getReferenceSize() - 1;
+    position otherLastPosition = variantPtr->getPosition() + variantPtr->getReferenceSize() - 1;
+    return this->m_record->position <= otherLastPosition && variantPtr->getPosition() <= lastPosition;
+  }
+
+  VariantStore::Mapping::~Mapping()
+  {
+    if (this->data != nullptr)
+      {
+	munmap(this->data, this->size);
+      }
+  }
+
+  VariantStore::VariantStore(const std::string& storePath) :
+    m_store_path(storePath),
+    m_mapping_ptr(std::make_shared< Mapping >()),
+    m_next_variant_idx(0),
+    m_process_overlapping_alleles(false)
+  {
+    int fd = open(storePath.c_str(), O_RDONLY);
+    if (fd < 0)
+      {
+	throw std::runtime_error("VariantStore could not open " + storePath);
+      }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(FileHeader))
+      {
+	close(fd);
+	throw std::runtime_error("VariantStore " + storePath + " is not a variant store");
+      }
+    void* data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file
+    if (data == MAP_FAILED)
+      {
+	throw std::runtime_error("VariantStore could not map " + storePath);
+      }
+    this->m_mapping_ptr->data = data;
+    this->m_mapping_ptr->size = fileStat.st_size;
+    validate();
+    for (uint64_t i = 0; i < this->m_mapping_ptr->header->contig_count; ++i)
+      {
+	const ContigEntry& contig = this->m_mapping_ptr->contigs[i];
+	this->m_contig_idxs.emplace(std::string(this->m_mapping_ptr->bytes + contig.name_offset, contig.name_length), i);
+      }
+  }
+
+  VariantStore::~VariantStore()
+  {
+  }
+
+  // every offset and count has to land inside the file before anything reads through it
+  void VariantStore::validate()
+  {
+    Mapping& mapping = *this->m_mapping_ptr;
+    const char* base = (const char*)mapping.data;
+    const FileHeader* header = (const FileHeader*)base;
+    if (memcmp(header->magic, s_magic, sizeof(s_magic)) != 0)
+      {
+	throw std::runtime_error("VariantStore " + this->m_store_path + " is not a variant store");
+      }
+    if (header->version != s_version || header->byte_order_mark != s_byte_order_mark)
+      {
+	throw std::runtime_error("VariantStore " + this->m_store_path + " was written by another version or on a machine of another byte order, write it again");
+      }
+    auto sectionFits = [&mapping](uint64_t offset, uint64_t count, size_t entrySize)
+      {
+	return offset % 8 == 0 && offset <= mapping.size && count <= (mapping.size - offset) / entrySize;
+      };
+    if (!sectionFits(header->contigs_offset, header->contig_count, sizeof(ContigEntry)) ||
+	!sectionFits(header->records_offset, header->variant_count, sizeof(RecordEntry)) ||
+	!sectionFits(header->clusters_offset, header->cluster_count, sizeof(ClusterEntry)) ||
+	!sectionFits(header->alleles_offset, header->allele_count, sizeof(AlleleEntry)) ||
+	!sectionFits(header->bytes_offset, header->bytes_size, 1))
+      {
+	throw std::runtime_error("VariantStore " + this->m_store_path + " is truncated");
+      }
+    mapping.header = header;
+    mapping.contigs = (const ContigEntry*)(base + header->contigs_offset);
+    mapping.records = (const RecordEntry*)(base + header->records_offset);
+    mapping.clusters = (const ClusterEntry*)(base + header->clusters_offset);
+    mapping.alleles = (const AlleleEntry*)(base + header->alleles_offset);
+    mapping.bytes = base + header->bytes_offset;
+
+    auto bytesFit = [header](uint64_t offset, uint64_t length) { return offset <= header->bytes_size && length <= header->bytes_size - offset; };
+    bool isValid = true;
+    for (uint64_t i = 0; i < header->contig_count; ++i)
+      {
+	const ContigEntry& contig = mapping.contigs[i];
+	isValid &= bytesFit(contig.name_offset, contig.name_length) && contig.first_cluster_idx <= header->cluster_count &&
+	  contig.cluster_count <= header->cluster_count - contig.first_cluster_idx;
+      }
+    for (uint64_t i = 0; i < header->cluster_count; ++i)
+      {
+	const ClusterEntry& cluster = mapping.clusters[i];
+	isValid &= cluster.first_variant_idx <= header->variant_count && cluster.variant_count <= header->variant_count - cluster.first_variant_idx;
+      }
+    for (uint64_t i = 0; i < header->variant_count; ++i)
+      {
+	const RecordEntry& record = mapping.records[i];
+	isValid &= record.contig_idx < header->contig_count && record.cluster_idx < header->cluster_count && record.allele_count > 0 &&
+	  record.first_allele_idx <= header->allele_count && record.allele_count <= header->allele_count - record.first_allele_idx &&
+	  bytesFit(record.line_offset, record.line_length) && record.alleles_column <= record.line_length;
+      }
+    for (uint64_t i = 0; i < header->allele_count; ++i)
+      {
+	const AlleleEntry& allele = mapping.alleles[i];
+	isValid &= bytesFit(allele.sequence_offset, allele.is_packed ? ((uint64_t)allele.length + 3) / 4 : allele.length);
+      }
+    if (!isValid)
+      {
+	throw std::runtime_error("VariantStore " + this->m_store_path + " is corrupt");
+      }
+  }
+
+  // alleles of only A, C, G and T are packed 2 bits a base, the first base in the low bits
+  void VariantStore::appendAllele(const std::string& sequence, std::vector< AlleleEntry >& alleles, std::string& bytes)
+  {
+    static const std::string packedBases = "ACGT";
+    AlleleEntry allele = { bytes.size(), (uint32_t)sequence.size(), 1 };
+    if (sequence.find_first_not_of(packedBases) != std::string::npos)
+      {
+	allele.is_packed = 0;
+	bytes += sequence;
+	alleles.push_back(allele);
+	return;
+      }
+    bytes.append((sequence.size() + 3) / 4, '\0');
+    char* packed = &bytes[allele.sequence_offset];
+    for (size_t i = 0; i < sequence.size(); ++i)
+      {
+	packed[i / 4] |= packedBases.find(sequence[i]) << (2 * (i % 4));
+      }
+    alleles.push_back(allele);
+  }
+
+  std::string VariantStore::unpackAllele(const AlleleEntry& allele, const char* bytes)
+  {
+    const char* sequence = bytes + allele.sequence_offset;
+    if (!allele.is_packed)
+      {
+	return std::string(sequence, allele.length);
+      }
+    static const char packedBases[] = "ACGT";
+    std::string unpacked(allele.length, '\0');
+    for (uint32_t i = 0; i < allele.length; ++i)
+      {
+	unpacked[i] = packedBases[(sequence[i / 4] >> (2 * (i % 4))) & 3];
+      }
+    return unpacked;
+  }
+
+  void VariantStore::write(IVariantList::SharedPtr variantListPtr, const std::string& storePath)
+  {
+    variantListPtr->sort();
+    std::vector< IVariant::SharedPtr > variantPtrs = variantListPtr->getAllVariantPtrs();
+    std::vector< ContigEntry > contigs;
+    std::unordered_map< std::string, uint32_t > contigIdxs;
+    std::vector< RecordEntry > records;
+    std::vector< ClusterEntry > clusters;
+    std::vector< AlleleEntry > alleles;
+    std::string bytes;
+    records.reserve(variantPtrs.size());
+    for (size_t i = 0; i < variantPtrs.size(); ++i)
+      {
+	auto& variantPtr = variantPtrs[i];
+	RecordEntry record;
+	memset(&record, 0, sizeof(record));
+	std::string contigName = variantPtr->getChrom();
+	auto contigIter = contigIdxs.find(contigName);
+	if (contigIter == contigIdxs.end())
+	  {
+	    contigIter = contigIdxs.emplace(contigName, contigs.size()).first;
+	    contigs.push_back({bytes.size(), (uint32_t)contigName.size(), 0, clusters.size()});
+	    bytes += contigName;
+	  }
+	record.contig_idx = contigIter->second;
+	record.position = variantPtr->getPosition();
+	if (!records.empty() && (record.contig_idx < records.back().contig_idx ||
+				 (record.contig_idx == records.back().contig_idx && record.position < records.back().position)))
+	  {
+	    throw std::runtime_error("VariantStore can't write " + storePath + ", the variants are out of order at " + contigName + ":" + std::to_string(record.position));
+	  }
+	record.reference_size = variantPtr->getReferenceSize();
+	record.variant_size = variantPtr->getVariantSize();
+	record.flags = variantPtr->isStructuralVariant() ? s_structural_variant_flag : 0;
+
+	// a variant starting past everything before it on the contig starts a cluster
+	position lastPosition = record.position + std::max< uint32_t >(record.reference_size, 1) - 1;
+	if (contigs[record.contig_idx].cluster_count == 0 || record.position > clusters.back().last_position)
+	  {
+	    clusters.push_back({i, 0, record.position, lastPosition});
+	    ++contigs[record.contig_idx].cluster_count;
+	  }
+	++clusters.back().variant_count;
+	clusters.back().last_position = std::max(clusters.back().last_position, lastPosition);
+	record.cluster_idx = clusters.size() - 1;
+
+	std::string refSequence = variantPtr->getRefAllelePtr()->getSequenceString();
+	std::string altColumn;
+	record.first_allele_idx = alleles.size();
+	appendAllele(refSequence, alleles, bytes);
+	for (auto& altAllelePtr : variantPtr->getAltAllelePtrs())
+	  {
+	    std::string altSequence = altAllelePtr->getSequenceString();
+	    altColumn += (altColumn.empty() ? "" : ",") + altSequence;
+	    appendAllele(altSequence, alleles, bytes);
+	  }
+	record.allele_count = alleles.size() - record.first_allele_idx;
+
+	// REF and ALT are the 4th and 5th columns, they're already stored as alleles
+	std::string line = variantPtr->getVariantLine(nullptr);
+	std::string allelesColumns = refSequence + "\t" + (altColumn.empty() ? "." : altColumn) + "\t";
+	size_t refStart = 0;
+	for (size_t column = 0; column < 3 && refStart != std::string::npos; ++column)
+	  {
+	    refStart = line.find('\t', refStart);
+	    refStart = (refStart == std::string::npos) ? refStart : refStart + 1;
+	  }
+	if (refStart != std::string::npos && line.compare(refStart, allelesColumns.size(), allelesColumns) == 0)
+	  {
+	    line.erase(refStart, allelesColumns.size());
+	    record.alleles_column = refStart;
+	  }
+	else
+	  {
+	    record.flags |= s_whole_line_flag;
+	  }
+	record.line_offset = bytes.size();
+	record.line_length = line.size();
+	bytes += line;
+	records.push_back(record);
+      }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.byte_order_mark = s_byte_order_mark;
+    header.variant_count = records.size();
+    header.contig_count = contigs.size();
+    header.cluster_count = clusters.size();
+    header.allele_count = alleles.size();
+    // every entry's size is a multiple of 8, so every section stays aligned
+    header.contigs_offset = sizeof(FileHeader);
+    header.records_offset = header.contigs_offset + contigs.size() * sizeof(ContigEntry);
+    header.clusters_offset = header.records_offset + records.size() * sizeof(RecordEntry);
+    header.alleles_offset = header.clusters_offset + clusters.size() * sizeof(ClusterEntry);
+    header.bytes_offset = header.alleles_offset + alleles.size() * sizeof(AlleleEntry);
+    header.bytes_size = bytes.size();
+
+    std::ofstream storeStream(storePath, std::ios::binary | std::ios::trunc);
+    storeStream.write((const char*)&header, sizeof(header));
+    storeStream.write((const char*)contigs.data(), contigs.size() * sizeof(ContigEntry));
+    storeStream.write((const char*)records.data(), records.size() * sizeof(RecordEntry));
+    storeStream.write((const char*)clusters.data(), clusters.size() * sizeof(ClusterEntry));
+    storeStream.write((const char*)alleles.data(), alleles.size() * sizeof(AlleleEntry));
+    storeStream.write(bytes.data(), bytes.size());
+    storeStream.close();
+    if (!storeStream)
+      {
+	throw std::runtime_error("VariantStore could not write " + storePath);
+      }
+  }
+
+  IVariant::SharedPtr VariantStore::getVariant(size_t variantIdx)
+  {
+    IVariant::SharedPtr variantPtr = std::make_shared< StoredVariant >(this->m_mapping_ptr, variantIdx);
+    if (this->m_process_overlapping_alleles)
+      {
+	variantPtr->processOverlappingAlleles();
+      }
+    return variantPtr;
+  }
+
+  void VariantStore::processOverlappingAlleles()
+  {
+    this->m_process_overlapping_alleles = true;
+    if (this->m_peeked_variant_ptr != nullptr)
+      {
+	this->m_peeked_variant_ptr->processOverlappingAlleles();
+      }
+  }
+
+  bool VariantStore::getNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (!peekNextVariant(variantPtr))
+      {
+	return false;
+      }
+    this->m_peeked_variant_ptr = nullptr;
+    ++this->m_next_variant_idx;
+    return true;
+  }
+
+  bool VariantStore::peekNextVariant(IVariant::SharedPtr& variantPtr)
+  {
+    if (this->m_peeked_variant_ptr == nullptr)
+      {
+	if (this->m_next_variant_idx >= this->m_mapping_ptr->header->variant_count)
+	  {
+	    return false;
+	  }
+	this->m_peeked_variant_ptr = getVariant(this->m_next_variant_idx);
+      }
+    variantPtr = this->m_peeked_variant_ptr;
+    return true;
+  }
+
+  size_t VariantStore::getCount()
+  {
+    return this->m_mapping_ptr->header->variant_count;
+  }
+
+  std::vector< IVariant::SharedPtr > VariantStore::getAllVariantPtrs()
+  {
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    variantPtrs.reserve(getCount() - this->m_next_variant_idx);
+    IVariant::SharedPtr variantPtr;
+    if (peekNextVariant(variantPtr))
+      {
+	variantPtrs.emplace_back(variantPtr);
+      }
+    for (size_t i = this->m_next_variant_idx + 1; i < getCount(); ++i)
+      {
+	variantPtrs.emplace_back(getVariant(i));
+      }
+    return variantPtrs;
+  }
+
+  std::vector< std::string > VariantStore::getContigNames()
+  {
+    std::vector< std::string > contigNames;
+    for (uint64_t i = 0; i < this->m_mapping_ptr->header->contig_count; ++i)
+      {
+	const ContigEntry& contig = this->m_mapping_ptr->contigs[i];
+	contigNames.emplace_back(this->m_mapping_ptr->bytes + contig.name_offset, contig.name_length);
+      }
+    return contigNames;
+  }
+
+  size_t VariantStore::getClusterCount()
+  {
+    return this->m_mapping_ptr->header->cluster_count;
+  }
+
+  // the variants in [firstVariantIdx, firstVariantIdx + variantCount) reaching into [firstPosition, lastPosition]
+  void VariantStore::appendOverlapping(size_t firstVariantIdx, size_t variantCount, position firstPosition, position lastPosition, std::vector< IVariant::SharedPtr >& variantPtrs)
+  {
+    for (size_t i = firstVariantIdx; i < firstVariantIdx + variantCount; ++i)
+      {
+	const RecordEntry& record = this->m_mapping_ptr->records[i];
+	uint64_t recordLastPosition = (uint64_t)record.position + std::max< uint32_t >(record.reference_size, 1) - 1;
+	if (record.position <= lastPosition && recordLastPosition >= firstPosition)
+	  {
+	    variantPtrs.emplace_back(getVariant(i));
+	  }
+      }
+  }
+
+  IVariantList::SharedPtr VariantStore::getClusterVariants(size_t clusterIdx)
+  {
+    if (clusterIdx >= getClusterCount())
+      {
+	throw std::invalid_argument("VariantStore has no cluster " + std::to_string(clusterIdx));
+      }
+    const ClusterEntry& cluster = this->m_mapping_ptr->clusters[clusterIdx];
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    appendOverlapping(cluster.first_variant_idx, cluster.variant_count, cluster.first_position, cluster.last_position, variantPtrs);
+    return std::make_shared< VariantList >(std::move(variantPtrs));
+  }
+
+  IVariantList::SharedPtr VariantStore::getVariantsInRegion(Region::SharedPtr regionPtr)
+  {
+    std::vector< IVariant::SharedPtr > variantPtrs;
+    uint64_t beginPosition;
+    uint64_t endPosition;
+    BinningIndex::getRegionBounds(regionPtr, beginPosition, endPosition);
+    auto contigIter = this->m_contig_idxs.find(regionPtr->getReferenceID());
+    if (contigIter != this->m_contig_idxs.end() && beginPosition < endPosition)
+      {
+	// one based like the records, the last position included
+	position firstPosition = beginPosition + 1;
+	position lastPosition = endPosition;
+	const ContigEntry& contig = this->m_mapping_ptr->contigs[contigIter->second];
+	const ClusterEntry* clustersEnd = this->m_mapping_ptr->clusters + contig.first_cluster_idx + contig.cluster_count;
+	// the clusters don't overlap, so their last positions are sorted too
+	const ClusterEntry* clusterPtr = std::lower_bound(this->m_mapping_ptr->clusters + contig.first_cluster_idx, clustersEnd, firstPosition,
+							  [](const ClusterEntry& cluster, position firstPosition) { return cluster.last_position < firstPosition; });
+	for (; clusterPtr != clustersEnd && clusterPtr->first_position <= lastPosition; ++clusterPtr)
+	  {
+	    appendOverlapping(clusterPtr->first_variant_idx, clusterPtr->variant_count, firstPosition, lastPosition, variantPtrs);
+	  }
+      }
+    return std::make_shared< VariantList >(std::move(variantPtrs));
+  }
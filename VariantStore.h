@@ -0,0 +1,150 @@
+#ifndef VARIANTSTORE_H
+#define VARIANTSTORE_H
+
+#include "IVariantList.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+  /*
+   * Variants in a binary file that is mapped rather than parsed, for a
+   * catalogue genotyped over and over. write converts any IVariantList once,
+   * sorted, keeping for each variant its contig, position, reference and
+   * variant sizes, whether it's structural and its alleles, those made of
+   * A, C, G and T packed four bases to a byte. The rest of the record stays
+   * text for getVariantLine. Variants whose reference spans overlap,
+   * directly or through others, are grouped into clusters as they're
+   * written, the variants a graph would be built over together.
+   *
+   * Opening a store maps it and checks the sections fit the file, nothing
+   * is parsed. Variants are small views of their record made as they're
+   * handed out and unpack their alleles the first time a graph asks for
+   * them. Clusters are sorted and don't overlap on a contig, so a region
+   * query is a binary search for its first cluster.
+   */
+  class VariantStore : public IVariantList
+  {
+  public:
+    typedef std::shared_ptr< VariantStore > SharedPtr;
+
+    // throws std::runtime_error if the file can't be mapped or isn't a store of this version
+    VariantStore(const std::string& storePath);
+    ~VariantStore();
+
+    // sorts the list first, throws std::runtime_error if the file can't be
+    // written or the list has no single order by contig and position
+    static void write(IVariantList::SharedPtr variantListPtr, const std::string& storePath);
+
+    void processOverlappingAlleles() override;
+    bool getNextVariant(IVariant::SharedPtr& variantPtr) override;
+    bool peekNextVariant(IVariant::SharedPtr& variantPtr) override;
+    size_t getCount() override;
+    void sort() override {} // written sorted
+    std::vector< IVariant::SharedPtr > getAllVariantPtrs() override; // the variants getNextVariant hasn't returned yet
+    // in position order, can be called from several threads at once
+    IVariantList::SharedPtr getVariantsInRegion(Region::SharedPtr regionPtr) override;
+
+    std::vector< std::string > getContigNames();
+    size_t getClusterCount();
+    // in position order
+    IVariantList::SharedPtr getClusterVariants(size_t clusterIdx);
+
+  private:
+    // the file's layout, in the byte order it was written in with every
+    // section 8 byte aligned so the mapping can be read in place
+    struct FileHeader
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t byte_order_mark;
+      uint64_t variant_count;
+      uint64_t contig_count;
+      uint64_t cluster_count;
+      uint64_t allele_count;
+      uint64_t contigs_offset;
+      uint64_t records_offset;
+      uint64_t clusters_offset;
+      uint64_t alleles_offset;
+      uint64_t bytes_offset; // names, allele sequences and line text
+      uint64_t bytes_size;
+    };
+
+    struct ContigEntry
+    {
+      uint64_t name_offset;
+      uint32_t name_length;
+      uint32_t cluster_count;
+      uint64_t first_cluster_idx;
+    };
+
+    struct RecordEntry
+    {
+      uint32_t contig_idx;
+      uint32_t position;
+      uint32_t reference_size;
+      uint32_t variant_size;
+      uint32_t flags;
+      uint32_t allele_count; // the reference allele first
+      uint64_t first_allele_idx;
+      uint64_t cluster_idx;
+      uint64_t line_offset;
+      uint32_t line_length;
+      uint32_t alleles_column; // where REF and ALT were cut out of the line
+    };
+
+    struct AlleleEntry
+    {
+      uint64_t sequence_offset;
+      uint32_t length; // in bases
+      uint32_t is_packed;
+    };
+
+    struct ClusterEntry
+    {
+      uint64_t first_variant_idx;
+      uint64_t variant_count;
+      uint32_t first_position;
+      uint32_t last_position; // the furthest any of its variants reaches
+    };
+
+    // the mapped file, shared with the variants so they outlive the store
+    struct Mapping
+    {
+      ~Mapping();
+
+      void* data = nullptr;
+      size_t size = 0;
+      const FileHeader* header;
+      const ContigEntry* contigs;
+      const RecordEntry* records;
+      const ClusterEntry* clusters;
+      const AlleleEntry* alleles;
+      const char* bytes;
+    };
+
+    class StoredVariant;
+
+    static const char s_magic[8];
+    static const uint32_t s_version = 1;
+    static const uint32_t s_byte_order_mark = 0x01020304;
+    static const uint32_t s_structural_variant_flag = 1;
+    static const uint32_t s_whole_line_flag = 2; // REF and ALT weren't where a VCF line has them, the line is kept whole
+
+    static void appendAllele(const std::string& sequence, std::vector< AlleleEntry >& alleles, std::string& bytes);
+    static std::string unpackAllele(const AlleleEntry& allele, const char* bytes);
+    void validate();
+    IVariant::SharedPtr getVariant(size_t variantIdx);
+    void appendOverlapping(size_t firstVariantIdx, size_t variantCount, position firstPosition, position lastPosition, std::vector< IVariant::SharedPtr >& variantPtrs);
+
+    std::string m_store_path;
+    std::shared_ptr< Mapping > m_mapping_ptr;
+    std::unordered_map< std::string, uint32_t > m_contig_idxs;
+    size_t m_next_variant_idx;
+    IVariant::SharedPtr m_peeked_variant_ptr;
+    bool m_process_overlapping_alleles;
+  };
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef WORKSTEALINGDEQUE_HPP
+#define WORKSTEALINGDEQUE_HPP
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+#include "Noncopyable.hpp"
+
+  /*
+   * Chase-Lev work stealing deque of pointers (Le, Pop, Cohen, Zappa Nardelli,
+   * "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+   * Only the owning thread may push and pop, at the bottom. Any thread may
+   * steal from the top. Buffers replaced by a grow are kept until the deque
+   * is destroyed because a thief may still be reading from them.
+   */
+  template< typename T >
+  class WorkStealingDeque : private Noncopyable
+  {
+  public:
+  WorkStealingDeque(int64_t capacity = 256) :
+    m_top(0),
+    m_bottom(0),
+    m_array(new Array(capacity))
+    {
+    }
+
+    ~WorkStealingDeque()
+      {
+	delete this->m_array.load(std::memory_order_relaxed);
+	for (auto array : this->m_retired_arrays)
+	  {
+	    delete array;
+	  }
+      }
+
+    void push(T* item)
+    {
+      int64_t b = this->m_bottom.load(std::memory_order_relaxed);
+      int64_t t = this->m_top.load(std::memory_order_acquire);
+      Array* a = this->m_array.load(std::memory_order_relaxed);
+      if (b - t > a->capacity - 1)
+	{
+	  Array* grown = a->grow(b, t);
+	  this->m_retired_arrays.push_back(a);
+	  this->m_array.store(grown, std::memory_order_release);
+	  a = grown;
+	}
+      a->put(b, item);
+      std::atomic_thread_fence(std::memory_order_release);
+      this->m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    T* pop()
+    {
+      int64_t b = this->m_bottom.load(std::memory_order_relaxed) - 1;
+      Array* a = this->m_array.load(std::memory_order_relaxed);
+      this->m_bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t t = this->m_top.load(std::memory_order_relaxed);
+      if (t > b)
+	{
+	  this->m_bottom.store(b + 1, std::memory_order_relaxed);
+	  return nullptr;
+	}
+      T* item = a->get(b);
+      if (t == b)
+	{
+	  // last item, race the thieves for it
+	  if (!this->m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	    {
+	      item = nullptr;
+	    }
+	  this->m_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+      return item;
+    }
+
+    T* steal()
+    {
+      int64_t t = this->m_top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = this->m_bottom.load(std::memory_order_acquire);
+      if (t >= b)
+	{
+	  return nullptr;
+	}
+      Array* a = this->m_array.load(std::memory_order_acquire);
+      T* item = a->get(t);
+      if (!this->m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+	  return nullptr;
+	}
+      return item;
+    }
+
+    // approximate, may be stale by the time the caller looks at it
+    int64_t size()
+    {
+      int64_t b = this->m_bottom.load(std::memory_order_relaxed);
+      int64_t t = this->m_top.load(std::memory_order_relaxed);
+      return (b > t) ? b - t : 0;
+    }
+
+    bool empty() { return size() == 0; }
+
+  private:
+    struct Array
+    {
+    Array(int64_t c) :
+      capacity(c), mask(c - 1), buffer(new std::atomic< T* >[c])
+      {
+      }
+
+      ~Array()
+	{
+	  delete[] this->buffer;
+	}
+
+      // release/acquire on the slot itself so the item is published even to tools that don't model fences
+      T* get(int64_t idx) { return this->buffer[idx & this->mask].load(std::memory_order_acquire); }
+      void put(int64_t idx, T* item) { this->buffer[idx & this->mask].store(item, std::memory_order_release); }
+
+      Array* grow(int64_t bottom, int64_t top)
+      {
+	Array* grown = new Array(this->capacity * 2);
+	for (int64_t i = top; i < bottom; ++i)
+	  {
+	    grown->put(i, get(i));
+	  }
+	return grown;
+      }
+
+      int64_t capacity; // always a power of two
+      int64_t mask;
+      std::atomic< T* >* buffer;
+    };
+
+    std::atomic< int64_t > m_top;
+    std::atomic< int64_t > m_bottom;
+    std::atomic< Array* > m_array;
+    std::vector< Array* > m_retired_arrays; // only touched by the owner
+  };
+
+#endif
@@ -64,17 +64,17 @@
 
 
 /* Generate query profile rearrange query sequence & calculate the weight of match/mismatch. */
-__m128i* gssw_qP_byte (const int8_t* read_num,
-                       const int8_t* mat,
-                       const int32_t readLen,
-                       const int32_t n,/* the edge length of the squre matrix mat */
-                       uint8_t bias) {
+__m128i* gssw_qP_byte_fill (__m128i* vProfile,
+                            const int8_t* read_num,
+                            const int8_t* mat,
+                            const int32_t readLen,
+                            const int32_t n,/* the edge length of the squre matrix mat */
+                            uint8_t bias) {
 
   int32_t segLen = (readLen + 15) / 16; /* Split the 128 bit register into 16 pieces.
 					        Each piece is 8 bit. Split the read into 16 segments.
 						     Calculat 16 segments in parallel.
 					*/
-  __m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
   int8_t* t = (int8_t*)vProfile;
   int32_t nt, i, j, segNum;
 
@@ -91,6 +91,16 @@ __m128i* gssw_qP_byte (const int8_t* read_num,
   return vProfile;
 }
 
+__m128i* gssw_qP_byte (const int8_t* read_num,
+                       const int8_t* mat,
+                       const int32_t readLen,
+                       const int32_t n,/* the edge length of the squre matrix mat */
+                       uint8_t bias) {
+  int32_t segLen = (readLen + 15) / 16;
+  __m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
+  return gssw_qP_byte_fill(vProfile, read_num, mat, readLen, n, bias);
+}
+
 /* To determine the maximum values within each vector, rather than between vectors. */
 
 #define m128i_max16(m, vm) \
@@ -377,13 +387,13 @@ gssw_alignment_end* gssw_sw_sse2_byte (const int8_t* ref,
   return bests;
 }
 
-__m128i* gssw_qP_word (const int8_t* read_num,
-		       const int8_t* mat,
-		       const int32_t readLen,
-		       const int32_t n) {
+__m128i* gssw_qP_word_fill (__m128i* vProfile,
+                            const int8_t* read_num,
+                            const int8_t* mat,
+                            const int32_t readLen,
+                            const int32_t n) {
 
   int32_t segLen = (readLen + 7) / 8;
-  __m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
   int16_t* t = (int16_t*)vProfile;
   int32_t nt, i, j;
   int32_t segNum;
@@ -401,6 +411,15 @@ __m128i* gssw_qP_word (const int8_t* read_num,
   return vProfile;
 }
 
+__m128i* gssw_qP_word (const int8_t* read_num,
+		       const int8_t* mat,
+		       const int32_t readLen,
+		       const int32_t n) {
+  int32_t segLen = (readLen + 7) / 8;
+  __m128i* vProfile = (__m128i*)malloc(n * segLen * sizeof(__m128i));
+  return gssw_qP_word_fill(vProfile, read_num, mat, readLen, n);
+}
+
 gssw_alignment_end* gssw_sw_sse2_word (const int8_t* ref,
                                        int8_t ref_dir,// 0: forward ref; 1: reverse ref
                                        int32_t refLen,
@@ -646,6 +665,35 @@ void gssw_init_destroy (gssw_profile* p) {
   free(p);
 }
 
+gssw_profile* gssw_init_reuse (gssw_profile* p, const int8_t* read, const int32_t readLen, const int8_t* mat, const int32_t n, const int8_t score_size) {
+  if (!p || p->readLen != readLen || p->n != n) {
+    if (p) gssw_init_destroy(p);
+    return gssw_init(read, readLen, mat, n, score_size);
+  }
+  // same read length, so the striped profile buffers have the right size already
+  if (score_size == 0 || score_size == 2) {
+    int32_t bias = 0, i;
+    for (i = 0; i < n*n; i++) if (mat[i] < bias) bias = mat[i];
+    bias = abs(bias);
+    p->bias = bias;
+    if (!p->profile_byte) p->profile_byte = (__m128i*)malloc(n * ((readLen + 15) / 16) * sizeof(__m128i));
+    gssw_qP_byte_fill(p->profile_byte, read, mat, readLen, n, bias);
+  } else {
+    free(p->profile_byte);
+    p->profile_byte = 0;
+  }
+  if (score_size == 1 || score_size == 2) {
+    if (!p->profile_word) p->profile_word = (__m128i*)malloc(n * ((readLen + 7) / 8) * sizeof(__m128i));
+    gssw_qP_word_fill(p->profile_word, read, mat, readLen, n);
+  } else {
+    free(p->profile_word);
+    p->profile_word = 0;
+  }
+  p->read = read;
+  p->mat = mat;
+  return p;
+}
+
 gssw_align* gssw_fill (const gssw_profile* prof,
                        const int8_t* ref,
                        const int32_t refLen,
@@ -1632,6 +1680,49 @@ gssw_graph_fill (gssw_graph* graph,
 
 }
 
+gssw_graph*
+gssw_graph_fill_profile (gssw_graph* graph,
+                         gssw_profile* prof,
+                         const uint8_t weight_gapO,
+                         const uint8_t weight_gapE,
+                         const int32_t maskLen) {
+
+  gssw_seed* seed = NULL;
+  uint16_t max_score = 0;
+  uint32_t i;
+  gssw_node** npp;
+
+ restart:
+  graph->max_node = NULL;
+  max_score = 0;
+  npp = &graph->nodes[0];
+  for (i = 0; i < graph->size; ++i, ++npp) {
+    gssw_node* n = *npp;
+    if (prof->profile_byte) {
+      seed = gssw_create_seed_byte(prof->readLen, n->prev, n->count_prev);
+    } else {
+      seed = gssw_create_seed_word(prof->readLen, n->prev, n->count_prev);
+    }
+    gssw_node* filled_node = gssw_node_fill(n, prof, weight_gapO, weight_gapE, maskLen, seed);
+    gssw_seed_destroy(seed); seed = NULL;
+    if (prof->profile_byte && !filled_node) {
+      // the 8-bit stripes overflowed, switch the caller's profile to 16-bit and start over
+      free(prof->profile_byte);
+      prof->profile_byte = NULL;
+      if (!prof->profile_word) prof->profile_word = gssw_qP_word(prof->read, prof->mat, prof->readLen, prof->n);
+      goto restart;
+    } else {
+      if (!graph->max_node || n->alignment->score1 > max_score) {
+	graph->max_node = n;
+	max_score = n->alignment->score1;
+      }
+    }
+  }
+
+  return graph;
+
+}
+
 // TODO graph traceback
 
 
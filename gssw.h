@@ -170,6 +170,12 @@ extern "C" {
   */
   void gssw_init_destroy (gssw_profile* p);
 
+  /*!@functionRefill a query profile for a new read, reusing its buffers when the read length is unchanged.
+    @parampprofile returned by a previous gssw_init or gssw_init_reuse, or NULL
+    @returnpointer to the query profile structure, p itself when its buffers could be reused
+  */
+  gssw_profile* gssw_init_reuse (gssw_profile* p, const int8_t* read, const int32_t readLen, const int8_t* mat, const int32_t n, const int8_t score_size);
+
   gssw_align* gssw_align_create(void);
 
 
@@ -391,6 +397,16 @@ gssw_graph_fill (gssw_graph* graph,
                  const int32_t maskLen,
                  const int8_t score_size);
 
+/*!@functionFill the graph with a caller owned query profile (see gssw_init_reuse).
+  @noteif the 8-bit stripes overflow the profile is switched to 16-bit in place
+*/
+gssw_graph*
+gssw_graph_fill_profile (gssw_graph* graph,
+                         gssw_profile* prof,
+                         const uint8_t weight_gapO,
+                         const uint8_t weight_gapE,
+                         const int32_t maskLen);
+
   gssw_graph* gssw_graph_create(uint32_t size);
   int32_t gssw_graph_add_node(gssw_graph* graph,
 			      gssw_node* node);
@@ -0,0 +1,180 @@
+#include "TestFiles.hpp"
+
+#include "BamAlignmentReader.h"
+#include "ThreadPool.hpp"
+
+#include <cstring>
+#include <random>
+
+  /*
+   * Checks BamAlignmentReader's chunk splitting against BAMs generated
+   * here. The blocks are stored rather than deflated so their compressed
+   * size is known, and each file cuts every block at the same place in a
+   * record: inside its 4 byte length, inside its body or right on its
+   * start. Whatever size the reader's chunks are, every chunk then ends
+   * that way, the first one right after the header's block too. Another
+   * file has a record longer than a whole chunk.
+   */
+
+  struct TestAlignment
+  {
+    std::string name;
+    position alignment_position; // one based
+    std::string sequence;
+    bool is_mapped;
+  };
+
+  static void appendInt(std::string& bytes, uint64_t value, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      {
+	bytes += (char)((value >> (8 * i)) & 0xff);
+      }
+  }
+
+  // the 4 byte length and the record, a CIGAR of one M and an RG tag
+  static std::string createRecord(const TestAlignment& alignment)
+  {
+    std::string record;
+    appendInt(record, 0, 4); // block_size, set below
+    appendInt(record, 0, 4); // refID
+    appendInt(record, alignment.alignment_position - 1, 4);
+    appendInt(record, alignment.name.size() + 1, 1);
+    appendInt(record, 60, 1); // MAPQ
+    appendInt(record, 0, 2); // bin
+    appendInt(record, 1, 2); // n_cigar_op
+    appendInt(record, alignment.is_mapped ? 0 : 4, 2); // FLAG
+    appendInt(record, alignment.sequence.size(), 4);
+    appendInt(record, (uint32_t)-1, 4); // next refID
+    appendInt(record, (uint32_t)-1, 4); // next pos
+    appendInt(record, 0, 4); // tlen
+    record += alignment.name + '\0';
+    appendInt(record, alignment.sequence.size() << 4, 4); // M
+    auto encode = [](char base) { return (uint8_t)((base == 'A') ? 1 : (base == 'C') ? 2 : (base == 'G') ? 4 : 8); };
+    for (size_t i = 0; i < alignment.sequence.size(); i += 2)
+      {
+	uint8_t codes = encode(alignment.sequence[i]) << 4;
+	codes |= (i + 1 < alignment.sequence.size()) ? encode(alignment.sequence[i + 1]) : 0;
+	record += (char)codes;
+      }
+    record += std::string(alignment.sequence.size(), (char)30); // qualities
+    record += std::string("RGZrg1", 6) + '\0';
+    uint32_t blockSize = record.size() - 4;
+    memcpy(&record[0], &blockSize, 4);
+    return record;
+  }
+
+  static std::string createHeader()
+  {
+    std::string text = "@HD\tVN:1.6\n@SQ\tSN:chr1\tLN:100000000\n@RG\tID:rg1\tSM:sample1\n";
+    std::string header("BAM\1", 4);
+    appendInt(header, text.size(), 4);
+    header += text;
+    appendInt(header, 1, 4); // n_ref
+    appendInt(header, 5, 4);
+    header += std::string("chr1") + '\0';
+    appendInt(header, 100000000, 4);
+    return header;
+  }
+
+  static std::vector< TestAlignment > createAlignments(size_t alignmentCount, size_t longSequenceSize)
+  {
+    std::mt19937 random(29);
+    std::vector< TestAlignment > alignments;
+    position alignmentPosition = 1;
+    for (size_t i = 0; i < alignmentCount; ++i)
+      {
+	TestAlignment alignment;
+	alignment.name = "read" + std::to_string(i);
+	alignmentPosition += random() % 100;
+	alignment.alignment_position = alignmentPosition;
+	for (size_t j = (i == alignmentCount / 2 && longSequenceSize > 0) ? longSequenceSize : 50 + random() % 350; j > 0; --j)
+	  {
+	    alignment.sequence += "ACGT"[random() % 4];
+	  }
+	alignment.is_mapped = (i % 10 != 7);
+	alignments.emplace_back(alignment);
+      }
+    return alignments;
+  }
+
+  /*
+   * Cuts each block recordSplit(recordSize) bytes into the last record
+   * starting in its first 60 kb, or at 60 kb when that would leave the
+   * block too big, inside a record longer than a block.
+   */
+  template< class F >
+  static void writeBam(const std::string& bamPath, const std::vector< TestAlignment >& alignments, F&& recordSplit)
+  {
+    std::string data = createHeader();
+    std::vector< size_t > recordStarts;
+    for (auto& alignment : alignments)
+      {
+	recordStarts.emplace_back(data.size());
+	data += createRecord(alignment);
+      }
+    BgzfWriter writer(bamPath, 0);
+    for (size_t blockStart = 0; blockStart < data.size(); )
+      {
+	size_t blockEnd = std::min< size_t >(blockStart + 60000, data.size());
+	auto recordStartIter = std::upper_bound(recordStarts.begin(), recordStarts.end(), blockEnd);
+	if (blockEnd < data.size() && recordStartIter != recordStarts.begin() && *(recordStartIter - 1) > blockStart + 1000)
+	  {
+	    size_t recordStart = *(recordStartIter - 1);
+	    size_t recordEnd = (recordStartIter != recordStarts.end()) ? *recordStartIter : data.size();
+	    size_t splitOffset = recordStart + recordSplit(recordEnd - recordStart);
+	    blockEnd = (splitOffset <= blockStart + 65280) ? splitOffset : blockEnd;
+	  }
+	writer.writeBlock(data.data() + blockStart, blockEnd - blockStart);
+	blockStart = blockEnd;
+      }
+  }
+
+  static void checkAlignments(const std::string& bamPath, const std::vector< TestAlignment >& alignments)
+  {
+    BamAlignmentReader reader(bamPath);
+    TEST_CHECK(reader.getReferenceNames() == std::vector< std::string >{ "chr1" });
+    IAlignment::SharedPtr alignmentPtr;
+    for (auto& alignment : alignments)
+      {
+	if (!alignment.is_mapped)
+	  {
+	    continue;
+	  }
+	TEST_CHECK(reader.getNextAlignment(alignmentPtr));
+	auto bamAlignmentPtr = std::dynamic_pointer_cast< BamAlignment >(alignmentPtr);
+	TEST_CHECK(bamAlignmentPtr != nullptr);
+	TEST_CHECK(bamAlignmentPtr->getID() == alignment.name);
+	TEST_CHECK(bamAlignmentPtr->getPosition() == alignment.alignment_position);
+	TEST_CHECK(bamAlignmentPtr->getReferenceID() == "chr1");
+	TEST_CHECK(bamAlignmentPtr->getReadGroup() == "rg1");
+	TEST_CHECK(bamAlignmentPtr->getLength() == alignment.sequence.size());
+	TEST_CHECK(alignment.sequence.compare(0, std::string::npos, bamAlignmentPtr->getSequence(), bamAlignmentPtr->getLength()) == 0);
+      }
+    TEST_CHECK(!reader.getNextAlignment(alignmentPtr));
+  }
+
+  int main()
+  {
+    ThreadPool::Instance()->setThreadCount(4);
+    ThreadPool::Instance()->start();
+    // about 2.5 mb, a few chunks
+    auto alignments = createAlignments(7000, 0);
+    for (size_t lengthSplit = 1; lengthSplit < 4; ++lengthSplit)
+      {
+	writeBam("length_split.bam", alignments, [lengthSplit](size_t) { return lengthSplit; });
+	checkAlignments("length_split.bam", alignments);
+      }
+    writeBam("record_split.bam", alignments, [](size_t recordSize) { return 4 + (recordSize - 4) / 2; });
+    checkAlignments("record_split.bam", alignments);
+    writeBam("record_start.bam", alignments, [](size_t) { return 0; });
+    checkAlignments("record_start.bam", alignments);
+
+    // a record of about 1.2 mb runs through a whole chunk
+    auto longAlignments = createAlignments(3000, 800000);
+    writeBam("long_record.bam", longAlignments, [](size_t recordSize) { return 4 + (recordSize - 4) / 2; });
+    checkAlignments("long_record.bam", longAlignments);
+    ThreadPool::Instance()->joinAll();
+    ThreadPool::Instance()->stop();
+    return 0;
+  }
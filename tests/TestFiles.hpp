@@ -0,0 +1,248 @@
+#ifndef TESTFILES_HPP
+#define TESTFILES_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <zlib.h>
+
+// stops the test with the failed condition, ctest reports the nonzero exit
+#define TEST_CHECK(condition)						\
+  do									\
+    {									\
+      if (!(condition))							\
+	{								\
+	  fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+	  exit(1);							\
+	}								\
+    }									\
+  while (0)
+
+  /*
+   * Writes the BGZF files the tests read, one block per writeBlock call so a
+   * test decides where blocks end, and keeps where each block starts for
+   * the virtual offsets an index stores. Level 0 stores the bytes, so the
+   * compressed size follows the uncompressed one.
+   */
+  class BgzfWriter
+  {
+  public:
+    BgzfWriter(const std::string& path, int level) :
+      m_stream(path, std::ios::binary),
+      m_level(level),
+      m_compressed_offset(0),
+      m_uncompressed_offset(0)
+    {
+      if (!this->m_stream.good())
+	{
+	  throw std::runtime_error("BgzfWriter could not open " + path);
+	}
+    }
+
+    ~BgzfWriter()
+    {
+      close();
+    }
+
+    // at most 65280 bytes, what bgzip puts in a block
+    void writeBlock(const char* data, size_t size)
+    {
+      z_stream stream = {};
+      if (size > 65280 || deflateInit2(&stream, this->m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+	  throw std::runtime_error("BgzfWriter could not deflate a block of " + std::to_string(size) + " bytes");
+	}
+      std::vector< unsigned char > compressed(deflateBound(&stream, size));
+      stream.next_in = (Bytef*)data;
+      stream.avail_in = size;
+      stream.next_out = compressed.data();
+      stream.avail_out = compressed.size();
+      int status = deflate(&stream, Z_FINISH);
+      size_t compressedSize = stream.total_out;
+      deflateEnd(&stream);
+      size_t blockSize = 18 + compressedSize + 8;
+      if (status != Z_STREAM_END || blockSize > 65536)
+	{
+	  throw std::runtime_error("BgzfWriter block of " + std::to_string(size) + " bytes doesn't fit");
+	}
+
+      unsigned char header[18] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0 };
+      header[16] = (blockSize - 1) & 0xff;
+      header[17] = (blockSize - 1) >> 8;
+      this->m_stream.write((const char*)header, sizeof(header));
+      this->m_stream.write((const char*)compressed.data(), compressedSize);
+      writeInt(crc32(crc32(0, nullptr, 0), (const Bytef*)data, size), 4);
+      writeInt(size, 4);
+      this->m_blocks.emplace_back(this->m_compressed_offset, this->m_uncompressed_offset);
+      this->m_compressed_offset += blockSize;
+      this->m_uncompressed_offset += size;
+    }
+
+    // cuts data into blocks of blockSize
+    void write(const std::string& data, size_t blockSize)
+    {
+      for (size_t offset = 0; offset < data.size(); offset += blockSize)
+	{
+	  writeBlock(data.data() + offset, std::min(blockSize, data.size() - offset));
+	}
+    }
+
+    // the empty block that ends a BGZF file, only once
+    void close()
+    {
+      if (this->m_stream.is_open())
+	{
+	  writeBlock(nullptr, 0);
+	  this->m_stream.close();
+	}
+    }
+
+    // called before close, an offset past the last block is the start of the next one
+    uint64_t getVirtualOffset(uint64_t uncompressedOffset)
+    {
+      if (uncompressedOffset >= this->m_uncompressed_offset)
+	{
+	  return this->m_compressed_offset << 16;
+	}
+      auto blockIter = std::upper_bound(this->m_blocks.begin(), this->m_blocks.end(), uncompressedOffset,
+					[](uint64_t offset, const std::pair< uint64_t, uint64_t >& block) { return offset < block.second; });
+      --blockIter;
+      return (blockIter->first << 16) | (uncompressedOffset - blockIter->second);
+    }
+
+  private:
+    void writeInt(uint64_t value, size_t size)
+    {
+      for (size_t i = 0; i < size; ++i)
+	{
+	  this->m_stream.put((char)((value >> (8 * i)) & 0xff));
+	}
+    }
+
+    std::ofstream m_stream;
+    int m_level;
+    uint64_t m_compressed_offset;
+    uint64_t m_uncompressed_offset;
+    std::vector< std::pair< uint64_t, uint64_t > > m_blocks; // compressed and uncompressed starts
+  };
+
+  /*
+   * Writes a tabix index for a VCF the way the SAM spec lays it out, bins
+   * from its reg2bin and the linear index over 16 kb windows, independent
+   * of BinningIndex so a test compares the two.
+   */
+  class TabixIndexWriter
+  {
+  public:
+    // in file order, [beginPosition, endPosition) zero based and the record's virtual offsets
+    void addRecord(const std::string& contigName, uint64_t beginPosition, uint64_t endPosition, uint64_t beginOffset, uint64_t endOffset)
+    {
+      if (this->m_contig_names.empty() || this->m_contig_names.back() != contigName)
+	{
+	  this->m_contig_names.emplace_back(contigName);
+	  this->m_contigs.emplace_back();
+	}
+      Contig& contig = this->m_contigs.back();
+      auto& chunks = contig.bin_chunks[getBin(beginPosition, endPosition)];
+      if (!chunks.empty() && chunks.back().second == beginOffset)
+	{
+	  chunks.back().second = endOffset;
+	}
+      else
+	{
+	  chunks.emplace_back(beginOffset, endOffset);
+	}
+      uint64_t lastWindow = (std::max(endPosition, beginPosition + 1) - 1) >> 14;
+      if (contig.window_offsets.size() <= lastWindow)
+	{
+	  contig.window_offsets.resize(lastWindow + 1, 0);
+	}
+      for (uint64_t window = beginPosition >> 14; window <= lastWindow; ++window)
+	{
+	  if (contig.window_offsets[window] == 0)
+	    {
+	      contig.window_offsets[window] = beginOffset;
+	    }
+	}
+    }
+
+    void write(const std::string& indexPath)
+    {
+      std::string names;
+      for (auto& contigName : this->m_contig_names)
+	{
+	  names += contigName + '\0';
+	}
+      std::string index("TBI\1", 4);
+      appendInt(index, this->m_contig_names.size());
+      // VCF: CHROM, POS and no end column, '#' lines skipped
+      for (uint32_t value : { 2u, 1u, 2u, 0u, (uint32_t)'#', 0u, (uint32_t)names.size() })
+	{
+	  appendInt(index, value);
+	}
+      index += names;
+      for (auto& contig : this->m_contigs)
+	{
+	  appendInt(index, contig.bin_chunks.size());
+	  for (auto& binChunks : contig.bin_chunks)
+	    {
+	      appendInt(index, binChunks.first);
+	      appendInt(index, binChunks.second.size());
+	      for (auto& chunk : binChunks.second)
+		{
+		  appendInt(index, chunk.first, 8);
+		  appendInt(index, chunk.second, 8);
+		}
+	    }
+	  // windows no record overlaps take the offset of the one before
+	  appendInt(index, contig.window_offsets.size());
+	  uint64_t windowOffset = 0;
+	  for (uint64_t offset : contig.window_offsets)
+	    {
+	      windowOffset = (offset != 0) ? offset : windowOffset;
+	      appendInt(index, windowOffset, 8);
+	    }
+	}
+      BgzfWriter indexWriter(indexPath, 6);
+      indexWriter.write(index, 65280);
+    }
+
+    // reg2bin from the SAM spec, 16 kb leaves and five levels above them
+    static uint32_t getBin(uint64_t beginPosition, uint64_t endPosition)
+    {
+      --endPosition;
+      if (beginPosition >> 14 == endPosition >> 14) return ((1 << 15) - 1) / 7 + (beginPosition >> 14);
+      if (beginPosition >> 17 == endPosition >> 17) return ((1 << 12) - 1) / 7 + (beginPosition >> 17);
+      if (beginPosition >> 20 == endPosition >> 20) return ((1 << 9) - 1) / 7 + (beginPosition >> 20);
+      if (beginPosition >> 23 == endPosition >> 23) return ((1 << 6) - 1) / 7 + (beginPosition >> 23);
+      if (beginPosition >> 26 == endPosition >> 26) return ((1 << 3) - 1) / 7 + (beginPosition >> 26);
+      return 0;
+    }
+
+  private:
+    struct Contig
+    {
+      std::map< uint32_t, std::vector< std::pair< uint64_t, uint64_t > > > bin_chunks;
+      std::vector< uint64_t > window_offsets; // 0 for windows no record overlaps
+    };
+
+    static void appendInt(std::string& bytes, uint64_t value, size_t size = 4)
+    {
+      for (size_t i = 0; i < size; ++i)
+	{
+	  bytes += (char)((value >> (8 * i)) & 0xff);
+	}
+    }
+
+    std::vector< std::string > m_contig_names;
+    std::vector< Contig > m_contigs;
+  };
+
+#endif
@@ -0,0 +1,276 @@
+#include "TestFiles.hpp"
+
+#include "BgzfFile.h"
+#include "Region.h"
+#include "ThreadPool.hpp"
+#include "VCFFileReader.h"
+#include "VariantStore.h"
+
+#include <random>
+
+  /*
+   * Checks VCFFileReader's ranges against a VCF generated here, so every
+   * record's bounds are known without parsing. The records run past three
+   * of the reader's 4 mb ranges: a line starts right on the first edge, a
+   * line longer than the reader's 64 kb read past a range's end crosses the
+   * second, and the CR of a CRLF line is the last byte before the third.
+   * Every third line ends in CRLF and the last one has no line break at
+   * all. The same text is then read bgzip compressed, queried through a
+   * .tbi written here, and written to a VariantStore.
+   */
+
+  struct TestRecord
+  {
+    std::string contig_name;
+    position variant_position;
+    std::string id;
+    std::string info;
+    uint64_t begin_position; // zero based
+    uint64_t reference_end; // past the REF
+    uint64_t end_position; // past the REF or INFO's END, whichever is further
+    uint64_t line_offset;
+    uint64_t line_end; // past the line break
+  };
+
+  static const uint64_t s_range_size = 4 * 1024 * 1024;
+
+  static std::string createVCF(std::vector< TestRecord >& records, uint64_t& recordsOffset)
+  {
+    std::string text = "##fileformat=VCFv4.2\n##contig=<ID=chr1,length=100000000>\n##contig=<ID=chr2,length=100000000>\n"
+      "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n";
+    recordsOffset = text.size();
+    std::mt19937 random(11);
+    position variantPosition = 0;
+    bool startsOnEdge = false;
+    bool crossesEdge = false;
+    bool splitsCRLF = false;
+    while (text.size() < recordsOffset + 3 * s_range_size + 500000)
+      {
+	TestRecord record;
+	record.contig_name = (text.size() < recordsOffset + 2 * s_range_size + 1000000) ? "chr1" : "chr2";
+	variantPosition = (record.contig_name == "chr2" && records.back().contig_name == "chr1") ? 1 : variantPosition + 1 + random() % 60;
+	record.variant_position = variantPosition;
+	record.id = "r" + std::to_string(records.size());
+	std::string reference;
+	for (size_t i = random() % 3 == 0 ? 1 + random() % 40 : 1; i > 0; --i)
+	  {
+	    reference += "ACGT"[random() % 4];
+	  }
+	record.begin_position = variantPosition - 1;
+	record.reference_end = record.begin_position + reference.size();
+	record.end_position = record.reference_end;
+	if (random() % 50 == 0)
+	  {
+	    record.end_position += 1 + random() % 30000;
+	    record.info = "SVTYPE=DEL;END=" + std::to_string(record.end_position);
+	  }
+	else
+	  {
+	    record.info = "DP=" + std::to_string(random() % 100);
+	  }
+	std::string lineBreak = (records.size() % 3 == 0) ? "\r\n" : "\n";
+
+	// pads the ID so the line ends at an offset into the records
+	uint64_t recordsSize = text.size() - recordsOffset;
+	auto padTo = [&](uint64_t lineEnd, std::string newLineBreak)
+	  {
+	    lineBreak = newLineBreak;
+	    std::string line = record.contig_name + "\t" + std::to_string(record.variant_position) + "\t" + record.id + "\t" + reference + "\tA\t50\tPASS\t" + record.info + lineBreak;
+	    record.id += "_" + std::string(lineEnd - recordsSize - line.size() - 1, 'x');
+	  };
+	if (!startsOnEdge && s_range_size - recordsSize < 300)
+	  {
+	    padTo(s_range_size, "\n");
+	    startsOnEdge = true;
+	  }
+	else if (!crossesEdge && 2 * s_range_size - recordsSize < 100000)
+	  {
+	    record.info += ";LONG=" + std::string(200000, 'A');
+	    crossesEdge = true;
+	  }
+	else if (!splitsCRLF && 3 * s_range_size - recordsSize < 300)
+	  {
+	    padTo(3 * s_range_size + 1, "\r\n");
+	    splitsCRLF = true;
+	  }
+	record.line_offset = text.size();
+	text += record.contig_name + "\t" + std::to_string(record.variant_position) + "\t" + record.id + "\t" + reference + "\tA\t50\tPASS\t" + record.info + lineBreak;
+	record.line_end = text.size();
+	records.emplace_back(record);
+      }
+    TEST_CHECK(startsOnEdge && crossesEdge && splitsCRLF);
+    TEST_CHECK(text.compare(recordsOffset + s_range_size - 1, 1, "\n") == 0);
+    TEST_CHECK(text.compare(recordsOffset + 3 * s_range_size - 1, 2, "\r\n") == 0);
+    text.resize(text.size() - 1); // no line break after the last record
+    records.back().line_end -= 1;
+    return text;
+  }
+
+  static std::string getFieldString(const Variant::SharedPtr& variantPtr, Variant::Field field)
+  {
+    return std::string(variantPtr->getField(field), variantPtr->getFieldLength(field));
+  }
+
+  // every record in order with its fields whole and its line break left out
+  static void checkRecords(VCFFileReader& reader, const std::vector< TestRecord >& records)
+  {
+    TEST_CHECK(reader.getCount() == records.size());
+    IVariant::SharedPtr variantPtr;
+    for (auto& record : records)
+      {
+	TEST_CHECK(reader.getNextVariant(variantPtr));
+	auto recordVariantPtr = std::dynamic_pointer_cast< Variant >(variantPtr);
+	TEST_CHECK(recordVariantPtr != nullptr);
+	TEST_CHECK(recordVariantPtr->getChrom() == record.contig_name);
+	TEST_CHECK(recordVariantPtr->getPosition() == record.variant_position);
+	TEST_CHECK(getFieldString(recordVariantPtr, Variant::Field::ID) == record.id);
+	TEST_CHECK(getFieldString(recordVariantPtr, Variant::Field::INFO) == record.info);
+      }
+    TEST_CHECK(!reader.getNextVariant(variantPtr));
+  }
+
+  static void testPlainRanges(const std::string& text, const std::vector< TestRecord >& records)
+  {
+    std::ofstream("ranges.vcf", std::ios::binary) << text;
+    VCFFileReader reader("ranges.vcf");
+    checkRecords(reader, records);
+  }
+
+  // writes the text bgzip compressed in blocks of varying size, with its .tbi
+  static void writeIndexedVCF(const std::string& vcfPath, const std::string& text, const std::vector< TestRecord >& records)
+  {
+    std::mt19937 random(13);
+    BgzfWriter writer(vcfPath, 1);
+    for (size_t offset = 0; offset < text.size(); )
+      {
+	size_t blockSize = std::min< size_t >(1000 + random() % 64000, text.size() - offset);
+	writer.writeBlock(text.data() + offset, blockSize);
+	offset += blockSize;
+      }
+    TabixIndexWriter indexWriter;
+    for (auto& record : records)
+      {
+	indexWriter.addRecord(record.contig_name, record.begin_position, record.end_position, writer.getVirtualOffset(record.line_offset), writer.getVirtualOffset(record.line_end));
+      }
+    writer.close();
+    indexWriter.write(vcfPath + ".tbi");
+  }
+
+  static void testBgzfFile(const std::string& vcfPath, const std::string& text)
+  {
+    BgzfFile bgzfFile(vcfPath);
+    TEST_CHECK(bgzfFile.getUncompressedSize() == text.size());
+    std::mt19937 random(17);
+    std::vector< char > buffer(200000);
+    for (size_t i = 0; i < 200; ++i)
+      {
+	uint64_t offset = random() % text.size();
+	size_t size = random() % buffer.size();
+	size_t expectedSize = std::min< uint64_t >(size, text.size() - offset);
+	TEST_CHECK(bgzfFile.read(offset, buffer.data(), size) == expectedSize);
+	TEST_CHECK(text.compare(offset, expectedSize, buffer.data(), expectedSize) == 0);
+      }
+    TEST_CHECK(bgzfFile.read(text.size(), buffer.data(), buffer.size()) == 0);
+  }
+
+  // queries through the .tbi return what a scan of every record finds
+  static void testTabixQueries(const std::string& vcfPath, const std::vector< TestRecord >& records)
+  {
+    VCFFileReader reader(vcfPath);
+    std::mt19937 random(19);
+    for (size_t i = 0; i < 120; ++i)
+      {
+	std::string contigName = (i % 2 == 0) ? "chr2" : "chr1";
+	uint64_t beginPosition = random() % ((contigName == "chr2") ? 2000000 : 6000000);
+	uint64_t endPosition = beginPosition + std::vector< uint64_t >{ 1, 100, 20000, 200000 }[i % 4];
+	if (i == 0)
+	  {
+	    beginPosition = 0;
+	    endPosition = 1000000000;
+	  }
+	auto regionPtr = std::make_shared< Region >(contigName, beginPosition, endPosition, Region::BASED::ZERO);
+	std::vector< std::string > expectedIDs;
+	for (auto& record : records)
+	  {
+	    if (record.contig_name == contigName && record.begin_position < endPosition && record.end_position > beginPosition)
+	      {
+		expectedIDs.emplace_back(record.id);
+	      }
+	  }
+	std::vector< std::string > ids;
+	auto variantListPtr = reader.getVariantsInRegion(regionPtr);
+	IVariant::SharedPtr variantPtr;
+	while (variantListPtr->getNextVariant(variantPtr))
+	  {
+	    ids.emplace_back(getFieldString(std::dynamic_pointer_cast< Variant >(variantPtr), Variant::Field::ID));
+	  }
+	TEST_CHECK(ids == expectedIDs);
+      }
+    auto regionPtr = std::make_shared< Region >("chr3", 0, 1000, Region::BASED::ZERO);
+    TEST_CHECK(reader.getVariantsInRegion(regionPtr)->getCount() == 0);
+  }
+
+  // a store of the first records streams the same lines and answers queries by REF
+  static void testVariantStore(const std::string& text, const std::vector< TestRecord >& records)
+  {
+    size_t recordCount = 5000;
+    std::ofstream("store.vcf", std::ios::binary) << text.substr(0, records[recordCount].line_offset);
+    VariantStore::write(std::make_shared< VCFFileReader >("store.vcf"), "test.store");
+    VariantStore store("test.store");
+    TEST_CHECK(store.getCount() == recordCount);
+    VCFFileReader reader("store.vcf");
+    IVariant::SharedPtr variantPtr;
+    IVariant::SharedPtr storedVariantPtr;
+    while (reader.getNextVariant(variantPtr))
+      {
+	TEST_CHECK(store.getNextVariant(storedVariantPtr));
+	TEST_CHECK(storedVariantPtr->getChrom() == variantPtr->getChrom());
+	TEST_CHECK(storedVariantPtr->getPosition() == variantPtr->getPosition());
+	TEST_CHECK(storedVariantPtr->getVariantLine(nullptr) == variantPtr->getVariantLine(nullptr));
+      }
+    TEST_CHECK(!store.getNextVariant(storedVariantPtr));
+
+    std::mt19937 random(23);
+    uint64_t lastPosition = records[recordCount - 1].reference_end;
+    for (size_t i = 0; i < 200; ++i)
+      {
+	uint64_t beginPosition = random() % lastPosition;
+	uint64_t endPosition = beginPosition + 1 + random() % 2000;
+	std::vector< position > expectedPositions;
+	for (size_t recordIdx = 0; recordIdx < recordCount; ++recordIdx)
+	  {
+	    if (records[recordIdx].begin_position < endPosition && records[recordIdx].reference_end > beginPosition)
+	      {
+		expectedPositions.emplace_back(records[recordIdx].variant_position);
+	      }
+	  }
+	std::vector< position > positions;
+	auto variantListPtr = store.getVariantsInRegion(std::make_shared< Region >("chr1", beginPosition, endPosition, Region::BASED::ZERO));
+	while (variantListPtr->getNextVariant(variantPtr))
+	  {
+	    positions.emplace_back(variantPtr->getPosition());
+	  }
+	TEST_CHECK(positions == expectedPositions);
+      }
+  }
+
+  int main()
+  {
+    ThreadPool::Instance()->setThreadCount(4);
+    ThreadPool::Instance()->start();
+    std::vector< TestRecord > records;
+    uint64_t recordsOffset;
+    std::string text = createVCF(records, recordsOffset);
+    testPlainRanges(text, records);
+    writeIndexedVCF("ranges.vcf.gz", text, records);
+    testBgzfFile("ranges.vcf.gz", text);
+    {
+      VCFFileReader reader("ranges.vcf.gz");
+      checkRecords(reader, records);
+    }
+    testTabixQueries("ranges.vcf.gz", records);
+    testVariantStore(text, records);
+    ThreadPool::Instance()->joinAll();
+    ThreadPool::Instance()->stop();
+    return 0;
+  }